@@ -0,0 +1,805 @@
+// Microbenchmark for the primitive intersection kernels
+//
+// Every ray is tested against its own group of primitives with closest-hit
+// semantics, the same loop shape as hit_world. Primitives are placed relative
+// to the ray so that each ray/primitive pair hits with a controlled
+// probability. Each kernel variant is timed over the same workload and, in
+// validation mode, compared against the scalar reference.
+//
+// With --mesh, an OBJ file is instead built both as full-precision triangles
+// under a float BVH and as a compressed mesh under a quantized BVH, and the
+// two are compared in bytes per triangle and closest-hit rays per second.
+//
+// With --reorder, diffuse bounces off an OBJ file are traced in path order
+// and sorted as the renderer's reorder_rays mode sorts them, and compared in
+// rays per second and cache misses per ray at each bounce.
+//
+
+#include "cg_utils2.h"
+#include "rt_box.h"
+#include "rt_bvh.h"
+#include "rt_qbvh.h"
+#include "rt_reorder.h"
+#include "rt_soa.h"
+#include "rt_sphere.h"
+#include "rt_stats.h"
+#include "rt_triangle.h"
+#include "rt_warp.h"
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const float kTMin = 1e-4f;
+const float kTMax = 1e4f;
+
+// Validation tolerances. The SoA kernels are built without FMA contraction,
+// so only their reformulated sphere quadratic differs from the reference.
+const float kTTolerance = 1e-4f;
+const float kNormalTolerance = 1e-3f;
+
+struct Options {
+    int num_rays = 1 << 16;
+    int group_size = 16;
+    float hit_ratio = 0.5f;
+    int repeat = 5;
+    unsigned seed = 1;
+    bool validate = false;
+    std::string primitive = "all";
+    std::string mesh_filename;  // Compare mesh formats instead of kernels
+    std::string reorder_filename;  // Compare secondary ray orders instead
+    int bounces = 4;
+    int reorder_batch = 16384;     // Rays per tile, as in a 32x32 tile at 16 spp
+    rt::IsaLevel max_isa = rt::ISA_AVX512;
+};
+
+struct Result {
+    bool hit;
+    float t;
+    glm::vec3 normal;
+};
+
+// Rays and the primitive groups they are tested against (group i belongs to
+// ray i and occupies primitives [i * group_size, (i + 1) * group_size))
+template <typename Prim>
+struct Workload {
+    std::vector<rt::Ray> rays;
+    std::vector<Prim> prims;
+    int group_size;
+};
+
+template <typename Prim>
+class Variant {
+  public:
+    virtual ~Variant() {}
+    virtual const char *name() const = 0;
+    virtual void prepare(const Workload<Prim> &) {}
+    virtual void run(const Workload<Prim> &work, std::vector<Result> &results) = 0;
+};
+
+// Reference: the per-object hit() methods used by hit_world
+template <typename Prim>
+class ScalarVariant : public Variant<Prim> {
+  public:
+    const char *name() const { return "scalar"; }
+    void run(const Workload<Prim> &work, std::vector<Result> &results)
+    {
+        const int n = int(work.rays.size());
+        for (int i = 0; i < n; ++i) {
+            const rt::Ray &r = work.rays[i];
+            const Prim *group = &work.prims[size_t(i) * work.group_size];
+            rt::HitRecord rec, temp_rec;
+            bool hit = false;
+            float closest = kTMax;
+            for (int j = 0; j < work.group_size; ++j) {
+                if (group[j].hit(r, kTMin, closest, temp_rec)) {
+                    hit = true;
+                    closest = temp_rec.t;
+                    rec = temp_rec;
+                }
+            }
+            results[i].hit = hit;
+            results[i].t = hit ? rec.t : 0.0f;
+            results[i].normal = hit ? rec.normal : glm::vec3(0.0f);
+        }
+    }
+};
+
+// Batched SoA kernels from rt_soa.h at one instruction set level, one call
+// per ray group
+template <typename Prim, typename SoA, int (*Closest)(const SoA &, int, int, const rt::Ray &, float,
+                                                     float &)>
+class SoAVariant : public Variant<Prim> {
+  public:
+    explicit SoAVariant(rt::IsaLevel l) : level(l), label(std::string("soa-") + rt::isaName(l)) {}
+    const char *name() const { return label.c_str(); }
+    void prepare(const Workload<Prim> &work) { soa.assign(&work.prims[0], int(work.prims.size())); }
+    void run(const Workload<Prim> &work, std::vector<Result> &results)
+    {
+        rt::setSoAIsa(level);
+        const int n = int(work.rays.size());
+        for (int i = 0; i < n; ++i) {
+            const rt::Ray &r = work.rays[i];
+            float t = kTMax;
+            int begin = i * work.group_size;
+            int hit = Closest(soa, begin, begin + work.group_size, r, kTMin, t);
+            results[i].hit = hit >= 0;
+            results[i].t = hit >= 0 ? t : 0.0f;
+            if (hit >= 0) {
+                rt::HitRecord rec;
+                work.prims[hit].record(r, t, rec);
+                results[i].normal = rec.normal;
+            } else {
+                results[i].normal = glm::vec3(0.0f);
+            }
+        }
+    }
+
+  private:
+    rt::IsaLevel level;
+    std::string label;
+    SoA soa;
+};
+
+// Helpers for generating the workload
+
+glm::vec3 randomUnitVector(std::mt19937 &rng)
+{
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    glm::vec3 v(normal(rng), normal(rng), normal(rng));
+    return glm::normalize(v);
+}
+
+glm::vec3 randomPerpendicular(std::mt19937 &rng, const glm::vec3 &d)
+{
+    glm::vec3 v = randomUnitVector(rng);
+    v -= d * glm::dot(v, d);
+    if (glm::length(v) < 1e-3f) { return randomPerpendicular(rng, d); }
+    return glm::normalize(v);
+}
+
+// Places a primitive around a point on the ray (hit) or off to the side of
+// the ray by more than its bounding radius (miss)
+rt::Sphere makeSphere(std::mt19937 &rng, const rt::Ray &r, const glm::vec3 &p, bool hit)
+{
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    float radius = 0.05f + 0.45f * u(rng);
+    glm::vec3 side = randomPerpendicular(rng, glm::normalize(r.direction()));
+    float offset = hit ? 0.9f * radius * u(rng) : radius * (1.1f + u(rng));
+    return rt::Sphere(p + side * offset, radius, nullptr);
+}
+
+rt::Box makeBox(std::mt19937 &rng, const rt::Ray &r, const glm::vec3 &p, bool hit)
+{
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    glm::vec3 radius = glm::vec3(0.05f) + 0.45f * glm::vec3(u(rng), u(rng), u(rng));
+    if (hit) {
+        glm::vec3 offset = 0.9f * radius * (2.0f * glm::vec3(u(rng), u(rng), u(rng)) - 1.0f);
+        return rt::Box(p + offset, radius, nullptr);
+    }
+    glm::vec3 side = randomPerpendicular(rng, glm::normalize(r.direction()));
+    return rt::Box(p + side * glm::length(radius) * (1.1f + u(rng)), radius, nullptr);
+}
+
+rt::Triangle makeTriangle(std::mt19937 &rng, const rt::Ray &r, const glm::vec3 &p, bool hit)
+{
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    glm::vec3 d = glm::normalize(r.direction());
+
+    // Front-facing plane through p, since Triangle::hit culls back faces
+    glm::vec3 n = randomUnitVector(rng);
+    if (glm::dot(n, -d) < 0.0f) { n = -n; }
+    if (glm::dot(n, -d) < 0.2f) { n = glm::normalize(n - d); }
+    glm::vec3 tu = randomPerpendicular(rng, n);
+    glm::vec3 tv = glm::cross(n, tu);
+
+    // Random triangle in the plane, shifted so that a random interior point
+    // (hit) or a point well outside it (miss) lies on the ray
+    float size = 0.1f + 0.4f * u(rng);
+    glm::vec3 v[3];
+    for (int k = 0; k < 3; ++k) {
+        float angle = (k + 0.3f * u(rng)) * 2.0943951f;
+        v[k] = size * (std::cos(angle) * tu + std::sin(angle) * tv);
+    }
+    float b1 = u(rng), b2 = u(rng);
+    if (b1 + b2 > 1.0f) {
+        b1 = 1.0f - b1;
+        b2 = 1.0f - b2;
+    }
+    glm::vec3 anchor = v[0] + b1 * (v[1] - v[0]) + b2 * (v[2] - v[0]);
+    if (!hit) {
+        float angle = 6.2831853f * u(rng);
+        anchor += 2.5f * size * (std::cos(angle) * tu + std::sin(angle) * tv);
+    }
+    glm::vec3 shift = p - anchor;
+
+    // Counter-clockwise winding as seen from the ray origin
+    if (glm::dot(glm::cross(v[1] - v[0], v[2] - v[0]), n) < 0.0f) { std::swap(v[1], v[2]); }
+    return rt::Triangle(v[0] + shift, v[1] + shift, v[2] + shift, nullptr);
+}
+
+template <typename Prim, typename MakeFn>
+Workload<Prim> makeWorkload(const Options &opt, MakeFn make)
+{
+    std::mt19937 rng(opt.seed);
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+
+    Workload<Prim> work;
+    work.group_size = opt.group_size;
+    work.rays.reserve(opt.num_rays);
+    work.prims.reserve(size_t(opt.num_rays) * opt.group_size);
+    for (int i = 0; i < opt.num_rays; ++i) {
+        glm::vec3 origin = 20.0f * (2.0f * glm::vec3(u(rng), u(rng), u(rng)) - 1.0f);
+        // Unnormalized directions, like the camera rays in updateLine
+        glm::vec3 direction = randomUnitVector(rng) * (0.5f + u(rng));
+        rt::Ray r(origin, direction);
+        for (int j = 0; j < opt.group_size; ++j) {
+            float t = (2.0f + 48.0f * u(rng)) / glm::length(direction);
+            work.prims.push_back(make(rng, r, r.point_at_parameter(t), u(rng) < opt.hit_ratio));
+        }
+        work.rays.push_back(r);
+    }
+    return work;
+}
+
+bool sameResult(const Result &a, const Result &b)
+{
+    if (a.hit != b.hit) { return false; }
+    if (!a.hit) { return true; }
+    if (std::abs(a.t - b.t) > kTTolerance * std::max(1.0f, std::abs(a.t))) { return false; }
+    return glm::length(a.normal - b.normal) <= kNormalTolerance;
+}
+
+template <typename Prim>
+bool runBenchmark(const char *prim_name, const Options &opt, const Workload<Prim> &work,
+                  std::vector<Variant<Prim> *> &variants)
+{
+    const double num_tests = double(work.rays.size()) * work.group_size;
+    std::vector<Result> reference(work.rays.size());
+    std::vector<Result> results(work.rays.size());
+    bool ok = true;
+    double reference_ns = 0.0;
+
+    for (size_t v = 0; v < variants.size(); ++v) {
+        Variant<Prim> &variant = *variants[v];
+        variant.prepare(work);
+
+        double best_ns = 1e300;
+        std::uint64_t best_cycles = 0;
+        for (int rep = 0; rep < opt.repeat; ++rep) {
+            typedef std::chrono::steady_clock Clock;
+            Clock::time_point t0 = Clock::now();
+            std::uint64_t c0 = rt::stats::cycleCount();
+            variant.run(work, results);
+            std::uint64_t c1 = rt::stats::cycleCount();
+            double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+            if (ns < best_ns) {
+                best_ns = ns;
+                best_cycles = c1 - c0;
+            }
+        }
+
+        size_t hits = 0;
+        for (size_t i = 0; i < results.size(); ++i) { hits += results[i].hit ? 1 : 0; }
+        if (v == 0) {
+            reference = results;
+            reference_ns = best_ns;
+        }
+
+        std::printf("%-9s %-14s %8.3f ns/test %8.3f tests/cycle %6.2fx  ray hit rate %5.1f%%\n",
+                    prim_name, variant.name(), best_ns / num_tests,
+                    num_tests / std::max<double>(1.0, double(best_cycles)), reference_ns / best_ns,
+                    100.0 * hits / results.size());
+
+        if (opt.validate && v > 0) {
+            size_t mismatches = 0;
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (!sameResult(reference[i], results[i])) {
+                    if (mismatches < 5) {
+                        std::printf("  mismatch ray %zu: ref (%d, t=%g) got (%d, t=%g)\n", i,
+                                    reference[i].hit, reference[i].t, results[i].hit,
+                                    results[i].t);
+                    }
+                    ++mismatches;
+                }
+            }
+            std::printf("  validation: %zu/%zu mismatches\n", mismatches, results.size());
+            ok = ok && mismatches == 0;
+        }
+    }
+    return ok;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+// Rays from a sphere around the mesh towards random points in its bounds,
+// so that most of them hit
+std::vector<rt::Ray> makeMeshRays(const Options &opt, const rt::AABB &bounds)
+{
+    std::mt19937 rng(opt.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    glm::vec3 center = bounds.center();
+    float radius = glm::length(bounds.extent());
+    std::vector<rt::Ray> rays(opt.num_rays);
+    for (size_t i = 0; i < rays.size(); ++i) {
+        glm::vec3 origin = center + radius * randomUnitVector(rng);
+        glm::vec3 target = bounds.lo + bounds.extent() * glm::vec3(unit(rng), unit(rng), unit(rng));
+        rays[i] = rt::Ray(origin, glm::normalize(target - origin));
+    }
+    return rays;
+}
+
+// Best of opt.repeat runs of `trace` over all rays, in nanoseconds
+template <typename TraceFn>
+double timeMeshRays(const Options &opt, const std::vector<rt::Ray> &rays,
+                    std::vector<Result> &results, TraceFn trace)
+{
+    double best_ns = 1e300;
+    for (int rep = 0; rep < opt.repeat; ++rep) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rays.size(); ++i) {
+            float t = kTMax;
+            rt::HitRecord rec;
+            results[i].hit = trace(rays[i], t, rec);
+            results[i].t = results[i].hit ? t : 0.0f;
+            results[i].normal = results[i].hit ? rec.normal : glm::vec3(0.0f);
+        }
+        best_ns = std::min(best_ns, 1e6 * millisecondsSince(start));
+    }
+    return best_ns;
+}
+
+bool loadMesh(const std::string &filename, std::vector<rt::Triangle> &triangles)
+{
+    cg::OBJMeshUV obj;
+    if (!cg::objMeshUVLoad(obj, filename) || obj.indices.size() < 3) {
+        std::printf("Could not read %s\n", filename.c_str());
+        return false;
+    }
+    triangles.reserve(obj.indices.size() / 3);
+    for (size_t i = 0; i + 2 < obj.indices.size(); i += 3) {
+        triangles.push_back(rt::Triangle(obj.vertices[obj.indices[i]], obj.vertices[obj.indices[i + 1]],
+                                         obj.vertices[obj.indices[i + 2]]));
+    }
+    return true;
+}
+
+// Full-precision triangles under a float BVH, as built by buildAcceleration
+// within the budget
+struct FullMesh {
+    rt::BVH bvh;
+    std::vector<rt::Triangle> triangles;  // In BVH leaf order
+    rt::TriangleSoA soa;
+    rt::AABB bounds;
+
+    explicit FullMesh(const std::vector<rt::Triangle> &input)
+    {
+        std::vector<rt::AABB> prim_bounds(input.size());
+        for (size_t i = 0; i < input.size(); ++i) {
+            prim_bounds[i] = input[i].bounds();
+            bounds.grow(prim_bounds[i]);
+        }
+        std::vector<std::uint32_t> order;
+        bvh.build(prim_bounds, rt::kSoAWidth, order);
+        triangles.resize(input.size());
+        for (size_t i = 0; i < order.size(); ++i) { triangles[i] = input[order[i]]; }
+        soa.assign(triangles.data(), int(triangles.size()));
+    }
+
+    bool closest(const rt::Ray &r, float &t, rt::HitRecord &rec) const
+    {
+        int hit = -1;
+        bvh.traverse(r, kTMin, t, [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+            int i = rt::closestTriangle(soa, first, first + count, r, kTMin, t_far);
+            if (i >= 0) { hit = i; }
+            return i >= 0;
+        });
+        if (hit >= 0) { triangles[hit].record(r, t, rec); }
+        return hit >= 0;
+    }
+};
+
+bool benchmarkMesh(const Options &opt)
+{
+    std::vector<rt::Triangle> input;
+    if (!loadMesh(opt.mesh_filename, input)) { return false; }
+    const double triangles = double(input.size());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    FullMesh full(input);
+    double full_ms = millisecondsSince(start);
+    double full_bytes = triangles * (sizeof(rt::Triangle) + 12 * sizeof(float)) +
+                        double(full.bvh.nodes.size()) * sizeof(rt::BVHNode);
+
+    start = std::chrono::steady_clock::now();
+    rt::CompressedMesh compressed;
+    compressed.build(input.data(), input.size(), rt::kSoAWidth);
+    double compressed_ms = millisecondsSince(start);
+
+    std::printf("%s: %.0f triangles, %zu welded vertices\n", opt.mesh_filename.c_str(), triangles,
+                compressed.vertexCount());
+    std::vector<rt::Ray> rays = makeMeshRays(opt, full.bounds);
+    std::vector<Result> reference(rays.size()), results(rays.size());
+    double full_ns = timeMeshRays(opt, rays, reference, [&](const rt::Ray &r, float &t,
+                                                            rt::HitRecord &rec) {
+        return full.closest(r, t, rec);
+    });
+    double compressed_ns = timeMeshRays(opt, rays, results, [&](const rt::Ray &r, float &t,
+                                                                rt::HitRecord &rec) {
+        rt::Triangle tri;
+        if (!compressed.closest(r, kTMin, t, tri)) { return false; }
+        tri.record(r, t, rec);
+        return true;
+    });
+
+    size_t hits = 0;
+    for (size_t i = 0; i < reference.size(); ++i) { hits += reference[i].hit ? 1 : 0; }
+    std::printf("%-11s %8.1f bytes/triangle %9.1f ms build %8.3f Mrays/s\n", "full",
+                full_bytes / triangles, full_ms, 1e3 * rays.size() / full_ns);
+    std::printf("%-11s %8.1f bytes/triangle %9.1f ms build %8.3f Mrays/s\n", "compressed",
+                compressed.bytes() / triangles, compressed_ms, 1e3 * rays.size() / compressed_ns);
+    std::printf("compressed is %.2fx smaller, %.2fx the speed; ray hit rate %.1f%%\n",
+                full_bytes / compressed.bytes(), full_ns / compressed_ns,
+                100.0 * hits / rays.size());
+
+    if (!opt.validate) { return true; }
+    size_t mismatches = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!sameResult(reference[i], results[i])) {
+            if (mismatches < 5) {
+                std::printf("  mismatch ray %zu: full (%d, t=%g) compressed (%d, t=%g)\n", i,
+                            reference[i].hit, reference[i].t, results[i].hit, results[i].t);
+            }
+            ++mismatches;
+        }
+    }
+    std::printf("  validation: %zu/%zu mismatches\n", mismatches, results.size());
+    return mismatches == 0;
+}
+
+// Data cache misses of the calling thread from Linux perf events: level 1
+// data reads and the last level. Both read -1 where counters are not allowed.
+class CacheMissCounters {
+  public:
+    CacheMissCounters()
+    {
+#ifdef __linux__
+        fds[0] = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        fds[1] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#endif
+    }
+    ~CacheMissCounters()
+    {
+#ifdef __linux__
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i] >= 0) { ::close(fds[i]); }
+        }
+#endif
+    }
+    void start()
+    {
+#ifdef __linux__
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i] >= 0) { ioctl(fds[i], PERF_EVENT_IOC_RESET, 0); }
+        }
+#endif
+    }
+    // Misses since start(), as (L1D, last level)
+    void read(double &l1d, double &llc) const
+    {
+        l1d = value(fds[0]);
+        llc = value(fds[1]);
+    }
+
+  private:
+#ifdef __linux__
+    static int open(std::uint32_t type, std::uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+    static double value(int fd)
+    {
+#ifdef __linux__
+        std::uint64_t count = 0;
+        if (fd >= 0 && ::read(fd, &count, sizeof(count)) == ssize_t(sizeof(count))) {
+            return double(count);
+        }
+#endif
+        (void)fd;
+        return -1.0;
+    }
+
+    int fds[2] = {-1, -1};
+};
+
+// One ordering of a bounce's rays: best time of opt.repeat runs, and the cache
+// misses of that run
+struct OrderTiming {
+    double ns = 0.0;
+    double l1d = -1.0;
+    double llc = -1.0;
+};
+
+OrderTiming timeOrder(const Options &opt, const FullMesh &mesh, const std::vector<rt::Ray> &rays,
+                      const std::vector<std::uint32_t> &order, std::vector<Result> &results)
+{
+    CacheMissCounters counters;
+    OrderTiming best;
+    best.ns = 1e300;
+    for (int rep = 0; rep < opt.repeat; ++rep) {
+        counters.start();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t k = 0; k < order.size(); ++k) {
+            std::uint32_t i = order[k];
+            float t = kTMax;
+            rt::HitRecord rec;
+            results[i].hit = mesh.closest(rays[i], t, rec);
+            results[i].t = results[i].hit ? t : 0.0f;
+            results[i].normal = results[i].hit ? rec.normal : glm::vec3(0.0f);
+        }
+        double ns = 1e6 * millisecondsSince(start);
+        if (ns < best.ns) {
+            best.ns = ns;
+            counters.read(best.l1d, best.llc);
+        }
+    }
+    return best;
+}
+
+// Rays in batches of `batch` consecutive rays, each sorted as renderReordered
+// sorts a tile's rays; one batch of all rays sorts the whole frame
+std::vector<std::uint32_t> sortedOrder(const std::vector<rt::Ray> &rays, size_t batch)
+{
+    std::vector<std::uint32_t> order;
+    order.reserve(rays.size());
+    std::vector<std::uint64_t> entries, scratch;
+    for (size_t first = 0; first < rays.size(); first += batch) {
+        size_t last = std::min(rays.size(), first + batch);
+        rt::AABB origins;
+        for (size_t i = first; i < last; ++i) { origins.grow(rays[i].origin()); }
+        entries.clear();
+        for (size_t i = first; i < last; ++i) {
+            entries.push_back((std::uint64_t(rt::rayOrderKey(rays[i], origins)) << 32) | i);
+        }
+        rt::sortRayKeys(entries, scratch);
+        for (size_t k = 0; k < entries.size(); ++k) { order.push_back(std::uint32_t(entries[k])); }
+    }
+    return order;
+}
+
+// Diffuse bounces off the mesh on a ground plane. Camera rays are traced in
+// pixel order; each bounce's rays are cosine-distributed about the normals
+// of the previous hits, in the order of the paths they continue, which is
+// the order the recursive integrator traces them in. Every bounce is then
+// timed in that order, sorted per tile and sorted per frame.
+bool benchmarkReorder(const Options &opt)
+{
+    std::vector<rt::Triangle> input;
+    if (!loadMesh(opt.reorder_filename, input)) { return false; }
+    rt::AABB bounds;
+    for (size_t i = 0; i < input.size(); ++i) { bounds.grow(input[i].bounds()); }
+    glm::vec3 center = bounds.center();
+    float size = glm::compMax(bounds.extent());
+
+    // Ground quad under the mesh, ten times its size
+    float y = bounds.lo.y;
+    glm::vec3 g0 = center + glm::vec3(-5.0f * size, 0.0f, -5.0f * size);
+    glm::vec3 g1 = center + glm::vec3(5.0f * size, 0.0f, -5.0f * size);
+    glm::vec3 g2 = center + glm::vec3(5.0f * size, 0.0f, 5.0f * size);
+    glm::vec3 g3 = center + glm::vec3(-5.0f * size, 0.0f, 5.0f * size);
+    g0.y = g1.y = g2.y = g3.y = y;
+    input.push_back(rt::Triangle(g0, g2, g1));
+    input.push_back(rt::Triangle(g0, g3, g2));
+    FullMesh mesh(input);
+
+    // Camera rays through a square image in front of the mesh, row by row
+    int side = std::max(1, int(std::sqrt(double(opt.num_rays))));
+    glm::vec3 eye = center + glm::vec3(0.0f, 0.25f * size, 1.5f * size);
+    std::mt19937 rng(opt.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<rt::Ray> rays;
+    for (int py = 0; py < side; ++py) {
+        for (int px = 0; px < side; ++px) {
+            glm::vec2 film((px + unit(rng)) / side - 0.5f, 0.5f - (py + unit(rng)) / side);
+            glm::vec3 target = center + size * glm::vec3(film.x, film.y, 0.0f);
+            rays.push_back(rt::Ray(eye, glm::normalize(target - eye)));
+        }
+    }
+
+    std::printf("%s: %zu triangles, %d camera rays, tiles of %d rays\n", opt.reorder_filename.c_str(),
+                input.size(), side * side, opt.reorder_batch);
+    std::printf("%-6s %8s %-6s %9s %10s %12s %12s\n", "bounce", "rays", "order", "Mrays/s",
+                "sort ms", "L1D miss/ray", "LLC miss/ray");
+    std::vector<Result> results(rays.size()), sorted_results(rays.size());
+    for (int bounce = 0; bounce <= opt.bounces && !rays.empty(); ++bounce) {
+        std::vector<std::uint32_t> identity(rays.size());
+        for (size_t i = 0; i < identity.size(); ++i) { identity[i] = std::uint32_t(i); }
+        results.resize(rays.size());
+        sorted_results.resize(rays.size());
+        OrderTiming unsorted = timeOrder(opt, mesh, rays, identity, results);
+
+        const char *names[2] = {"tile", "frame"};
+        size_t batches[2] = {size_t(opt.reorder_batch), rays.size()};
+        OrderTiming timings[3] = {unsorted};
+        double sort_ms[3] = {0.0};
+        for (int k = 0; k < 2 && bounce > 0; ++k) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::vector<std::uint32_t> order = sortedOrder(rays, batches[k]);
+            sort_ms[k + 1] = millisecondsSince(start);
+            timings[k + 1] = timeOrder(opt, mesh, rays, order, sorted_results);
+            for (size_t i = 0; i < results.size(); ++i) {
+                if (!sameResult(results[i], sorted_results[i])) {
+                    std::printf("  mismatch at bounce %d ray %zu\n", bounce, i);
+                    return false;
+                }
+            }
+        }
+        for (int k = 0; k < (bounce > 0 ? 3 : 1); ++k) {
+            const OrderTiming &t = timings[k];
+            double n = double(rays.size());
+            std::printf("%-6d %8zu %-6s %9.3f %10.2f %12.2f %12.3f\n", bounce, rays.size(),
+                        k == 0 ? "path" : names[k - 1], 1e3 * n / t.ns, sort_ms[k],
+                        t.l1d >= 0.0 ? t.l1d / n : -1.0, t.llc >= 0.0 ? t.llc / n : -1.0);
+        }
+
+        // Diffuse continuations of the rays that hit, in path order
+        std::vector<rt::Ray> next;
+        for (size_t i = 0; i < rays.size(); ++i) {
+            if (!results[i].hit) { continue; }
+            glm::vec3 p = rays[i].origin() + results[i].t * rays[i].direction();
+            glm::vec3 n = glm::normalize(results[i].normal);
+            if (glm::dot(n, rays[i].direction()) > 0.0f) { n = -n; }
+            rt::Frame frame(n);
+            glm::vec3 d = frame.toWorld(rt::sampleCosineHemisphere(glm::vec2(unit(rng), unit(rng))));
+            next.push_back(rt::Ray(p + 1e-4f * size * n, d));
+        }
+        rays.swap(next);
+    }
+    CacheMissCounters probe;
+    double l1d, llc;
+    probe.read(l1d, llc);
+    if (l1d < 0.0 && llc < 0.0) {
+        std::printf("Cache misses read -1: perf events are not available here, see "
+                    "/proc/sys/kernel/perf_event_paranoid\n");
+    }
+    return true;
+}
+
+void printUsage()
+{
+    std::printf(
+        "Usage: rt_bench [options]\n"
+        "  --primitive sphere|box|triangle|all  primitive type to benchmark (all)\n"
+        "  --rays N        number of rays (65536)\n"
+        "  --group N       primitives tested per ray (16)\n"
+        "  --hit-ratio R   probability that a ray/primitive pair intersects (0.5)\n"
+        "  --repeat N      timed runs per variant, best is reported (5)\n"
+        "  --seed N        random seed (1)\n"
+        "  --validate      check variants against the scalar reference\n"
+        "  --isa LEVEL     highest SoA kernel level to run: scalar|sse2|sse4|avx2|avx512\n"
+        "                  (all levels this CPU supports)\n"
+        "  --mesh FILE     compare full and compressed meshes of an OBJ file instead\n"
+        "  --reorder FILE  trace diffuse bounces off an OBJ file on a ground plane, in path\n"
+        "                  order and sorted per tile and per frame; --rays sets the camera rays\n"
+        "  --bounces N     bounces traced by --reorder (4)\n"
+        "  --tile N        rays per tile sorted by --reorder (16384)\n");
+}
+
+// Scalar reference plus the SoA kernels at every available level up to max_isa
+template <typename Prim, typename SoA, int (*Closest)(const SoA &, int, int, const rt::Ray &, float,
+                                                     float &)>
+bool benchmarkPrimitive(const char *prim_name, const Options &opt,
+                        Prim (*make)(std::mt19937 &, const rt::Ray &, const glm::vec3 &, bool))
+{
+    typedef SoAVariant<Prim, SoA, Closest> SoAType;
+    Workload<Prim> work = makeWorkload<Prim>(opt, make);
+    ScalarVariant<Prim> scalar;
+    std::vector<std::unique_ptr<SoAType> > soa;
+    std::vector<Variant<Prim> *> variants;
+    variants.push_back(&scalar);
+    for (int l = rt::ISA_SCALAR; l <= opt.max_isa; ++l) {
+        if (!rt::soaIsaAvailable(rt::IsaLevel(l))) { continue; }
+        soa.emplace_back(new SoAType(rt::IsaLevel(l)));
+        variants.push_back(soa.back().get());
+    }
+    return runBenchmark(prim_name, opt, work, variants);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--primitive" && has_value) {
+            opt.primitive = argv[++i];
+        } else if (arg == "--rays" && has_value) {
+            opt.num_rays = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--group" && has_value) {
+            opt.group_size = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--hit-ratio" && has_value) {
+            opt.hit_ratio = glm::clamp(float(std::atof(argv[++i])), 0.0f, 1.0f);
+        } else if (arg == "--repeat" && has_value) {
+            opt.repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--seed" && has_value) {
+            opt.seed = unsigned(std::atoi(argv[++i]));
+        } else if (arg == "--validate") {
+            opt.validate = true;
+        } else if (arg == "--isa" && has_value && rt::parseIsa(argv[i + 1], opt.max_isa)) {
+            ++i;
+        } else if (arg == "--mesh" && has_value) {
+            opt.mesh_filename = argv[++i];
+        } else if (arg == "--reorder" && has_value) {
+            opt.reorder_filename = argv[++i];
+        } else if (arg == "--bounces" && has_value) {
+            opt.bounces = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--tile" && has_value) {
+            opt.reorder_batch = std::max(1, std::atoi(argv[++i]));
+        } else {
+            printUsage();
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (!opt.mesh_filename.empty()) {
+        rt::setSoAIsa(opt.max_isa);
+        return benchmarkMesh(opt) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (!opt.reorder_filename.empty()) {
+        rt::setSoAIsa(opt.max_isa);
+        return benchmarkReorder(opt) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::printf("%d rays x %d primitives, pair hit ratio %.2f, %.3f ns/cycle, cpu %s\n",
+                opt.num_rays, opt.group_size, opt.hit_ratio, rt::stats::nanosecondsPerCycle(),
+                rt::isaName(rt::detectIsa()));
+
+    bool ok = true;
+    bool all = opt.primitive == "all";
+    if (all || opt.primitive == "sphere") {
+        ok = benchmarkPrimitive<rt::Sphere, rt::SphereSoA, rt::closestSphere>("sphere", opt,
+                                                                            makeSphere) && ok;
+    }
+    if (all || opt.primitive == "box") {
+        ok = benchmarkPrimitive<rt::Box, rt::BoxSoA, rt::closestBox>("box", opt, makeBox) && ok;
+    }
+    if (all || opt.primitive == "triangle") {
+        ok = benchmarkPrimitive<rt::Triangle, rt::TriangleSoA, rt::closestTriangle>(
+                 "triangle", opt, makeTriangle) && ok;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -3,7 +3,14 @@
 // Modify this file and other files according to the instructions.
 //
 
+#include "rt_cpu.h"
+#include "rt_distributed.h"
+#include "rt_procedural.h"
 #include "rt_raytracing.h"
+#include "rt_server.h"
+#include "rt_soa.h"
+#include "rt_stats.h"
+#include "rt_trace.h"
 #include "cg_utils.h"
 #include "cg_utils2.h"
 
@@ -17,9 +24,19 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <dirent.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <cstdio>
 #include <cstdlib>
 #include <algorithm>
+#include <string>
+#include <vector>
 
 // Struct for resources and state
 struct Context {
@@ -33,6 +50,15 @@ struct Context {
     rt::RTContext rtx;
     GLuint texture = 0;
     float elapsed_time;
+    std::vector<std::string> models;  // OBJ files in the model directory
+    int model_index = 0;
+    char texture_path[256] = "";  // PNG to assign in the Materials panel
+    int texture_budget_mb = 64;
+    int mesh_budget_mb = 1024;  // Larger meshes are built compressed
+    int stream_budget_mb = 256;
+    float procedural_log_size = 4.0f;  // log10 of the primitive count
+    int procedural_seed = 1;
+    std::string executable;  // For spawning local workers
 };
 
 // Returns the value of an environment variable
@@ -68,6 +94,37 @@ std::string modelDir(void)
     return rootDir + "/3d_models/";
 }
 
+// Returns the sorted names of the OBJ and cluster files in the 3D model
+// directory
+std::vector<std::string> listModels(void)
+{
+    std::vector<std::string> models;
+    DIR *dir = opendir(modelDir().c_str());
+    if (!dir) { return models; }
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if ((name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0) ||
+            rt::StreamedMesh::isClusterFile(name)) {
+            models.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(models.begin(), models.end());
+    return models;
+}
+
+// Procedural scene of `primitives` primitives that scatters copies of the
+// bundled low-poly models
+std::string proceduralScene(std::size_t primitives, std::uint32_t seed)
+{
+    rt::ProceduralParams params;
+    params.primitives = primitives;
+    params.seed = seed;
+    const char *models[] = {"armadillo_lowpoly.obj", "bunny_lowpoly.obj", "gargo_lowpoly.obj"};
+    for (const char *model : models) { params.meshes.push_back(modelDir() + model); }
+    return rt::proceduralSceneName(params);
+}
+
 void createImageTexture(GLuint *texture, int width, int height)
 {
     glDeleteTextures(1, texture);
@@ -91,18 +148,24 @@ void initializeTrackball(Context &ctx)
 
 void init(Context &ctx)
 {
+    RT_TRACE_SCOPE("init");
     ctx.program =
         cg::loadShaderProgram(shaderDir() + "draw_image.vert", shaderDir() + "draw_image.frag");
     createImageTexture(&ctx.texture, ctx.rtx.width, ctx.rtx.height);
 
     // Set up ray tracing scene
     rt::setupScene(ctx.rtx, (modelDir() + "bunny_lowpoly.obj").c_str());
+    ctx.models = listModels();
+    ctx.model_index = int(std::find(ctx.models.begin(), ctx.models.end(), "bunny_lowpoly.obj") -
+                          ctx.models.begin());
 
     initializeTrackball(ctx);
 }
 
 void updateRayTracing(Context &ctx)
 {
+    RT_TRACE_SCOPE("updateRayTracing");
+
     // Check for convergence
     if (ctx.rtx.current_frame >= ctx.rtx.max_frames) { return; }
 
@@ -116,6 +179,8 @@ void updateRayTracing(Context &ctx)
 
 void drawImage(Context &ctx)
 {
+    RT_TRACE_SCOPE("drawImage");
+
     // Bind texture and upload new image from the ray tracing
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, ctx.texture);
@@ -131,9 +196,343 @@ void drawImage(Context &ctx)
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
+void showHeatmapGui(Context &ctx)
+{
+    const char *modes = "Off\0Nodes visited\0Primitives tested\0Time (ns)\0\0";
+    const char *palettes = "Turbo\0Viridis\0Inferno\0Grayscale\0\0";
+    if (ImGui::Combo("Heatmap", &ctx.rtx.heatmap_mode, modes)) { rt::resetImage(ctx.rtx); }
+    if (ctx.rtx.heatmap_mode == rt::HEATMAP_OFF) { return; }
+    if (ctx.rtx.heatmap_mode != rt::HEATMAP_TIME && !rt::stats::enabled()) {
+        ImGui::Text("Node and primitive costs need RT_ENABLE_STATS");
+    }
+    ImGui::Combo("Palette", &ctx.rtx.heatmap_palette, palettes);
+    ImGui::SameLine();
+    ImGui::Checkbox("Log", &ctx.rtx.heatmap_log_scale);
+
+    // Colour bar legend with the current min/max cost per sample
+    const int steps = 32;
+    float width = ImGui::GetContentRegionAvailWidth();
+    ImVec2 pos = ImGui::GetCursorScreenPos();
+    ImDrawList *draw_list = ImGui::GetWindowDrawList();
+    for (int i = 0; i < steps; ++i) {
+        glm::vec3 c = rt::falseColor(ctx.rtx.heatmap_palette, (i + 0.5f) / steps);
+        ImVec2 a(pos.x + width * i / steps, pos.y);
+        ImVec2 b(pos.x + width * (i + 1) / steps, pos.y + 12.0f);
+        draw_list->AddRectFilled(a, b, ImColor(c.r, c.g, c.b));
+    }
+    ImGui::Dummy(ImVec2(width, 12.0f));
+    ImGui::Text("min %.1f", ctx.rtx.heatmap_min);
+    ImGui::SameLine();
+    ImGui::Text("max %.1f %s", ctx.rtx.heatmap_max,
+                ctx.rtx.heatmap_mode == rt::HEATMAP_TIME ? "ns/sample" : "per sample");
+}
+
+bool samplerItemGetter(void *, int index, const char **out_text)
+{
+    *out_text = rt::samplerName(index);
+    return true;
+}
+
+void showSamplingGui(Context &ctx)
+{
+    if (ImGui::Combo("Sampler", &ctx.rtx.sampler, samplerItemGetter, nullptr,
+                     rt::NUM_SAMPLER_TYPES)) {
+        rt::resetAccumulation(ctx.rtx);
+    }
+    if (ImGui::Checkbox("Next event estimation", &ctx.rtx.next_event_estimation)) {
+        rt::resetAccumulation(ctx.rtx);
+    }
+    if (ImGui::Checkbox("Russian roulette", &ctx.rtx.russian_roulette)) {
+        rt::resetAccumulation(ctx.rtx);
+    }
+    if (ctx.rtx.russian_roulette &&
+        ImGui::SliderInt("From bounce", &ctx.rtx.roulette_start_bounce, 0, 10)) {
+        rt::resetAccumulation(ctx.rtx);
+    }
+    if (ImGui::Checkbox("Irradiance cache", &ctx.rtx.irradiance_cache)) {
+        rt::resetAccumulation(ctx.rtx);
+    }
+    if (ctx.rtx.irradiance_cache) {
+        // Records are kept across camera moves, so interpolation errors stay put
+        if (ImGui::SliderFloat("Cache error", &ctx.rtx.irradiance_error, 0.05f, 1.0f)) {
+            rt::resetAccumulation(ctx.rtx);
+        }
+        rt::IrradianceCacheStats cache = rt::irradianceCacheStats();
+        ImGui::Text("%zu records, %.2f MB", cache.records, cache.bytes / 1048576.0);
+    }
+    if (ImGui::Checkbox("Path guiding", &ctx.rtx.path_guiding)) { rt::resetAccumulation(ctx.rtx); }
+    if (ctx.rtx.path_guiding) {
+        rt::PathGuidingStats guiding = rt::pathGuidingStats();
+        ImGui::Text("Pass %d, %zu cells, %.2f MB", guiding.passes, guiding.cells,
+                    guiding.bytes / 1048576.0);
+        ImGui::Text("BSDF sampled %.0f%%", 100.0f * guiding.bsdf_fraction);
+    }
+
+    // A/B comparison: render a reference (e.g. uniform at high spp), then
+    // switch samplers and compare the error at the same sample count
+    if (ImGui::Button("Set reference")) { rt::captureReference(ctx.rtx); }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear")) { ctx.rtx.reference.clear(); }
+    float error = rt::referenceError(ctx.rtx);
+    if (error >= 0.0f) {
+        ImGui::Text("RMSE %.5f at %d spp", error, rt::accumulatedSamples(ctx.rtx));
+    } else {
+        ImGui::Text("%d spp, no reference", rt::accumulatedSamples(ctx.rtx));
+    }
+}
+
+void showCameraGui(Context &ctx)
+{
+    bool changed = ImGui::SliderFloat("Field of view", &ctx.rtx.fov, 10.0f, 120.0f);
+    changed |= ImGui::SliderFloat("Aperture", &ctx.rtx.aperture, 0.0f, 0.3f);
+    changed |= ImGui::SliderFloat("Focus distance", &ctx.rtx.focus_distance, 0.1f, 10.0f);
+    if (changed) { rt::resetAccumulation(ctx.rtx); }
+}
+
+void showAnimationGui(Context &ctx)
+{
+    const char *modes = "None\0Turntable\0Sway\0\0";
+    float time = ctx.rtx.animation_time;
+    bool changed = ImGui::Combo("Animation", &ctx.rtx.animation, modes);
+    changed |= ImGui::SliderFloat("Time (s)", &time, 0.0f, 8.0f);
+    if (changed) {
+        rt::animateScene(ctx.rtx, time);
+        rt::resetAccumulation(ctx.rtx);
+    }
+    ImGui::Checkbox("Play", &ctx.rtx.animation_playing);
+    ImGui::SameLine();
+    ImGui::SliderFloat("Steps/s", &ctx.rtx.animation_fps, 1.0f, 60.0f);
+    ImGui::SliderFloat("Rebuild at", &ctx.rtx.rebuild_threshold, 1.05f, 3.0f, "%.2fx SAH");
+
+    rt::AnimationStats stats = rt::animationStats();
+    ImGui::Text("%d triangles, pose and refit %.2f ms", stats.triangles, stats.pose_ms);
+    ImGui::Text("SAH cost %.1f, %.2fx of last build", stats.sah_cost, stats.sah_ratio);
+    ImGui::Text("%d refits, %d rebuilds (last %.1f ms)%s", stats.refits, stats.rebuilds,
+                stats.rebuild_ms, stats.rebuilding ? ", rebuilding" : "");
+}
+
+void showEnvironmentGui(Context &ctx)
+{
+    rt::EnvironmentInfo info = rt::environmentInfo();
+    if (info.bytes == 0) {
+        ImGui::Text("No environment map (start with --env FILE)");
+        return;
+    }
+    if (ImGui::Checkbox("Use environment map", &ctx.rtx.use_environment)) {
+        rt::resetAccumulation(ctx.rtx);
+    }
+    if (ImGui::SliderFloat("Env intensity", &ctx.rtx.environment_intensity, 0.0f, 4.0f)) {
+        rt::resetAccumulation(ctx.rtx);
+    }
+    ImGui::Text("%dx%d, %.2f MB", info.width, info.height, info.bytes / 1048576.0);
+}
+
+// Lists every level; unavailable ones fall back to the best supported level
+bool isaItemGetter(void *, int index, const char **out_text)
+{
+    *out_text = rt::isaName(rt::IsaLevel(index));
+    return true;
+}
+
+void showStatsGui(Context &ctx)
+{
+    const std::deque<rt::stats::FrameStats> &history = rt::stats::history();
+    if (history.empty()) { return; }
+    const rt::stats::FrameStats &last = history.back();
+
+    int isa = rt::soaIsa();
+    if (ImGui::Combo("Kernels", &isa, isaItemGetter, nullptr, rt::NUM_ISA_LEVELS)) {
+        rt::setSoAIsa(rt::IsaLevel(isa));
+    }
+    if (ImGui::Checkbox("Reorder secondary rays", &ctx.rtx.reorder_rays)) {
+        rt::selectRenderKernel(ctx.rtx);  // Same image, so the accumulation stays
+    }
+    ImGui::Text("Render kernel: %s", rt::renderKernelName(ctx.rtx).c_str());
+    ImGui::Text("Frame: %.2f ms", last.frame_time * 1e3);
+    for (int i = 0; i < rt::stats::NUM_STAGES; ++i) {
+        rt::stats::Stage stage = rt::stats::Stage(i);
+        ImGui::Text("  %s: %.2f ms", rt::stats::stageName(stage), last.stage_times[i] * 1e3);
+    }
+    if (!rt::stats::enabled()) {
+        ImGui::Text("Counters disabled (configure with -DRT_ENABLE_STATS=ON)");
+        return;
+    }
+
+    ImGui::Text("Rays/sec: %.3f M (%.3f M while tracing)", last.raysPerSecond() * 1e-6,
+                last.raysPerTraceSecond() * 1e-6);
+    float rays_per_sec[256];
+    int count = std::min(int(history.size()), 256);
+    for (int i = 0; i < count; ++i) {
+        rays_per_sec[i] = history[history.size() - count + i].raysPerSecond() * 1e-6f;
+    }
+    ImGui::PlotLines("Mrays/s", rays_per_sec, count);
+
+    for (int depth = 0; depth <= std::min(ctx.rtx.max_bounces, rt::stats::kMaxDepthBins - 1);
+         ++depth) {
+        ImGui::Text("  bounce %d: %llu rays", depth,
+                    (unsigned long long)last.counters[rt::stats::depthCounter(depth)]);
+    }
+    for (int i = 0; i < rt::stats::RAYS_DEPTH_0; ++i) {
+        rt::stats::Counter counter = rt::stats::Counter(i);
+        ImGui::Text("  %s: %llu", rt::stats::counterName(counter),
+                    (unsigned long long)last.counters[i]);
+    }
+    if (ImGui::Button("Export CSV")) { rt::stats::exportCSV("rt_stats.csv"); }
+}
+
+void showTraceGui()
+{
+    bool recording = rt::trace::enabled();
+    if (ImGui::Checkbox("Record trace", &recording)) { rt::trace::setEnabled(recording); }
+    ImGui::SameLine();
+    if (ImGui::Button("Save trace")) { rt::trace::flush("rt_trace.json"); }
+}
+
+bool modelItemGetter(void *data, int index, const char **out_text)
+{
+    const std::vector<std::string> &models = *static_cast<std::vector<std::string> *>(data);
+    *out_text = models[index].c_str();
+    return true;
+}
+
+void showSceneGui(Context &ctx)
+{
+    // Scenes are built on a background thread and swapped in between frames
+    if (ImGui::Combo("Model", &ctx.model_index, modelItemGetter, &ctx.models,
+                     int(ctx.models.size()))) {
+        rt::loadSceneAsync(modelDir() + ctx.models[ctx.model_index]);
+    }
+    if (ImGui::Button("Rebuild") && ctx.model_index < int(ctx.models.size())) {
+        rt::loadSceneAsync(modelDir() + ctx.models[ctx.model_index]);
+    }
+    ImGui::SameLine();
+    ImGui::Text("%s", rt::sceneLoading() ? "Loading..." : "Ready");
+
+    // Random spheres, boxes and model copies on the ground instead of a model
+    std::size_t primitives = std::size_t(std::pow(10.0, double(ctx.procedural_log_size)) + 0.5);
+    ImGui::SliderFloat("Primitives (log10)", &ctx.procedural_log_size, 3.0f, 7.0f, "%.1f");
+    ImGui::InputInt("Seed", &ctx.procedural_seed);
+    if (ImGui::Button("Generate")) {
+        rt::loadSceneAsync(proceduralScene(primitives, std::uint32_t(ctx.procedural_seed)));
+    }
+    ImGui::SameLine();
+    ImGui::Text("%zu primitives", primitives);
+
+    rt::SceneMemory memory = rt::sceneMemory();
+    ImGui::Text("%zu spheres, %zu boxes, %zu triangles", memory.spheres, memory.boxes,
+                memory.triangles);
+    ImGui::Text("Arena %.2f / %.2f MB", memory.bytes_used / 1048576.0,
+                memory.bytes_reserved / 1048576.0);
+    ImGui::Text("Mesh %s, %.1f bytes/triangle", memory.compressed_mesh ? "compressed" : "full",
+                memory.triangles ? double(memory.mesh_bytes) / memory.triangles : 0.0);
+    // Takes effect on the next load or rebuild
+    if (ImGui::SliderInt("Mesh budget (MB)", &ctx.mesh_budget_mb, 0, 4096)) {
+        rt::setMeshMemoryBudget(std::size_t(ctx.mesh_budget_mb) << 20);
+    }
+
+    // Cluster files only
+    rt::StreamStats stream = rt::streamingStats();
+    if (stream.clusters > 0) {
+        ImGui::Text("Streaming: %d / %d clusters resident, %.1f MB", stream.resident,
+                    stream.clusters, stream.bytes / 1048576.0);
+        ImGui::Text("%llu loads in %llu batches, %llu evictions, %llu deferred rays",
+                    (unsigned long long)stream.loads, (unsigned long long)stream.batches,
+                    (unsigned long long)stream.evictions, (unsigned long long)stream.misses);
+    }
+    if (ImGui::SliderInt("Cluster cache (MB)", &ctx.stream_budget_mb, 1, 4096)) {
+        rt::setStreamingBudget(std::size_t(ctx.stream_budget_mb) << 20);
+    }
+}
+
+// Assigns ctx.texture_path to a material's albedo or roughness slot
+bool showTextureGui(Context &ctx, rt::MaterialParams &params)
+{
+    const char *mappings[] = {"UV", "Planar (xz)"};
+    rt::MaterialTextures &textures = params.textures;
+    bool changed = false;
+    if (ImGui::Button("Albedo texture")) {
+        int id = rt::textureCache().load(ctx.texture_path, true);
+        if (id >= 0) {
+            textures.albedo = id;
+            changed = true;
+        }
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Roughness texture")) {
+        int id = rt::textureCache().load(ctx.texture_path, false);
+        if (id >= 0) {
+            textures.roughness = id;
+            changed = true;
+        }
+    }
+    if (textures.albedo < 0 && textures.roughness < 0) { return changed; }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear textures")) {
+        textures = rt::MaterialTextures();
+        return true;
+    }
+    if (textures.albedo >= 0) { ImGui::Text("Albedo: %s", rt::textureCache().name(textures.albedo)); }
+    if (textures.roughness >= 0) {
+        ImGui::Text("Roughness: %s", rt::textureCache().name(textures.roughness));
+    }
+    changed |= ImGui::Combo("Mapping", &textures.mapping, mappings, rt::NUM_TEXTURE_MAPPINGS);
+    changed |= ImGui::SliderFloat("Texture scale", &textures.scale, 0.1f, 32.0f, "%.2f", 2.0f);
+    return changed;
+}
+
+void showMaterialsGui(Context &ctx)
+{
+    for (int i = 0; i < rt::materialCount(); ++i) {
+        ImGui::PushID(i);
+        rt::MaterialParams params = rt::materialParams(i);
+        ImGui::Text("%s", rt::materialName(i));
+        bool changed = ImGui::ColorEdit3("Albedo", &params.albedo[0]);
+        changed |= ImGui::SliderFloat("Intensity", &params.intensity, 0.0f,
+                                      params.emissive ? 50.0f : 2.0f);
+        if (params.has_fuzz) { changed |= ImGui::SliderFloat("Fuzz", &params.fuzz, 0.0f, 1.0f); }
+        if (params.has_textures) { changed |= showTextureGui(ctx, params); }
+        if (changed) { rt::editMaterial(ctx.rtx, i, params); }
+        ImGui::PopID();
+    }
+
+    ImGui::Separator();
+    ImGui::InputText("Texture file", ctx.texture_path, sizeof(ctx.texture_path));
+    rt::TextureCacheStats stats = rt::textureCache().stats();
+    std::uint64_t lookups = stats.hits + stats.misses;
+    ImGui::Text("%d textures, tiles %.1f / %.1f MB", stats.textures, stats.resident / 1048576.0,
+                stats.budget / 1048576.0);
+    ImGui::Text("Hit rate %.2f%%, %llu evictions", lookups ? 100.0 * stats.hits / lookups : 0.0,
+                (unsigned long long)stats.evictions);
+    if (ImGui::SliderInt("Cache budget (MB)", &ctx.texture_budget_mb, 1, 1024)) {
+        rt::textureCache().setBudget(std::size_t(ctx.texture_budget_mb) << 20);
+    }
+}
+
+void showDistributedGui(Context &ctx)
+{
+    rt::ClusterStatus status = rt::clusterStatus();
+    if (!status.listening) {
+        ImGui::Text("Not coordinating (start with --listen PORT or --spawn-workers N)");
+        if (ImGui::Button("Listen on a free port")) { rt::startCoordinator(0); }
+        return;
+    }
+    if (ImGui::Checkbox("Render on workers", &status.enabled)) {
+        rt::setDistributedEnabled(status.enabled);
+    }
+    if (ImGui::Button("Spawn local worker")) { rt::spawnWorkers(1, ctx.executable); }
+    ImGui::Text("Port %d, %d workers", status.port, int(status.workers.size()));
+    for (const rt::WorkerStatus &worker : status.workers) {
+        ImGui::Text("  pid %d: %d tiles, %d in flight", worker.pid, worker.tiles, worker.in_flight);
+    }
+    ImGui::Text("Tiles: %d remote, %d local fallback", status.tiles_remote, status.tiles_local);
+    ImGui::Text("Lost workers: %d", status.failures);
+}
+
 // MODIFY THIS FUNCTION
 void showGui(Context &ctx)
 {
+    RT_TRACE_SCOPE("showGui");
+
     if (ImGui::SliderInt("Max bounces", &ctx.rtx.max_bounces, 0, 10)) {
         rt::resetAccumulation(ctx.rtx);
     }
@@ -153,13 +552,27 @@ void showGui(Context &ctx)
     if (ImGui::SliderInt("Samples Per Pixel", &ctx.rtx.samples_per_pixel, 1, 16)) {
         rt::resetAccumulation(ctx.rtx);
     }
-    // 材質控制
-    ImGui::SliderFloat("Metallic Roughness", &ctx.rtx.metallic_roughness, 0.0f, 1.0f);
-    ImGui::SliderFloat("Material Intensity", &ctx.rtx.material_intensity, 0.0f, 2.0f);
+    // 材質控制 (edited in place, no scene rebuild)
+    if (ImGui::SliderFloat("Metallic Roughness", &ctx.rtx.metallic_roughness, 0.0f, 1.0f)) {
+        rt::applyMaterialSettings(ctx.rtx);
+    }
+    if (ImGui::SliderFloat("Material Intensity", &ctx.rtx.material_intensity, 0.0f, 2.0f)) {
+        rt::applyMaterialSettings(ctx.rtx);
+    }
     // 切換Gamma校正
     if (ImGui::Checkbox("Gamma Correction", &ctx.rtx.enable_gamma_correction)) {
         rt::resetAccumulation(ctx.rtx);
     }
+    if (ImGui::CollapsingHeader("Scene")) { showSceneGui(ctx); }
+    if (ImGui::CollapsingHeader("Camera")) { showCameraGui(ctx); }
+    if (ImGui::CollapsingHeader("Animation")) { showAnimationGui(ctx); }
+    if (ImGui::CollapsingHeader("Materials")) { showMaterialsGui(ctx); }
+    if (ImGui::CollapsingHeader("Sampling")) { showSamplingGui(ctx); }
+    if (ImGui::CollapsingHeader("Environment")) { showEnvironmentGui(ctx); }
+    if (ImGui::CollapsingHeader("Distributed")) { showDistributedGui(ctx); }
+    if (ImGui::CollapsingHeader("Performance")) { showStatsGui(ctx); }
+    if (ImGui::CollapsingHeader("Traversal heatmap")) { showHeatmapGui(ctx); }
+    if (ImGui::CollapsingHeader("Trace capture")) { showTraceGui(); }
 }
 
 void display(Context &ctx)
@@ -173,11 +586,21 @@ void display(Context &ctx)
     ctx.rtx.view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     if (ctx.trackball.tracking) { rt::resetAccumulation(ctx.rtx); }
 
-    // Update and draw ray tracing image
+    // Swap in a scene finished by the background loader, then update and draw
+    // the ray tracing image
+    double tic = glfwGetTime();
+    rt::commitScene(ctx.rtx);
     updateRayTracing(ctx);
+    rt::resolveHeatmap(ctx.rtx);
+    double toc = glfwGetTime();
+    rt::stats::recordStage(rt::stats::STAGE_RAY_TRACING, toc - tic);
     drawImage(ctx);
+    tic = toc;
+    toc = glfwGetTime();
+    rt::stats::recordStage(rt::stats::STAGE_TEXTURE_UPLOAD, toc - tic);
 
     showGui(ctx);
+    rt::stats::recordStage(rt::stats::STAGE_GUI, glfwGetTime() - toc);
 }
 
 void reloadShaders(Context *ctx)
@@ -267,10 +690,345 @@ void resizeCallback(GLFWwindow *window, int width, int height)
     rt::resetImage(ctx->rtx);
 }
 
-int main(void)
+void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [--isa scalar|sse2|sse4|avx2|avx512] [--env FILE|DIR]"
+              << " [--listen PORT] [--spawn-workers N] [--mesh-budget MB] [--stream-budget MB]\n"
+              << "       " << program << " --preprocess-mesh MESH.obj OUT.rtc [--cluster-size N]\n"
+              << "       " << program << " --worker HOST:PORT\n"
+              << "       " << program << " --serve SOCKET\n"
+              << "       " << program << " --render SOCKET MESH OUT.png [--size WxH] [--spp N]"
+              << " [--frames N]\n"
+              << "       " << program << " --sequence MESH OUT_%04d.png [--animation turntable|sway]"
+              << " [--length N] [--fps F] [--size WxH] [--spp N] [--frames N]\n"
+              << "       " << program << " --scaling SEED [--max-primitives N] [--size WxH]"
+              << " [--frames N]\n"
+              << "       " << program << " --guiding-benchmark MESH SECONDS [--size WxH] [--spp N]\n"
+              << "MESH may be procedural:PRIMITIVES:SEED[:MESH.obj,...] for a generated scene"
+              << std::endl;
+}
+
+// Client for the render server: submits one job and writes the final image
+int renderWithServer(const std::string &socket_path, const rt::RenderJob &job,
+                     const std::string &output)
+{
+    rt::RenderFrame last;
+    std::string error;
+    bool ok = rt::submitRenderJob(socket_path, job, [&](const rt::RenderFrame &frame) {
+        std::cout << "Frame " << frame.frame << "/" << frame.frames << ": " << frame.frame_ms
+                  << " ms" << std::endl;
+        if (frame.frame == 1) {
+            std::cout << "Scene " << (frame.cache_hit ? "cached" : "built") << " in "
+                      << frame.scene_ms << " ms" << std::endl;
+        }
+        last = frame;
+    }, error);
+    if (!ok) {
+        std::cerr << "Error: " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    unsigned status = lodepng::encode(output, last.rgba, last.width, last.height);
+    if (status != 0) {
+        std::cerr << "Error: " << lodepng_error_text(status) << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// `pattern` with its %d or %0Nd replaced by `index`, or an empty string if
+// it has no such field
+std::string sequenceFilename(const std::string &pattern, int index)
+{
+    std::size_t percent = pattern.find('%');
+    if (percent == std::string::npos) { return std::string(); }
+    std::size_t end = percent + 1;
+    int width = 0;
+    while (end < pattern.size() && pattern[end] >= '0' && pattern[end] <= '9') {
+        width = std::min(width * 10 + (pattern[end++] - '0'), 16);
+    }
+    if (end >= pattern.size() || pattern[end] != 'd') { return std::string(); }
+    std::string number = std::to_string(index);
+    if (int(number.size()) < width) { number.insert(0, width - number.size(), '0'); }
+    return pattern.substr(0, percent) + number + pattern.substr(end + 1);
+}
+
+// Renders `length` frames of an animation headlessly and writes them as
+// numbered PNGs. Every image accumulates job.frames passes.
+int renderSequence(const rt::RenderJob &job, int animation, int length, float fps,
+                   const std::string &pattern)
+{
+    if (sequenceFilename(pattern, 0).empty()) {
+        std::cerr << "Error: output pattern needs a frame number field such as %04d" << std::endl;
+        return EXIT_FAILURE;
+    }
+    rt::RTContext rtx;
+    rt::setupScene(rtx, job.mesh_filename.c_str());
+    rtx.width = job.width;
+    rtx.height = job.height;
+    rtx.view = glm::lookAt(job.eye, job.target, job.up);
+    rtx.fov = job.fov;
+    rtx.samples_per_pixel = job.samples_per_pixel;
+    rtx.max_bounces = job.max_bounces;
+    rtx.show_normals = false;
+    rtx.animation = animation;
+    rtx.animation_fps = fps;
+
+    std::vector<unsigned char> rgba;
+    for (int frame = 0; frame < length; ++frame) {
+        auto start = std::chrono::steady_clock::now();
+        rt::animateScene(rtx, frame / fps);
+        rt::resetImage(rtx);
+        rtx.camera.update(rtx.view, rtx.fov, rtx.width, rtx.height, rtx.aperture,
+                          rtx.focus_distance);
+        for (int pass = 0; pass < job.frames; ++pass) { rt::renderFrame(rtx); }
+        rt::packImage(rtx, rgba);
+
+        std::string filename = sequenceFilename(pattern, frame + 1);
+        unsigned status = lodepng::encode(filename, rgba, rtx.width, rtx.height);
+        if (status != 0) {
+            std::cerr << "Error: " << filename << ": " << lodepng_error_text(status) << std::endl;
+            return EXIT_FAILURE;
+        }
+        rt::AnimationStats stats = rt::animationStats();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << filename << ": " << elapsed.count() << " ms, SAH "
+                  << stats.sah_ratio << "x of last build, " << stats.rebuilds << " rebuilds"
+                  << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Builds procedural scenes of 10^3, 10^4, ... primitives up to `max_primitives`
+// and prints, per scale, the primitive counts, memory, build time and the
+// tracing rate of job.frames frames from the default camera, as CSV for
+// plotting scaling curves
+int runScalingBenchmark(const rt::RenderJob &job, std::uint32_t seed, std::size_t max_primitives)
+{
+    std::cout << "primitives,spheres,boxes,triangles,arena_mb,mesh_mb,compressed,build_ms,"
+              << "frame_ms," << (rt::stats::enabled() ? "mrays_per_sec" : "mcamera_rays_per_sec")
+              << std::endl;
+    for (std::size_t primitives = 1000; primitives <= max_primitives; primitives *= 10) {
+        rt::RTContext rtx;
+        auto start = std::chrono::steady_clock::now();
+        rt::setupScene(rtx, proceduralScene(primitives, seed).c_str());
+        std::chrono::duration<double, std::milli> build = std::chrono::steady_clock::now() - start;
+        rt::SceneMemory memory = rt::sceneMemory();
+
+        rtx.width = job.width;
+        rtx.height = job.height;
+        rtx.view = glm::lookAt(job.eye, job.target, job.up);
+        rtx.fov = job.fov;
+        rtx.max_bounces = job.max_bounces;
+        rtx.show_normals = false;
+        rt::resetImage(rtx);
+        rtx.camera.update(rtx.view, rtx.fov, rtx.width, rtx.height, rtx.aperture,
+                          rtx.focus_distance);
+        rt::stats::endFrame(0.0);  // Leaves out rays traced before the timed frames
+        start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < job.frames; ++frame) { rt::renderFrame(rtx); }
+        std::chrono::duration<double> render = std::chrono::steady_clock::now() - start;
+        rt::stats::endFrame(render.count());
+        // Without counters only camera rays, one per pixel and frame, are known
+        double rays = rt::stats::enabled() ? double(rt::stats::history().back().rays())
+                                           : double(rtx.width) * rtx.height * job.frames;
+
+        std::cout << primitives << "," << memory.spheres << "," << memory.boxes << ","
+                  << memory.triangles << "," << memory.bytes_reserved / 1048576.0 << ","
+                  << memory.mesh_bytes / 1048576.0 << "," << (memory.compressed_mesh ? 1 : 0)
+                  << "," << build.count() << "," << 1e3 * render.count() / job.frames << ","
+                  << 1e-6 * rays / render.count() << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Equal-time comparison of path guiding: renders the scene of `job` for
+// `seconds` without and then with guiding, from scratch, and prints the RMSE
+// against a reference after every frame as CSV. The reference is plain path
+// tracing for eight times as long, from sample indices neither run uses.
+int runGuidingBenchmark(const rt::RenderJob &job, double seconds)
+{
+    rt::RTContext rtx;
+    rt::setupScene(rtx, job.mesh_filename.c_str());
+    rtx.width = job.width;
+    rtx.height = job.height;
+    rtx.view = glm::lookAt(job.eye, job.target, job.up);
+    rtx.fov = job.fov;
+    rtx.samples_per_pixel = job.samples_per_pixel;
+    rtx.max_bounces = job.max_bounces;
+    rtx.show_normals = false;
+    // Gamma applies to each sample, so its mean would depend on the variance
+    // of the estimator; compare linear radiance instead
+    rtx.enable_gamma_correction = false;
+    rt::resetImage(rtx);
+    rtx.camera.update(rtx.view, rtx.fov, rtx.width, rtx.height, rtx.aperture, rtx.focus_distance);
+
+    rtx.current_frame = 1 << 20;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed(0.0);
+    while (elapsed.count() < 8.0 * seconds) {
+        rt::renderFrame(rtx);
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    rt::captureReference(rtx);
+    std::cerr << "Reference: " << rt::accumulatedSamples(rtx) << " spp in " << elapsed.count()
+              << " s" << std::endl;
+
+    std::cout << "guiding,frame,seconds,rmse" << std::endl;
+    float error[2] = {0.0f, 0.0f};
+    for (int guiding = 0; guiding < 2; ++guiding) {
+        rtx.path_guiding = guiding != 0;
+        rt::resetImage(rtx);
+        start = std::chrono::steady_clock::now();
+        elapsed = std::chrono::duration<double>(0.0);
+        for (int frame = 1; elapsed.count() < seconds; ++frame) {
+            rt::renderFrame(rtx);
+            elapsed = std::chrono::steady_clock::now() - start;
+            error[guiding] = rt::referenceError(rtx);
+            std::cout << guiding << "," << frame << "," << elapsed.count() << "," << error[guiding]
+                      << std::endl;
+        }
+    }
+    rt::PathGuidingStats stats = rt::pathGuidingStats();
+    std::cerr << "RMSE after " << seconds << " s: " << error[0] << " without guiding, " << error[1]
+              << " with (" << stats.cells << " cells, " << stats.bytes / 1048576.0 << " MB, BSDF "
+              << "fraction " << stats.bsdf_fraction << ")" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// Writes a cluster file for streaming a mesh that does not fit in memory
+int preprocessMesh(const std::string &input, const std::string &output, int cluster_size)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string error;
+    if (!rt::StreamedMesh::preprocess(input, output, cluster_size, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Wrote " << output << " in " << elapsed.count() << " s" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// Path of the running executable, for spawning local workers
+std::string executablePath(const char *argv0)
+{
+#ifdef __linux__
+    char path[4096];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length > 0) { return std::string(path, length); }
+#endif
+    return argv0;
+}
+
+int main(int argc, char *argv[])
 {
     Context ctx;
 
+    // Intersection kernels default to the best level this CPU supports;
+    // --isa forces a lower one for benchmarking
+    rt::IsaLevel isa = rt::detectIsa();
+    std::string env_path;
+    std::string worker_address;
+    int listen_port = -1;
+    int spawn_count = 0;
+    std::string serve_path;
+    std::string render_path, render_output;
+    rt::RenderJob job;
+    std::string sequence_pattern;
+    int animation = rt::ANIM_TURNTABLE;
+    int sequence_length = 48;
+    float sequence_fps = 24.0f;
+    std::string preprocess_input, preprocess_output;
+    int cluster_size = rt::kDefaultClusterSize;
+    bool scaling = false;
+    std::uint32_t scaling_seed = 1;
+    std::size_t max_primitives = 10000000;
+    double guiding_seconds = 0.0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--isa" && i + 1 < argc && rt::parseIsa(argv[i + 1], isa)) {
+            ++i;
+        } else if (arg == "--env" && i + 1 < argc) {
+            env_path = argv[++i];
+        } else if (arg == "--worker" && i + 1 < argc) {
+            worker_address = argv[++i];
+        } else if (arg == "--listen" && i + 1 < argc) {
+            listen_port = std::atoi(argv[++i]);
+        } else if (arg == "--spawn-workers" && i + 1 < argc) {
+            spawn_count = std::atoi(argv[++i]);
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (arg == "--render" && i + 3 < argc) {
+            render_path = argv[++i];
+            job.mesh_filename = argv[++i];
+            render_output = argv[++i];
+        } else if (arg == "--size" && i + 1 < argc &&
+                   std::sscanf(argv[i + 1], "%dx%d", &job.width, &job.height) == 2) {
+            ++i;
+        } else if (arg == "--spp" && i + 1 < argc) {
+            job.samples_per_pixel = std::atoi(argv[++i]);
+        } else if (arg == "--frames" && i + 1 < argc) {
+            job.frames = std::atoi(argv[++i]);
+        } else if (arg == "--sequence" && i + 2 < argc) {
+            job.mesh_filename = argv[++i];
+            sequence_pattern = argv[++i];
+        } else if (arg == "--animation" && i + 1 < argc &&
+                   (std::string(argv[i + 1]) == "turntable" || std::string(argv[i + 1]) == "sway")) {
+            animation = std::string(argv[++i]) == "sway" ? rt::ANIM_SWAY : rt::ANIM_TURNTABLE;
+        } else if (arg == "--length" && i + 1 < argc) {
+            sequence_length = std::atoi(argv[++i]);
+        } else if (arg == "--mesh-budget" && i + 1 < argc) {
+            ctx.mesh_budget_mb = std::max(std::atoi(argv[++i]), 0);
+            rt::setMeshMemoryBudget(std::size_t(ctx.mesh_budget_mb) << 20);
+        } else if (arg == "--stream-budget" && i + 1 < argc) {
+            ctx.stream_budget_mb = std::max(std::atoi(argv[++i]), 1);
+            rt::setStreamingBudget(std::size_t(ctx.stream_budget_mb) << 20);
+        } else if (arg == "--preprocess-mesh" && i + 2 < argc) {
+            preprocess_input = argv[++i];
+            preprocess_output = argv[++i];
+        } else if (arg == "--cluster-size" && i + 1 < argc) {
+            cluster_size = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--fps" && i + 1 < argc) {
+            sequence_fps = std::max(float(std::atof(argv[++i])), 1.0f);
+        } else if (arg == "--scaling" && i + 1 < argc) {
+            scaling = true;
+            scaling_seed = std::uint32_t(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--max-primitives" && i + 1 < argc) {
+            max_primitives = std::size_t(std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--guiding-benchmark" && i + 2 < argc) {
+            job.mesh_filename = argv[++i];
+            guiding_seconds = std::max(std::atof(argv[++i]), 0.1);
+        } else {
+            printUsage(argv[0]);
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    rt::IsaLevel selected = rt::setSoAIsa(isa);
+    if (selected != isa) {
+        std::cerr << "Warning: " << rt::isaName(isa) << " kernels are not available, using "
+                  << rt::isaName(selected) << std::endl;
+    }
+    std::cout << "Intersection kernels: " << rt::isaName(selected) << " (CPU supports "
+              << rt::isaName(rt::detectIsa()) << ")" << std::endl;
+
+    // Headless render worker for a coordinator; no window is opened
+    if (!worker_address.empty()) { return rt::runWorker(worker_address); }
+    if (!serve_path.empty()) { return rt::runServer(serve_path); }
+    if (!render_path.empty()) { return renderWithServer(render_path, job, render_output); }
+    if (!sequence_pattern.empty()) {
+        return renderSequence(job, animation, sequence_length, sequence_fps, sequence_pattern);
+    }
+    if (!preprocess_output.empty()) {
+        return preprocessMesh(preprocess_input, preprocess_output, cluster_size);
+    }
+    if (scaling) { return runScalingBenchmark(job, scaling_seed, max_primitives); }
+    if (guiding_seconds > 0.0) { return runGuidingBenchmark(job, guiding_seconds); }
+
+    // Record a Chrome trace from start-up and write it on exit if requested
+    std::string trace_filename = getEnvVar("RT_TRACE");
+    rt::trace::setEnabled(!trace_filename.empty());
+    rt::trace::setThreadName("main");
+
     // Create a GLFW window
     glfwSetErrorCallback(errorCallback);
     glfwInit();
@@ -306,18 +1064,27 @@ int main(void)
     glGenVertexArrays(1, &ctx.emptyVAO);
     glBindVertexArray(ctx.emptyVAO);
     init(ctx);
+    if (!env_path.empty()) { rt::loadEnvironment(ctx.rtx, env_path); }
+    if (listen_port >= 0) { rt::startCoordinator(listen_port); }
+    if (spawn_count > 0) { rt::spawnWorkers(spawn_count, executablePath(argv[0])); }
+    ctx.executable = executablePath(argv[0]);
 
     // Start rendering loop
     while (!glfwWindowShouldClose(ctx.window)) {
+        RT_TRACE_SCOPE("frame");
         glfwPollEvents();
-        ctx.elapsed_time = glfwGetTime();
+        double frame_start = glfwGetTime();
+        ctx.elapsed_time = float(frame_start);
         ImGui_ImplGlfwGL3_NewFrame();
         display(ctx);
         ImGui::Render();
         glfwSwapBuffers(ctx.window);
+        rt::stats::endFrame(glfwGetTime() - frame_start);
     }
 
     // Shutdown
+    rt::stopCoordinator();
+    if (!trace_filename.empty()) { rt::trace::flush(trace_filename); }
     glfwDestroyWindow(ctx.window);
     glfwTerminate();
     std::exit(EXIT_SUCCESS);
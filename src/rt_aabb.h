@@ -0,0 +1,48 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+namespace rt {
+
+// Axis-aligned bounding box, empty (inverted) by default
+struct AABB {
+    glm::vec3 lo = glm::vec3(FLT_MAX);
+    glm::vec3 hi = glm::vec3(-FLT_MAX);
+
+    AABB() {}
+    AABB(const glm::vec3 &a, const glm::vec3 &b) : lo(a), hi(b) {}
+
+    void grow(const glm::vec3 &p)
+    {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    void grow(const AABB &b)
+    {
+        lo = glm::min(lo, b.lo);
+        hi = glm::max(hi, b.hi);
+    }
+    bool empty() const
+    {
+        return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z;
+    }
+    glm::vec3 center() const
+    {
+        return 0.5f * (lo + hi);
+    }
+    glm::vec3 extent() const
+    {
+        return hi - lo;
+    }
+    float surfaceArea() const
+    {
+        if (empty()) { return 0.0f; }
+        glm::vec3 e = hi - lo;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+}  // namespace rt
@@ -0,0 +1,65 @@
+#include "rt_arena.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+namespace rt {
+
+void *alignedAlloc(std::size_t bytes, std::size_t alignment)
+{
+    void *p = nullptr;
+#if defined(_MSC_VER)
+    p = _aligned_malloc(bytes, alignment);
+#else
+    if (posix_memalign(&p, alignment, bytes) != 0) { p = nullptr; }
+#endif
+    if (!p) { throw std::bad_alloc(); }
+    return p;
+}
+
+void alignedFree(void *p)
+{
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+Arena::Arena(std::size_t size) : block_size(size)
+{
+}
+
+Arena::~Arena()
+{
+    for (size_t i = 0; i < blocks.size(); ++i) { alignedFree(blocks[i]); }
+}
+
+void *Arena::allocate(std::size_t bytes, std::size_t alignment)
+{
+    std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+    if (cursor && p + bytes <= reinterpret_cast<std::uintptr_t>(limit)) {
+        cursor = reinterpret_cast<char *>(p + bytes);
+        used += bytes;
+        return reinterpret_cast<void *>(p);
+    }
+
+    // Large requests get a block of their own so the current one stays in use
+    std::size_t alloc_alignment = alignment > kCacheLineSize ? alignment : kCacheLineSize;
+    if (bytes > block_size / 4) {
+        void *block = alignedAlloc(bytes > 0 ? bytes : 1, alloc_alignment);
+        blocks.push_back(block);
+        used += bytes;
+        reserved += bytes;
+        return block;
+    }
+    char *block = static_cast<char *>(alignedAlloc(block_size, alloc_alignment));
+    blocks.push_back(block);
+    reserved += block_size;
+    cursor = block + bytes;
+    limit = block + block_size;
+    used += bytes;
+    return block;
+}
+
+}  // namespace rt
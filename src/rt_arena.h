@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace rt {
+
+// Alignment of arena blocks and container buffers (one cache line, which also
+// covers AVX-512 loads)
+const std::size_t kCacheLineSize = 64;
+
+void *alignedAlloc(std::size_t bytes, std::size_t alignment);
+void alignedFree(void *p);
+
+// Monotonic allocator. Allocations are carved out of large blocks that are
+// only released together when the arena is destroyed, so tearing down a
+// scene costs one free per block however many objects it holds. Destructors
+// of objects created in an arena are never run.
+class Arena {
+  public:
+    static const std::size_t kDefaultBlockSize = std::size_t(1) << 20;
+
+    explicit Arena(std::size_t block_size = kDefaultBlockSize);
+    ~Arena();
+
+    void *allocate(std::size_t bytes, std::size_t alignment);
+
+    template <typename T, typename... Args>
+    T *create(Args &&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "objects in an arena are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    std::size_t bytesUsed() const
+    {
+        return used;
+    }
+    std::size_t bytesReserved() const
+    {
+        return reserved;
+    }
+
+  private:
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+    std::vector<void *> blocks;
+    std::size_t block_size;
+    char *cursor = nullptr;
+    char *limit = nullptr;
+    std::size_t used = 0;
+    std::size_t reserved = 0;
+};
+
+// STL allocator that draws from an arena, or from the aligned heap when no
+// arena is given. Deallocation is a no-op inside an arena.
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    template <typename U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    Arena *arena;
+
+    ArenaAllocator(Arena *a = nullptr) : arena(a) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        std::size_t bytes = n * sizeof(T);
+        void *p = arena ? arena->allocate(bytes, kCacheLineSize) : alignedAlloc(bytes, kCacheLineSize);
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, std::size_t)
+    {
+        if (!arena) { alignedFree(p); }
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return a.arena == b.arena;
+}
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+{
+    return a.arena != b.arena;
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+}  // namespace rt
@@ -10,6 +10,11 @@ class Box : public Hitable {
     Box(const glm::vec3 &cen, const glm::vec3 r, Material* m = nullptr)
         : center(cen), radius(r), mat_ptr(m) {};
     virtual bool hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const;
+    void record(const Ray &r, float t, HitRecord &rec) const;
+    AABB bounds() const
+    {
+        return AABB(center - radius, center + radius);
+    }
 
     glm::vec3 center;
     glm::vec3 radius;
@@ -18,23 +23,37 @@ class Box : public Hitable {
 
 // Ray-box test adapted from branchless code at
 // https://tavianator.com/fast-branchless-raybounding-box-intersections/
-bool Box::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
+inline bool Box::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
 {
+    // The ray's signs pick the entry face per axis, so no min/max or division
     glm::vec3 oc = r.origin() - center;
-    glm::vec3 t0 = (-radius - oc) / r.direction();
-    glm::vec3 t1 = (radius - oc) / r.direction();
-    float temp1 = glm::compMax(glm::min(t0, t1));
-    float temp2 = glm::compMin(glm::max(t1, t0));
+    glm::vec3 entry(r.sign(0) ? radius.x : -radius.x, r.sign(1) ? radius.y : -radius.y,
+                    r.sign(2) ? radius.z : -radius.z);
+    glm::vec3 t0 = (entry - oc) * r.inv_direction();
+    glm::vec3 t1 = (-entry - oc) * r.inv_direction();
+    float temp1 = glm::compMax(t0);
+    float temp2 = glm::compMin(t1);
     float temp = (temp1 < t_max && temp1 > t_min) ? temp1 : temp2;
     if (temp1 <= temp2 && temp1 < t_max && temp > t_min) {
-        rec.t = temp;  // TODO Handle case where origin is inside box
-        rec.p = r.point_at_parameter(rec.t);
-        glm::vec3 npc = (rec.p - center) / radius;
-        rec.normal = glm::sign(npc) * glm::step(glm::compMax(glm::abs(npc)), glm::abs(npc));
-        rec.mat_ptr = mat_ptr;
+        record(r, temp, rec);  // TODO Handle case where origin is inside box
         return true;
     }
     return false;
 }
 
+// Fill in the hit record for a hit at distance t (also used by batched tests)
+inline void Box::record(const Ray &r, float t, HitRecord &rec) const
+{
+    rec.t = t;
+    rec.p = r.point_at_parameter(rec.t);
+    glm::vec3 npc = (rec.p - center) / radius;
+    rec.normal = glm::sign(npc) * glm::step(glm::compMax(glm::abs(npc)), glm::abs(npc));
+    rec.mat_ptr = mat_ptr;
+    // Each face is mapped to [0, 1]^2 by the two axes it spans
+    glm::vec3 q = 0.5f * npc + 0.5f;
+    rec.uv = rec.normal.x != 0.0f ? glm::vec2(q.z, q.y)
+                                  : (rec.normal.y != 0.0f ? glm::vec2(q.x, q.z) : glm::vec2(q.x, q.y));
+    rec.uv_density = 0.5f / glm::compMin(radius);
+}
+
 }  // namespace rt
@@ -0,0 +1,201 @@
+#include "rt_bvh.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace rt {
+
+namespace {
+
+const int kNumBins = 12;
+const int kMaxDepth = 60;  // Stays below the traversal stack size
+
+struct Builder {
+    const std::vector<AABB> &bounds;
+    std::vector<glm::vec3> centroids;
+    std::vector<std::uint32_t> &order;
+    ArenaVector<BVHNode> &nodes;
+    int max_leaf_size;
+
+    Builder(const std::vector<AABB> &b, std::vector<std::uint32_t> &o, ArenaVector<BVHNode> &n,
+            int leaf_size)
+        : bounds(b), order(o), nodes(n), max_leaf_size(leaf_size)
+    {
+        centroids.resize(bounds.size());
+        for (size_t i = 0; i < bounds.size(); ++i) { centroids[i] = bounds[i].center(); }
+    }
+
+    void makeLeaf(std::uint32_t index, std::uint32_t begin, std::uint32_t end)
+    {
+        nodes[index].offset = begin;
+        nodes[index].count = end - begin;
+    }
+
+    // Returns the split position in [begin, end), or begin if no split helps
+    std::uint32_t split(std::uint32_t begin, std::uint32_t end, const AABB &centroid_bounds)
+    {
+        glm::vec3 extent = centroid_bounds.extent();
+        int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+        if (extent[axis] <= 0.0f) { return begin + (end - begin) / 2; }  // Coincident centroids
+
+        // Bin centroids along the widest axis and sweep for the lowest SAH cost
+        AABB bin_bounds[kNumBins];
+        int bin_counts[kNumBins] = {};
+        float scale = kNumBins / extent[axis];
+        float lo = centroid_bounds.lo[axis];
+        for (std::uint32_t i = begin; i < end; ++i) {
+            int b = std::min(int((centroids[order[i]][axis] - lo) * scale), kNumBins - 1);
+            bin_bounds[b].grow(bounds[order[i]]);
+            bin_counts[b]++;
+        }
+
+        float right_cost[kNumBins];
+        AABB acc;
+        int count = 0;
+        for (int b = kNumBins - 1; b > 0; --b) {
+            acc.grow(bin_bounds[b]);
+            count += bin_counts[b];
+            right_cost[b] = acc.surfaceArea() * count;
+        }
+        int best_bin = -1;
+        float best_cost = FLT_MAX;
+        acc = AABB();
+        count = 0;
+        for (int b = 0; b < kNumBins - 1; ++b) {
+            acc.grow(bin_bounds[b]);
+            count += bin_counts[b];
+            float cost = acc.surfaceArea() * count + right_cost[b + 1];
+            if (count > 0 && cost < best_cost) {
+                best_cost = cost;
+                best_bin = b;
+            }
+        }
+
+        std::uint32_t *mid = std::partition(&order[begin], &order[0] + end, [&](std::uint32_t i) {
+            return std::min(int((centroids[i][axis] - lo) * scale), kNumBins - 1) <= best_bin;
+        });
+        std::uint32_t m = std::uint32_t(mid - &order[0]);
+        if (m == begin || m == end) {
+            // Degenerate binning; fall back to an object median split
+            m = begin + (end - begin) / 2;
+            std::nth_element(&order[begin], &order[m], &order[0] + end,
+                             [&](std::uint32_t a, std::uint32_t b) {
+                                 return centroids[a][axis] < centroids[b][axis];
+                             });
+        }
+        return m;
+    }
+
+    void build(std::uint32_t index, std::uint32_t begin, std::uint32_t end, int depth)
+    {
+        AABB node_bounds, centroid_bounds;
+        for (std::uint32_t i = begin; i < end; ++i) {
+            node_bounds.grow(bounds[order[i]]);
+            centroid_bounds.grow(centroids[order[i]]);
+        }
+        nodes[index].lo = node_bounds.lo;
+        nodes[index].hi = node_bounds.hi;
+
+        if (int(end - begin) <= max_leaf_size || depth >= kMaxDepth) {
+            makeLeaf(index, begin, end);
+            return;
+        }
+        std::uint32_t mid = split(begin, end, centroid_bounds);
+
+        nodes[index].count = 0;
+        std::uint32_t left = std::uint32_t(nodes.size());
+        nodes.push_back(BVHNode());
+        build(left, begin, mid, depth + 1);
+        std::uint32_t right = std::uint32_t(nodes.size());
+        nodes.push_back(BVHNode());
+        nodes[index].offset = right;
+        build(right, mid, end, depth + 1);
+    }
+};
+
+}  // namespace
+
+void BVH::build(const std::vector<AABB> &bounds, int max_leaf_size,
+                std::vector<std::uint32_t> &order, Arena *arena)
+{
+    nodes = ArenaVector<BVHNode>(ArenaAllocator<BVHNode>(arena));
+    refit_order.clear();
+    level_starts.clear();
+    order.resize(bounds.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (bounds.empty()) { return; }
+
+    nodes.reserve(2 * bounds.size());
+    nodes.push_back(BVHNode());
+    Builder builder(bounds, order, nodes, std::max(1, max_leaf_size));
+    builder.build(0, 0, std::uint32_t(bounds.size()), 0);
+}
+
+void BVH::assignNodes(const BVH &other)
+{
+    nodes.assign(other.nodes.begin(), other.nodes.end());
+    refit_order.clear();
+    level_starts.clear();
+}
+
+void BVH::computeLevels()
+{
+    // Children always come after their parent, so one forward pass finds depths
+    std::vector<std::uint32_t> depth(nodes.size(), 0);
+    std::uint32_t max_depth = 0;
+    for (std::uint32_t i = 0; i < nodes.size(); ++i) {
+        max_depth = std::max(max_depth, depth[i]);
+        if (nodes[i].count == 0) { depth[i + 1] = depth[nodes[i].offset] = depth[i] + 1; }
+    }
+
+    // Counting sort by decreasing depth
+    level_starts.assign(max_depth + 2, 0);
+    for (std::uint32_t i = 0; i < nodes.size(); ++i) { level_starts[max_depth - depth[i] + 1]++; }
+    for (std::uint32_t l = 1; l < level_starts.size(); ++l) { level_starts[l] += level_starts[l - 1]; }
+    refit_order.resize(nodes.size());
+    std::vector<std::uint32_t> cursor(level_starts.begin(), level_starts.end() - 1);
+    for (std::uint32_t i = 0; i < nodes.size(); ++i) { refit_order[cursor[max_depth - depth[i]]++] = i; }
+}
+
+void BVH::refit(const AABB *bounds)
+{
+    if (nodes.empty()) { return; }
+    if (refit_order.size() != nodes.size()) { computeLevels(); }
+
+    int levels = int(level_starts.size()) - 1;
+#pragma omp parallel
+    for (int level = 0; level < levels; ++level) {
+        // The implicit barrier after each level keeps children ahead of parents
+        int begin = int(level_starts[level]);
+        int end = int(level_starts[level + 1]);
+#pragma omp for schedule(static)
+        for (int i = begin; i < end; ++i) {
+            std::uint32_t index = refit_order[i];
+            BVHNode &node = nodes[index];
+            AABB box;
+            if (node.count > 0) {
+                for (std::uint32_t k = 0; k < node.count; ++k) { box.grow(bounds[node.offset + k]); }
+            } else {
+                const BVHNode &a = nodes[index + 1];
+                const BVHNode &b = nodes[node.offset];
+                box = AABB(glm::min(a.lo, b.lo), glm::max(a.hi, b.hi));
+            }
+            node.lo = box.lo;
+            node.hi = box.hi;
+        }
+    }
+}
+
+float BVH::sahCost() const
+{
+    if (nodes.empty()) { return 0.0f; }
+    double cost = 0.0;
+    for (const BVHNode &node : nodes) {
+        float area = AABB(node.lo, node.hi).surfaceArea();
+        cost += double(area) * (node.count > 0 ? node.count : 1);
+    }
+    float root_area = AABB(nodes[0].lo, nodes[0].hi).surfaceArea();
+    return root_area > 0.0f ? float(cost / root_area) : 0.0f;
+}
+
+}  // namespace rt
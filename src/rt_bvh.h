@@ -0,0 +1,189 @@
+#pragma once
+
+#include "rt_aabb.h"
+#include "rt_arena.h"
+#include "rt_ray.h"
+#include "rt_stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace rt {
+
+// 32-byte node in depth-first order. The first child of an interior node
+// directly follows it and `offset` is the index of the second child; for
+// leaves `offset` is the first primitive and `count` is non-zero.
+struct BVHNode {
+    glm::vec3 lo;
+    std::uint32_t offset;
+    glm::vec3 hi;
+    std::uint32_t count;
+};
+
+// Binned-SAH bounding volume hierarchy over an external primitive array.
+// build() returns the permutation the caller must apply to its primitives so
+// that every leaf covers a contiguous range. Nodes live in `arena` if given.
+class BVH {
+  public:
+    ArenaVector<BVHNode> nodes;
+
+    void build(const std::vector<AABB> &bounds, int max_leaf_size,
+               std::vector<std::uint32_t> &order, Arena *arena = nullptr);
+    // Takes over the topology of `other` (e.g. built on another thread),
+    // keeping this tree's allocator
+    void assignNodes(const BVH &other);
+    void clear()
+    {
+        nodes.clear();
+        refit_order.clear();
+        level_starts.clear();
+    }
+    bool empty() const
+    {
+        return nodes.empty();
+    }
+
+    // Recomputes all node bounds bottom-up for moved primitives, keeping the
+    // topology. `bounds` holds one box per primitive in leaf order. The nodes
+    // of each depth are refit in parallel, deepest first.
+    void refit(const AABB *bounds);
+    // Expected cost of a random ray that hits the root: node surface areas
+    // relative to the root's, times 1 per node visit and 1 per primitive
+    // test. Grows as refitting stretches the tree.
+    float sahCost() const;
+
+    // Closest-hit traversal. `leaf(first, count, t_max)` tests a primitive
+    // range, shrinks t_max and returns true on a hit.
+    template <typename LeafFn>
+    bool traverse(const Ray &r, float t_min, float &t_max, LeafFn leaf) const;
+
+    // Any-hit traversal for shadow rays: stops at the first leaf for which
+    // `leaf(first, count, t_max)` returns true. Children are not sorted.
+    template <typename LeafFn>
+    bool occluded(const Ray &r, float t_min, float t_max, LeafFn leaf) const;
+
+  private:
+    void computeLevels();
+
+    // Refit schedule: node indices grouped by depth, deepest first
+    std::vector<std::uint32_t> refit_order;
+    std::vector<std::uint32_t> level_starts;
+};
+
+// Slab test against a box using the ray's cached reciprocal direction and
+// signs to pick the entry and exit planes; on a hit t_near is the entry distance
+inline bool intersectBox(const glm::vec3 &lo, const glm::vec3 &hi, const Ray &r, float t_min,
+                         float t_max, float &t_near)
+{
+    const glm::vec3 o = r.origin();
+    const glm::vec3 inv_dir = r.inv_direction();
+    float tx0 = ((r.sign(0) ? hi.x : lo.x) - o.x) * inv_dir.x;
+    float tx1 = ((r.sign(0) ? lo.x : hi.x) - o.x) * inv_dir.x;
+    float ty0 = ((r.sign(1) ? hi.y : lo.y) - o.y) * inv_dir.y;
+    float ty1 = ((r.sign(1) ? lo.y : hi.y) - o.y) * inv_dir.y;
+    float tz0 = ((r.sign(2) ? hi.z : lo.z) - o.z) * inv_dir.z;
+    float tz1 = ((r.sign(2) ? lo.z : hi.z) - o.z) * inv_dir.z;
+    t_near = glm::max(glm::max(tx0, ty0), glm::max(tz0, t_min));
+    float t_far = glm::min(glm::min(tx1, ty1), glm::min(tz1, t_max));
+    return t_near <= t_far;
+}
+
+inline bool intersectNode(const BVHNode &node, const Ray &r, float t_min, float t_max,
+                          float &t_near)
+{
+    return intersectBox(node.lo, node.hi, r, t_min, t_max, t_near);
+}
+
+template <typename LeafFn>
+bool BVH::traverse(const Ray &r, float t_min, float &t_max, LeafFn leaf) const
+{
+    if (nodes.empty()) { return false; }
+
+    struct Entry {
+        std::uint32_t node;
+        float t_near;
+    } stack[64];
+    int stack_size = 0;
+
+    float t_near;
+    if (!intersectNode(nodes[0], r, t_min, t_max, t_near)) { return false; }
+
+    bool hit = false;
+    std::uint32_t index = 0;
+    while (true) {
+        const BVHNode &node = nodes[index];
+        RT_STAT_INC(stats::BVH_NODES);
+        if (node.count > 0) {
+            hit = leaf(node.offset, node.count, t_max) || hit;
+        } else {
+            // Visit the nearer child first and defer the other one
+            std::uint32_t a = index + 1;
+            std::uint32_t b = node.offset;
+            float t_a, t_b;
+            bool hit_a = intersectNode(nodes[a], r, t_min, t_max, t_a);
+            bool hit_b = intersectNode(nodes[b], r, t_min, t_max, t_b);
+            if (hit_a && hit_b) {
+                if (t_b < t_a) {
+                    std::swap(a, b);
+                    std::swap(t_a, t_b);
+                }
+                stack[stack_size].node = b;
+                stack[stack_size].t_near = t_b;
+                ++stack_size;
+                index = a;
+                continue;
+            }
+            if (hit_a || hit_b) {
+                index = hit_a ? a : b;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that can still contain a closer hit
+        while (stack_size > 0 && stack[stack_size - 1].t_near > t_max) { --stack_size; }
+        if (stack_size == 0) { break; }
+        index = stack[--stack_size].node;
+    }
+    return hit;
+}
+
+template <typename LeafFn>
+bool BVH::occluded(const Ray &r, float t_min, float t_max, LeafFn leaf) const
+{
+    if (nodes.empty()) { return false; }
+
+    std::uint32_t stack[64];
+    int stack_size = 0;
+    std::uint32_t index = 0;
+    float t_near;
+    if (!intersectNode(nodes[0], r, t_min, t_max, t_near)) { return false; }
+
+    while (true) {
+        const BVHNode &node = nodes[index];
+        RT_STAT_INC(stats::BVH_NODES);
+        if (node.count > 0) {
+            float t_far = t_max;
+            if (leaf(node.offset, node.count, t_far)) { return true; }
+        } else {
+            std::uint32_t a = index + 1;
+            std::uint32_t b = node.offset;
+            bool hit_a = intersectNode(nodes[a], r, t_min, t_max, t_near);
+            bool hit_b = intersectNode(nodes[b], r, t_min, t_max, t_near);
+            if (hit_a) {
+                if (hit_b) { stack[stack_size++] = b; }
+                index = a;
+                continue;
+            }
+            if (hit_b) {
+                index = b;
+                continue;
+            }
+        }
+        if (stack_size == 0) { break; }
+        index = stack[--stack_size];
+    }
+    return false;
+}
+
+}  // namespace rt
@@ -0,0 +1,134 @@
+#include "rt_camera.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <cmath>
+
+namespace rt {
+
+void RayBatch::resize(int count)
+{
+    std::vector<float> *arrays[6] = {&origin_x,    &origin_y,    &origin_z,
+                                     &direction_x, &direction_y, &direction_z};
+    for (int k = 0; k < 6; ++k) { arrays[k]->resize(count); }
+}
+
+void CameraSamples::resize(int count)
+{
+    film_x.resize(count);
+    film_y.resize(count);
+    lens_u.resize(count);
+    lens_v.resize(count);
+}
+
+bool Camera::update(const glm::mat4 &view, float fov, int width, int height, float aperture,
+                    float focus)
+{
+    if (view == cached_view && fov == cached_fov && width == cached_width &&
+        height == cached_height && aperture == cached_aperture && focus == cached_focus) {
+        return false;
+    }
+    cached_view = view;
+    cached_fov = fov;
+    cached_width = width;
+    cached_height = height;
+    cached_aperture = aperture;
+    cached_focus = focus;
+
+    glm::mat4 world_from_view = glm::inverse(view);
+    glm::vec3 right(world_from_view[0]);
+    glm::vec3 up(world_from_view[1]);
+    glm::vec3 forward = -glm::vec3(world_from_view[2]);
+    eye = glm::vec3(world_from_view[3]);
+
+    float half_height = std::tan(0.5f * glm::radians(fov));
+    float half_width = half_height * float(width) / float(height);
+    lower_left_corner = forward - half_width * right - half_height * up;
+    pixel_dx = (2.0f * half_width / width) * right;
+    pixel_dy = (2.0f * half_height / height) * up;
+
+    lens_radius = 0.5f * aperture;
+    lens_right = lens_radius * right;
+    lens_up = lens_radius * up;
+    focus_distance = glm::max(focus, 1e-3f);
+    return true;
+}
+
+Ray Camera::generate(float film_x, float film_y, const glm::vec2 &lens) const
+{
+    glm::vec3 direction = lower_left_corner + film_x * pixel_dx + film_y * pixel_dy;
+    if (lens_radius <= 0.0f) { return Ray(eye, direction); }
+
+    // Thin lens: start on the aperture and aim at the point in focus
+    float r = std::sqrt(lens.x);
+    float phi = 2.0f * glm::pi<float>() * lens.y;
+    glm::vec3 offset = r * std::cos(phi) * lens_right + r * std::sin(phi) * lens_up;
+    return Ray(eye + offset, focus_distance * direction - offset);
+}
+
+void Camera::generate(const CameraSamples &samples, RayBatch &batch) const
+{
+    int count = samples.size();
+    batch.resize(count);
+    const float *fx = samples.film_x.data();
+    const float *fy = samples.film_y.data();
+    float *dx = batch.direction_x.data();
+    float *dy = batch.direction_y.data();
+    float *dz = batch.direction_z.data();
+    // Members are copied to locals so that the stores cannot alias them
+    const glm::vec3 c = lower_left_corner, px = pixel_dx, py = pixel_dy, o = eye;
+    for (int i = 0; i < count; ++i) {
+        dx[i] = c.x + fx[i] * px.x + fy[i] * py.x;
+        dy[i] = c.y + fx[i] * px.y + fy[i] * py.y;
+        dz[i] = c.z + fx[i] * px.z + fy[i] * py.z;
+    }
+
+    float *ox = batch.origin_x.data();
+    float *oy = batch.origin_y.data();
+    float *oz = batch.origin_z.data();
+    if (lens_radius <= 0.0f) {
+        for (int i = 0; i < count; ++i) {
+            ox[i] = o.x;
+            oy[i] = o.y;
+            oz[i] = o.z;
+        }
+        return;
+    }
+    const float *lu = samples.lens_u.data();
+    const float *lv = samples.lens_v.data();
+    const float two_pi = 2.0f * glm::pi<float>();
+    const glm::vec3 right_axis = lens_right, up_axis = lens_up;
+    const float focus = focus_distance;
+    for (int i = 0; i < count; ++i) {
+        float r = std::sqrt(lu[i]);
+        float s = r * std::cos(two_pi * lv[i]);
+        float t = r * std::sin(two_pi * lv[i]);
+        float off_x = s * right_axis.x + t * up_axis.x;
+        float off_y = s * right_axis.y + t * up_axis.y;
+        float off_z = s * right_axis.z + t * up_axis.z;
+        ox[i] = o.x + off_x;
+        oy[i] = o.y + off_y;
+        oz[i] = o.z + off_z;
+        dx[i] = focus * dx[i] - off_x;
+        dy[i] = focus * dy[i] - off_y;
+        dz[i] = focus * dz[i] - off_z;
+    }
+}
+
+// Derivative of d / |d| for a film step dp: (d.d * dp - (d.dp) * d) / |d|^3
+void Camera::differentials(const glm::vec3 &direction, glm::vec3 &ddx, glm::vec3 &ddy) const
+{
+    float dd = glm::dot(direction, direction);
+    float inv = 1.0f / (dd * std::sqrt(dd));
+    ddx = (dd * pixel_dx - glm::dot(direction, pixel_dx) * direction) * inv;
+    ddy = (dd * pixel_dy - glm::dot(direction, pixel_dy) * direction) * inv;
+}
+
+float Camera::spreadAngle(const glm::vec3 &direction) const
+{
+    glm::vec3 ddx, ddy;
+    differentials(direction, ddx, ddy);
+    return glm::max(glm::length(ddx), glm::length(ddy));
+}
+
+}  // namespace rt
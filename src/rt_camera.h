@@ -0,0 +1,87 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "rt_ray.h"
+
+#include <vector>
+
+namespace rt {
+
+// Structure-of-arrays batch of camera rays, e.g. for one tile
+struct RayBatch {
+    std::vector<float> origin_x, origin_y, origin_z;
+    std::vector<float> direction_x, direction_y, direction_z;
+
+    void resize(int count);
+    int size() const
+    {
+        return int(origin_x.size());
+    }
+    Ray ray(int i) const
+    {
+        return Ray(glm::vec3(origin_x[i], origin_y[i], origin_z[i]),
+                   glm::vec3(direction_x[i], direction_y[i], direction_z[i]));
+    }
+};
+
+// Per-sample inputs for a batch: film positions in pixels (x + jitter,
+// y + jitter) and lens numbers in [0, 1)^2
+struct CameraSamples {
+    std::vector<float> film_x, film_y, lens_u, lens_v;
+
+    void resize(int count);
+    int size() const
+    {
+        return int(film_x.size());
+    }
+};
+
+// Pinhole or thin-lens camera looking down -z in view space. The world-space
+// film basis is computed once in update(), so generating a ray is a few
+// multiply-adds. Directions are not normalized; they reach the plane one unit
+// in front of the camera.
+class Camera {
+  public:
+    // Recomputes the basis if anything changed and returns whether it did.
+    // `fov` is the vertical field of view in degrees; a zero aperture is a
+    // pinhole, otherwise points at `focus_distance` are sharp.
+    bool update(const glm::mat4 &view, float fov, int width, int height, float aperture,
+                float focus_distance);
+
+    Ray generate(float film_x, float film_y, const glm::vec2 &lens) const;
+    // Fills `batch` with one ray per sample; the loops are branch-free so that
+    // the compiler can vectorize them
+    void generate(const CameraSamples &samples, RayBatch &batch) const;
+
+    // Change of the normalized ray direction per pixel step in x and y, for
+    // filter footprints (e.g. texture mip selection)
+    void differentials(const glm::vec3 &direction, glm::vec3 &ddx, glm::vec3 &ddy) const;
+    // Angle one pixel subtends along `direction`, the spread of its ray cone
+    float spreadAngle(const glm::vec3 &direction) const;
+
+    glm::vec3 position() const
+    {
+        return eye;
+    }
+
+  private:
+    glm::mat4 cached_view = glm::mat4(0.0f);
+    float cached_fov = -1.0f;
+    int cached_width = 0;
+    int cached_height = 0;
+    float cached_aperture = -1.0f;
+    float cached_focus = -1.0f;
+
+    glm::vec3 eye;
+    glm::vec3 lower_left_corner;  // World-space direction to the film corner
+    glm::vec3 pixel_dx;           // Film step per pixel
+    glm::vec3 pixel_dy;
+    glm::vec3 lens_right;  // Lens axes scaled by the aperture radius
+    glm::vec3 lens_up;
+    float lens_radius = 0.0f;
+    float focus_distance = 1.0f;
+};
+
+}  // namespace rt
@@ -0,0 +1,108 @@
+#include "rt_cpu.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RT_CPU_X86 1
+#if defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace rt {
+
+namespace {
+
+#if defined(RT_CPU_X86)
+
+void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, int(leaf), int(subleaf));
+    for (int i = 0; i < 4; ++i) { regs[i] = unsigned(r[i]); }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switches (XCR0)
+unsigned long long xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+
+IsaLevel queryIsa()
+{
+    unsigned regs[4];  // eax, ebx, ecx, edx
+    cpuid(0, 0, regs);
+    unsigned max_leaf = regs[0];
+    if (max_leaf < 1) { return ISA_SCALAR; }
+
+    cpuid(1, 0, regs);
+    bool sse2 = (regs[3] >> 26) & 1;
+    bool sse41 = (regs[2] >> 19) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+    if (!sse2) { return ISA_SCALAR; }
+    if (!sse41) { return ISA_SSE2; }
+
+    // AVX needs the OS to save the YMM state, AVX-512 also the opmask and ZMM state
+    unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+    bool ymm_state = (xcr0 & 0x6) == 0x6;
+    bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+    if (!avx || !ymm_state || max_leaf < 7) { return ISA_SSE41; }
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] >> 5) & 1;
+    bool avx512f = (regs[1] >> 16) & 1;
+    if (!avx2) { return ISA_SSE41; }
+    if (!avx512f || !zmm_state) { return ISA_AVX2; }
+    return ISA_AVX512;
+}
+
+#else
+
+IsaLevel queryIsa()
+{
+    return ISA_SCALAR;
+}
+
+#endif
+
+const char *const kIsaNames[NUM_ISA_LEVELS] = {"scalar", "sse2", "sse4", "avx2", "avx512"};
+
+}  // namespace
+
+IsaLevel detectIsa()
+{
+    static const IsaLevel level = queryIsa();
+    return level;
+}
+
+const char *isaName(IsaLevel level)
+{
+    return (level >= 0 && level < NUM_ISA_LEVELS) ? kIsaNames[level] : "unknown";
+}
+
+bool parseIsa(const char *name, IsaLevel &level)
+{
+    for (int i = 0; i < NUM_ISA_LEVELS; ++i) {
+        if (std::strcmp(name, kIsaNames[i]) == 0) {
+            level = IsaLevel(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace rt
@@ -0,0 +1,26 @@
+#pragma once
+
+namespace rt {
+
+// Instruction set levels the intersection kernels are built for, in
+// increasing order of capability
+enum IsaLevel {
+    ISA_SCALAR = 0,
+    ISA_SSE2,
+    ISA_SSE41,
+    ISA_AVX2,
+    ISA_AVX512,
+    NUM_ISA_LEVELS
+};
+
+// Highest level supported by both the CPU (CPUID) and the operating system
+// (XGETBV), detected once
+IsaLevel detectIsa();
+
+const char *isaName(IsaLevel level);
+
+// Parses "scalar", "sse2", "sse4", "avx2" or "avx512"; returns false if the
+// name is unknown
+bool parseIsa(const char *name, IsaLevel &level);
+
+}  // namespace rt
@@ -0,0 +1,663 @@
+#include "rt_distributed.h"
+#include "rt_message.h"
+#include "rt_texture.h"
+#include "rt_trace.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace rt {
+
+#ifndef _WIN32
+
+namespace {
+
+// Tiles are square; edge tiles are clipped to the image
+const int kTileSize = 32;
+// Tiles handed to one worker at a time, so that it never waits for the next
+const int kMaxInFlight = 2;
+// A worker holding a tile this long is treated as dead
+const double kTileTimeoutSeconds = 30.0;
+// Bound on blocking reads of a message body once its header arrived
+const int kReceiveTimeoutSeconds = 5;
+
+// Payloads are in host byte order, so all nodes are expected to share the
+// coordinator's architecture
+enum MessageType : std::uint32_t {
+    MSG_HELLO = 1,  // Worker -> coordinator: pid
+    MSG_SETTINGS,   // Coordinator -> worker: scene and render settings
+    MSG_TILE,       // Coordinator -> worker: TileRequest
+    MSG_RESULT,     // Worker -> coordinator: TileRequest, then RGBA floats
+};
+
+struct TileRequest {
+    std::uint32_t generation;  // Results from older generations are dropped
+    std::int32_t frame;
+    std::int32_t x0, y0, x1, y1;
+
+    int pixels() const
+    {
+        return (x1 - x0) * (y1 - y0);
+    }
+};
+
+double now()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void setReceiveTimeout(int fd, int seconds)
+{
+    timeval tv = {seconds, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+std::string textureName(int texture)
+{
+    return texture >= 0 ? std::string(textureCache().name(texture)) : std::string();
+}
+
+int loadTextureByName(const std::string &name, bool srgb)
+{
+    return name.empty() ? -1 : textureCache().load(name, srgb);
+}
+
+// Whether the settings a message carries for a material differ. Editing a
+// material drops what was learned about the light, so settings messages,
+// which are also sent on camera moves, only edit the materials that changed.
+bool materialChanged(const MaterialParams &a, const MaterialParams &b)
+{
+    return a.albedo != b.albedo || a.intensity != b.intensity || a.fuzz != b.fuzz ||
+           a.textures.mapping != b.textures.mapping || a.textures.scale != b.textures.scale ||
+           a.textures.albedo != b.textures.albedo || a.textures.roughness != b.textures.roughness;
+}
+
+// Everything a worker needs to render the same image. Paths are sent as is,
+// so remote nodes need the models and textures at the same locations.
+std::vector<char> serializeSettings(const RTContext &rtx)
+{
+    MessageWriter w;
+    w.put(rtx.width);
+    w.put(rtx.height);
+    w.put(rtx.max_bounces);
+    w.put(rtx.epsilon);
+    w.put(rtx.view);
+    w.put(rtx.fov);
+    w.put(rtx.aperture);
+    w.put(rtx.focus_distance);
+    w.put(rtx.ground_color);
+    w.put(rtx.sky_color);
+    w.put(rtx.show_normals);
+    w.put(rtx.samples_per_pixel);
+    w.put(rtx.enable_gamma_correction);
+    w.put(rtx.metallic_roughness);
+    w.put(rtx.material_intensity);
+    w.put(rtx.sampler);
+    w.put(rtx.next_event_estimation);
+    w.put(rtx.use_environment);
+    w.put(rtx.environment_intensity);
+    w.put(rtx.russian_roulette);
+    w.put(rtx.roulette_start_bounce);
+    w.put(rtx.reorder_rays);
+    w.put(rtx.irradiance_cache);
+    w.put(rtx.irradiance_error);
+    w.put(rtx.path_guiding);
+    w.put(rtx.animation);
+    w.put(rtx.animation_time);
+    w.putString(sceneFilename());
+    w.putString(environmentPath());
+
+    int count = materialCount();
+    w.put(count);
+    for (int i = 0; i < count; ++i) {
+        MaterialParams params = materialParams(i);
+        w.put(params.albedo);
+        w.put(params.intensity);
+        w.put(params.fuzz);
+        w.put(params.textures.mapping);
+        w.put(params.textures.scale);
+        w.putString(textureName(params.textures.albedo));
+        w.putString(textureName(params.textures.roughness));
+    }
+    return w.data;
+}
+
+bool applySettings(RTContext &rtx, const std::vector<char> &payload)
+{
+    RT_TRACE_SCOPE("applySettings");
+    MessageReader r(payload);
+    rtx.width = r.get<int>();
+    rtx.height = r.get<int>();
+    rtx.max_bounces = r.get<int>();
+    rtx.epsilon = r.get<float>();
+    rtx.view = r.get<glm::mat4>();
+    rtx.fov = r.get<float>();
+    rtx.aperture = r.get<float>();
+    rtx.focus_distance = r.get<float>();
+    glm::vec3 ground_color = r.get<glm::vec3>();
+    glm::vec3 sky_color = r.get<glm::vec3>();
+    rtx.show_normals = r.get<bool>();
+    rtx.samples_per_pixel = r.get<int>();
+    rtx.enable_gamma_correction = r.get<bool>();
+    rtx.metallic_roughness = r.get<float>();
+    rtx.material_intensity = r.get<float>();
+    rtx.sampler = r.get<int>();
+    rtx.next_event_estimation = r.get<bool>();
+    bool use_environment = r.get<bool>();
+    rtx.environment_intensity = r.get<float>();
+    rtx.russian_roulette = r.get<bool>();
+    rtx.roulette_start_bounce = r.get<int>();
+    rtx.reorder_rays = r.get<bool>();
+    rtx.irradiance_cache = r.get<bool>();
+    rtx.irradiance_error = r.get<float>();
+    rtx.path_guiding = r.get<bool>();
+    int animation = r.get<int>();
+    float animation_time = r.get<float>();
+    std::string mesh = r.getString();
+    std::string environment = r.getString();
+    if (!r.ok) { return false; }
+
+    // setupScene resets the background colours, so they are applied after it
+    bool new_scene = mesh != sceneFilename();
+    if (new_scene) { setupScene(rtx, mesh.c_str()); }
+    rtx.ground_color = ground_color;
+    rtx.sky_color = sky_color;
+    if (!environment.empty() && environment != environmentPath()) {
+        loadEnvironment(rtx, environment);
+    }
+    rtx.use_environment = use_environment;
+
+    int count = r.get<int>();
+    for (int i = 0; r.ok && i < count; ++i) {
+        MaterialParams current = i < materialCount() ? materialParams(i) : MaterialParams();
+        MaterialParams params = current;
+        params.albedo = r.get<glm::vec3>();
+        params.intensity = r.get<float>();
+        params.fuzz = r.get<float>();
+        params.textures.mapping = r.get<int>();
+        params.textures.scale = r.get<float>();
+        params.textures.albedo = loadTextureByName(r.getString(), true);
+        params.textures.roughness = loadTextureByName(r.getString(), false);
+        if (i < materialCount() && materialChanged(current, params)) {
+            editMaterial(rtx, i, params);
+        }
+    }
+    // The coordinator's pose; the trees may differ after rebuilds, the image does not.
+    // Posing drops what was learned about the light, so an unchanged pose is kept.
+    if (new_scene || animation != rtx.animation || animation_time != rtx.animation_time) {
+        rtx.animation = animation;
+        animateScene(rtx, animation_time);
+    }
+
+    rtx.heatmap_mode = HEATMAP_OFF;
+    rtx.image.assign(std::size_t(rtx.width) * rtx.height, glm::vec4(0.0f));
+    rtx.heatmap.assign(std::size_t(rtx.width) * rtx.height, glm::vec2(0.0f));
+    rtx.camera.update(rtx.view, rtx.fov, rtx.width, rtx.height, rtx.aperture, rtx.focus_distance);
+    selectRenderKernel(rtx);
+    return r.ok;
+}
+
+// Adds one frame's contribution to a tile, like renderTile does
+void mergeTile(RTContext &rtx, const TileRequest &tile, const glm::vec4 *pixels)
+{
+    int nx = rtx.width;
+    for (int y = tile.y0; y < tile.y1; ++y) {
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            glm::vec4 &pixel = rtx.image[y * nx + x];
+            if (tile.frame <= 0) {
+                pixel = glm::clamp(pixel / glm::max(1.0f, pixel.a), 0.0f, 1.0f);
+                rtx.heatmap[y * nx + x] = glm::vec2(0.0f);
+            }
+            pixel += *pixels++;
+        }
+    }
+}
+
+struct Worker {
+    int fd = -1;
+    int pid = 0;
+    int tiles = 0;
+    int settings_version = -1;  // Last settings sent
+    std::vector<TileRequest> in_flight;
+    std::vector<double> sent_at;
+};
+
+struct Cluster {
+    int listen_fd = -1;
+    int port = 0;
+    bool enabled = true;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<pid_t> children;  // Spawned by spawnWorkers
+
+    // Frame in progress
+    bool active = false;
+    int frame = 0;
+    std::uint32_t generation = 0;
+    std::deque<TileRequest> queue;  // Not yet handed out
+    int outstanding = 0;            // Tiles of this generation not merged yet
+
+    std::vector<char> settings;
+    int settings_version = 0;
+
+    int tiles_remote = 0;
+    int tiles_local = 0;
+    int failures = 0;
+} g_cluster;
+
+void dropWorker(std::size_t index)
+{
+    Worker &worker = *g_cluster.workers[index];
+    for (const TileRequest &tile : worker.in_flight) {
+        if (g_cluster.active && tile.generation == g_cluster.generation) {
+            g_cluster.queue.push_front(tile);
+        }
+    }
+    if (!worker.in_flight.empty()) {
+        ++g_cluster.failures;
+        std::cerr << "Worker " << worker.pid << " lost with " << worker.in_flight.size()
+                  << " tiles in flight" << std::endl;
+    }
+    ::close(worker.fd);
+    g_cluster.workers.erase(g_cluster.workers.begin() + index);
+}
+
+void acceptWorkers()
+{
+    while (true) {
+        int fd = ::accept(g_cluster.listen_fd, nullptr, nullptr);
+        if (fd < 0) { return; }
+        setReceiveTimeout(fd, kReceiveTimeoutSeconds);
+        MessageHeader header;
+        std::vector<char> payload;
+        if (!receiveMessage(fd, header, payload) || header.type != MSG_HELLO ||
+            payload.size() != sizeof(std::int32_t)) {
+            ::close(fd);
+            continue;
+        }
+        std::unique_ptr<Worker> worker(new Worker);
+        worker->fd = fd;
+        std::int32_t pid;
+        std::memcpy(&pid, payload.data(), sizeof(pid));
+        worker->pid = pid;
+        g_cluster.workers.push_back(std::move(worker));
+    }
+}
+
+void reapChildren()
+{
+    for (std::size_t i = 0; i < g_cluster.children.size();) {
+        if (::waitpid(g_cluster.children[i], nullptr, WNOHANG) == g_cluster.children[i]) {
+            g_cluster.children.erase(g_cluster.children.begin() + i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void startFrame(RTContext &rtx)
+{
+    g_cluster.active = true;
+    g_cluster.frame = rtx.current_frame;
+    ++g_cluster.generation;
+    g_cluster.queue.clear();
+    for (int y0 = 0; y0 < rtx.height; y0 += kTileSize) {
+        for (int x0 = 0; x0 < rtx.width; x0 += kTileSize) {
+            TileRequest tile = {g_cluster.generation, rtx.current_frame, x0, y0,
+                                std::min(x0 + kTileSize, rtx.width),
+                                std::min(y0 + kTileSize, rtx.height)};
+            g_cluster.queue.push_back(tile);
+        }
+    }
+    g_cluster.outstanding = int(g_cluster.queue.size());
+}
+
+// Hands out queued tiles; returns false if the worker has to be dropped
+bool dispatch(Worker &worker)
+{
+    if (worker.settings_version != g_cluster.settings_version && !g_cluster.queue.empty()) {
+        if (!sendMessage(worker.fd, MSG_SETTINGS, g_cluster.settings.data(),
+                         g_cluster.settings.size())) {
+            return false;
+        }
+        worker.settings_version = g_cluster.settings_version;
+    }
+    while (int(worker.in_flight.size()) < kMaxInFlight && !g_cluster.queue.empty()) {
+        TileRequest tile = g_cluster.queue.front();
+        if (!sendMessage(worker.fd, MSG_TILE, &tile, sizeof(tile))) { return false; }
+        g_cluster.queue.pop_front();
+        worker.in_flight.push_back(tile);
+        worker.sent_at.push_back(now());
+    }
+    return true;
+}
+
+// Reads one result; returns false if the worker has to be dropped
+bool receiveResult(RTContext &rtx, Worker &worker)
+{
+    MessageHeader header;
+    std::vector<char> payload;
+    if (!receiveMessage(worker.fd, header, payload) || header.type != MSG_RESULT ||
+        payload.size() < sizeof(TileRequest)) {
+        return false;
+    }
+    TileRequest tile;
+    std::memcpy(&tile, payload.data(), sizeof(tile));
+    if (payload.size() != sizeof(tile) + tile.pixels() * sizeof(glm::vec4)) { return false; }
+
+    for (std::size_t i = 0; i < worker.in_flight.size(); ++i) {
+        const TileRequest &t = worker.in_flight[i];
+        if (t.generation == tile.generation && t.x0 == tile.x0 && t.y0 == tile.y0) {
+            worker.in_flight.erase(worker.in_flight.begin() + i);
+            worker.sent_at.erase(worker.sent_at.begin() + i);
+            break;
+        }
+    }
+    if (!g_cluster.active || tile.generation != g_cluster.generation) { return true; }  // Stale
+
+    std::vector<glm::vec4> pixels(tile.pixels());
+    std::memcpy(pixels.data(), payload.data() + sizeof(tile), pixels.size() * sizeof(glm::vec4));
+    mergeTile(rtx, tile, pixels.data());
+    ++worker.tiles;
+    ++g_cluster.tiles_remote;
+    --g_cluster.outstanding;
+    return true;
+}
+
+}  // namespace
+
+bool startCoordinator(int port)
+{
+    if (g_cluster.listen_fd >= 0) { return true; }
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) { return false; }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(std::uint16_t(port));
+    socklen_t length = sizeof(addr);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0 ||
+        ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) != 0) {
+        std::cerr << "Could not listen on port " << port << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    g_cluster.listen_fd = fd;
+    g_cluster.port = ntohs(addr.sin_port);
+    std::cout << "Coordinator listening on port " << g_cluster.port << std::endl;
+    return true;
+}
+
+int spawnWorkers(int count, const std::string &program)
+{
+    if (g_cluster.listen_fd < 0 && !startCoordinator(0)) { return 0; }
+    std::string address = "127.0.0.1:" + std::to_string(g_cluster.port);
+    int started = 0;
+    for (int i = 0; i < count; ++i) {
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            ::close(g_cluster.listen_fd);
+            ::execl(program.c_str(), program.c_str(), "--worker", address.c_str(), (char *)nullptr);
+            ::_exit(127);
+        }
+        if (pid < 0) { break; }
+        g_cluster.children.push_back(pid);
+        ++started;
+    }
+    return started;
+}
+
+void stopCoordinator()
+{
+    while (!g_cluster.workers.empty()) { dropWorker(g_cluster.workers.size() - 1); }
+    if (g_cluster.listen_fd >= 0) { ::close(g_cluster.listen_fd); }
+    g_cluster.listen_fd = -1;
+    g_cluster.active = false;
+    for (pid_t pid : g_cluster.children) {
+        ::kill(pid, SIGTERM);
+        ::waitpid(pid, nullptr, 0);
+    }
+    g_cluster.children.clear();
+}
+
+void setDistributedEnabled(bool enabled)
+{
+    g_cluster.enabled = enabled;
+}
+
+ClusterStatus clusterStatus()
+{
+    ClusterStatus status;
+    status.listening = g_cluster.listen_fd >= 0;
+    status.port = g_cluster.port;
+    status.enabled = g_cluster.enabled;
+    for (const std::unique_ptr<Worker> &worker : g_cluster.workers) {
+        WorkerStatus w;
+        w.pid = worker->pid;
+        w.tiles = worker->tiles;
+        w.in_flight = int(worker->in_flight.size());
+        status.workers.push_back(w);
+    }
+    status.tiles_remote = g_cluster.tiles_remote;
+    status.tiles_local = g_cluster.tiles_local;
+    status.failures = g_cluster.failures;
+    return status;
+}
+
+bool updateDistributed(RTContext &rtx)
+{
+    if (g_cluster.listen_fd < 0) { return false; }
+    acceptWorkers();
+    reapChildren();
+
+    // Settings edits and accumulation resets restart the frame; results of
+    // the old generation that are still in flight get dropped on arrival
+    std::vector<char> settings = serializeSettings(rtx);
+    bool settings_changed = settings != g_cluster.settings;
+    if (settings_changed) {
+        g_cluster.settings.swap(settings);
+        ++g_cluster.settings_version;
+    }
+    if (!g_cluster.active) {
+        // Only start at a frame boundary, so that no line gets two samples
+        if (!g_cluster.enabled || g_cluster.workers.empty() || rtx.heatmap_mode != HEATMAP_OFF ||
+            rtx.current_line != 0) {
+            return false;
+        }
+        if (rtx.current_frame >= rtx.max_frames) { return true; }
+        startFrame(rtx);
+    } else if (settings_changed || rtx.current_frame != g_cluster.frame) {
+        startFrame(rtx);
+    }
+    RT_TRACE_SCOPE("updateDistributed");
+
+    for (std::size_t i = 0; i < g_cluster.workers.size();) {
+        if (dispatch(*g_cluster.workers[i])) {
+            ++i;
+        } else {
+            dropWorker(i);
+        }
+    }
+
+    std::vector<pollfd> fds(g_cluster.workers.size());
+    for (std::size_t i = 0; i < fds.size(); ++i) {
+        fds[i].fd = g_cluster.workers[i]->fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    if (!fds.empty() && ::poll(fds.data(), fds.size(), 1) > 0) {
+        for (std::size_t i = fds.size(); i-- > 0;) {
+            if (fds[i].revents == 0) { continue; }
+            if (!(fds[i].revents & POLLIN) || !receiveResult(rtx, *g_cluster.workers[i])) {
+                dropWorker(i);
+            }
+        }
+    }
+
+    // Workers that stopped answering count as dead
+    double t = now();
+    for (std::size_t i = g_cluster.workers.size(); i-- > 0;) {
+        const Worker &worker = *g_cluster.workers[i];
+        if (!worker.sent_at.empty() && t - worker.sent_at.front() > kTileTimeoutSeconds) {
+            dropWorker(i);
+        }
+    }
+
+    // With every worker gone, the rest of the frame is rendered here, one
+    // tile per call so that the GUI stays responsive
+    if (g_cluster.workers.empty() && !g_cluster.queue.empty()) {
+        TileRequest tile = g_cluster.queue.front();
+        g_cluster.queue.pop_front();
+        renderTile(rtx, tile.x0, tile.y0, tile.x1, tile.y1);
+        ++g_cluster.tiles_local;
+        --g_cluster.outstanding;
+    }
+
+    if (g_cluster.outstanding == 0) {
+        g_cluster.active = false;
+        finishFrame(rtx);
+        if (rtx.current_frame < rtx.max_frames) { rtx.current_frame += 1; }
+    }
+    return true;
+}
+
+int runWorker(const std::string &address)
+{
+    std::size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        std::cerr << "Expected HOST:PORT, got " << address << std::endl;
+        return 1;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0) {
+        std::cerr << "Could not resolve " << address << std::endl;
+        return 1;
+    }
+    int fd = -1;
+    for (addrinfo *ai = result; ai && fd < 0; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(result);
+    if (fd < 0) {
+        std::cerr << "Could not connect to " << address << std::endl;
+        return 1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    std::int32_t pid = std::int32_t(::getpid());
+    if (!sendMessage(fd, MSG_HELLO, &pid, sizeof(pid))) { return 1; }
+    trace::setThreadName("worker");
+
+    RTContext rtx;
+    MessageHeader header;
+    std::vector<char> payload;
+    std::vector<glm::vec4> pixels;
+    while (receiveMessage(fd, header, payload)) {
+        if (header.type == MSG_SETTINGS) {
+            if (!applySettings(rtx, payload)) { break; }
+        } else if (header.type == MSG_TILE && payload.size() == sizeof(TileRequest)) {
+            TileRequest tile;
+            std::memcpy(&tile, payload.data(), sizeof(tile));
+            if (tile.x0 < 0 || tile.y0 < 0 || tile.x1 > rtx.width || tile.y1 > rtx.height) { break; }
+
+            // Rendered into zeroed pixels, so the image holds just this frame
+            RT_TRACE_SCOPE("workerTile");
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                std::fill(&rtx.image[y * rtx.width + tile.x0], &rtx.image[y * rtx.width + tile.x1],
+                          glm::vec4(0.0f));
+            }
+            // Each worker learns path guiding from its own tiles
+            if (tile.frame != rtx.current_frame) { finishFrame(rtx); }
+            rtx.current_frame = tile.frame;
+            renderTile(rtx, tile.x0, tile.y0, tile.x1, tile.y1);
+            resolveDeferredPixels(rtx, true);  // The tile must be complete when sent
+
+            pixels.clear();
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                pixels.insert(pixels.end(), &rtx.image[y * rtx.width + tile.x0],
+                              &rtx.image[y * rtx.width + tile.x1]);
+            }
+            if (!sendMessage(fd, MSG_RESULT, &tile, sizeof(tile), pixels.data(),
+                             pixels.size() * sizeof(glm::vec4))) {
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+    ::close(fd);
+    return 0;
+}
+
+#else  // _WIN32
+
+bool startCoordinator(int)
+{
+    std::cerr << "Distributed rendering is not supported on this platform" << std::endl;
+    return false;
+}
+
+int spawnWorkers(int, const std::string &)
+{
+    return 0;
+}
+
+void stopCoordinator() {}
+
+void setDistributedEnabled(bool) {}
+
+ClusterStatus clusterStatus()
+{
+    return ClusterStatus();
+}
+
+bool updateDistributed(RTContext &)
+{
+    return false;
+}
+
+int runWorker(const std::string &)
+{
+    std::cerr << "Distributed rendering is not supported on this platform" << std::endl;
+    return 1;
+}
+
+#endif  // _WIN32
+
+}  // namespace rt
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "rt_raytracing.h"
+
+#include <string>
+#include <vector>
+
+namespace rt {
+
+// Distributed rendering: a coordinator (the viewer) listens on a TCP port,
+// headless worker processes (rt_viewer --worker HOST:PORT) connect to it, and
+// each frame is split into tiles that are handed out to the workers. Workers
+// render with the same sample indices as the local path, so the merged image
+// is identical to a local render, except with the irradiance cache or path
+// guiding on: each worker then learns from its own tiles only, and the result
+// differs from a local render. Tiles held by a worker that disconnects or
+// stops answering are handed to another worker, or rendered locally when none
+// are left. POSIX only.
+
+struct WorkerStatus {
+    int pid = 0;          // As reported by the worker
+    int tiles = 0;        // Completed tiles
+    int in_flight = 0;
+};
+
+struct ClusterStatus {
+    bool listening = false;
+    int port = 0;
+    bool enabled = true;
+    std::vector<WorkerStatus> workers;
+    int tiles_remote = 0;  // Since startCoordinator
+    int tiles_local = 0;   // Rendered by the coordinator after worker failures
+    int failures = 0;      // Workers lost with tiles in flight or on timeout
+};
+
+// Listens on `port` (0 picks a free one). Returns false on failure.
+bool startCoordinator(int port);
+// Starts `count` local workers running `program` (normally the viewer's own
+// executable) that connect to the coordinator. Returns how many were started.
+int spawnWorkers(int count, const std::string &program);
+// Disconnects all workers and terminates the ones spawned here
+void stopCoordinator();
+void setDistributedEnabled(bool enabled);
+ClusterStatus clusterStatus();
+
+// Advances the distributed frame in progress: hands out tiles, merges results
+// and finishes the frame when all tiles are in. Returns false when the frame
+// should be rendered locally instead (no workers, heatmap on, or a local frame
+// is half done). Called by updateImage.
+bool updateDistributed(RTContext &rtx);
+
+// Worker main loop: connects to HOST:PORT and renders tiles until the
+// coordinator goes away. Returns the process exit status.
+int runWorker(const std::string &address);
+
+}  // namespace rt
@@ -0,0 +1,316 @@
+#include "rt_envmap.h"
+
+#include <glm/gtc/constants.hpp>
+#include <lodepng.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace rt {
+
+namespace {
+
+// Shared-exponent packing: 9-bit mantissas and a 5-bit exponent (bias 15)
+std::uint32_t packRGB9E5(const glm::vec3 &rgb)
+{
+    const float max_value = 65408.0f;
+    glm::vec3 c = glm::clamp(rgb, glm::vec3(0.0f), glm::vec3(max_value));
+    float max_c = glm::max(c.x, glm::max(c.y, c.z));
+    if (!(max_c > 0.0f)) { return 0; }
+    int exponent = glm::max(-16, int(std::floor(std::log2(max_c)))) + 16;
+    float scale = std::ldexp(1.0f, exponent - 24);
+    if (int(std::floor(max_c / scale + 0.5f)) == 512) {
+        scale *= 2.0f;
+        exponent += 1;
+    }
+    std::uint32_t r = std::uint32_t(std::floor(c.x / scale + 0.5f));
+    std::uint32_t g = std::uint32_t(std::floor(c.y / scale + 0.5f));
+    std::uint32_t b = std::uint32_t(std::floor(c.z / scale + 0.5f));
+    return r | (g << 9) | (b << 18) | (std::uint32_t(exponent) << 27);
+}
+
+glm::vec3 unpackRGB9E5(std::uint32_t v)
+{
+    float scale = std::ldexp(1.0f, int(v >> 27) - 24);
+    return glm::vec3(float(v & 511), float((v >> 9) & 511), float((v >> 18) & 511)) * scale;
+}
+
+float luminance(const glm::vec3 &c)
+{
+    return glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Lat-long parameterization: u follows the azimuth, v = 0 is straight up
+glm::vec2 directionToUV(const glm::vec3 &dir)
+{
+    glm::vec3 d = glm::normalize(dir);
+    float u = 0.5f + std::atan2(d.x, -d.z) * (0.5f * glm::one_over_pi<float>());
+    float v = std::acos(glm::clamp(d.y, -1.0f, 1.0f)) * glm::one_over_pi<float>();
+    return glm::vec2(u, v);
+}
+
+glm::vec3 uvToDirection(const glm::vec2 &uv, float &sin_theta)
+{
+    float theta = uv.y * glm::pi<float>();
+    float phi = 2.0f * glm::pi<float>() * (uv.x - 0.5f);
+    sin_theta = std::sin(theta);
+    return glm::vec3(sin_theta * std::sin(phi), std::cos(theta), -sin_theta * std::cos(phi));
+}
+
+bool hasSuffix(const std::string &s, const std::string &suffix)
+{
+    if (s.size() < suffix.size()) { return false; }
+    std::string tail = s.substr(s.size() - suffix.size());
+    std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+    return tail == suffix;
+}
+
+}  // namespace
+
+void Distribution1D::build(const float *weights, int n)
+{
+    cdf.resize(n + 1);
+    cdf[0] = 0.0f;
+    for (int i = 0; i < n; ++i) { cdf[i + 1] = cdf[i] + glm::max(weights[i], 0.0f); }
+    integral = cdf[n];
+    for (int i = 1; i <= n; ++i) { cdf[i] = integral > 0.0f ? cdf[i] / integral : float(i) / n; }
+}
+
+int Distribution1D::sample(float u, float &remapped) const
+{
+    int n = size();
+    int i = int(std::upper_bound(cdf.begin() + 1, cdf.end(), u) - cdf.begin()) - 1;
+    i = glm::clamp(i, 0, n - 1);
+    float width = cdf[i + 1] - cdf[i];
+    remapped = width > 0.0f ? glm::clamp((u - cdf[i]) / width, 0.0f, 0.99999994f) : 0.5f;
+    return i;
+}
+
+bool EnvironmentMap::load(const std::string &path)
+{
+    std::vector<glm::vec3> rgb;
+    bool ok;
+    if (hasSuffix(path, ".hdr")) {
+        ok = loadHDR(path, rgb);
+    } else if (hasSuffix(path, ".png")) {
+        ok = loadPNG(path, rgb);
+    } else {
+        ok = loadCubeFaces(path, rgb);
+    }
+    if (!ok) {
+        std::cerr << "Error: could not load environment map " << path << std::endl;
+        return false;
+    }
+    std::cout << "Loaded environment map " << path << " (" << w << "x" << h << ")" << std::endl;
+    assign(w, h, rgb);
+    return true;
+}
+
+std::size_t EnvironmentMap::bytes() const
+{
+    std::size_t total = texels.size() * sizeof(std::uint32_t) + marginal.cdf.size() * sizeof(float);
+    for (size_t i = 0; i < rows.size(); ++i) { total += rows[i].cdf.size() * sizeof(float); }
+    return total;
+}
+
+void EnvironmentMap::assign(int width, int height, const std::vector<glm::vec3> &rgb)
+{
+    w = width;
+    h = height;
+    texels.resize(rgb.size());
+    for (size_t i = 0; i < rgb.size(); ++i) { texels[i] = packRGB9E5(rgb[i]); }
+
+    // Sampling weights cover each texel's bilinear footprint (the brightest
+    // neighbour), so every direction with radiance keeps a non-zero pdf. The
+    // sin(theta) term accounts for the rows shrinking towards the poles.
+    std::vector<float> row_weights(w);
+    std::vector<float> marginal_weights(h);
+    rows.resize(h);
+    for (int y = 0; y < h; ++y) {
+        float sin_theta = std::sin((y + 0.5f) * glm::pi<float>() / h);
+        for (int x = 0; x < w; ++x) {
+            float l = 0.0f;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) { l = glm::max(l, luminance(texel(x + dx, y + dy))); }
+            }
+            row_weights[x] = l * sin_theta;
+        }
+        rows[y].build(&row_weights[0], w);
+        marginal_weights[y] = rows[y].integral;
+    }
+    marginal.build(&marginal_weights[0], h);
+}
+
+// Texel with wrapping in x and clamping in y
+glm::vec3 EnvironmentMap::texel(int x, int y) const
+{
+    x = ((x % w) + w) % w;
+    y = glm::clamp(y, 0, h - 1);
+    return unpackRGB9E5(texels[y * w + x]);
+}
+
+glm::vec3 EnvironmentMap::lookup(const glm::vec3 &dir) const
+{
+    glm::vec2 uv = directionToUV(dir);
+    float x = uv.x * w - 0.5f;
+    float y = uv.y * h - 0.5f;
+    int x0 = int(std::floor(x));
+    int y0 = int(std::floor(y));
+    float fx = x - x0;
+    float fy = y - y0;
+    glm::vec3 top = glm::mix(texel(x0, y0), texel(x0 + 1, y0), fx);
+    glm::vec3 bottom = glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), fx);
+    return glm::mix(top, bottom, fy);
+}
+
+glm::vec3 EnvironmentMap::sample(const glm::vec2 &u, glm::vec3 &dir, float &pdf) const
+{
+    float ry, rx;
+    int row = marginal.sample(u.y, ry);
+    int col = rows[row].sample(u.x, rx);
+    float sin_theta;
+    dir = uvToDirection(glm::vec2((col + rx) / w, (row + ry) / h), sin_theta);
+    pdf = sin_theta > 0.0f ? marginal.probability(row) * rows[row].probability(col) * w * h /
+                                 (2.0f * glm::pi<float>() * glm::pi<float>() * sin_theta)
+                           : 0.0f;
+    return lookup(dir);
+}
+
+float EnvironmentMap::pdf(const glm::vec3 &dir) const
+{
+    glm::vec2 uv = directionToUV(dir);
+    int col = glm::clamp(int(uv.x * w), 0, w - 1);
+    int row = glm::clamp(int(uv.y * h), 0, h - 1);
+    float sin_theta = std::sin(uv.y * glm::pi<float>());
+    if (!(sin_theta > 0.0f)) { return 0.0f; }
+    return marginal.probability(row) * rows[row].probability(col) * w * h /
+           (2.0f * glm::pi<float>() * glm::pi<float>() * sin_theta);
+}
+
+// Radiance RGBE image with run-length encoded scanlines, -Y H +X W orientation
+bool EnvironmentMap::loadHDR(const std::string &filename, std::vector<glm::vec3> &rgb)
+{
+    std::ifstream file(filename, std::ios::binary);
+    std::string line;
+    if (!std::getline(file, line) || line.compare(0, 2, "#?") != 0) { return false; }
+    while (std::getline(file, line) && !line.empty()) {
+        if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe") { return false; }
+    }
+    if (!std::getline(file, line) || std::sscanf(line.c_str(), "-Y %d +X %d", &h, &w) != 2 ||
+        w <= 0 || h <= 0) {
+        return false;
+    }
+
+    rgb.resize(size_t(w) * h);
+    std::vector<unsigned char> scanline(size_t(w) * 4);
+    for (int y = 0; y < h; ++y) {
+        unsigned char header[4];
+        if (!file.read(reinterpret_cast<char *>(header), 4)) { return false; }
+        bool rle = w >= 8 && w < 32768 && header[0] == 2 && header[1] == 2 &&
+                   ((header[2] << 8) | header[3]) == w;
+        if (rle) {
+            // Each channel is stored separately as runs and literal spans
+            for (int c = 0; c < 4; ++c) {
+                int x = 0;
+                while (x < w) {
+                    int count = file.get();
+                    if (count == EOF) { return false; }
+                    if (count > 128) {
+                        count -= 128;
+                        int value = file.get();
+                        if (value == EOF || x + count > w) { return false; }
+                        for (int i = 0; i < count; ++i) { scanline[(x++) * 4 + c] = (unsigned char)value; }
+                    } else {
+                        if (count == 0 || x + count > w) { return false; }
+                        for (int i = 0; i < count; ++i) {
+                            int value = file.get();
+                            if (value == EOF) { return false; }
+                            scanline[(x++) * 4 + c] = (unsigned char)value;
+                        }
+                    }
+                }
+            }
+        } else {
+            std::copy(header, header + 4, scanline.begin());
+            if (!file.read(reinterpret_cast<char *>(&scanline[4]), (w - 1) * 4)) { return false; }
+        }
+        for (int x = 0; x < w; ++x) {
+            const unsigned char *p = &scanline[x * 4];
+            float scale = p[3] ? std::ldexp(1.0f, int(p[3]) - 136) : 0.0f;
+            rgb[y * w + x] = glm::vec3(p[0], p[1], p[2]) * scale;
+        }
+    }
+    return true;
+}
+
+// 8-bit sRGB lat-long image
+bool EnvironmentMap::loadPNG(const std::string &filename, std::vector<glm::vec3> &rgb)
+{
+    std::vector<unsigned char> data;
+    unsigned width, height;
+    if (lodepng::decode(data, width, height, filename) != 0) { return false; }
+    w = int(width);
+    h = int(height);
+    rgb.resize(size_t(w) * h);
+    for (size_t i = 0; i < rgb.size(); ++i) {
+        glm::vec3 c(data[i * 4 + 0], data[i * 4 + 1], data[i * 4 + 2]);
+        rgb[i] = glm::pow(c / 255.0f, glm::vec3(2.2f));
+    }
+    return true;
+}
+
+// Six square sRGB faces with the OpenGL cube map orientation, resampled to
+// a lat-long image four faces wide
+bool EnvironmentMap::loadCubeFaces(const std::string &dirname, std::vector<glm::vec3> &rgb)
+{
+    const char *filenames[] = {"posx.png", "negx.png", "posy.png", "negy.png", "posz.png", "negz.png"};
+    std::vector<unsigned char> faces[6];
+    unsigned size = 0;
+    for (int i = 0; i < 6; ++i) {
+        unsigned width, height;
+        if (lodepng::decode(faces[i], width, height, dirname + "/" + filenames[i]) != 0 ||
+            width != height || (i > 0 && width != size)) {
+            return false;
+        }
+        size = width;
+    }
+
+    w = int(4 * size);
+    h = int(2 * size);
+    rgb.resize(size_t(w) * h);
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            float sin_theta;
+            glm::vec3 d = uvToDirection(glm::vec2((x + 0.5f) / w, (y + 0.5f) / h), sin_theta);
+            glm::vec3 a = glm::abs(d);
+            int face;
+            float sc, tc, ma;
+            if (a.x >= a.y && a.x >= a.z) {
+                face = d.x > 0.0f ? 0 : 1;
+                sc = d.x > 0.0f ? -d.z : d.z;
+                tc = -d.y;
+                ma = a.x;
+            } else if (a.y >= a.z) {
+                face = d.y > 0.0f ? 2 : 3;
+                sc = d.x;
+                tc = d.y > 0.0f ? d.z : -d.z;
+                ma = a.y;
+            } else {
+                face = d.z > 0.0f ? 4 : 5;
+                sc = d.z > 0.0f ? d.x : -d.x;
+                tc = -d.y;
+                ma = a.z;
+            }
+            int s = glm::clamp(int((sc / ma + 1.0f) * 0.5f * size), 0, int(size) - 1);
+            int t = glm::clamp(int((tc / ma + 1.0f) * 0.5f * size), 0, int(size) - 1);
+            const unsigned char *p = &faces[face][(size_t(t) * size + s) * 4];
+            rgb[size_t(y) * w + x] = glm::pow(glm::vec3(p[0], p[1], p[2]) / 255.0f, glm::vec3(2.2f));
+        }
+    }
+    return true;
+}
+
+}  // namespace rt
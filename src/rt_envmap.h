@@ -0,0 +1,76 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rt {
+
+// Piecewise-constant 1-D distribution over `n` bins. Sampling inverts the
+// CDF, so stratified input numbers stay stratified.
+struct Distribution1D {
+    std::vector<float> cdf;  // n + 1 entries, cdf[0] = 0 and cdf[n] = 1
+    float integral = 0.0f;   // Sum of the weights
+
+    void build(const float *weights, int n);
+    int size() const
+    {
+        return int(cdf.size()) - 1;
+    }
+    // Returns the bin and remaps u to its position within the bin
+    int sample(float u, float &remapped) const;
+    // Probability of picking bin i
+    float probability(int i) const
+    {
+        return cdf[i + 1] - cdf[i];
+    }
+};
+
+// HDR environment in a lat-long layout with +y up, stored as shared-exponent
+// RGB9E5 texels (4 bytes each). It can be loaded from a Radiance .hdr or PNG
+// lat-long image, or from a directory of cube faces like cg::loadCubemap
+// (posx.png, negx.png, ...), which is resampled to lat-long.
+class EnvironmentMap {
+  public:
+    bool load(const std::string &path);
+    bool empty() const
+    {
+        return texels.empty();
+    }
+    int width() const
+    {
+        return w;
+    }
+    int height() const
+    {
+        return h;
+    }
+    std::size_t bytes() const;
+
+    // Bilinearly filtered radiance arriving from direction `dir`
+    glm::vec3 lookup(const glm::vec3 &dir) const;
+
+    // Importance samples a direction in proportion to luminance * sin(theta),
+    // returning the radiance and the solid-angle pdf
+    glm::vec3 sample(const glm::vec2 &u, glm::vec3 &dir, float &pdf) const;
+    float pdf(const glm::vec3 &dir) const;
+
+  private:
+    void assign(int width, int height, const std::vector<glm::vec3> &rgb);
+    glm::vec3 texel(int x, int y) const;
+    bool loadHDR(const std::string &filename, std::vector<glm::vec3> &rgb);
+    bool loadPNG(const std::string &filename, std::vector<glm::vec3> &rgb);
+    bool loadCubeFaces(const std::string &dirname, std::vector<glm::vec3> &rgb);
+
+    int w = 0;
+    int h = 0;
+    std::vector<std::uint32_t> texels;
+    Distribution1D marginal;             // Over rows
+    std::vector<Distribution1D> rows;    // Over columns, per row
+};
+
+}  // namespace rt
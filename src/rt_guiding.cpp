@@ -0,0 +1,318 @@
+#include "rt_guiding.h"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/component_wise.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace rt {
+
+namespace {
+
+// Logits are kept within this, so that neither strategy is ever left out
+const float kMaxLogit = 4.0f;
+
+void addAtomic(std::atomic<float> &target, float value)
+{
+    float old = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(old, old + value, std::memory_order_relaxed)) {}
+}
+
+// Quadrant of `p` in the unit square, with `p` moved into that quadrant's
+// own unit square
+int descend(glm::vec2 &p)
+{
+    int x = p.x >= 0.5f ? 1 : 0;
+    int y = p.y >= 0.5f ? 1 : 0;
+    p = glm::min(2.0f * p - glm::vec2(float(x), float(y)), glm::vec2(0.99999994f));
+    return x + 2 * y;
+}
+
+// Picks one side with probability `a` / (a + b) and rescales `u` to [0, 1)
+int pick(float a, float b, float &u)
+{
+    float p = a / (a + b);
+    if (u < p) {
+        u = glm::min(u / p, 0.99999994f);
+        return 0;
+    }
+    u = glm::min((u - p) / (1.0f - p), 0.99999994f);
+    return 1;
+}
+
+}  // namespace
+
+glm::vec2 directionToSquare(const glm::vec3 &d)
+{
+    glm::vec3 n = glm::normalize(d);
+    float phi = std::atan2(n.y, n.x);
+    if (phi < 0.0f) { phi += glm::two_pi<float>(); }
+    glm::vec2 p(0.5f * (n.z + 1.0f), phi / glm::two_pi<float>());
+    return glm::clamp(p, glm::vec2(0.0f), glm::vec2(0.99999994f));
+}
+
+glm::vec3 squareToDirection(const glm::vec2 &p)
+{
+    float cos_theta = 2.0f * p.x - 1.0f;
+    float sin_theta = std::sqrt(glm::max(1.0f - cos_theta * cos_theta, 0.0f));
+    float phi = glm::two_pi<float>() * p.y;
+    return glm::vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+}
+
+DirectionalTree::Node::Node()
+{
+    for (int q = 0; q < 4; ++q) {
+        sum[q].store(0.0f, std::memory_order_relaxed);
+        child[q] = 0;
+    }
+}
+
+DirectionalTree::Node::Node(const Node &other)
+{
+    *this = other;
+}
+
+DirectionalTree::Node &DirectionalTree::Node::operator=(const Node &other)
+{
+    for (int q = 0; q < 4; ++q) {
+        sum[q].store(other.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        child[q] = other.child[q];
+    }
+    return *this;
+}
+
+DirectionalTree::DirectionalTree() : nodes(1) {}
+
+void DirectionalTree::record(const glm::vec2 &p, float value)
+{
+    glm::vec2 local = p;
+    std::uint32_t index = 0;
+    while (true) {
+        int q = descend(local);
+        addAtomic(nodes[index].sum[q], value);
+        if (!nodes[index].child[q]) { return; }
+        index = nodes[index].child[q];
+    }
+}
+
+float DirectionalTree::total() const
+{
+    const Node &root = nodes[0];
+    return root.sum[0].load(std::memory_order_relaxed) + root.sum[1].load(std::memory_order_relaxed) +
+           root.sum[2].load(std::memory_order_relaxed) + root.sum[3].load(std::memory_order_relaxed);
+}
+
+float DirectionalTree::pdf(const glm::vec2 &p) const
+{
+    glm::vec2 local = p;
+    float density = 1.0f;
+    std::uint32_t index = 0;
+    while (true) {
+        const Node &node = nodes[index];
+        float s[4];
+        for (int q = 0; q < 4; ++q) { s[q] = node.sum[q].load(std::memory_order_relaxed); }
+        float total = s[0] + s[1] + s[2] + s[3];
+        if (!(total > 0.0f)) { return density; }
+        int q = descend(local);
+        density *= 4.0f * s[q] / total;
+        if (!node.child[q] || density == 0.0f) { return density; }
+        index = node.child[q];
+    }
+}
+
+glm::vec2 DirectionalTree::sample(glm::vec2 u) const
+{
+    glm::vec2 origin(0.0f);
+    float size = 1.0f;
+    std::uint32_t index = 0;
+    while (true) {
+        const Node &node = nodes[index];
+        float s[4];
+        for (int q = 0; q < 4; ++q) { s[q] = node.sum[q].load(std::memory_order_relaxed); }
+        if (!(s[0] + s[1] + s[2] + s[3] > 0.0f)) { break; }
+        // Column by its share of the total, then the row within the column
+        int x = pick(s[0] + s[2], s[1] + s[3], u.x);
+        int y = pick(s[x], s[x + 2], u.y);
+        int q = x + 2 * y;
+        size *= 0.5f;
+        origin += size * glm::vec2(float(x), float(y));
+        if (!node.child[q]) { break; }
+        index = node.child[q];
+    }
+    return origin + size * u;
+}
+
+DirectionalTree DirectionalTree::refined(float threshold, int max_depth) const
+{
+    DirectionalTree tree;
+    float total = this->total();
+    tree.refineFrom(*this, 0, 1.0f, total > 0.0f ? 1.0f / total : 0.0f, threshold, 1, max_depth, 0);
+    return tree;
+}
+
+void DirectionalTree::refineFrom(const DirectionalTree &source, long from, float share,
+                                 float inverse_total, float threshold, int depth, int max_depth,
+                                 std::uint32_t index)
+{
+    if (depth >= max_depth) { return; }
+    for (int q = 0; q < 4; ++q) {
+        const Node *node = from >= 0 ? &source.nodes[std::size_t(from)] : nullptr;
+        float quadrant = node ? node->sum[q].load(std::memory_order_relaxed) * inverse_total
+                              : 0.25f * share;
+        if (!(quadrant > threshold)) { continue; }
+        std::uint32_t child = std::uint32_t(nodes.size());
+        nodes.push_back(Node());
+        nodes[index].child[q] = child;
+        long next = node && node->child[q] ? long(node->child[q]) : -1;
+        refineFrom(source, next, quadrant, inverse_total, threshold, depth + 1, max_depth, child);
+    }
+}
+
+std::size_t DirectionalTree::bytes() const
+{
+    return nodes.size() * sizeof(Node);
+}
+
+GuidingCell::GuidingCell() : samples(0), gradient(0.0f), gradient_samples(0) {}
+
+GuidingCell::GuidingCell(const GuidingCell &other)
+    : sampling(other.sampling),
+      building(other.building),
+      samples(other.samples.load(std::memory_order_relaxed)),
+      logit(other.logit),
+      moment(other.moment),
+      second_moment(other.second_moment),
+      steps(other.steps),
+      gradient(other.gradient.load(std::memory_order_relaxed)),
+      gradient_samples(other.gradient_samples.load(std::memory_order_relaxed))
+{
+}
+
+float GuidingCell::bsdfFraction() const
+{
+    if (!trained()) { return 1.0f; }
+    return 1.0f / (1.0f + std::exp(-logit));
+}
+
+void GuidingCell::addGradient(float value)
+{
+    addAtomic(gradient, value);
+    gradient_samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+GuidingField::GuidingField()
+{
+    reset(AABB());
+}
+
+void GuidingField::reset(const AABB &bounds)
+{
+    // A cube, so that splits cycling through the axes keep cells cube-like
+    glm::vec3 center(0.0f);
+    float half = 1.0f;
+    if (!bounds.empty()) {
+        center = bounds.center();
+        half = glm::max(0.5f * glm::compMax(bounds.extent()), 1e-3f) * 1.01f;
+    }
+    box = AABB(center - glm::vec3(half), center + glm::vec3(half));
+    nodes.clear();
+    storage.clear();
+    storage.emplace_back();
+    Node root = {-1, 0.0f, {0, 0}, &storage.back()};
+    nodes.push_back(root);
+}
+
+GuidingCell &GuidingField::cell(const glm::vec3 &p)
+{
+    std::uint32_t index = 0;
+    while (nodes[index].axis >= 0) {
+        const Node &node = nodes[index];
+        index = node.child[p[node.axis] < node.split ? 0 : 1];
+    }
+    return *nodes[index].cell;
+}
+
+void GuidingField::refine(std::uint32_t split_samples, float threshold, int max_depth)
+{
+    // Split first, so that both halves start from their parent's distributions
+    split(0, box, 0, split_samples);
+    for (GuidingCell &cell : storage) {
+        // A cell no path reached keeps what it had
+        if (cell.building.total() > 0.0f) { cell.sampling = cell.building; }
+        cell.building = cell.sampling.refined(threshold, max_depth);
+        cell.samples.store(0, std::memory_order_relaxed);
+    }
+}
+
+void GuidingField::split(std::uint32_t index, const AABB &bounds, int depth,
+                         std::uint32_t split_samples)
+{
+    if (nodes[index].axis < 0) {
+        GuidingCell *cell = nodes[index].cell;
+        std::uint32_t samples = cell->samples.load(std::memory_order_relaxed);
+        if (samples <= split_samples) { return; }
+        cell->samples.store(samples / 2, std::memory_order_relaxed);
+        storage.push_back(*cell);
+        std::uint32_t first = std::uint32_t(nodes.size());
+        Node low = {-1, 0.0f, {0, 0}, cell};
+        Node high = {-1, 0.0f, {0, 0}, &storage.back()};
+        nodes.push_back(low);
+        nodes.push_back(high);
+        Node &node = nodes[index];
+        node.axis = depth % 3;
+        node.split = 0.5f * (bounds.lo[node.axis] + bounds.hi[node.axis]);
+        node.child[0] = first;
+        node.child[1] = first + 1;
+        node.cell = nullptr;
+    }
+    const Node node = nodes[index];
+    AABB low = bounds, high = bounds;
+    low.hi[node.axis] = node.split;
+    high.lo[node.axis] = node.split;
+    split(node.child[0], low, depth + 1, split_samples);
+    split(node.child[1], high, depth + 1, split_samples);
+}
+
+void GuidingField::step(float learning_rate)
+{
+    // Adam (Kingma and Ba 2015) with the usual decay rates
+    const float beta1 = 0.9f, beta2 = 0.999f;
+    for (GuidingCell &cell : storage) {
+        std::uint32_t n = cell.gradient_samples.exchange(0, std::memory_order_relaxed);
+        float sum = cell.gradient.exchange(0.0f, std::memory_order_relaxed);
+        if (n == 0 || !cell.trained()) { continue; }
+        float g = sum / float(n);
+        if (!std::isfinite(g)) { continue; }
+        ++cell.steps;
+        cell.moment = beta1 * cell.moment + (1.0f - beta1) * g;
+        cell.second_moment = beta2 * cell.second_moment + (1.0f - beta2) * g * g;
+        float m = cell.moment / (1.0f - std::pow(beta1, float(cell.steps)));
+        float v = cell.second_moment / (1.0f - std::pow(beta2, float(cell.steps)));
+        cell.logit -= learning_rate * m / (std::sqrt(v) + 1e-8f);
+        cell.logit = glm::clamp(cell.logit, -kMaxLogit, kMaxLogit);
+    }
+}
+
+std::size_t GuidingField::bytes() const
+{
+    std::size_t total = nodes.size() * sizeof(Node);
+    for (const GuidingCell &cell : storage) {
+        total += sizeof(GuidingCell) + cell.sampling.bytes() + cell.building.bytes();
+    }
+    return total;
+}
+
+float GuidingField::meanBsdfFraction() const
+{
+    float sum = 0.0f;
+    int count = 0;
+    for (const GuidingCell &cell : storage) {
+        if (!cell.trained()) { continue; }
+        sum += cell.bsdfFraction();
+        ++count;
+    }
+    return count > 0 ? sum / float(count) : 1.0f;
+}
+
+}  // namespace rt
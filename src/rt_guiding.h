@@ -0,0 +1,143 @@
+#pragma once
+
+#include "rt_aabb.h"
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace rt {
+
+// Training schedule: pass k of path guiding lasts 2^k frames, and after
+// kGuidingPasses passes the distributions are left as they are
+const int kGuidingPasses = 10;
+// In pass k, cells split past kGuidingSplitSamples * sqrt(2^k) samples
+const float kGuidingSplitSamples = 12000.0f;
+// Directional quadrants split past this share of their cell's radiance
+const float kGuidingQuadrantShare = 0.01f;
+const int kGuidingMaxDepth = 20;
+// Adam step size for the BSDF fractions, one step per frame
+const float kGuidingLearningRate = 0.1f;
+
+// Directions map to the unit square by (cos theta, phi) about the world z
+// axis. The map preserves area, so a density over the square divided by
+// 4 pi is a density over solid angle.
+glm::vec2 directionToSquare(const glm::vec3 &d);
+glm::vec3 squareToDirection(const glm::vec2 &p);
+
+// Quadtree over the direction square (the D-tree of Mueller et al. 2017).
+// Every node splits its square into four quadrants and sums the radiance
+// recorded through each; a quadrant is either a leaf or a child node.
+class DirectionalTree {
+  public:
+    DirectionalTree();
+
+    // Thread-safe; adds `value` to every quadrant on the way down to `p`
+    void record(const glm::vec2 &p, float value);
+    float total() const;
+    // Density over the unit square that sample() draws from, in proportion
+    // to the sums; uniform where a node has none
+    float pdf(const glm::vec2 &p) const;
+    glm::vec2 sample(glm::vec2 u) const;
+    // A tree with quadrants holding more than `threshold` of the total split,
+    // the others merged, and all sums zero
+    DirectionalTree refined(float threshold, int max_depth) const;
+    std::size_t bytes() const;
+
+  private:
+    struct Node {
+        std::atomic<float> sum[4];  // Quadrant x + 2y
+        std::uint32_t child[4];     // Index of the quadrant's node, or 0 for a leaf
+
+        Node();
+        Node(const Node &other);
+        Node &operator=(const Node &other);
+    };
+
+    // Builds node `index` of this tree from node `from` of `source`, or from
+    // a quadrant holding `share` of the total if `from` is negative
+    void refineFrom(const DirectionalTree &source, long from, float share, float inverse_total,
+                    float threshold, int depth, int max_depth, std::uint32_t index);
+
+    std::vector<Node> nodes;  // nodes[0] is the root
+};
+
+// Region of a GuidingField with what was learned about it
+struct GuidingCell {
+    DirectionalTree sampling;  // Learned in earlier passes; read-only while rendering
+    DirectionalTree building;  // Learned from the current pass
+    std::atomic<std::uint32_t> samples;  // Recorded in the current pass
+
+    // Probability of sampling the BSDF rather than `sampling`, as a logit,
+    // fitted with Adam to the gradient of the KL divergence between the
+    // mixture and the integrand (Mueller et al. 2019)
+    float logit = 0.0f;
+    float moment = 0.0f;
+    float second_moment = 0.0f;
+    int steps = 0;
+    std::atomic<float> gradient;  // Summed over the current frame
+    std::atomic<std::uint32_t> gradient_samples;
+
+    GuidingCell();
+    GuidingCell(const GuidingCell &other);
+
+    // Whether `sampling` has anything to sample
+    bool trained() const
+    {
+        return sampling.total() > 0.0f;
+    }
+    float bsdfFraction() const;
+    // Thread-safe; d(KL) / d(logit) of one sample
+    void addGradient(float value);
+};
+
+// Binary tree over a cube (the S-tree of Mueller et al. 2017) whose leaves
+// are GuidingCells. Cells split at their middle, cycling through the axes,
+// where enough samples arrive. Rendering threads may look up cells and record
+// into them; everything else must run between frames.
+class GuidingField {
+  public:
+    GuidingField();
+
+    // Drops everything learned and covers `bounds` with one cell
+    void reset(const AABB &bounds);
+    // The cell containing `p`; points outside the cube use the nearest cell
+    GuidingCell &cell(const glm::vec3 &p);
+    // Ends a training pass: cells with more than `split_samples` recorded
+    // samples are split until each child has at most that many, then every
+    // cell samples what it learned and starts learning anew. Directional
+    // quadrants with more than `threshold` of a cell's radiance are split.
+    void refine(std::uint32_t split_samples, float threshold, int max_depth);
+    // One Adam step of each cell's BSDF fraction from the gradients of the
+    // frame
+    void step(float learning_rate);
+
+    std::size_t cells() const
+    {
+        return storage.size();
+    }
+    std::size_t bytes() const;
+    // Mean BSDF fraction of the cells that have learned anything, or 1
+    float meanBsdfFraction() const;
+
+  private:
+    struct Node {
+        int axis;       // Split axis, or -1 for a leaf
+        float split;    // Position on `axis`
+        std::uint32_t child[2];
+        GuidingCell *cell;  // Leaves only
+    };
+
+    void split(std::uint32_t index, const AABB &bounds, int depth, std::uint32_t split_samples);
+
+    AABB box;
+    std::vector<Node> nodes;
+    std::deque<GuidingCell> storage;
+};
+
+}  // namespace rt
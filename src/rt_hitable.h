@@ -5,6 +5,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/component_wise.hpp>
 
+#include "rt_aabb.h"
 #include "rt_ray.h"
 
 namespace rt {
@@ -12,11 +13,16 @@ namespace rt {
 // 前向声明 Material 类
 class Material;
 
-struct HitRecord {
-    float t;
+// One cache line. The hit point and t share the first 16 bytes since
+// closest-hit loops and shading read them together.
+struct alignas(64) HitRecord {
     glm::vec3 p;
+    float t;
     glm::vec3 normal;
+    float footprint;    // Ray cone width at the hit, set by the integrator
     Material* mat_ptr;  // 指向材质的指针
+    glm::vec2 uv;       // Texture coordinates
+    float uv_density;   // Texture coordinate change per unit of surface length
 };
 
 class Hitable {
@@ -0,0 +1,237 @@
+#include "rt_irradiance.h"
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/component_wise.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace rt {
+
+namespace {
+
+// The root cube covers the ground around the origin; records beyond it are
+// kept in the root's list
+const float kRootHalfSize = 2048.0f;
+const int kMaxOctreeDepth = 20;
+
+int childIndex(const glm::vec3 &p, const glm::vec3 &center)
+{
+    return (p.x >= center.x ? 1 : 0) | (p.y >= center.y ? 2 : 0) | (p.z >= center.z ? 4 : 0);
+}
+
+glm::vec3 childCenter(const glm::vec3 &center, float half_size, int index)
+{
+    float quarter = 0.5f * half_size;
+    return center + glm::vec3(index & 1 ? quarter : -quarter, index & 2 ? quarter : -quarter,
+                              index & 4 ? quarter : -quarter);
+}
+
+}  // namespace
+
+glm::vec3 IrradianceRecord::at(const glm::vec3 &q, const glm::vec3 &normal) const
+{
+    glm::vec3 turn = glm::cross(n, normal);
+    glm::vec3 offset = q - p;
+    glm::vec3 e;
+    for (int c = 0; c < 3; ++c) {
+        e[c] = irradiance[c] + glm::dot(turn, rotation[c]) + glm::dot(offset, translation[c]);
+    }
+    return glm::max(e, glm::vec3(0.0f));
+}
+
+glm::vec3 hemisphereStratum(int j, int k, const glm::vec2 &u)
+{
+    float sin2 = (float(j) + u.x) / float(kIrradianceThetaStrata);
+    float sin_theta = std::sqrt(sin2);
+    float cos_theta = std::sqrt(glm::max(1.0f - sin2, 0.0f));
+    float phi = glm::two_pi<float>() * (float(k) + u.y) / float(kIrradiancePhiStrata);
+    return glm::vec3(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta);
+}
+
+IrradianceRecord makeIrradianceRecord(const glm::vec3 &p, const Frame &frame,
+                                      const HemisphereSample *samples, int depth)
+{
+    const int M = kIrradianceThetaStrata;
+    const int N = kIrradiancePhiStrata;
+    IrradianceRecord record;
+    record.p = p;
+    record.n = frame.n;
+    record.depth = depth;
+    record.irradiance = glm::vec3(0.0f);
+    for (int c = 0; c < 3; ++c) {
+        record.rotation[c] = glm::vec3(0.0f);
+        record.translation[c] = glm::vec3(0.0f);
+    }
+
+    float inverse_distances = 0.0f;
+    for (int i = 0; i < M * N; ++i) {
+        record.irradiance += samples[i].radiance;
+        inverse_distances += 1.0f / samples[i].distance;
+    }
+    record.irradiance *= glm::pi<float>() / float(M * N);
+    float harmonic = inverse_distances > 0.0f ? float(M * N) / inverse_distances
+                                              : std::numeric_limits<float>::infinity();
+
+    // Gradients from differences between neighbouring strata, with stratum
+    // centers standing in for the jittered directions
+    for (int k = 0; k < N; ++k) {
+        float phi = glm::two_pi<float>() * (float(k) + 0.5f) / float(N);
+        float phi_lo = glm::two_pi<float>() * float(k) / float(N);
+        glm::vec3 u_k = frame.toWorld(glm::vec3(std::cos(phi), std::sin(phi), 0.0f));
+        glm::vec3 v_k = frame.toWorld(glm::vec3(-std::sin(phi), std::cos(phi), 0.0f));
+        glm::vec3 v_lo = frame.toWorld(glm::vec3(-std::sin(phi_lo), std::cos(phi_lo), 0.0f));
+        int k_prev = (k + N - 1) % N;
+        for (int j = 0; j < M; ++j) {
+            const HemisphereSample &s = samples[j * N + k];
+            float sin2 = (float(j) + 0.5f) / float(M);
+            float tan_theta = std::sqrt(sin2 / glm::max(1.0f - sin2, 1e-6f));
+            float sin_lo = std::sqrt(float(j) / float(M));
+            float sin_hi = std::sqrt(float(j + 1) / float(M));
+
+            // Across the ring boundary below, and the sector boundary before
+            glm::vec3 ring(0.0f);
+            if (j > 0) {
+                const HemisphereSample &below = samples[(j - 1) * N + k];
+                float cos2_lo = 1.0f - float(j) / float(M);
+                ring = (glm::two_pi<float>() / float(N)) * sin_lo * cos2_lo /
+                       glm::min(s.distance, below.distance) * (s.radiance - below.radiance);
+            }
+            const HemisphereSample &before = samples[j * N + k_prev];
+            glm::vec3 sector = (sin_hi - sin_lo) / glm::min(s.distance, before.distance) *
+                               (s.radiance - before.radiance);
+            for (int c = 0; c < 3; ++c) {
+                record.rotation[c] -= v_k * (tan_theta * s.radiance[c]);
+                record.translation[c] += u_k * ring[c] + v_lo * sector[c];
+            }
+        }
+    }
+    for (int c = 0; c < 3; ++c) { record.rotation[c] *= glm::pi<float>() / float(M * N); }
+
+    // A steep gradient means the estimate will not extrapolate far
+    float radius = glm::clamp(harmonic, kMinRecordRadius, kMaxRecordRadius);
+    for (int c = 0; c < 3; ++c) {
+        float slope = glm::length(record.translation[c]);
+        if (slope * radius > record.irradiance[c]) {
+            radius = glm::max(record.irradiance[c] / slope, kMinRecordRadius);
+        }
+    }
+    record.radius = radius;
+    return record;
+}
+
+IrradianceCache::Node::Node() : records(nullptr)
+{
+    for (int i = 0; i < 8; ++i) { children[i].store(nullptr, std::memory_order_relaxed); }
+}
+
+IrradianceCache::IrradianceCache() : center(0.0f), half_size(kRootHalfSize), count(0) {}
+
+bool IrradianceCache::lookup(const glm::vec3 &p, const glm::vec3 &n, int depth, float error,
+                             glm::vec3 &irradiance) const
+{
+    glm::vec3 sum(0.0f);
+    float weights = 0.0f;
+    const Node *node = &root;
+    glm::vec3 node_center = center;
+    float node_half = half_size;
+    bool inside = glm::compMax(glm::abs(p - center)) < half_size;
+    for (int level = 0; node; ++level) {
+        for (const Link *link = node->records.load(std::memory_order_acquire); link;
+             link = link->next) {
+            const IrradianceRecord &record = *link->record;
+            if (record.depth != depth) { continue; }
+            glm::vec3 offset = p - record.p;
+            // Records in front of the point see surfaces it does not
+            if (glm::dot(offset, 0.5f * (n + record.n)) < -0.05f * record.radius) { continue; }
+            float estimate = glm::length(offset) / record.radius +
+                             std::sqrt(glm::max(1.0f - glm::dot(n, record.n), 0.0f));
+            if (estimate >= error) { continue; }
+            // Falls to zero at the edge of the region, so records fade in
+            float weight = 1.0f / glm::max(estimate, 1e-6f) - 1.0f / error;
+            sum += weight * record.at(p, n);
+            weights += weight;
+        }
+        if (!inside || level == kMaxOctreeDepth) { break; }
+        int index = childIndex(p, node_center);
+        node = node->children[index].load(std::memory_order_acquire);
+        node_center = childCenter(node_center, node_half, index);
+        node_half *= 0.5f;
+    }
+    if (!(weights > 0.0f)) { return false; }
+    irradiance = sum / weights;
+    return true;
+}
+
+void IrradianceCache::insert(const IrradianceRecord &record, float error)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    records.push_back(record);
+    const IrradianceRecord *stored = &records.back();
+    count.store(records.size(), std::memory_order_relaxed);
+
+    // The deepest level whose nodes are at least as wide as the region of
+    // influence, so that the region overlaps at most two nodes per axis
+    float reach = error * record.radius;
+    int target = 0;
+    for (float half = half_size; target < kMaxOctreeDepth && 0.5f * half >= reach; half *= 0.5f) {
+        ++target;
+    }
+    if (glm::compMax(glm::abs(record.p - center)) + reach >= half_size) { target = 0; }
+
+    struct Visit {
+        Node *node;
+        glm::vec3 center;
+        float half;
+        int level;
+    };
+    Visit stack[1 + 8 * kMaxOctreeDepth];
+    int top = 0;
+    Visit start = {&root, center, half_size, 0};
+    stack[top++] = start;
+    while (top > 0) {
+        Visit visit = stack[--top];
+        if (visit.level == target) {
+            links.push_back(Link());
+            Link &link = links.back();
+            link.record = stored;
+            link.next = visit.node->records.load(std::memory_order_relaxed);
+            visit.node->records.store(&link, std::memory_order_release);
+            continue;
+        }
+        for (int i = 0; i < 8; ++i) {
+            glm::vec3 c = childCenter(visit.center, visit.half, i);
+            float h = 0.5f * visit.half;
+            if (glm::compMax(glm::abs(record.p - c)) > h + reach) { continue; }
+            Node *child = visit.node->children[i].load(std::memory_order_relaxed);
+            if (!child) {
+                nodes.emplace_back();
+                child = &nodes.back();
+                visit.node->children[i].store(child, std::memory_order_release);
+            }
+            Visit next = {child, c, h, visit.level + 1};
+            stack[top++] = next;
+        }
+    }
+}
+
+void IrradianceCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    root.records.store(nullptr, std::memory_order_relaxed);
+    for (int i = 0; i < 8; ++i) { root.children[i].store(nullptr, std::memory_order_relaxed); }
+    nodes.clear();
+    links.clear();
+    records.clear();
+    count.store(0, std::memory_order_relaxed);
+}
+
+std::size_t IrradianceCache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return nodes.size() * sizeof(Node) + records.size() * sizeof(IrradianceRecord) +
+           links.size() * sizeof(Link);
+}
+
+}  // namespace rt
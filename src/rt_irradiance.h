@@ -0,0 +1,103 @@
+#pragma once
+
+#include "rt_warp.h"
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace rt {
+
+// Strata of the hemisphere a record is computed from: rings of equal
+// projected solid angle, times sectors. Each stratum gets one cosine-weighted
+// sample, which the gradients below rely on.
+const int kIrradianceThetaStrata = 8;
+const int kIrradiancePhiStrata = 16;
+const int kIrradianceSamples = kIrradianceThetaStrata * kIrradiancePhiStrata;
+
+// Bounds on a record's radius of validity, in scene units
+const float kMinRecordRadius = 0.02f;
+const float kMaxRecordRadius = 0.5f;
+
+// Irradiance at a point, with its gradients under rotation and translation
+// (Ward and Heckbert 1992), one vector per color channel
+struct IrradianceRecord {
+    glm::vec3 p;
+    glm::vec3 n;
+    glm::vec3 irradiance;
+    glm::vec3 rotation[3];
+    glm::vec3 translation[3];
+    float radius = 0.0f;  // Harmonic mean distance to the surfaces seen, clamped
+    int depth = 0;        // Bounces the estimate included, see IrradianceCache
+
+    // Extrapolated to a point and normal nearby
+    glm::vec3 at(const glm::vec3 &q, const glm::vec3 &normal) const;
+};
+
+// One stratified sample of the hemisphere above a record
+struct HemisphereSample {
+    glm::vec3 radiance;
+    float distance;  // To the first hit; infinite for the background
+};
+
+// Local direction (z up) of the sample in ring j and sector k, jittered by u
+glm::vec3 hemisphereStratum(int j, int k, const glm::vec2 &u);
+// Builds a record from kIrradianceSamples samples taken at
+// hemisphereStratum(i / kIrradiancePhiStrata, i % kIrradiancePhiStrata, u_i)
+// in `frame`
+IrradianceRecord makeIrradianceRecord(const glm::vec3 &p, const Frame &frame,
+                                      const HemisphereSample *samples, int depth);
+
+// Irradiance records in an octree. Records are only added, each to every
+// node of the level matching its size that its region of influence
+// overlaps, so a lookup only visits the nodes on the path to its point.
+// Lookups take no lock and may run concurrently with inserts, which are
+// serialized; nodes and records are never changed once published.
+class IrradianceCache {
+  public:
+    IrradianceCache();
+
+    // Weighted average of the records of the same depth whose error estimate
+    // at (p, n) is below `error`. Returns false if there are none.
+    bool lookup(const glm::vec3 &p, const glm::vec3 &n, int depth, float error,
+                glm::vec3 &irradiance) const;
+    // `error` must be the one lookups use; a record reaches error * radius
+    void insert(const IrradianceRecord &record, float error);
+    // Drops every record. Only call while no lookup or insert is running.
+    void clear();
+
+    std::size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+    std::size_t bytes() const;
+
+  private:
+    struct Link {
+        const IrradianceRecord *record;
+        const Link *next;
+    };
+    struct Node {
+        std::atomic<Node *> children[8];
+        std::atomic<const Link *> records;
+
+        Node();
+    };
+
+    Node root;
+    glm::vec3 center;
+    float half_size;
+
+    mutable std::mutex mutex;  // Serializes inserts and clear()
+    std::deque<Node> nodes;
+    std::deque<IrradianceRecord> records;
+    std::deque<Link> links;
+    std::atomic<std::size_t> count;
+};
+
+}  // namespace rt
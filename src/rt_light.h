@@ -0,0 +1,76 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "rt_material.h"
+
+namespace rt {
+
+enum LightShape { LIGHT_SPHERE = 0, LIGHT_QUAD, LIGHT_TRIANGLE };
+
+// Emitter for next-event estimation. The same surface is also in the scene
+// geometry (as a sphere or as triangles) so that BSDF-sampled rays can hit it.
+// A sphere is `p` with radius `edge1.x`; a quad spans p + s * edge1 + t * edge2
+// and a triangle p, p + edge1, p + edge2.
+struct Light {
+    int shape;
+    glm::vec3 p;
+    glm::vec3 edge1;
+    glm::vec3 edge2;
+    float area;
+    const Material *material;
+
+    static Light sphere(const glm::vec3 &center, float radius, const Material *m)
+    {
+        Light l = {LIGHT_SPHERE, center, glm::vec3(radius, 0.0f, 0.0f), glm::vec3(0.0f),
+                   4.0f * glm::pi<float>() * radius * radius, m};
+        return l;
+    }
+    static Light quad(const glm::vec3 &corner, const glm::vec3 &e1, const glm::vec3 &e2,
+                      const Material *m)
+    {
+        Light l = {LIGHT_QUAD, corner, e1, e2, glm::length(glm::cross(e1, e2)), m};
+        return l;
+    }
+    static Light triangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+                          const Material *m)
+    {
+        Light l = {LIGHT_TRIANGLE, v0, v1 - v0, v2 - v0,
+                   0.5f * glm::length(glm::cross(v1 - v0, v2 - v0)), m};
+        return l;
+    }
+
+    // Uniformly distributed point on the surface and its normal, which for
+    // quads and triangles follows the winding like Triangle::record
+    void sample(const glm::vec2 &u, glm::vec3 &point, glm::vec3 &normal) const
+    {
+        if (shape == LIGHT_SPHERE) {
+            float z = 1.0f - 2.0f * u.x;
+            float r = glm::sqrt(glm::max(0.0f, 1.0f - z * z));
+            float phi = 2.0f * glm::pi<float>() * u.y;
+            normal = glm::vec3(r * glm::cos(phi), r * glm::sin(phi), z);
+            point = p + edge1.x * normal;
+            return;
+        }
+        glm::vec2 st = u;
+        if (shape == LIGHT_TRIANGLE && st.x + st.y > 1.0f) { st = 1.0f - st; }
+        point = p + st.x * edge1 + st.y * edge2;
+        normal = glm::normalize(glm::cross(edge1, edge2));
+    }
+};
+
+inline float luminance(const glm::vec3 &c)
+{
+    return glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Power heuristic with beta = 2 for combining two sampling strategies
+inline float powerHeuristic(float pdf_a, float pdf_b)
+{
+    float a2 = pdf_a * pdf_a;
+    float b2 = pdf_b * pdf_b;
+    return a2 + b2 > 0.0f ? a2 / (a2 + b2) : 0.0f;
+}
+
+}  // namespace rt
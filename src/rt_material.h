@@ -2,49 +2,305 @@
 
 #include "rt_ray.h"
 #include "rt_hitable.h"
+#include "rt_stats.h"
+#include "rt_texture.h"
+#include "rt_warp.h"
 
 namespace rt {
 
-// 声明一个用于生成随机点的函数
-glm::vec3 random_in_unit_sphere();
+// Minimum GGX roughness; smoother metals are treated as perfect mirrors
+const float kMinRoughness = 1e-3f;
+
+// Shading frame with the normal flipped to the side the ray arrives from
+inline Frame shadingFrame(const Ray& ray_in, const HitRecord& rec)
+{
+    return Frame(glm::dot(ray_in.direction(), rec.normal) < 0.0f ? rec.normal : -rec.normal);
+}
+
+// Image textures modulating a material; -1 means untextured. Ids refer to
+// textureCache().
+struct MaterialTextures {
+    int albedo = -1;     // sRGB, multiplies the albedo
+    int roughness = -1;  // Linear, red channel multiplies the fuzz
+    int mapping = TEXMAP_UV;
+    float scale = 1.0f;  // Texture repeats per unit of texture coordinate
+
+    glm::vec3 albedoAt(const glm::vec3& base, const HitRecord& rec) const {
+        if (albedo < 0) { return base; }
+        return base * glm::vec3(lookupTexture(albedo, mapping, scale, rec));
+    }
+    float roughnessAt(float base, const HitRecord& rec) const {
+        if (roughness < 0) { return base; }
+        return base * lookupTexture(roughness, mapping, scale, rec).x;
+    }
+};
+
+// Editable material parameters; materials ignore the ones they do not have
+struct MaterialParams {
+    glm::vec3 albedo = glm::vec3(1.0f);
+    float intensity = 1.0f;  // Scales the albedo
+    float fuzz = 0.0f;
+    bool has_fuzz = false;   // Read-only: whether fuzz applies
+    bool emissive = false;   // Read-only: albedo * intensity is emitted radiance
+    bool has_textures = false;  // Read-only: whether textures apply
+    MaterialTextures textures;
+};
+
+// Concrete type of a material, so that kernels specialised for the built-in
+// materials can call them without going through the vtable (StandardMaterials)
+enum MaterialKind { MATERIAL_OTHER = 0, MATERIAL_LAMBERTIAN, MATERIAL_METAL, MATERIAL_DIFFUSE_LIGHT };
 
 class Material {
 public:
-    virtual bool scatter(const Ray& ray_in, const HitRecord& rec,
+    explicit Material(MaterialKind k = MATERIAL_OTHER) : kind(k) {}
+
+    // Samples an outgoing direction. `u` holds the sampler's BSDF numbers for
+    // this bounce; `attenuation` is the sample weight f * cos / pdf.
+    virtual bool scatter(const Ray& ray_in, const HitRecord& rec, const glm::vec3& u,
                          glm::vec3& attenuation, Ray& scattered) const = 0;
+    // f * cos for a given outgoing direction, and the solid-angle pdf that
+    // scatter() samples it with. Both are zero for specular materials.
+    virtual glm::vec3 eval(const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) const = 0;
+    virtual float pdf(const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) const = 0;
+    virtual bool isSpecular() const { return false; }
+    // How much a bounce widens the ray cone, in radians; blurs texture
+    // lookups further down the path
+    virtual float spreadAngle(const HitRecord&) const { return 0.0f; }
+    // Radiance leaving the front of the surface
+    virtual glm::vec3 emitted() const { return glm::vec3(0.0f); }
+    virtual MaterialParams params() const = 0;
+    virtual void setParams(const MaterialParams& p) = 0;
+
+    const MaterialKind kind;
 };
 
-// 朗伯特（漫反射）材质
-class Lambertian : public Material {
+// 朗伯特（漫反射）材质, cosine-weighted sampling so the weight is the albedo
+class Lambertian final : public Material {
 public:
-    Lambertian(const glm::vec3& a) : albedo(a) {}
+    Lambertian(const glm::vec3& a, float i = 1.0f)
+        : Material(MATERIAL_LAMBERTIAN), albedo(a), intensity(i) {}
     
-    virtual bool scatter(const Ray& ray_in, const HitRecord& rec,
+    virtual bool scatter(const Ray& ray_in, const HitRecord& rec, const glm::vec3& u,
                          glm::vec3& attenuation, Ray& scattered) const {
-        glm::vec3 target = rec.p + rec.normal + random_in_unit_sphere();
-        scattered = Ray(rec.p, target - rec.p);
-        attenuation = albedo;
+        RT_STAT_INC(stats::SCATTER_LAMBERTIAN);
+        Frame frame = shadingFrame(ray_in, rec);
+        scattered = Ray(rec.p, frame.toWorld(sampleCosineHemisphere(glm::vec2(u.x, u.y))));
+        attenuation = textures.albedoAt(albedo, rec) * intensity;
         return true;
     }
+
+    virtual glm::vec3 eval(const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) const {
+        float cos_theta = shadingFrame(ray_in, rec).toLocal(glm::normalize(dir)).z;
+        return textures.albedoAt(albedo, rec) * intensity * cosineHemispherePdf(cos_theta);
+    }
+    virtual float pdf(const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) const {
+        return cosineHemispherePdf(shadingFrame(ray_in, rec).toLocal(glm::normalize(dir)).z);
+    }
+    virtual float spreadAngle(const HitRecord&) const { return 1.0f; }
+
+    virtual MaterialParams params() const {
+        MaterialParams p;
+        p.albedo = albedo;
+        p.intensity = intensity;
+        p.has_textures = true;
+        p.textures = textures;
+        return p;
+    }
+    virtual void setParams(const MaterialParams& p) {
+        albedo = p.albedo;
+        intensity = p.intensity;
+        textures = p.textures;
+    }
     
     glm::vec3 albedo;
+    float intensity = 1.0f;
+    MaterialTextures textures;
 };
 
-// 金属（反射）材质
-class Metal : public Material {
+// 金属（反射）材质: GGX microfacets with roughness fuzz^2, sampled through the
+// visible normals. Fresnel is the albedo, as before.
+class Metal final : public Material {
 public:
-    Metal(const glm::vec3& a, float f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    Metal(const glm::vec3& a, float f, float i = 1.0f)
+        : Material(MATERIAL_METAL), albedo(a), fuzz(f < 1 ? f : 1), intensity(i) {}
     
-    virtual bool scatter(const Ray& ray_in, const HitRecord& rec,
+    virtual bool scatter(const Ray& ray_in, const HitRecord& rec, const glm::vec3& u,
                          glm::vec3& attenuation, Ray& scattered) const {
-        glm::vec3 reflected = glm::reflect(glm::normalize(ray_in.direction()), rec.normal);
-        scattered = Ray(rec.p, reflected + fuzz * random_in_unit_sphere());
-        attenuation = albedo;
-        return (glm::dot(scattered.direction(), rec.normal) > 0);
+        RT_STAT_INC(stats::SCATTER_METAL);
+        Frame frame = shadingFrame(ray_in, rec);
+        glm::vec3 wo = frame.toLocal(-glm::normalize(ray_in.direction()));
+        if (wo.z <= 0.0f) { return false; }
+        attenuation = textures.albedoAt(albedo, rec) * intensity;
+        if (isSpecular()) {
+            scattered = Ray(rec.p, frame.toWorld(glm::vec3(-wo.x, -wo.y, wo.z)));
+            return true;
+        }
+        // Weight f * cos / pdf reduces to G1(wi) for visible-normal sampling
+        float a = alpha(rec);
+        glm::vec3 h = sampleGGXVisibleNormal(wo, a, glm::vec2(u.x, u.y));
+        glm::vec3 wi = glm::reflect(-wo, h);
+        if (wi.z <= 0.0f) { return false; }
+        scattered = Ray(rec.p, frame.toWorld(wi));
+        attenuation *= ggxG1(wi, a);
+        return true;
+    }
+
+    virtual glm::vec3 eval(const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) const {
+        if (isSpecular()) { return glm::vec3(0.0f); }
+        Frame frame = shadingFrame(ray_in, rec);
+        glm::vec3 wo = frame.toLocal(-glm::normalize(ray_in.direction()));
+        glm::vec3 wi = frame.toLocal(glm::normalize(dir));
+        float a = alpha(rec);
+        return textures.albedoAt(albedo, rec) * intensity * ggxReflectionPdf(wo, wi, a) *
+               ggxG1(wi, a);
+    }
+    virtual float pdf(const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) const {
+        if (isSpecular()) { return 0.0f; }
+        Frame frame = shadingFrame(ray_in, rec);
+        return ggxReflectionPdf(frame.toLocal(-glm::normalize(ray_in.direction())),
+                                frame.toLocal(glm::normalize(dir)), alpha(rec));
+    }
+    virtual bool isSpecular() const { return alpha() < kMinRoughness; }
+    virtual float spreadAngle(const HitRecord& rec) const { return isSpecular() ? 0.0f : alpha(rec); }
+
+    virtual MaterialParams params() const {
+        MaterialParams p;
+        p.albedo = albedo;
+        p.intensity = intensity;
+        p.fuzz = fuzz;
+        p.has_fuzz = true;
+        p.has_textures = true;
+        p.textures = textures;
+        return p;
+    }
+    virtual void setParams(const MaterialParams& p) {
+        albedo = p.albedo;
+        intensity = p.intensity;
+        fuzz = p.fuzz < 1 ? p.fuzz : 1;
+        textures = p.textures;
+    }
+
+    // Untextured roughness decides whether the metal is a mirror; a roughness
+    // texture only varies it across the surface of a rough metal
+    float alpha() const { return fuzz * fuzz; }
+    float alpha(const HitRecord& rec) const {
+        float f = textures.roughnessAt(fuzz, rec);
+        return glm::max(f * f, kMinRoughness);
     }
     
     glm::vec3 albedo;
     float fuzz=0.0;
+    float intensity = 1.0f;
+    MaterialTextures textures;
+};
+
+// 发光材质: emits albedo * intensity from the front face and absorbs all light
+class DiffuseLight final : public Material {
+public:
+    DiffuseLight(const glm::vec3& c, float i = 1.0f)
+        : Material(MATERIAL_DIFFUSE_LIGHT), color(c), intensity(i) {}
+
+    virtual bool scatter(const Ray&, const HitRecord&, const glm::vec3&, glm::vec3&, Ray&) const {
+        return false;
+    }
+    virtual glm::vec3 eval(const Ray&, const HitRecord&, const glm::vec3&) const {
+        return glm::vec3(0.0f);
+    }
+    virtual float pdf(const Ray&, const HitRecord&, const glm::vec3&) const { return 0.0f; }
+    virtual glm::vec3 emitted() const { return color * intensity; }
+
+    virtual MaterialParams params() const {
+        MaterialParams p;
+        p.albedo = color;
+        p.intensity = intensity;
+        p.emissive = true;
+        return p;
+    }
+    virtual void setParams(const MaterialParams& p) {
+        color = p.albedo;
+        intensity = p.intensity;
+    }
+
+    glm::vec3 color;
+    float intensity = 1.0f;
+};
+
+// Material sets of the render kernels. AnyMaterials calls through the vtable.
+// StandardMaterials switches on Material::kind and calls the built-in
+// materials directly, so that their code is inlined into the kernel; other
+// materials still take the virtual call.
+struct AnyMaterials {
+    static bool scatter(const Material& m, const Ray& ray_in, const HitRecord& rec,
+                        const glm::vec3& u, glm::vec3& attenuation, Ray& scattered) {
+        return m.scatter(ray_in, rec, u, attenuation, scattered);
+    }
+    static glm::vec3 eval(const Material& m, const Ray& ray_in, const HitRecord& rec,
+                          const glm::vec3& dir) {
+        return m.eval(ray_in, rec, dir);
+    }
+    static float pdf(const Material& m, const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) {
+        return m.pdf(ray_in, rec, dir);
+    }
+    static bool isSpecular(const Material& m) { return m.isSpecular(); }
+    static float spreadAngle(const Material& m, const HitRecord& rec) { return m.spreadAngle(rec); }
+    static glm::vec3 emitted(const Material& m) { return m.emitted(); }
+};
+
+struct StandardMaterials {
+    static bool scatter(const Material& m, const Ray& ray_in, const HitRecord& rec,
+                        const glm::vec3& u, glm::vec3& attenuation, Ray& scattered) {
+        switch (m.kind) {
+        case MATERIAL_LAMBERTIAN:
+            return static_cast<const Lambertian&>(m).Lambertian::scatter(ray_in, rec, u, attenuation, scattered);
+        case MATERIAL_METAL:
+            return static_cast<const Metal&>(m).Metal::scatter(ray_in, rec, u, attenuation, scattered);
+        case MATERIAL_DIFFUSE_LIGHT:
+            return false;
+        default:
+            return m.scatter(ray_in, rec, u, attenuation, scattered);
+        }
+    }
+    static glm::vec3 eval(const Material& m, const Ray& ray_in, const HitRecord& rec,
+                          const glm::vec3& dir) {
+        switch (m.kind) {
+        case MATERIAL_LAMBERTIAN: return static_cast<const Lambertian&>(m).Lambertian::eval(ray_in, rec, dir);
+        case MATERIAL_METAL: return static_cast<const Metal&>(m).Metal::eval(ray_in, rec, dir);
+        case MATERIAL_DIFFUSE_LIGHT: return glm::vec3(0.0f);
+        default: return m.eval(ray_in, rec, dir);
+        }
+    }
+    static float pdf(const Material& m, const Ray& ray_in, const HitRecord& rec, const glm::vec3& dir) {
+        switch (m.kind) {
+        case MATERIAL_LAMBERTIAN: return static_cast<const Lambertian&>(m).Lambertian::pdf(ray_in, rec, dir);
+        case MATERIAL_METAL: return static_cast<const Metal&>(m).Metal::pdf(ray_in, rec, dir);
+        case MATERIAL_DIFFUSE_LIGHT: return 0.0f;
+        default: return m.pdf(ray_in, rec, dir);
+        }
+    }
+    static bool isSpecular(const Material& m) {
+        switch (m.kind) {
+        case MATERIAL_LAMBERTIAN:
+        case MATERIAL_DIFFUSE_LIGHT: return false;
+        case MATERIAL_METAL: return static_cast<const Metal&>(m).Metal::isSpecular();
+        default: return m.isSpecular();
+        }
+    }
+    static float spreadAngle(const Material& m, const HitRecord& rec) {
+        switch (m.kind) {
+        case MATERIAL_LAMBERTIAN: return static_cast<const Lambertian&>(m).Lambertian::spreadAngle(rec);
+        case MATERIAL_METAL: return static_cast<const Metal&>(m).Metal::spreadAngle(rec);
+        case MATERIAL_DIFFUSE_LIGHT: return 0.0f;
+        default: return m.spreadAngle(rec);
+        }
+    }
+    static glm::vec3 emitted(const Material& m) {
+        switch (m.kind) {
+        case MATERIAL_LAMBERTIAN:
+        case MATERIAL_METAL: return glm::vec3(0.0f);
+        case MATERIAL_DIFFUSE_LIGHT: return static_cast<const DiffuseLight&>(m).DiffuseLight::emitted();
+        default: return m.emitted();
+        }
+    }
 };
 
 // 确保reflect函数正确实现
@@ -0,0 +1,130 @@
+#pragma once
+
+// Length-prefixed messages over stream sockets, shared by the distributed
+// renderer and the render server. Payloads are flat copies of plain values
+// in host byte order. POSIX only.
+
+#ifndef _WIN32
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+namespace rt {
+
+struct MessageHeader {
+    std::uint32_t type;
+    std::uint32_t size;  // Bytes of payload that follow
+};
+
+inline bool sendAll(int fd, const void *data, std::size_t size)
+{
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;  // A closed peer is an error, not SIGPIPE
+#else
+    const int flags = 0;
+#endif
+    const char *p = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t n = ::send(fd, p, size, flags);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        p += n;
+        size -= std::size_t(n);
+    }
+    return true;
+}
+
+inline bool receiveAll(int fd, void *data, std::size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }  // Closed, reset or timed out
+        p += n;
+        size -= std::size_t(n);
+    }
+    return true;
+}
+
+// The payload may come in two parts, e.g. a fixed header and pixel data
+inline bool sendMessage(int fd, std::uint32_t type, const void *payload, std::size_t size,
+                        const void *extra = nullptr, std::size_t extra_size = 0)
+{
+    MessageHeader header = {type, std::uint32_t(size + extra_size)};
+    return sendAll(fd, &header, sizeof(header)) && (size == 0 || sendAll(fd, payload, size)) &&
+           (extra_size == 0 || sendAll(fd, extra, extra_size));
+}
+
+inline bool receiveMessage(int fd, MessageHeader &header, std::vector<char> &payload)
+{
+    if (!receiveAll(fd, &header, sizeof(header))) { return false; }
+    payload.resize(header.size);
+    return header.size == 0 || receiveAll(fd, payload.data(), header.size);
+}
+
+// Flat serialization of plain values (including glm vectors and matrices)
+// and strings
+class MessageWriter {
+  public:
+    template <typename T>
+    void put(const T &value)
+    {
+        const char *p = reinterpret_cast<const char *>(&value);
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+    void putString(const std::string &s)
+    {
+        put(std::uint32_t(s.size()));
+        data.insert(data.end(), s.begin(), s.end());
+    }
+
+    std::vector<char> data;
+};
+
+// Reads what MessageWriter wrote; `ok` turns false on a short payload
+class MessageReader {
+  public:
+    explicit MessageReader(const std::vector<char> &d) : data(d) {}
+
+    template <typename T>
+    T get()
+    {
+        T value = T();
+        if (offset + sizeof(T) > data.size()) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(static_cast<void *>(&value), &data[offset], sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+    std::string getString()
+    {
+        std::uint32_t size = get<std::uint32_t>();
+        if (!ok || offset + size > data.size()) {
+            ok = false;
+            return std::string();
+        }
+        std::string s(&data[offset], size);
+        offset += size;
+        return s;
+    }
+
+    bool ok = true;
+
+  private:
+    const std::vector<char> &data;
+    std::size_t offset = 0;
+};
+
+}  // namespace rt
+
+#endif  // _WIN32
@@ -0,0 +1,218 @@
+#include "rt_procedural.h"
+#include "rt_aabb.h"
+
+#include "cg_utils2.h"
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace rt {
+
+namespace {
+
+const char kPrefix[] = "procedural:";
+const float kCellSize = 0.3f;  // One object per cell
+
+// PCG32 (O'Neill), so that a seed does not depend on the standard library
+struct Pcg32 {
+    std::uint64_t state = 0;
+    std::uint64_t inc;
+
+    explicit Pcg32(std::uint64_t seed, std::uint64_t stream = 0x5851f42d4c957f2dull)
+        : inc((stream << 1) | 1u)
+    {
+        next();
+        state += seed;
+        next();
+    }
+
+    std::uint32_t next()
+    {
+        std::uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        std::uint32_t xorshifted = std::uint32_t(((old >> 18u) ^ old) >> 27u);
+        std::uint32_t rot = std::uint32_t(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // In [lo, hi)
+    float uniform(float lo, float hi)
+    {
+        return lo + (hi - lo) * float(next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // In [0, n)
+    std::uint32_t below(std::uint32_t n)
+    {
+        return std::uint32_t((std::uint64_t(next()) * n) >> 32);
+    }
+
+    std::size_t index(std::size_t n)
+    {
+        if (n <= 0xffffffffu) { return below(std::uint32_t(n)); }
+        return std::size_t(((std::uint64_t(next()) << 32) | next()) % n);
+    }
+};
+
+// Triangle corners of a mesh fitted into a unit cube standing on y = 0 and
+// centered on the vertical axis
+struct MeshTemplate {
+    std::vector<glm::vec3> corners;
+
+    std::size_t triangles() const
+    {
+        return corners.size() / 3;
+    }
+};
+
+bool loadTemplate(const std::string &filename, MeshTemplate &mesh)
+{
+    cg::OBJMeshUV obj;
+    if (!cg::objMeshUVLoad(obj, filename) || obj.indices.size() < 3) { return false; }
+    AABB bounds;
+    for (const glm::vec3 &v : obj.vertices) { bounds.grow(AABB(v, v)); }
+    glm::vec3 origin(bounds.center().x, bounds.lo.y, bounds.center().z);
+    float scale = 1.0f / glm::max(glm::compMax(bounds.extent()), 1e-20f);
+    mesh.corners.reserve(obj.indices.size() - obj.indices.size() % 3);
+    for (size_t i = 0; i + 2 < obj.indices.size(); i += 3) {
+        for (int k = 0; k < 3; ++k) {
+            mesh.corners.push_back((obj.vertices[obj.indices[i + k]] - origin) * scale);
+        }
+    }
+    return true;
+}
+
+// Top of the ground sphere above (x, z)
+float groundHeight(float x, float z)
+{
+    return -1000.5f + std::sqrt(glm::max(1e6f - x * x - z * z, 0.0f));
+}
+
+enum ObjectKind { OBJECT_SPHERE = 0, OBJECT_BOX, OBJECT_MESH };
+
+}  // namespace
+
+bool parseProceduralScene(const std::string &name, ProceduralParams &params)
+{
+    const std::size_t prefix = sizeof(kPrefix) - 1;
+    if (name.compare(0, prefix, kPrefix) != 0) { return false; }
+    const char *p = name.c_str() + prefix;
+    char *end;
+    unsigned long long primitives = std::strtoull(p, &end, 10);
+    if (end == p || *end != ':') { return false; }
+    p = end + 1;
+    unsigned long seed = std::strtoul(p, &end, 10);
+    if (end == p || (*end != ':' && *end != '\0')) { return false; }
+
+    params.primitives = std::size_t(primitives);
+    params.seed = std::uint32_t(seed);
+    params.meshes.clear();
+    if (*end == ':') {
+        // Mesh paths may hold colons themselves, so everything left is the list
+        std::string list(end + 1);
+        std::size_t start = 0;
+        while (start < list.size()) {
+            std::size_t comma = std::min(list.find(',', start), list.size());
+            if (comma > start) { params.meshes.push_back(list.substr(start, comma - start)); }
+            start = comma + 1;
+        }
+    }
+    return true;
+}
+
+std::string proceduralSceneName(const ProceduralParams &params)
+{
+    std::string name =
+        kPrefix + std::to_string(params.primitives) + ":" + std::to_string(params.seed);
+    for (size_t i = 0; i < params.meshes.size(); ++i) {
+        name += (i == 0 ? ":" : ",") + params.meshes[i];
+    }
+    return name;
+}
+
+void generateProceduralScene(const ProceduralParams &params,
+                             const std::vector<Material *> &palette,
+                             std::vector<Sphere> &spheres, std::vector<Box> &boxes,
+                             std::vector<Triangle> &triangles)
+{
+    std::vector<MeshTemplate> meshes;
+    for (const std::string &filename : params.meshes) {
+        MeshTemplate mesh;
+        if (loadTemplate(filename, mesh)) {
+            meshes.push_back(mesh);
+        } else {
+            std::cerr << "Could not load " << filename << std::endl;
+        }
+    }
+    std::size_t smallest = ~std::size_t(0);
+    for (const MeshTemplate &mesh : meshes) { smallest = std::min(smallest, mesh.triangles()); }
+
+    // Whole mesh copies while one still fits in the triangle share; the rest
+    // becomes spheres, so that the total is exact
+    Pcg32 rng(params.seed);
+    std::size_t box_count = params.primitives * 3 / 10;
+    std::size_t triangle_budget = params.primitives - params.primitives * 4 / 10 - box_count;
+    std::vector<std::uint32_t> copies;
+    std::size_t triangle_count = 0;
+    while (triangle_budget - triangle_count >= smallest) {
+        std::uint32_t index = rng.below(std::uint32_t(meshes.size()));
+        if (meshes[index].triangles() > triangle_budget - triangle_count) { continue; }
+        copies.push_back(index);
+        triangle_count += meshes[index].triangles();
+    }
+    std::size_t sphere_count = params.primitives - box_count - triangle_count;
+
+    // Shuffled kinds, one per cell of a square grid centered on the origin
+    std::vector<std::uint8_t> kinds(sphere_count + box_count + copies.size(), OBJECT_SPHERE);
+    std::fill(kinds.begin() + sphere_count, kinds.begin() + sphere_count + box_count,
+              std::uint8_t(OBJECT_BOX));
+    std::fill(kinds.begin() + sphere_count + box_count, kinds.end(), std::uint8_t(OBJECT_MESH));
+    for (std::size_t i = kinds.size(); i > 1; --i) {
+        std::swap(kinds[i - 1], kinds[rng.index(i)]);
+    }
+    std::size_t side = std::size_t(std::ceil(std::sqrt(double(kinds.size()))));
+    float half_extent = 0.5f * kCellSize * float(side);
+
+    spheres.reserve(spheres.size() + sphere_count);
+    boxes.reserve(boxes.size() + box_count);
+    triangles.reserve(triangles.size() + triangle_count);
+    std::size_t next_copy = 0;
+    for (std::size_t i = 0; i < kinds.size(); ++i) {
+        float cell_x = -half_extent + kCellSize * (float(i % side) + 0.5f);
+        float cell_z = -half_extent + kCellSize * (float(i / side) + 0.5f);
+        Material *material = palette[rng.below(std::uint32_t(palette.size()))];
+        // `size` bounds the object's half extent in x and z; the object is
+        // jittered as far as it stays inside its cell
+        float size = rng.uniform(0.03f, 0.1f);
+        float jitter = 0.5f * kCellSize - size;
+        float x = cell_x + rng.uniform(-jitter, jitter);
+        float z = cell_z + rng.uniform(-jitter, jitter);
+        float y = groundHeight(x, z);
+
+        if (kinds[i] == OBJECT_SPHERE) {
+            spheres.push_back(Sphere(glm::vec3(x, y + size, z), size, material));
+        } else if (kinds[i] == OBJECT_BOX) {
+            glm::vec3 radius(size, rng.uniform(0.02f, 0.15f), rng.uniform(0.3f, 1.0f) * size);
+            if (rng.below(2u)) { std::swap(radius.x, radius.z); }
+            boxes.push_back(Box(glm::vec3(x, y + radius.y, z), radius, material));
+        } else {
+            const MeshTemplate &mesh = meshes[copies[next_copy++]];
+            float angle = rng.uniform(0.0f, glm::two_pi<float>());
+            float c = std::cos(angle), s = std::sin(angle);
+            float scale = glm::root_two<float>() * size;  // Any turn stays within `size`
+            glm::vec3 corners[3];
+            for (std::size_t t = 0; t < mesh.corners.size(); t += 3) {
+                for (int k = 0; k < 3; ++k) {
+                    glm::vec3 v = mesh.corners[t + k] * scale;
+                    corners[k] = glm::vec3(x + c * v.x + s * v.z, y + v.y, z - s * v.x + c * v.z);
+                }
+                triangles.push_back(Triangle(corners[0], corners[1], corners[2], material));
+            }
+        }
+    }
+}
+
+}  // namespace rt
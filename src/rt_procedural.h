@@ -0,0 +1,38 @@
+#pragma once
+
+#include "rt_box.h"
+#include "rt_material.h"
+#include "rt_sphere.h"
+#include "rt_triangle.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rt {
+
+// Procedural scenes are named like mesh files, as
+// "procedural:<primitives>:<seed>[:<mesh.obj>,<mesh.obj>...]", so that they
+// go through scene loading, the scene cache and distributed rendering unchanged
+struct ProceduralParams {
+    std::size_t primitives = 1000;
+    std::uint32_t seed = 1;
+    std::vector<std::string> meshes;  // OBJ files copied into the scene
+};
+
+bool parseProceduralScene(const std::string &name, ProceduralParams &params);
+std::string proceduralSceneName(const ProceduralParams &params);
+
+// Scatters `params.primitives` primitives on the ground sphere (radius 1000,
+// top at y = -0.5): about 40% spheres, 30% boxes and 30% triangles in whole
+// copies of the meshes, each scaled, turned about the vertical and placed.
+// Objects are one to a jittered grid cell, so the field grows with the count
+// at constant density. Materials are drawn from `palette`. The same
+// parameters give the same scene on every platform.
+void generateProceduralScene(const ProceduralParams &params,
+                             const std::vector<Material *> &palette,
+                             std::vector<Sphere> &spheres, std::vector<Box> &boxes,
+                             std::vector<Triangle> &triangles);
+
+}  // namespace rt
@@ -0,0 +1,336 @@
+#include "rt_qbvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace rt {
+
+namespace {
+
+typedef std::vector<std::pair<std::uint32_t, std::uint32_t> > LeafRanges;
+
+const std::uint32_t kWide = 0xffffffffu;  // Leaf::base of leaves with full indices
+const std::uint8_t kDefaultUV = 0x80;     // Triangle flag: Triangle's default texcoords
+
+// Writes the outward-rounded planes of `child` within `box` to child slot
+// `c` of `node` and returns the box the traversal will decode
+AABB quantize(const AABB &child, const AABB &box, QBVHNode &node, int c)
+{
+    glm::vec3 scale = box.extent() * (1.0f / 255.0f);
+    for (int k = 0; k < 3; ++k) {
+        int lo = 0;
+        int hi = 255;
+        if (scale[k] > 0.0f) {
+            lo = glm::clamp(int(std::floor((child.lo[k] - box.lo[k]) / scale[k])), 0, 255);
+            hi = glm::clamp(int(std::ceil((child.hi[k] - box.lo[k]) / scale[k])), 0, 255);
+        }
+        // Step outwards until the decoded planes, with their own rounding, hold
+        while (lo > 0 && dequantize(box.lo[k], box.hi[k], scale[k], std::uint8_t(lo)) > child.lo[k]) {
+            --lo;
+        }
+        while (hi < 255 && dequantize(box.lo[k], box.hi[k], scale[k], std::uint8_t(hi)) < child.hi[k]) {
+            ++hi;
+        }
+        node.lo[c][k] = std::uint8_t(lo);
+        node.hi[c][k] = std::uint8_t(hi);
+    }
+    return decodeChild(node, c, box);
+}
+
+struct Converter {
+    const ArenaVector<BVHNode> &source;
+    ArenaVector<QBVHNode> &nodes;
+    LeafRanges &ranges;
+
+    Converter(const ArenaVector<BVHNode> &s, ArenaVector<QBVHNode> &n, LeafRanges &r)
+        : source(s), nodes(n), ranges(r)
+    {
+    }
+
+    std::uint32_t leaf(std::uint32_t first, std::uint32_t count, const AABB &box)
+    {
+        if (count <= std::uint32_t(kQMaxLeafSize)) {
+            std::uint32_t index = std::uint32_t(ranges.size());
+            ranges.push_back(std::make_pair(first, count));
+            return kQLeafFlag | ((count - 1) << kQLeafCountShift) | index;
+        }
+        // Leaves cut off by the builder's depth limit are split in halves
+        // under nodes whose children share their box
+        std::uint32_t q = std::uint32_t(nodes.size());
+        nodes.push_back(QBVHNode());
+        std::uint32_t half = count / 2;
+        for (int c = 0; c < 2; ++c) {
+            for (int k = 0; k < 3; ++k) {
+                nodes[q].lo[c][k] = 0;
+                nodes[q].hi[c][k] = 255;
+            }
+        }
+        std::uint32_t left = leaf(first, half, box);
+        nodes[q].child[0] = left;
+        std::uint32_t right = leaf(first + half, count - half, box);
+        nodes[q].child[1] = right;
+        return q;
+    }
+
+    // Reference to source node `index`, whose decoded box is `box`
+    std::uint32_t convert(std::uint32_t index, const AABB &box)
+    {
+        const BVHNode &node = source[index];
+        if (node.count > 0) { return leaf(node.offset, node.count, box); }
+
+        std::uint32_t q = std::uint32_t(nodes.size());
+        nodes.push_back(QBVHNode());
+        std::uint32_t children[2] = {index + 1, node.offset};
+        for (int c = 0; c < 2; ++c) {
+            const BVHNode &child = source[children[c]];
+            AABB decoded = quantize(AABB(child.lo, child.hi), box, nodes[q], c);
+            std::uint32_t ref = convert(children[c], decoded);
+            nodes[q].child[c] = ref;  // `nodes` may have grown meanwhile
+        }
+        return q;
+    }
+};
+
+// Welding key: a corner's position and texture coordinates, bit for bit
+struct CornerKey {
+    std::uint32_t bits[5];
+
+    bool operator==(const CornerKey &other) const
+    {
+        return std::memcmp(bits, other.bits, sizeof(bits)) == 0;
+    }
+};
+
+struct CornerHash {
+    std::size_t operator()(const CornerKey &key) const
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (int i = 0; i < 5; ++i) { hash = (hash ^ key.bits[i]) * 1099511628211ull; }
+        return std::size_t(hash);
+    }
+};
+
+CornerKey cornerKey(const glm::vec3 &p, const glm::vec2 &uv)
+{
+    float values[5] = {p.x, p.y, p.z, uv.x, uv.y};
+    CornerKey key;
+    std::memcpy(key.bits, values, sizeof(values));
+    return key;
+}
+
+bool hasDefaultUV(const Triangle &tri)
+{
+    return tri.t0 == glm::vec2(0.0f) && tri.t1 == glm::vec2(1.0f, 0.0f) &&
+           tri.t2 == glm::vec2(0.0f, 1.0f);
+}
+
+template <typename T>
+void reset(ArenaVector<T> &v, Arena *arena)
+{
+    v = ArenaVector<T>(ArenaAllocator<T>(arena));
+}
+
+template <typename T>
+std::size_t capacityBytes(const ArenaVector<T> &v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+}  // namespace
+
+void QBVH::convert(const BVH &source, LeafRanges &leaf_ranges, Arena *arena)
+{
+    nodes = ArenaVector<QBVHNode>(ArenaAllocator<QBVHNode>(arena));
+    leaf_ranges.clear();
+    leaf_count = 0;
+    if (source.empty()) { return; }
+
+    // Interior nodes are about half the source's; leaves need no node
+    nodes.reserve(source.nodes.size() / 2 + 1);
+    bounds = AABB(source.nodes[0].lo, source.nodes[0].hi);
+    Converter converter(source.nodes, nodes, leaf_ranges);
+    root = converter.convert(0, bounds);
+    leaf_count = std::uint32_t(leaf_ranges.size());
+}
+
+bool CompressedMesh::build(const Triangle *triangles, std::size_t count, int max_leaf_size,
+                           Arena *arena)
+{
+    reset(bvh.nodes, arena);
+    bvh.leaf_count = 0;
+    reset(leaves, arena);
+    reset(positions, arena);
+    reset(texcoords, arena);
+    reset(narrow, arena);
+    reset(wide, arena);
+    reset(triangle_flags, arena);
+    reset(materials, arena);
+    if (count == 0) { return true; }
+
+    // Material table; flags hold 7 bits of index
+    std::vector<std::uint8_t> flags(count);
+    bool any_uv = false;
+    for (std::size_t i = 0; i < count; ++i) {
+        const Triangle &tri = triangles[i];
+        std::size_t m = std::find(materials.begin(), materials.end(), tri.mat_ptr) - materials.begin();
+        if (m == materials.size()) {
+            if (m >= kDefaultUV) {
+                reset(materials, arena);
+                return false;
+            }
+            materials.push_back(tri.mat_ptr);
+        }
+        bool default_uv = hasDefaultUV(tri);
+        any_uv = any_uv || !default_uv;
+        flags[i] = std::uint8_t(m | (default_uv ? kDefaultUV : 0));
+    }
+
+    // The usual binned-SAH tree, then quantized
+    std::vector<AABB> bounds(count);
+    for (std::size_t i = 0; i < count; ++i) { bounds[i] = triangles[i].bounds(); }
+    BVH source;
+    std::vector<std::uint32_t> order;
+    source.build(bounds, std::min(max_leaf_size, kQMaxLeafSize), order);
+    LeafRanges ranges;
+    bvh.convert(source, ranges, arena);
+    source.clear();
+    std::vector<AABB>().swap(bounds);
+
+    // Weld identical corners, numbering vertices in first-use order over the
+    // leaves so that most leaves reference a narrow range
+    std::unordered_map<CornerKey, std::uint32_t, CornerHash> ids;
+    ids.reserve(count);
+    std::vector<glm::vec3> welded;
+    std::vector<glm::vec2> welded_uv;
+    std::vector<std::uint32_t> corner(3 * count);
+    triangle_flags.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const Triangle &tri = triangles[order[i]];
+        std::uint8_t f = flags[order[i]];
+        triangle_flags.push_back(f);
+        const glm::vec3 *p[3] = {&tri.v0, &tri.v1, &tri.v2};
+        const glm::vec2 *uv[3] = {&tri.t0, &tri.t1, &tri.t2};
+        for (int k = 0; k < 3; ++k) {
+            glm::vec2 t = (f & kDefaultUV) ? glm::vec2(0.0f) : *uv[k];
+            std::pair<std::unordered_map<CornerKey, std::uint32_t, CornerHash>::iterator, bool> entry =
+                ids.insert(std::make_pair(cornerKey(*p[k], t), std::uint32_t(welded.size())));
+            if (entry.second) {
+                welded.push_back(*p[k]);
+                welded_uv.push_back(t);
+            }
+            corner[3 * i + k] = entry.first->second;
+        }
+    }
+    positions.assign(welded.begin(), welded.end());
+    if (any_uv) { texcoords.assign(welded_uv.begin(), welded_uv.end()); }
+
+    // Leaves whose corners span at most 16 bits store offsets from their lowest
+    std::vector<std::uint32_t> base(ranges.size(), kWide);
+    std::size_t narrow_size = 0;
+    for (std::size_t l = 0; l < ranges.size(); ++l) {
+        const std::uint32_t *begin = &corner[3 * ranges[l].first];
+        const std::uint32_t *end = begin + 3 * ranges[l].second;
+        std::uint32_t lo = *std::min_element(begin, end);
+        if (*std::max_element(begin, end) - lo <= 0xffff) {
+            base[l] = lo;
+            narrow_size += end - begin;
+        }
+    }
+    leaves.reserve(ranges.size());
+    narrow.reserve(narrow_size);
+    wide.reserve(3 * count - narrow_size);
+    for (std::size_t l = 0; l < ranges.size(); ++l) {
+        const std::uint32_t *begin = &corner[3 * ranges[l].first];
+        const std::uint32_t *end = begin + 3 * ranges[l].second;
+        Leaf leaf = {ranges[l].first, 0, base[l]};
+        if (base[l] != kWide) {
+            leaf.indices = std::uint32_t(narrow.size());
+            for (const std::uint32_t *c = begin; c != end; ++c) {
+                narrow.push_back(std::uint16_t(*c - base[l]));
+            }
+        } else {
+            leaf.indices = std::uint32_t(wide.size());
+            wide.insert(wide.end(), begin, end);
+        }
+        leaves.push_back(leaf);
+    }
+    return true;
+}
+
+std::size_t CompressedMesh::bytes() const
+{
+    return capacityBytes(bvh.nodes) + capacityBytes(leaves) + capacityBytes(positions) +
+           capacityBytes(texcoords) + capacityBytes(narrow) + capacityBytes(wide) +
+           capacityBytes(triangle_flags) + capacityBytes(materials);
+}
+
+inline void CompressedMesh::corners(const Leaf &leaf, std::uint32_t i, std::uint32_t v[3]) const
+{
+    if (leaf.base == kWide) {
+        const std::uint32_t *w = &wide[leaf.indices + 3 * i];
+        v[0] = w[0];
+        v[1] = w[1];
+        v[2] = w[2];
+    } else {
+        const std::uint16_t *n = &narrow[leaf.indices + 3 * i];
+        v[0] = leaf.base + n[0];
+        v[1] = leaf.base + n[1];
+        v[2] = leaf.base + n[2];
+    }
+}
+
+Triangle CompressedMesh::triangle(const Leaf &leaf, std::uint32_t i) const
+{
+    std::uint32_t v[3];
+    corners(leaf, i, v);
+    std::uint8_t f = triangle_flags[leaf.first + i];
+    Triangle tri(positions[v[0]], positions[v[1]], positions[v[2]], materials[f & (kDefaultUV - 1)]);
+    if (!(f & kDefaultUV)) {
+        tri.t0 = texcoords[v[0]];
+        tri.t1 = texcoords[v[1]];
+        tri.t2 = texcoords[v[2]];
+    }
+    return tri;
+}
+
+const TriangleSoA &CompressedMesh::gather(const Leaf &leaf, std::uint32_t count) const
+{
+    static thread_local TriangleSoA batch;
+    if (batch.size == 0) { batch.allocate(kQMaxLeafSize); }
+    for (std::uint32_t i = 0; i < count; ++i) {
+        std::uint32_t v[3];
+        corners(leaf, i, v);
+        batch.set(int(i), positions[v[0]], positions[v[1]], positions[v[2]]);
+    }
+    return batch;
+}
+
+bool CompressedMesh::closest(const Ray &r, float t_min, float &t_max, Triangle &hit) const
+{
+    const Leaf *hit_leaf = nullptr;
+    int hit_index = -1;
+    bvh.traverse(r, t_min, t_max, [&](std::uint32_t index, std::uint32_t count, float &t_far) {
+        RT_STAT_ADD(stats::TRIANGLE_TESTS, count);
+        const Leaf &leaf = leaves[index];
+        int i = closestTriangle(gather(leaf, count), 0, int(count), r, t_min, t_far);
+        if (i < 0) { return false; }
+        hit_leaf = &leaf;
+        hit_index = i;
+        return true;
+    });
+    if (!hit_leaf) { return false; }
+    hit = triangle(*hit_leaf, std::uint32_t(hit_index));
+    return true;
+}
+
+bool CompressedMesh::occluded(const Ray &r, float t_min, float t_max) const
+{
+    return bvh.occluded(r, t_min, t_max, [&](std::uint32_t index, std::uint32_t count, float &t_far) {
+        RT_STAT_ADD(stats::TRIANGLE_TESTS, count);
+        return closestTriangle(gather(leaves[index], count), 0, int(count), r, t_min, t_far) >= 0;
+    });
+}
+
+}  // namespace rt
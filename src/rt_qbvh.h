@@ -0,0 +1,244 @@
+#pragma once
+
+#include "rt_arena.h"
+#include "rt_bvh.h"
+#include "rt_soa.h"
+#include "rt_stats.h"
+#include "rt_triangle.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace rt {
+
+// Child reference of a compressed node: the index of an interior node, or a
+// leaf with kQLeafFlag set, count - 1 in the next 5 bits and the leaf index
+// in the low 26 bits
+const std::uint32_t kQLeafFlag = 0x80000000u;
+const int kQLeafCountShift = 26;
+const std::uint32_t kQLeafIndexMask = (1u << kQLeafCountShift) - 1;
+const int kQMaxLeafSize = 32;
+
+// 20-byte node of a quantized BVH. Both children's boxes are stored with 8
+// bits per plane relative to this node's own box as decoded by its parent,
+// rounded outwards so that a decoded box always contains the exact one.
+// Leaf-only children need no node of their own.
+struct QBVHNode {
+    std::uint8_t lo[2][3];
+    std::uint8_t hi[2][3];
+    std::uint32_t child[2];
+};
+
+// Plane q of 0..255 across [lo, hi]. The top value maps to hi exactly, so
+// that rounding in the scale can never shrink a box.
+inline float dequantize(float lo, float hi, float scale, std::uint8_t q)
+{
+    return q == 255 ? hi : lo + float(q) * scale;
+}
+
+inline AABB decodeChild(const QBVHNode &node, int c, const AABB &box)
+{
+    glm::vec3 scale = box.extent() * (1.0f / 255.0f);
+    AABB child;
+    for (int k = 0; k < 3; ++k) {
+        child.lo[k] = dequantize(box.lo[k], box.hi[k], scale[k], node.lo[c][k]);
+        child.hi[k] = dequantize(box.lo[k], box.hi[k], scale[k], node.hi[c][k]);
+    }
+    return child;
+}
+
+// Binary BVH with quantized nodes, converted from a BVH built as usual. The
+// root box is kept in full precision; every other box is decoded on the way
+// down, so the traversal stack carries boxes along with node references.
+class QBVH {
+  public:
+    ArenaVector<QBVHNode> nodes;
+    AABB bounds;
+    std::uint32_t root = 0;  // Node 0, or a leaf when the whole tree is one
+    std::uint32_t leaf_count = 0;
+
+    bool empty() const
+    {
+        return leaf_count == 0;
+    }
+
+    // Quantizes `source`. Leaves are numbered in depth-first order and their
+    // primitive ranges (first, count) appended to `leaf_ranges`; leaves over
+    // kQMaxLeafSize are split.
+    void convert(const BVH &source, std::vector<std::pair<std::uint32_t, std::uint32_t> > &leaf_ranges,
+                 Arena *arena = nullptr);
+
+    // Closest-hit traversal with the same contract as BVH::traverse, except
+    // that `leaf(index, count, t_max)` is given a leaf index
+    template <typename LeafFn>
+    bool traverse(const Ray &r, float t_min, float &t_max, LeafFn leaf) const;
+    template <typename LeafFn>
+    bool occluded(const Ray &r, float t_min, float t_max, LeafFn leaf) const;
+};
+
+// Compact static triangle mesh for meshes that would not fit the memory
+// budget as Triangle copies, SoA arrays and float BVH nodes. Identical
+// corners are welded into a shared vertex array, numbered in first-use order
+// over the leaves. Each leaf stores its corners as 16-bit offsets from a base
+// vertex, or as full indices when they span too far. Triangles of a leaf are
+// decoded into a SoA batch on the fly and tested with the usual kernels.
+class CompressedMesh {
+  public:
+    // Returns false, leaving the mesh empty, if the triangles use more
+    // materials than a triangle can reference
+    bool build(const Triangle *triangles, std::size_t count, int max_leaf_size,
+               Arena *arena = nullptr);
+    bool empty() const
+    {
+        return bvh.empty();
+    }
+    std::size_t triangleCount() const
+    {
+        return triangle_flags.size();
+    }
+    std::size_t vertexCount() const
+    {
+        return positions.size();
+    }
+    std::size_t bytes() const;
+
+    // Closest hit in (t_min, t_max): shrinks t_max and decodes the triangle
+    // that was hit, with its material and texture coordinates, into `hit`
+    bool closest(const Ray &r, float t_min, float &t_max, Triangle &hit) const;
+    bool occluded(const Ray &r, float t_min, float t_max) const;
+
+  private:
+    struct Leaf {
+        std::uint32_t first;    // First triangle; triangles are stored in leaf order
+        std::uint32_t indices;  // First entry in narrow (3 per triangle) or wide
+        std::uint32_t base;     // Vertex the narrow offsets are relative to, or all ones
+    };
+
+    void corners(const Leaf &leaf, std::uint32_t i, std::uint32_t v[3]) const;
+    Triangle triangle(const Leaf &leaf, std::uint32_t i) const;
+    // Decodes a leaf's triangles into the calling thread's scratch batch
+    const TriangleSoA &gather(const Leaf &leaf, std::uint32_t count) const;
+
+    QBVH bvh;
+    ArenaVector<Leaf> leaves;
+    ArenaVector<glm::vec3> positions;
+    ArenaVector<glm::vec2> texcoords;  // Per vertex; empty if no triangle has any
+    ArenaVector<std::uint16_t> narrow;
+    ArenaVector<std::uint32_t> wide;
+    ArenaVector<std::uint8_t> triangle_flags;  // Material index, default texcoords bit
+    ArenaVector<Material *> materials;
+};
+
+template <typename LeafFn>
+bool QBVH::traverse(const Ray &r, float t_min, float &t_max, LeafFn leaf) const
+{
+    if (empty()) { return false; }
+
+    struct Entry {
+        std::uint32_t ref;
+        float t_near;
+        AABB box;
+    } stack[64];
+    int stack_size = 0;
+
+    float t_near;
+    if (!intersectBox(bounds.lo, bounds.hi, r, t_min, t_max, t_near)) { return false; }
+
+    bool hit = false;
+    std::uint32_t ref = root;
+    AABB box = bounds;
+    while (true) {
+        RT_STAT_INC(stats::BVH_NODES);
+        if (ref & kQLeafFlag) {
+            std::uint32_t count = ((ref & ~kQLeafFlag) >> kQLeafCountShift) + 1;
+            hit = leaf(ref & kQLeafIndexMask, count, t_max) || hit;
+        } else {
+            // Visit the nearer child first and defer the other one
+            const QBVHNode &node = nodes[ref];
+            AABB box_a = decodeChild(node, 0, box);
+            AABB box_b = decodeChild(node, 1, box);
+            float t_a, t_b;
+            bool hit_a = intersectBox(box_a.lo, box_a.hi, r, t_min, t_max, t_a);
+            bool hit_b = intersectBox(box_b.lo, box_b.hi, r, t_min, t_max, t_b);
+            if (hit_a && hit_b) {
+                int first = t_b < t_a ? 1 : 0;
+                stack[stack_size].ref = node.child[1 - first];
+                stack[stack_size].t_near = first ? t_a : t_b;
+                stack[stack_size].box = first ? box_a : box_b;
+                ++stack_size;
+                ref = node.child[first];
+                box = first ? box_b : box_a;
+                continue;
+            }
+            if (hit_a || hit_b) {
+                ref = node.child[hit_a ? 0 : 1];
+                box = hit_a ? box_a : box_b;
+                continue;
+            }
+        }
+
+        // Pop the next subtree that can still contain a closer hit
+        while (stack_size > 0 && stack[stack_size - 1].t_near > t_max) { --stack_size; }
+        if (stack_size == 0) { break; }
+        --stack_size;
+        ref = stack[stack_size].ref;
+        box = stack[stack_size].box;
+    }
+    return hit;
+}
+
+template <typename LeafFn>
+bool QBVH::occluded(const Ray &r, float t_min, float t_max, LeafFn leaf) const
+{
+    if (empty()) { return false; }
+
+    struct Entry {
+        std::uint32_t ref;
+        AABB box;
+    } stack[64];
+    int stack_size = 0;
+
+    float t_near;
+    if (!intersectBox(bounds.lo, bounds.hi, r, t_min, t_max, t_near)) { return false; }
+
+    std::uint32_t ref = root;
+    AABB box = bounds;
+    while (true) {
+        RT_STAT_INC(stats::BVH_NODES);
+        if (ref & kQLeafFlag) {
+            std::uint32_t count = ((ref & ~kQLeafFlag) >> kQLeafCountShift) + 1;
+            float t_far = t_max;
+            if (leaf(ref & kQLeafIndexMask, count, t_far)) { return true; }
+        } else {
+            const QBVHNode &node = nodes[ref];
+            AABB box_a = decodeChild(node, 0, box);
+            AABB box_b = decodeChild(node, 1, box);
+            bool hit_a = intersectBox(box_a.lo, box_a.hi, r, t_min, t_max, t_near);
+            bool hit_b = intersectBox(box_b.lo, box_b.hi, r, t_min, t_max, t_near);
+            if (hit_a) {
+                if (hit_b) {
+                    stack[stack_size].ref = node.child[1];
+                    stack[stack_size].box = box_b;
+                    ++stack_size;
+                }
+                ref = node.child[0];
+                box = box_a;
+                continue;
+            }
+            if (hit_b) {
+                ref = node.child[1];
+                box = box_b;
+                continue;
+            }
+        }
+        if (stack_size == 0) { break; }
+        --stack_size;
+        ref = stack[stack_size].ref;
+        box = stack[stack_size].box;
+    }
+    return false;
+}
+
+}  // namespace rt
@@ -3,15 +3,29 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
 namespace rt {
 
-class Ray {
+// Ray with the per-ray terms every slab test needs precomputed: reciprocal
+// direction, which axes point backwards and the valid t range. Rows are
+// 16 bytes so each vector loads with its scalar neighbour in one go. Create
+// rays through the constructor so the cached terms stay in sync.
+class alignas(16) Ray {
   public:
     Ray() {}
-    Ray(const glm::vec3 &a, const glm::vec3 &b)
+    Ray(const glm::vec3 &a, const glm::vec3 &b, float t_min = 0.0f, float t_max = FLT_MAX)
     {
         A = a;
+        tmin = t_min;
         B = b;
+        tmax = t_max;
+        inv_B = 1.0f / b;
+        // From the sign bit, so that -0 counts as negative like its -inf inverse
+        signs = (std::signbit(b.x) ? 1u : 0u) | (std::signbit(b.y) ? 2u : 0u) |
+                (std::signbit(b.z) ? 4u : 0u);
     }
     glm::vec3 origin() const
     {
@@ -21,13 +35,35 @@ class Ray {
     {
         return B;
     }
+    // 1 / direction, with +-inf for axis-parallel rays
+    glm::vec3 inv_direction() const
+    {
+        return inv_B;
+    }
+    // Non-zero if the direction is negative along `axis`
+    std::uint32_t sign(int axis) const
+    {
+        return (signs >> axis) & 1u;
+    }
+    float t_min() const
+    {
+        return tmin;
+    }
+    float t_max() const
+    {
+        return tmax;
+    }
     glm::vec3 point_at_parameter(float t) const
     {
         return A + t * B;
     }
 
     glm::vec3 A;
+    float tmin = 0.0f;
     glm::vec3 B;
+    float tmax = FLT_MAX;
+    glm::vec3 inv_B;
+    std::uint32_t signs = 0;  // Bit k set if B[k] < 0
 };
 
 }  // namespace rt
@@ -4,154 +4,845 @@
 #include "rt_sphere.h"
 #include "rt_triangle.h"
 #include "rt_box.h"
+#include "rt_arena.h"
+#include "rt_bvh.h"
+#include "rt_qbvh.h"
+#include "rt_reorder.h"
+#include "rt_distributed.h"
+#include "rt_soa.h"
 #include "rt_material.h"  // 确保包含新的材质头文件
+#include "rt_light.h"
+#include "rt_envmap.h"
+#include "rt_guiding.h"
+#include "rt_irradiance.h"
+#include "rt_procedural.h"
+#include "rt_sampler.h"
+#include "rt_stats.h"
+#include "rt_stream.h"
+#include "rt_trace.h"
 
 #include "cg_utils2.h"
 #include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
 
 namespace rt {
 
-// 全局场景变量
-struct Scene {
-    Sphere ground;
+// Maximum primitives per BVH leaf; analytic leaves are tested as one SIMD batch
+const int kSoALeafSize = kSoAWidth;
+
+// Primitives as created by setupScene, before BVH reordering
+struct SceneInput {
     std::vector<Sphere> spheres;
     std::vector<Box> boxes;
     std::vector<Triangle> mesh;
-    Box mesh_bbox;  // 網格的包圍盒
-    std::vector<Material*> materials;
-    
-    // 析構函數清理材質
-    ~Scene() {
-        for (auto material : materials) {
-            delete material;
-        }
+};
+
+// 全局场景变量. Everything a scene owns, including its materials, lives in
+// its arena, so dropping a scene frees a handful of blocks.
+struct Scene {
+    struct NamedMaterial {
+        const char *name;
+        Material *material;
+    };
+
+    Arena arena;  // Declared first so that it outlives the containers below
+    std::string mesh_filename;
+    ArenaVector<NamedMaterial> materials;  // Editable in place, see editMaterial
+    Material *mesh_material = nullptr;     // Driven by the material sliders
+    Sphere ground;
+    ArenaVector<Sphere> spheres;  // In sphere_bvh leaf order
+    ArenaVector<Box> boxes;       // In box_bvh leaf order
+    ArenaVector<Triangle> mesh;   // In mesh_bvh leaf order
+    ArenaVector<Light> lights;    // Emitters, also present in the geometry above
+    ArenaVector<float> light_cdf; // Running sum of luminance * area per light
+    float light_power = 0.0f;     // Sum over all lights, see updateLightDistribution
+    SphereSoA sphere_soa;
+    BoxSoA box_soa;
+    TriangleSoA mesh_soa;
+    BVH sphere_bvh;
+    BVH box_bvh;
+    BVH mesh_bvh;
+    CompressedMesh mesh_compressed;  // Replaces mesh, mesh_soa and mesh_bvh over the budget
+    StreamedMesh mesh_streamed;      // Out-of-core mesh of a cluster file
+    ArenaVector<Triangle> rest_mesh;  // Unposed copy of `mesh` once animated, see animateScene
+    AABB rest_bounds;                 // Of the animated triangles at rest
+    AABB bounds;                      // Of everything but the ground, see buildAcceleration
+    float built_cost = 0.0f;          // mesh_bvh SAH cost right after its last (re)build
+    bool standard_materials = true;   // Only built-in materials, see StandardMaterials
+
+    Scene()
+        : materials(ArenaAllocator<NamedMaterial>(&arena)),
+          spheres(ArenaAllocator<Sphere>(&arena)),
+          boxes(ArenaAllocator<Box>(&arena)),
+          mesh(ArenaAllocator<Triangle>(&arena)),
+          lights(ArenaAllocator<Light>(&arena)),
+          light_cdf(ArenaAllocator<float>(&arena)),
+          rest_mesh(ArenaAllocator<Triangle>(&arena))
+    {
+    }
+
+    template <typename T, typename... Args>
+    Material *createMaterial(const char *name, Args &&... args)
+    {
+        Material *material = arena.create<T>(std::forward<Args>(args)...);
+        standard_materials = standard_materials && material->kind != MATERIAL_OTHER;
+        NamedMaterial entry = {name, material};
+        materials.push_back(entry);
+        return material;
+    }
+};
+
+// Scene being rendered; only touched by the render thread. Shared with the
+// scene cache, see activateCachedScene.
+std::shared_ptr<Scene> g_scene;
+
+// Environment lighting, independent of the scene; null when none is loaded
+std::unique_ptr<EnvironmentMap> g_environment;
+std::string g_environment_path;
+
+// Settings that change the light arriving anywhere in the scene, so that
+// what was learned about it must be dropped
+struct LightingSettings {
+    const EnvironmentMap *environment = nullptr;
+    bool use_environment = false;
+    float environment_intensity = 0.0f;
+    glm::vec3 ground_color = glm::vec3(0.0f);
+    glm::vec3 sky_color = glm::vec3(0.0f);
+
+    LightingSettings() {}
+    explicit LightingSettings(const RTContext &rtx)
+        : environment(g_environment.get()),
+          use_environment(rtx.use_environment),
+          environment_intensity(rtx.environment_intensity),
+          ground_color(rtx.ground_color),
+          sky_color(rtx.sky_color)
+    {
+    }
+    bool operator==(const LightingSettings &other) const
+    {
+        return environment == other.environment && use_environment == other.use_environment &&
+               environment_intensity == other.environment_intensity &&
+               ground_color == other.ground_color && sky_color == other.sky_color;
+    }
+};
+
+// Irradiance records of g_scene and the settings they were traced with.
+// Scene, material and pose changes clear the cache directly (dropLearnedLight);
+// the settings are compared at every reset, see syncLearnedLight.
+struct IrradianceState {
+    IrradianceCache cache;
+    std::atomic<std::uint32_t> started;  // Records begun, which seeds their samples
+    LightingSettings lighting;
+    float error = 0.0f;
+
+    IrradianceState() : started(0) {}
+} g_irradiance;
+
+// Path guiding distributions of g_scene, kept like the irradiance records.
+// The radiance paths bring back also depends on the bounce count and on
+// next-event estimation, which takes emitters out of it.
+struct GuidingState {
+    GuidingField field;
+    int pass = 0;    // Training passes finished, see finishFrame
+    int frames = 0;  // Frames of the current pass
+    LightingSettings lighting;
+    int max_bounces = 0;
+    bool nee = false;
+} g_guiding;
+
+// What training needs of a path vertex that scattered through a guiding
+// cell; `cell` is null elsewhere
+struct GuidingVertex {
+    GuidingCell *cell;
+    glm::vec2 direction;  // Of the scattered ray, on the direction square
+    glm::vec3 weight;     // f * cos / pdf
+    float pdf;            // Of the mixture
+    float bsdf_pdf;
+    float guide_pdf;
+    float bsdf_fraction;
+};
+
+const float kInvFourPi = 0.25f * glm::one_over_pi<float>();
+
+// Set while the calling thread traces an irradiance record, whose own paths
+// must not end in the cache
+thread_local bool t_tracing_record = false;
+
+// Lights are picked in proportion to their power, so that the pdf of a point
+// on any light is luminance(emitted) / light_power per unit area. Must be
+// rerun when an emissive material changes.
+void updateLightDistribution(Scene &scene)
+{
+    scene.light_cdf.resize(scene.lights.size());
+    float sum = 0.0f;
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        const Light &light = scene.lights[i];
+        sum += luminance(light.material->emitted()) * light.area;
+        scene.light_cdf[i] = sum;
+    }
+    scene.light_power = sum;
+}
+
+// Build a BVH over `input` and store the primitives in leaf order in `prims`
+template <typename Prim>
+void buildBVH(BVH &bvh, const std::vector<Prim> &input, ArenaVector<Prim> &prims, Arena &arena,
+              int max_leaf_size)
+{
+    std::vector<AABB> bounds(input.size());
+    for (size_t i = 0; i < input.size(); ++i) { bounds[i] = input[i].bounds(); }
+    std::vector<std::uint32_t> order;
+    bvh.build(bounds, max_leaf_size, order, &arena);
+
+    prims.reserve(input.size());
+    for (size_t i = 0; i < order.size(); ++i) { prims.push_back(input[order[i]]); }
+}
+
+// Memory a mesh takes as Triangle copies, SoA arrays and float BVH nodes.
+// Leaves hold a few triangles each, so there is at most one node per triangle.
+std::size_t fullMeshBytes(std::size_t triangles)
+{
+    return triangles * (sizeof(Triangle) + 12 * sizeof(float) + sizeof(BVHNode));
+}
+
+// Build acceleration structures and SoA copies from the scene input. A mesh
+// that would take more than `mesh_budget` bytes is stored compressed.
+void buildAcceleration(Scene &scene, const SceneInput &input, std::size_t mesh_budget)
+{
+    RT_TRACE_SCOPE("buildAcceleration");
+    // The extent path guiding covers; ground hits beyond it share the edge cells
+    for (const Sphere &sphere : input.spheres) { scene.bounds.grow(sphere.bounds()); }
+    for (const Box &box : input.boxes) { scene.bounds.grow(box.bounds()); }
+    for (const Triangle &tri : input.mesh) { scene.bounds.grow(tri.bounds()); }
+    scene.bounds.grow(scene.mesh_streamed.bounds());
+    buildBVH(scene.sphere_bvh, input.spheres, scene.spheres, scene.arena, kSoALeafSize);
+    buildBVH(scene.box_bvh, input.boxes, scene.boxes, scene.arena, kSoALeafSize);
+    scene.sphere_soa.assign(scene.spheres.data(), int(scene.spheres.size()), &scene.arena);
+    scene.box_soa.assign(scene.boxes.data(), int(scene.boxes.size()), &scene.arena);
+    if (fullMeshBytes(input.mesh.size()) > mesh_budget &&
+        scene.mesh_compressed.build(input.mesh.data(), input.mesh.size(), kSoALeafSize,
+                                    &scene.arena)) {
+        return;
     }
-} g_scene;
+    buildBVH(scene.mesh_bvh, input.mesh, scene.mesh, scene.arena, kSoALeafSize);
+    scene.mesh_soa.assign(scene.mesh.data(), int(scene.mesh.size()), &scene.arena);
+}
 
-// 已经存在的 random_in_unit_sphere 函数实现
-glm::vec3 random_in_unit_sphere()
+// Any-hit query for shadow rays; returns at the first occluder in (t_min, t_max)
+bool occluded(const Ray &r, float t_min, float t_max)
 {
-    glm::vec3 p;
-    do {
-        p = 2.0f * glm::vec3(drand48(), drand48(), drand48()) - glm::vec3(1.0f);
-    } while (glm::length(p) >= 1.0f);
-    return p;
+    const Scene &scene = *g_scene;
+    RT_STAT_INC(stats::SHADOW_RAYS);
+    HitRecord temp_rec;
+    RT_STAT_INC(stats::SPHERE_TESTS);
+    if (scene.ground.hit(r, t_min, t_max, temp_rec)) { return true; }
+
+    return scene.sphere_bvh.occluded(
+               r, t_min, t_max,
+               [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+                   RT_STAT_ADD(stats::SPHERE_TESTS, count);
+                   return closestSphere(scene.sphere_soa, first, first + count, r, t_min, t_far) >= 0;
+               }) ||
+           scene.box_bvh.occluded(
+               r, t_min, t_max,
+               [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+                   RT_STAT_ADD(stats::BOX_TESTS, count);
+                   return closestBox(scene.box_soa, first, first + count, r, t_min, t_far) >= 0;
+               }) ||
+           scene.mesh_bvh.occluded(
+               r, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+                   RT_STAT_ADD(stats::TRIANGLE_TESTS, count);
+                   return closestTriangle(scene.mesh_soa, first, first + count, r, t_min, t_far) >= 0;
+               }) ||
+           scene.mesh_compressed.occluded(r, t_min, t_max) ||
+           scene.mesh_streamed.occluded(r, t_min, t_max);
 }
 
 // 碰撞检测函数
 bool hit_world(const Ray &r, float t_min, float t_max, HitRecord &rec)
 {
+    const Scene &scene = *g_scene;
     HitRecord temp_rec;
     bool hit_anything = false;
     float closest_so_far = t_max;
 
     // 檢測地面
-    if (g_scene.ground.hit(r, t_min, closest_so_far, temp_rec)) {
+    RT_STAT_INC(stats::SPHERE_TESTS);
+    if (scene.ground.hit(r, t_min, closest_so_far, temp_rec)) {
         hit_anything = true;
         closest_so_far = temp_rec.t;
         rec = temp_rec;
     }
-    
-    // 檢測所有球體
-    for (int i = 0; i < g_scene.spheres.size(); ++i) {
-        if (g_scene.spheres[i].hit(r, t_min, closest_so_far, temp_rec)) {
+
+    // 檢測所有球體 (BVH leaves are tested as SoA batches)
+    hit_anything |= scene.sphere_bvh.traverse(
+        r, t_min, closest_so_far, [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+            RT_STAT_ADD(stats::SPHERE_TESTS, count);
+            int i = closestSphere(scene.sphere_soa, first, first + count, r, t_min, t_far);
+            if (i < 0) { return false; }
+            scene.spheres[i].record(r, t_far, rec);
+            return true;
+        });
+
+    // 檢測所有盒子
+    hit_anything |= scene.box_bvh.traverse(
+        r, t_min, closest_so_far, [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+            RT_STAT_ADD(stats::BOX_TESTS, count);
+            int i = closestBox(scene.box_soa, first, first + count, r, t_min, t_far);
+            if (i < 0) { return false; }
+            scene.boxes[i].record(r, t_far, rec);
+            return true;
+        });
+
+    // 檢測網格三角形
+    hit_anything |= scene.mesh_bvh.traverse(
+        r, t_min, closest_so_far, [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+            RT_STAT_ADD(stats::TRIANGLE_TESTS, count);
+            int i = closestTriangle(scene.mesh_soa, first, first + count, r, t_min, t_far);
+            if (i < 0) { return false; }
+            scene.mesh[i].record(r, t_far, rec);
+            return true;
+        });
+
+    // 壓縮網格 (meshes over the memory budget)
+    if (!scene.mesh_compressed.empty()) {
+        Triangle tri;
+        if (scene.mesh_compressed.closest(r, t_min, closest_so_far, tri)) {
+            tri.record(r, closest_so_far, rec);
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
         }
     }
-    
-    // 檢測所有盒子
-    for (int i = 0; i < g_scene.boxes.size(); ++i) {
-        if (g_scene.boxes[i].hit(r, t_min, closest_so_far, temp_rec)) {
+
+    // 串流網格 (resident clusters only; see renderPixels for the others)
+    if (!scene.mesh_streamed.empty()) {
+        Triangle tri;
+        if (scene.mesh_streamed.closest(r, t_min, closest_so_far, tri)) {
+            tri.record(r, closest_so_far, rec);
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
         }
     }
-    
-    // 先檢測網格的包圍盒，如果命中再檢測所有三角形
-    if (g_scene.mesh.size() > 0 && g_scene.mesh_bbox.hit(r, t_min, closest_so_far, temp_rec)) {
-        // 包圍盒命中，檢測所有三角形
-        for (int i = 0; i < g_scene.mesh.size(); ++i) {
-            if (g_scene.mesh[i].hit(r, t_min, closest_so_far, temp_rec)) {
-                hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
-            }
+
+    return hit_anything;
+}
+
+inline bool environmentActive(const RTContext &rtx)
+{
+    return g_environment && rtx.use_environment;
+}
+
+// Next-event estimation picks the environment with this probability and a
+// scene light otherwise. Kernels compiled without kEnvironment only run
+// while the environment is inactive, see KernelConfig::optional.
+template <bool kEnvironment>
+float environmentSelectProbability(const RTContext &rtx)
+{
+    if (!kEnvironment || !environmentActive(rtx)) { return 0.0f; }
+    return g_scene->light_power > 0.0f ? 0.5f : 1.0f;
+}
+
+// Radiance arriving from the background in direction `dir`
+template <bool kEnvironment>
+glm::vec3 background(const RTContext &rtx, const glm::vec3 &dir)
+{
+    if (kEnvironment && environmentActive(rtx)) { return rtx.environment_intensity * g_environment->lookup(dir); }
+    glm::vec3 unit_direction = glm::normalize(dir);
+    float t = 0.5f * (unit_direction.y + 1.0f);
+    return (1.0f - t) * rtx.ground_color + t * rtx.sky_color;
+}
+
+// Solid-angle pdf of scattering from `rec` towards `dir`: the material's,
+// or that of its mixture with the learned distribution of a guiding cell
+template <typename Materials>
+float scatterPdf(const Material &material, const Ray &r, const HitRecord &rec,
+                 const glm::vec3 &dir, const GuidingCell *cell)
+{
+    float pdf = Materials::pdf(material, r, rec, dir);
+    if (!cell || !cell->trained()) { return pdf; }
+    float fraction = cell->bsdfFraction();
+    return fraction * pdf +
+           (1.0f - fraction) * cell->sampling.pdf(directionToSquare(dir)) * kInvFourPi;
+}
+
+// Next-event estimation: light from one emitter or the environment, picked
+// with `u`, through a shadow ray and weighted with the power heuristic
+// against scattering, guided through `cell` if it is not null
+template <typename Materials, bool kEnvironment>
+glm::vec3 sampleDirect(const RTContext &rtx, const Ray &r, const HitRecord &rec, glm::vec3 u,
+                       const GuidingCell *cell)
+{
+    const Scene &scene = *g_scene;
+    const Material &material = *rec.mat_ptr;
+    float env_probability = environmentSelectProbability<kEnvironment>(rtx);
+    if (u.x < env_probability) {
+        glm::vec3 wi;
+        float env_pdf;
+        glm::vec3 le = rtx.environment_intensity * g_environment->sample(glm::vec2(u.y, u.z), wi, env_pdf);
+        env_pdf *= env_probability;
+        if (!(env_pdf > 0.0f)) { return glm::vec3(0.0f); }
+        glm::vec3 f = Materials::eval(material, r, rec, wi);
+        if (glm::compMax(f) <= 0.0f) { return glm::vec3(0.0f); }
+        if (occluded(Ray(rec.p, wi), rtx.epsilon, 9999.0f)) { return glm::vec3(0.0f); }
+        float weight = powerHeuristic(env_pdf, scatterPdf<Materials>(material, r, rec, wi, cell));
+        return f * le * (weight / env_pdf);
+    }
+    if (scene.light_power <= 0.0f) { return glm::vec3(0.0f); }
+    u.x = (u.x - env_probability) / (1.0f - env_probability);
+
+    const float *cdf = scene.light_cdf.data();
+    int count = int(scene.lights.size());
+    int index = int(std::upper_bound(cdf, cdf + count, u.x * scene.light_power) - cdf);
+    const Light &light = scene.lights[glm::min(index, count - 1)];
+
+    glm::vec3 point, normal;
+    light.sample(glm::vec2(u.y, u.z), point, normal);
+    glm::vec3 to_light = point - rec.p;
+    float dist2 = glm::dot(to_light, to_light);
+    float dist = glm::sqrt(dist2);
+    glm::vec3 wi = to_light / dist;
+    float cos_light = -glm::dot(wi, normal);
+    glm::vec3 le = Materials::emitted(*light.material);
+    float light_pdf =
+        (1.0f - env_probability) * luminance(le) / scene.light_power * dist2 / cos_light;
+    if (cos_light <= 0.0f || !(light_pdf > 0.0f)) { return glm::vec3(0.0f); }
+
+    glm::vec3 f = Materials::eval(material, r, rec, wi);
+    if (glm::compMax(f) <= 0.0f) { return glm::vec3(0.0f); }
+    if (occluded(Ray(rec.p, wi), rtx.epsilon, dist * (1.0f - 1e-3f))) { return glm::vec3(0.0f); }
+    float weight = powerHeuristic(light_pdf, scatterPdf<Materials>(material, r, rec, wi, cell));
+    return f * le * (weight / light_pdf);
+}
+
+// Settings a render kernel is compiled for, besides gamma and the bounce count.
+// Kernels without kOptional run while the irradiance cache, path guiding,
+// the heatmap and the environment map are all off, and test none of them.
+template <bool kNee, bool kRoulette, typename MaterialSet, bool kOptional>
+struct KernelConfig {
+    static const bool nee = kNee;            // rtx.next_event_estimation
+    static const bool roulette = kRoulette;  // rtx.russian_roulette
+    typedef MaterialSet Materials;
+    static const bool optional = kOptional;  // See optionalFeatures
+};
+
+// Bounces a path tracer reads from its `depth` argument instead
+const int kRuntimeDepth = -2;
+// Bounce counts up to this get their own kernels; the GUI slider's range
+const int kMaxKernelBounces = 10;
+
+// Path tracer with `kDepth` bounces left. Each depth is its own function, so
+// the recursion is a chain of direct calls the compiler may inline, and the
+// test for the last bounce is a constant.
+template <typename Config, int kDepth>
+struct PathTracer {
+    // 修改 color 函数以使用材质. `bsdf_pdf` is the solid-angle pdf `r` was
+    // sampled with, or 0 for camera rays, specular bounces and with next-event
+    // estimation off, where emitters hit by `r` count in full. `cone` is the
+    // footprint of `r`, which selects texture mip levels.
+    static glm::vec3 color(RTContext &rtx, Sampler &sampler, const Ray &r, int depth, float bsdf_pdf,
+                           const RayCone &cone);
+
+    static glm::vec3 radiance(RTContext &rtx, Sampler &sampler, const Ray &r, const RayCone &cone)
+    {
+        return color(rtx, sampler, r, rtx.max_bounces, 0.0f, cone);
+    }
+
+    static const bool optional = Config::optional;  // Whether renderPixels checks the heatmap
+};
+
+// Past the last bounce
+template <typename Config>
+struct PathTracer<Config, -1> {
+    static glm::vec3 color(RTContext &, Sampler &, const Ray &, int, float, const RayCone &)
+    {
+        return glm::vec3(0.0f);
+    }
+};
+
+template <typename Config>
+glm::vec3 cachedIrradiance(RTContext &rtx, const Ray &r, const HitRecord &rec, int depth);
+
+// Light reaching the start of `r` from the background; `bsdf_pdf` as in
+// PathTracer::color
+template <bool kEnvironment>
+inline glm::vec3 missRadiance(const RTContext &rtx, const Ray &r, float bsdf_pdf)
+{
+    RT_STAT_INC(stats::BACKGROUND_HITS);
+    glm::vec3 le = background<kEnvironment>(rtx, r.direction());
+    if (kEnvironment && bsdf_pdf > 0.0f && environmentActive(rtx)) {
+        float env_pdf =
+            environmentSelectProbability<kEnvironment>(rtx) * g_environment->pdf(r.direction());
+        le *= powerHeuristic(bsdf_pdf, env_pdf);
+    }
+    return le;
+}
+
+// Materials::scatter through a guiding cell: `u.z` picks the BSDF or the
+// cell's learned distribution, and the sample is weighted by the pdf of the
+// mixture, so either choice is unbiased. Fills `vertex` for trainGuiding.
+template <typename Materials>
+bool scatterGuided(const Material &material, const Ray &r, const HitRecord &rec,
+                   const glm::vec3 &u, GuidingCell &cell, glm::vec3 &attenuation, Ray &scattered,
+                   GuidingVertex &vertex)
+{
+    float fraction = cell.bsdfFraction();
+    if (u.z < fraction) {
+        if (!Materials::scatter(material, r, rec, u, attenuation, scattered)) { return false; }
+    } else {
+        scattered = Ray(rec.p, squareToDirection(cell.sampling.sample(glm::vec2(u.x, u.y))));
+    }
+    glm::vec3 dir = scattered.direction();
+    glm::vec2 square = directionToSquare(dir);
+    float bsdf_pdf = Materials::pdf(material, r, rec, dir);
+    float guide_pdf = cell.trained() ? cell.sampling.pdf(square) * kInvFourPi : 0.0f;
+    float pdf = fraction * bsdf_pdf + (1.0f - fraction) * guide_pdf;
+    glm::vec3 f = Materials::eval(material, r, rec, dir);
+    if (!(pdf > 0.0f) || glm::compMax(f) <= 0.0f) { return false; }
+    attenuation = f / pdf;
+
+    vertex.cell = &cell;
+    vertex.direction = square;
+    vertex.weight = attenuation;
+    vertex.pdf = pdf;
+    vertex.bsdf_pdf = bsdf_pdf;
+    vertex.guide_pdf = guide_pdf;
+    vertex.bsdf_fraction = fraction;
+    return true;
+}
+
+// Teaches the cell of a guided vertex the radiance `li` that came back along
+// its scattered ray: into the directional tree being built, and into the
+// gradient of its BSDF fraction
+inline void trainGuiding(const GuidingVertex &vertex, const glm::vec3 &li)
+{
+    if (!vertex.cell || g_guiding.pass >= kGuidingPasses) { return; }
+    float radiance = luminance(li);
+    if (!std::isfinite(radiance)) { return; }
+    GuidingCell &cell = *vertex.cell;
+    cell.building.record(vertex.direction, radiance / vertex.pdf);
+    cell.samples.fetch_add(1, std::memory_order_relaxed);
+    if (cell.trained()) {
+        // The integrand f * Li * cos over the mixture pdf, times d(pdf) / d(logit) / pdf
+        float fraction = vertex.bsdf_fraction;
+        float estimate = luminance(vertex.weight * li);
+        cell.addGradient(-estimate * (vertex.bsdf_pdf - vertex.guide_pdf) / vertex.pdf * fraction *
+                         (1.0f - fraction));
+    }
+}
+
+// One path vertex at the hit `rec` of `r`, with `depth` bounces left: sets
+// `radiance` to the light the hit sends back along `r` by itself (emission
+// and next-event estimation). Returns whether the path goes on along
+// `scattered`, weighted by `attenuation`, with the pdf and cone of the next
+// call. With path guiding, `guide` is set up for trainGuiding.
+template <typename Config>
+inline bool shadeHit(RTContext &rtx, Sampler &sampler, const Ray &r, HitRecord &rec, int depth,
+                     float bsdf_pdf, const RayCone &cone, glm::vec3 &radiance, Ray &scattered,
+                     glm::vec3 &attenuation, float &pdf, RayCone &next, GuidingVertex &guide)
+{
+    typedef typename Config::Materials Materials;
+    int bounce = rtx.max_bounces - depth;
+    radiance = glm::vec3(0.0f);
+    guide.cell = nullptr;
+    rec.normal = glm::normalize(rec.normal);
+    if (!rec.mat_ptr) { return false; }
+    const Material &material = *rec.mat_ptr;
+
+    // The cone's width projected onto the surface, floored at grazing angles
+    float dist = rec.t * glm::length(r.direction());
+    float cos_in = glm::abs(glm::dot(glm::normalize(r.direction()), rec.normal));
+    rec.footprint = cone.widthAt(dist) / glm::max(cos_in, 0.1f);
+
+    // Emitters are seen from the front only, like the triangles they are made of
+    glm::vec3 le = Materials::emitted(material);
+    float cos_light = -glm::dot(glm::normalize(r.direction()), rec.normal);
+    if (glm::compMax(le) > 0.0f && cos_light > 0.0f) {
+        float weight = 1.0f;
+        if (bsdf_pdf > 0.0f && g_scene->light_power > 0.0f) {
+            float env_probability = environmentSelectProbability<Config::optional>(rtx);
+            float light_pdf = (1.0f - env_probability) * luminance(le) / g_scene->light_power *
+                              dist * dist / cos_light;
+            weight = powerHeuristic(bsdf_pdf, light_pdf);
         }
+        radiance += weight * le;
     }
-    
-    return hit_anything;
+
+    // Past the first hit, diffuse light may come from the irradiance cache;
+    // the path ends here either way
+    if (Config::optional && rtx.irradiance_cache && bounce > 0 && depth > 0 &&
+        material.kind == MATERIAL_LAMBERTIAN && !t_tracing_record) {
+        glm::vec3 irradiance = cachedIrradiance<Config>(rtx, r, rec, depth);
+        radiance += Materials::eval(material, r, rec, shadingFrame(r, rec).n) * irradiance;
+        return false;
+    }
+
+    // Guiding is pointless past the last bounce, whose light is not traced
+    GuidingCell *cell = nullptr;
+    if (Config::optional && rtx.path_guiding && depth > 0 && !Materials::isSpecular(material)) {
+        cell = &g_guiding.field.cell(rec.p);
+    }
+
+    // Direct light, only where the BSDF-sampled path can still reach an
+    // emitter, so that both strategies cover the same paths
+    bool nee = Config::nee && depth > 0 && !Materials::isSpecular(material);
+    if (nee) {
+        radiance +=
+            sampleDirect<Materials, Config::optional>(rtx, r, rec, sampler.light(bounce), cell);
+    }
+
+    // 关键部分：确保材质散射计算正确
+    if (cell) {
+        if (!scatterGuided<Materials>(material, r, rec, sampler.bsdf(bounce), *cell, attenuation,
+                                      scattered, guide)) {
+            return false;
+        }
+    } else if (!Materials::scatter(material, r, rec, sampler.bsdf(bounce), attenuation, scattered)) {
+        return false;  // 如果没有材质或散射失败
+    }
+    // Russian roulette: end dim paths early and reweight the survivors. The
+    // start bounce is a parameter of the roulette, read by its kernels only.
+    if (Config::roulette && bounce >= rtx.roulette_start_bounce) {
+        float survive = glm::clamp(glm::compMax(attenuation), 0.05f, 0.95f);
+        if (sampler.roulette(bounce) >= survive) { return false; }
+        attenuation /= survive;
+    }
+    if (!nee) {
+        pdf = 0.0f;
+    } else {
+        pdf = cell ? guide.pdf : Materials::pdf(material, r, rec, scattered.direction());
+    }
+    next.width = cone.widthAt(dist);
+    next.spread = cone.spread + Materials::spreadAngle(material, rec);
+    return true;
 }
 
-// 修改 color 函数以使用材质
-glm::vec3 color(RTContext &rtx, const Ray &r, int max_bounces)
+template <typename Config, int kDepth>
+glm::vec3 PathTracer<Config, kDepth>::color(RTContext &rtx, Sampler &sampler, const Ray &r, int depth,
+                                            float bsdf_pdf, const RayCone &cone)
 {
-    if (max_bounces < 0) return glm::vec3(0.0f);  // 避免无限递归
+    const int next_depth = kDepth == kRuntimeDepth ? kRuntimeDepth : kDepth - 1;
+    if (kDepth == kRuntimeDepth) {
+        if (depth < 0) return glm::vec3(0.0f);  // 避免无限递归
+    } else {
+        depth = kDepth;
+    }
+    RT_STAT_INC(stats::depthCounter(rtx.max_bounces - depth));
 
     HitRecord rec;
-    if (hit_world(r, rtx.epsilon, 9999.0f, rec)) {
-        rec.normal = glm::normalize(rec.normal);
-        if (rtx.show_normals) { return rec.normal * 0.5f + 0.5f; }
+    if (!hit_world(r, glm::max(r.t_min(), rtx.epsilon), glm::min(r.t_max(), 9999.0f), rec)) {
+        return missRadiance<Config::optional>(rtx, r, bsdf_pdf);  // 背景部分
+    }
+    glm::vec3 radiance, attenuation;
+    Ray scattered;
+    float pdf;
+    RayCone next;
+    GuidingVertex guide;
+    if (!shadeHit<Config>(rtx, sampler, r, rec, depth, bsdf_pdf, cone, radiance, scattered,
+                          attenuation, pdf, next, guide)) {
+        return radiance;
+    }
+    // 递归计算反射光线的颜色
+    glm::vec3 li =
+        PathTracer<Config, next_depth>::color(rtx, sampler, scattered, depth - 1, pdf, next);
+    if (guide.cell) { trainGuiding(guide, li); }
+    return radiance + attenuation * li;
+}
 
-        Ray scattered;
+// Irradiance at a diffuse hit with `depth` bounces left, interpolated from
+// the cache or traced into a new record. Each of the record's rays is a path
+// with depth - 1 bounces that counts the emitters it hits in full, so the
+// record holds direct and indirect light and replaces next-event estimation.
+template <typename Config>
+glm::vec3 cachedIrradiance(RTContext &rtx, const Ray &r, const HitRecord &rec, int depth)
+{
+    Frame frame = shadingFrame(r, rec);
+    glm::vec3 irradiance;
+    if (g_irradiance.cache.lookup(rec.p, frame.n, depth, rtx.irradiance_error, irradiance)) {
+        RT_STAT_INC(stats::IRRADIANCE_HITS);
+        return irradiance;
+    }
+    RT_STAT_INC(stats::IRRADIANCE_RECORDS);
+    t_tracing_record = true;
+    // Samples come from a sampler of their own, seeded per record
+    std::uint32_t id = g_irradiance.started.fetch_add(1, std::memory_order_relaxed);
+    Sampler sampler(SAMPLER_UNIFORM);
+    RayCone cone = {0.0f, 1.0f};
+    HemisphereSample samples[kIrradianceSamples];
+    for (int i = 0; i < kIrradianceSamples; ++i) {
+        sampler.startSample(int(id & 0xffffu), int(id >> 16), std::uint32_t(i));
+        glm::vec3 dir = frame.toWorld(
+            hemisphereStratum(i / kIrradiancePhiStrata, i % kIrradiancePhiStrata, sampler.pixel()));
+        Ray ray(rec.p, dir);
+        RT_STAT_INC(stats::depthCounter(rtx.max_bounces - depth + 1));
+        HitRecord hit;
+        if (!hit_world(ray, rtx.epsilon, 9999.0f, hit)) {
+            samples[i].radiance = missRadiance<Config::optional>(rtx, ray, 0.0f);
+            samples[i].distance = std::numeric_limits<float>::infinity();
+            continue;
+        }
+        samples[i].distance = hit.t;
         glm::vec3 attenuation;
-        
-        // 关键部分：确保材质散射计算正确
-        if (rec.mat_ptr && rec.mat_ptr->scatter(r, rec, attenuation, scattered)) {
-            // 递归计算反射光线的颜色
-            return attenuation * color(rtx, scattered, max_bounces - 1);
+        Ray scattered;
+        float pdf;
+        RayCone next;
+        GuidingVertex guide;
+        if (shadeHit<Config>(rtx, sampler, ray, hit, depth - 1, 0.0f, cone, samples[i].radiance,
+                             scattered, attenuation, pdf, next, guide)) {
+            samples[i].radiance += attenuation * PathTracer<Config, kRuntimeDepth>::color(
+                                                     rtx, sampler, scattered, depth - 2, pdf, next);
         }
-        
-        // 如果没有材质或散射失败，返回黑色
-        return glm::vec3(0.0f);
-    }else {
-        // 背景部分 - 确保这部分代码被执行
-        glm::vec3 unit_direction = glm::normalize(r.direction());
-        float t = 0.5f * (unit_direction.y + 1.0f);
-        
-        return (1.0f - t) * rtx.ground_color + t * rtx.sky_color;
     }
+    t_tracing_record = false;
+    IrradianceRecord record = makeIrradianceRecord(rec.p, frame, samples, depth);
+    g_irradiance.cache.insert(record, rtx.irradiance_error);
+    return record.irradiance;
+}
 
-    // 背景颜色
-    glm::vec3 unit_direction = glm::normalize(r.direction());
-    float t = 0.5f * (unit_direction.y + 1.0f);
-    return (1.0f - t) * rtx.ground_color + t * rtx.sky_color;
+void resetGuiding()
+{
+    g_guiding.field.reset(g_scene ? g_scene->bounds : AABB());
+    g_guiding.pass = 0;
+    g_guiding.frames = 0;
+}
+
+// Forgets what was learned about the light in g_scene: irradiance records
+// and guiding distributions. For scene, material and pose changes; between
+// frames only.
+void dropLearnedLight()
+{
+    g_irradiance.cache.clear();
+    resetGuiding();
+}
+
+// Drops the irradiance records and guiding distributions whose settings have
+// changed since they were learned. Between frames only.
+void syncLearnedLight(const RTContext &rtx)
+{
+    LightingSettings lighting(rtx);
+    IrradianceState &irradiance = g_irradiance;
+    if (!(irradiance.lighting == lighting) || irradiance.error != rtx.irradiance_error) {
+        irradiance.cache.clear();
+        irradiance.lighting = lighting;
+        irradiance.error = rtx.irradiance_error;
+    }
+    GuidingState &guiding = g_guiding;
+    if (!(guiding.lighting == lighting) || guiding.max_bounces != rtx.max_bounces ||
+        guiding.nee != rtx.next_event_estimation) {
+        resetGuiding();
+        guiding.lighting = lighting;
+        guiding.max_bounces = rtx.max_bounces;
+        guiding.nee = rtx.next_event_estimation;
+    }
+}
+
+// rtx.show_normals: the first hit's normal, or the background
+template <bool kOptional>
+struct NormalShader {
+    static const bool optional = kOptional;  // As in PathTracer
+
+    static glm::vec3 radiance(RTContext &rtx, Sampler &, const Ray &r, const RayCone &)
+    {
+        RT_STAT_INC(stats::depthCounter(0));
+        HitRecord rec;
+        if (hit_world(r, glm::max(r.t_min(), rtx.epsilon), glm::min(r.t_max(), 9999.0f), rec)) {
+            return glm::normalize(rec.normal) * 0.5f + 0.5f;
+        }
+        return missRadiance<kOptional>(rtx, r, 0.0f);
+    }
+};
+
+// Inputs of a scene build, copied so that the build can run on a background
+// thread. Material settings are not among them: they are applied in place
+// once the scene is active (applyMaterialSettings).
+struct SceneParams {
+    std::string mesh_filename;
+    std::size_t mesh_budget;    // See setMeshMemoryBudget
+    std::size_t stream_budget;  // See setStreamingBudget
+
+    SceneParams(const std::string &filename, std::size_t budget);
+};
+
+// Meshes that would need more memory at full precision are built compressed
+std::size_t g_mesh_budget = std::size_t(1) << 30;
+// Cluster cache of streamed meshes
+std::size_t g_stream_budget = std::size_t(256) << 20;
+
+SceneParams::SceneParams(const std::string &filename, std::size_t budget)
+    : mesh_filename(filename), mesh_budget(budget), stream_budget(g_stream_budget)
+{
+}
+
+// Emitters go into the geometry, where rays can hit them, and the light list
+void addSphereLight(Scene &scene, SceneInput &input, const glm::vec3 &center, float radius,
+                    Material *material)
+{
+    input.spheres.push_back(Sphere(center, radius, material));
+    scene.lights.push_back(Light::sphere(center, radius, material));
+}
+
+// Quad with corner `p` spanning e1 and e2, emitting towards cross(e1, e2)
+void addQuadLight(Scene &scene, SceneInput &input, const glm::vec3 &p, const glm::vec3 &e1,
+                  const glm::vec3 &e2, Material *material)
+{
+    input.mesh.push_back(Triangle(p, p + e1, p + e1 + e2, material));
+    input.mesh.push_back(Triangle(p, p + e1 + e2, p + e2, material));
+    scene.lights.push_back(Light::quad(p, e1, e2, material));
+}
+
+void addTriangleLight(Scene &scene, SceneInput &input, const glm::vec3 &v0, const glm::vec3 &v1,
+                      const glm::vec3 &v2, Material *material)
+{
+    input.mesh.push_back(Triangle(v0, v1, v2, material));
+    scene.lights.push_back(Light::triangle(v0, v1, v2, material));
 }
 
 // 修改 setupScene 函数添加更多球体和材质
-void setupScene(RTContext &rtx, const char *filename)
+std::unique_ptr<Scene> buildScene(const SceneParams &params)
 {
-    // 设置高对比度背景
-    rtx.ground_color = glm::vec3(0.0f, 0.0f, 0.0f);  // 纯黑色地面
-    rtx.sky_color = glm::vec3(1.0f, 1.0f, 1.0f);     // 明亮的天蓝色
+    RT_TRACE_SCOPE("buildScene");
+    std::unique_ptr<Scene> scene(new Scene());
+    scene->mesh_filename = params.mesh_filename;
+    SceneInput input;
+    ProceduralParams procedural;
+    bool is_procedural = parseProceduralScene(params.mesh_filename, procedural);
 
     // 创建材质
-    Material* ground_material = new Lambertian(glm::vec3(0.3f, 0.3f, 0.3f));
-    g_scene.materials.push_back(ground_material);
+    Material* ground_material = scene->createMaterial<Lambertian>("Ground", glm::vec3(0.3f, 0.3f, 0.3f));
     
     // 创建极端金属材质 - 完美反射、极亮的银色
-    // 根據 metallic_roughness 調整金屬材質的模糊程度
-        Material* metal_material = new Metal(
-            glm::vec3(1.0f, 0.9f, 0.3f) * rtx.material_intensity,
-            rtx.metallic_roughness
-        );
-    g_scene.materials.push_back(metal_material);
+    // 模糊程度和強度由 metallic_roughness 和 material_intensity 滑桿設定
+    Material* metal_material = scene->createMaterial<Metal>("Mesh metal", glm::vec3(1.0f, 0.9f, 0.3f), 0.0f);
+    scene->mesh_material = metal_material;
     
     // 创建彩色漫反射材质
-    Material* red_material = new Lambertian(glm::vec3(0.8f, 0.2f, 0.2f));    // 红色
-    Material* green_material = new Lambertian(glm::vec3(0.2f, 0.8f, 0.2f));  // 绿色
-    Material* blue_material = new Lambertian(glm::vec3(0.2f, 0.2f, 0.8f));   // 蓝色
-    g_scene.materials.push_back(red_material);
-    g_scene.materials.push_back(green_material);
-    g_scene.materials.push_back(blue_material);
+    Material* red_material = scene->createMaterial<Lambertian>("Red", glm::vec3(0.8f, 0.2f, 0.2f));      // 红色
+    Material* green_material = scene->createMaterial<Lambertian>("Green", glm::vec3(0.2f, 0.8f, 0.2f));  // 绿色
+    Material* blue_material = scene->createMaterial<Lambertian>("Blue", glm::vec3(0.2f, 0.2f, 0.8f));    // 蓝色
+
+    // 光源: a panel above the bunny and a small lamp by the spheres
+    Material* panel_light = scene->createMaterial<DiffuseLight>("Light panel", glm::vec3(1.0f, 0.95f, 0.85f), 4.0f);
+    addQuadLight(*scene, input, glm::vec3(-0.3f, 1.2f, -0.3f), glm::vec3(0.6f, 0.0f, 0.0f),
+                 glm::vec3(0.0f, 0.0f, 0.6f), panel_light);
+    // Procedural objects could bury the lamp
+    if (!is_procedural) {
+        Material* lamp_light = scene->createMaterial<DiffuseLight>("Lamp", glm::vec3(1.0f, 0.6f, 0.3f), 8.0f);
+        addSphereLight(*scene, input, glm::vec3(-0.25f, -0.45f, 0.8f), 0.05f, lamp_light);
+    }
 
     // 设置地面 - 使用纯黑色材质
-    g_scene.ground = Sphere(glm::vec3(0.0f, -1000.5f, 0.0f), 1000.0f, ground_material);
-    
-    // 清空球体列表
-    g_scene.spheres.clear();
+    scene->ground = Sphere(glm::vec3(0.0f, -1000.5f, 0.0f), 1000.0f, ground_material);
     
     // 设置球体尺寸
     float sphere_radius = 0.1f;  // 球体半径为0.1
@@ -163,131 +854,1282 @@ void setupScene(RTContext &rtx, const char *filename)
     float y_position = -0.5f + sphere_radius;
 
     // 添加三个球，放在地面上
-    g_scene.spheres.push_back(Sphere(glm::vec3(-0.5f, y_position, 0.5f), sphere_radius, red_material));
-    g_scene.spheres.push_back(Sphere(glm::vec3(0.5f, y_position, 0.5f), sphere_radius, green_material));
-    g_scene.spheres.push_back(Sphere(glm::vec3(0.0f, y_position, 0.5f), sphere_radius, blue_material));
+    if (!is_procedural) {
+        input.spheres.push_back(Sphere(glm::vec3(-0.5f, y_position, 0.5f), sphere_radius, red_material));
+        input.spheres.push_back(Sphere(glm::vec3(0.5f, y_position, 0.5f), sphere_radius, green_material));
+        input.spheres.push_back(Sphere(glm::vec3(0.0f, y_position, 0.5f), sphere_radius, blue_material));
+    }
 
     // 加载兔子模型，使用极端金属材质
-    cg::OBJMesh mesh;
-    cg::objMeshLoad(mesh, filename);
-    g_scene.mesh.clear();
-    for (int i = 0; i < mesh.indices.size(); i += 3) {
-        int i0 = mesh.indices[i + 0];
-        int i1 = mesh.indices[i + 1];
-        int i2 = mesh.indices[i + 2];
-        // 调整兔子模型的位置，使其站在地面上
-        // 注意：0.135f可能需要根据模型的实际尺寸进行调整
-        glm::vec3 v0 = mesh.vertices[i0] + glm::vec3(0.0f, 0.135f, 0.0f);
-        glm::vec3 v1 = mesh.vertices[i1] + glm::vec3(0.0f, 0.135f, 0.0f);
-        glm::vec3 v2 = mesh.vertices[i2] + glm::vec3(0.0f, 0.135f, 0.0f);
-        g_scene.mesh.push_back(Triangle(v0, v1, v2, metal_material));
-    }
-    // 計算模型的最小和最大邊界
-        glm::vec3 min_bounds(FLT_MAX);
-        glm::vec3 max_bounds(-FLT_MAX);
-        
-        for (int i = 0; i < mesh.indices.size(); i += 3) {
+    cg::OBJMeshUV mesh;
+    if (is_procedural) {
+        RT_TRACE_SCOPE("generateProceduralScene");
+        // There is no loaded mesh to animate or to drive from the material
+        // sliders; the metal is just one more palette entry
+        scene->mesh_material = nullptr;
+        std::vector<Material *> palette;
+        palette.push_back(red_material);
+        palette.push_back(green_material);
+        palette.push_back(blue_material);
+        palette.push_back(scene->createMaterial<Lambertian>("Stone", glm::vec3(0.6f, 0.55f, 0.5f)));
+        palette.push_back(scene->createMaterial<Metal>("Steel", glm::vec3(0.7f, 0.7f, 0.75f), 0.3f));
+        palette.push_back(metal_material);
+        generateProceduralScene(procedural, palette, input.spheres, input.boxes, input.mesh);
+    } else if (StreamedMesh::isClusterFile(params.mesh_filename)) {
+        // Out of core: only the cluster table is read here
+        if (!scene->mesh_streamed.open(params.mesh_filename, metal_material,
+                                       glm::vec3(0.0f, 0.135f, 0.0f), params.stream_budget)) {
+            std::cerr << "Could not open cluster file " << params.mesh_filename << std::endl;
+        }
+    } else {
+        RT_TRACE_SCOPE("objMeshUVLoad");
+        cg::objMeshUVLoad(mesh, params.mesh_filename);
+    }
+    bool has_texcoords = mesh.texcoords.size() == mesh.vertices.size();
+    {
+        RT_TRACE_SCOPE("buildMesh");
+        input.mesh.reserve(mesh.indices.size() / 3);
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
             int i0 = mesh.indices[i + 0];
             int i1 = mesh.indices[i + 1];
             int i2 = mesh.indices[i + 2];
-            
+            // 调整兔子模型的位置，使其站在地面上
+            // 注意：0.135f可能需要根据模型的实际尺寸进行调整
             glm::vec3 v0 = mesh.vertices[i0] + glm::vec3(0.0f, 0.135f, 0.0f);
             glm::vec3 v1 = mesh.vertices[i1] + glm::vec3(0.0f, 0.135f, 0.0f);
             glm::vec3 v2 = mesh.vertices[i2] + glm::vec3(0.0f, 0.135f, 0.0f);
-            
-            // 更新邊界
-            min_bounds = glm::min(min_bounds, v0);
-            min_bounds = glm::min(min_bounds, v1);
-            min_bounds = glm::min(min_bounds, v2);
-            
-            max_bounds = glm::max(max_bounds, v0);
-            max_bounds = glm::max(max_bounds, v1);
-            max_bounds = glm::max(max_bounds, v2);
-            
-            g_scene.mesh.push_back(Triangle(v0, v1, v2, metal_material));
+            Triangle triangle(v0, v1, v2, metal_material);
+            if (has_texcoords) {
+                triangle.t0 = glm::vec2(mesh.texcoords[i0].x, mesh.texcoords[i0].y);
+                triangle.t1 = glm::vec2(mesh.texcoords[i1].x, mesh.texcoords[i1].y);
+                triangle.t2 = glm::vec2(mesh.texcoords[i2].x, mesh.texcoords[i2].y);
+            }
+            input.mesh.push_back(triangle);
         }
-        
-        // 計算包圍盒的中心和半徑
-        glm::vec3 center = (min_bounds + max_bounds) * 0.5f;
-        glm::vec3 radius = (max_bounds - min_bounds) * 0.5f;
-        
-        // 創建稍微大一點的包圍盒（為了安全）
-        g_scene.mesh_bbox = Box(center, radius * 1.01f, metal_material);
+    }
+
+    buildAcceleration(*scene, input, params.mesh_budget);
+    updateLightDistribution(*scene);
+    return scene;
 }
 
-// MODIFY THIS FUNCTION!
-void updateLine(RTContext &rtx, int y)
+// Copy the material slider values into the mesh material
+void applyMeshMaterial(Scene &scene, const RTContext &rtx)
+{
+    if (!scene.mesh_material) { return; }
+    MaterialParams params = scene.mesh_material->params();
+    params.fuzz = rtx.metallic_roughness;
+    params.intensity = rtx.material_intensity;
+    scene.mesh_material->setParams(params);
+}
+
+// Background scene loading. The loader thread builds the latest requested
+// scene into `pending`, which the render thread swaps in between frames.
+struct SceneLoader {
+    std::mutex mutex;
+    std::thread thread;
+    std::unique_ptr<SceneParams> request;
+    std::unique_ptr<Scene> pending;
+    bool running = false;
+
+    ~SceneLoader()
+    {
+        if (thread.joinable()) { thread.join(); }
+    }
+} g_loader;
+
+void loaderMain()
+{
+    trace::setThreadName("scene loader");
+    while (true) {
+        std::unique_ptr<SceneParams> params;
+        {
+            std::lock_guard<std::mutex> lock(g_loader.mutex);
+            if (!g_loader.request) {
+                g_loader.running = false;
+                return;
+            }
+            params.swap(g_loader.request);
+        }
+        std::unique_ptr<Scene> scene = buildScene(*params);
+
+        // A superseded pending scene is released here, off the render thread
+        std::unique_ptr<Scene> stale;
+        std::lock_guard<std::mutex> lock(g_loader.mutex);
+        stale.swap(g_loader.pending);
+        g_loader.pending.swap(scene);
+    }
+}
+
+void setupBackground(RTContext &rtx)
+{
+    // 设置高对比度背景
+    rtx.ground_color = glm::vec3(0.0f, 0.0f, 0.0f);  // 纯黑色地面
+    rtx.sky_color = glm::vec3(1.0f, 1.0f, 1.0f);     // 明亮的天蓝色
+}
+
+// Frees the decoded clusters of the active scene before another replaces
+// it. A scene kept in the scene cache would otherwise hold up to its stream
+// budget while inactive, as only the active scene is collected; its clusters
+// load again once it is active. Between frames only.
+void deactivateScene()
+{
+    if (!g_scene || g_scene->mesh_streamed.empty()) { return; }
+    StreamedMesh &mesh = g_scene->mesh_streamed;
+    mesh.setBudget(0);
+    mesh.waitForLoads();
+    // Twice, as collect() spares the clusters used since its previous call
+    mesh.collect();
+    mesh.collect();
+}
+
+void setupScene(RTContext &rtx, const char *filename)
+{
+    RT_TRACE_SCOPE("setupScene");
+    setupBackground(rtx);
+    deactivateScene();
+    g_scene = buildScene(SceneParams(filename, g_mesh_budget));
+    dropLearnedLight();
+    applyMeshMaterial(*g_scene, rtx);
+    selectRenderKernel(rtx);
+}
+
+// Built scenes keyed by a hash of the mesh file's content, most recently
+// used first. File hashes are remembered by path, size and modification
+// time, so a repeated job does not even read the file again.
+struct SceneCache {
+    struct Entry {
+        std::uint64_t hash;
+        std::size_t mesh_budget;  // Scenes built under another budget may differ
+        std::shared_ptr<Scene> scene;
+        std::size_t bytes;  // The arena; inactive scenes hold no clusters, see deactivateScene
+    };
+    struct FileStamp {
+        std::uint64_t hash;
+        off_t size;
+        time_t mtime;
+    };
+
+    std::list<Entry> entries;
+    std::map<std::string, FileStamp> stamps;
+    std::size_t bytes = 0;
+    std::size_t budget = std::size_t(512) << 20;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+
+    void evict()
+    {
+        // The newest entry stays even if it alone exceeds the budget
+        while (bytes > budget && entries.size() > 1) {
+            bytes -= entries.back().bytes;
+            entries.pop_back();
+        }
+    }
+} g_scene_cache;
+
+// 64-bit FNV-1a of the file's bytes
+bool contentHash(const std::string &filename, std::uint64_t &hash)
+{
+    // A procedural scene is determined by its name and the meshes it copies
+    ProceduralParams procedural;
+    if (parseProceduralScene(filename, procedural)) {
+        hash = 14695981039346656037ull;
+        for (char c : filename) { hash = (hash ^ std::uint8_t(c)) * 1099511628211ull; }
+        for (const std::string &mesh : procedural.meshes) {
+            std::uint64_t mesh_hash;
+            if (!contentHash(mesh, mesh_hash)) { return false; }
+            hash = (hash ^ mesh_hash) * 1099511628211ull;
+        }
+        return true;
+    }
+
+    struct stat info;
+    if (::stat(filename.c_str(), &info) != 0) { return false; }
+    auto stamp = g_scene_cache.stamps.find(filename);
+    if (stamp != g_scene_cache.stamps.end() && stamp->second.size == info.st_size &&
+        stamp->second.mtime == info.st_mtime) {
+        hash = stamp->second.hash;
+        return true;
+    }
+    // Cluster files may not fit in memory; they carry their own hash
+    if (StreamedMesh::isClusterFile(filename)) { return StreamedMesh::contentHash(filename, hash); }
+
+    RT_TRACE_SCOPE("contentHash");
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file) { return false; }
+    hash = 14695981039346656037ull;
+    char buffer[1 << 16];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        for (std::streamsize i = 0; i < file.gcount(); ++i) {
+            hash = (hash ^ std::uint8_t(buffer[i])) * 1099511628211ull;
+        }
+    }
+    SceneCache::FileStamp entry = {hash, info.st_size, info.st_mtime};
+    g_scene_cache.stamps[filename] = entry;
+    return true;
+}
+
+bool activateCachedScene(RTContext &rtx, const std::string &mesh_filename, bool *cache_hit)
+{
+    RT_TRACE_SCOPE("activateCachedScene");
+    std::uint64_t hash;
+    if (!contentHash(mesh_filename, hash)) { return false; }
+    setupBackground(rtx);
+
+    std::list<SceneCache::Entry> &entries = g_scene_cache.entries;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->hash == hash && it->mesh_budget == g_mesh_budget) {
+            entries.splice(entries.begin(), entries, it);
+            ++g_scene_cache.hits;
+            if (it->scene != g_scene) { deactivateScene(); }
+            g_scene = it->scene;
+            g_scene->mesh_streamed.setBudget(g_stream_budget);  // May have changed since
+            dropLearnedLight();
+            applyMeshMaterial(*g_scene, rtx);
+            selectRenderKernel(rtx);
+            if (cache_hit) { *cache_hit = true; }
+            return true;
+        }
+    }
+
+    ++g_scene_cache.misses;
+    deactivateScene();
+    g_scene = buildScene(SceneParams(mesh_filename, g_mesh_budget));
+    dropLearnedLight();
+    applyMeshMaterial(*g_scene, rtx);
+    selectRenderKernel(rtx);
+    SceneCache::Entry entry = {hash, g_mesh_budget, g_scene, g_scene->arena.bytesReserved()};
+    entries.push_front(entry);
+    g_scene_cache.bytes += entry.bytes;
+    g_scene_cache.evict();
+    if (cache_hit) { *cache_hit = false; }
+    return true;
+}
+
+void setSceneCacheBudget(std::size_t bytes)
+{
+    g_scene_cache.budget = bytes;
+    g_scene_cache.evict();
+}
+
+IrradianceCacheStats irradianceCacheStats()
+{
+    IrradianceCacheStats stats;
+    stats.records = g_irradiance.cache.size();
+    stats.bytes = g_irradiance.cache.bytes();
+    return stats;
+}
+
+PathGuidingStats pathGuidingStats()
+{
+    PathGuidingStats stats;
+    stats.passes = g_guiding.pass;
+    stats.cells = g_guiding.field.cells();
+    stats.bytes = g_guiding.field.bytes();
+    stats.bsdf_fraction = g_guiding.field.meanBsdfFraction();
+    return stats;
+}
+
+SceneCacheStats sceneCacheStats()
+{
+    SceneCacheStats stats;
+    stats.entries = int(g_scene_cache.entries.size());
+    stats.bytes = g_scene_cache.bytes;
+    stats.budget = g_scene_cache.budget;
+    stats.hits = g_scene_cache.hits;
+    stats.misses = g_scene_cache.misses;
+    return stats;
+}
+
+void loadSceneAsync(const std::string &mesh_filename)
+{
+    std::lock_guard<std::mutex> lock(g_loader.mutex);
+    g_loader.request.reset(new SceneParams(mesh_filename, g_mesh_budget));
+    if (!g_loader.running) {
+        if (g_loader.thread.joinable()) { g_loader.thread.join(); }  // Already finished
+        g_loader.running = true;
+        g_loader.thread = std::thread(loaderMain);
+    }
+}
+
+bool sceneLoading()
+{
+    std::lock_guard<std::mutex> lock(g_loader.mutex);
+    return g_loader.running || g_loader.pending;
+}
+
+bool commitScene(RTContext &rtx)
+{
+    std::unique_ptr<Scene> scene;
+    {
+        std::lock_guard<std::mutex> lock(g_loader.mutex);
+        if (!g_loader.pending) { return false; }
+        scene.swap(g_loader.pending);
+    }
+    RT_TRACE_SCOPE("commitScene");
+    std::shared_ptr<Scene> previous(std::move(scene));
+    deactivateScene();
+    g_scene.swap(previous);
+    dropLearnedLight();
+    applyMeshMaterial(*g_scene, rtx);  // Slider edits made while the scene was loading
+    animateScene(rtx, rtx.animation_time);
+    resetImage(rtx);
+    return true;  // The old scene's arena is freed as `previous` goes out of scope
+}
+
+int materialCount()
+{
+    return g_scene ? int(g_scene->materials.size()) : 0;
+}
+
+const char *materialName(int index)
+{
+    return g_scene->materials[index].name;
+}
+
+MaterialParams materialParams(int index)
+{
+    return g_scene->materials[index].material->params();
+}
+
+void editMaterial(RTContext &rtx, int index, const MaterialParams &params)
+{
+    g_scene->materials[index].material->setParams(params);
+    updateLightDistribution(*g_scene);
+    dropLearnedLight();
+    resetAccumulation(rtx);
+}
+
+void applyMaterialSettings(RTContext &rtx)
+{
+    if (!g_scene) { return; }
+    applyMeshMaterial(*g_scene, rtx);
+    dropLearnedLight();
+    resetAccumulation(rtx);
+}
+
+bool loadEnvironment(RTContext &rtx, const std::string &path)
+{
+    RT_TRACE_SCOPE("loadEnvironment");
+    std::unique_ptr<EnvironmentMap> environment(new EnvironmentMap());
+    if (!environment->load(path)) { return false; }
+    g_environment.swap(environment);
+    g_environment_path = path;
+    rtx.use_environment = true;
+    resetAccumulation(rtx);
+    return true;
+}
+
+EnvironmentInfo environmentInfo()
+{
+    EnvironmentInfo info;
+    if (g_environment) {
+        info.width = g_environment->width();
+        info.height = g_environment->height();
+        info.bytes = g_environment->bytes();
+    }
+    return info;
+}
+
+std::string sceneFilename()
+{
+    return g_scene ? g_scene->mesh_filename : std::string();
+}
+
+std::string environmentPath()
+{
+    return g_environment ? g_environment_path : std::string();
+}
+
+SceneMemory sceneMemory()
+{
+    SceneMemory memory;
+    if (g_scene) {
+        memory.bytes_used = g_scene->arena.bytesUsed();
+        memory.bytes_reserved = g_scene->arena.bytesReserved();
+        const Scene &scene = *g_scene;
+        memory.spheres = scene.spheres.size();
+        memory.boxes = scene.boxes.size();
+        memory.compressed_mesh = !scene.mesh_compressed.empty();
+        if (memory.compressed_mesh) {
+            memory.triangles = scene.mesh_compressed.triangleCount();
+            memory.mesh_bytes = scene.mesh_compressed.bytes();
+        } else if (!scene.mesh_streamed.empty()) {
+            StreamStats stream = scene.mesh_streamed.stats();
+            memory.triangles = stream.triangles;
+            memory.mesh_bytes = stream.bytes;
+        } else {
+            memory.triangles = scene.mesh.size();
+            memory.mesh_bytes = scene.mesh.capacity() * sizeof(Triangle) +
+                                scene.mesh_bvh.nodes.capacity() * sizeof(BVHNode) +
+                                12 * scene.mesh_soa.v0_x.capacity() * sizeof(float);
+        }
+    }
+    return memory;
+}
+
+void setMeshMemoryBudget(std::size_t bytes)
+{
+    g_mesh_budget = bytes;
+}
+
+std::size_t meshMemoryBudget()
+{
+    return g_mesh_budget;
+}
+
+void setStreamingBudget(std::size_t bytes)
+{
+    g_stream_budget = bytes;
+    if (g_scene) { g_scene->mesh_streamed.setBudget(bytes); }
+}
+
+StreamStats streamingStats()
+{
+    StreamStats stats;
+    if (g_scene) { stats = g_scene->mesh_streamed.stats(); }
+    stats.budget = g_stream_budget;
+    return stats;
+}
+
+// Pose of the animated mesh at one point in time, applied to rest positions
+struct MeshPose {
+    int mode;
+    glm::mat4 rigid = glm::mat4(1.0f);  // The whole mesh, or the upper bone for sway
+    float blend_lo = 0.0f;              // Sway weights ramp from the lower bone to the
+    float blend_hi = 0.0f;              // upper one over this height range
+
+    MeshPose(int animation, float time, const AABB &rest) : mode(animation)
+    {
+        glm::vec3 center = rest.center();
+        if (mode == ANIM_TURNTABLE) {
+            // A quarter turn per second about the vertical axis through the center
+            glm::mat4 m = glm::translate(glm::mat4(1.0f), center);
+            m = glm::rotate(m, 0.5f * glm::pi<float>() * time, glm::vec3(0.0f, 1.0f, 0.0f));
+            rigid = glm::translate(m, -center);
+        } else if (mode == ANIM_SWAY) {
+            // The upper bone swings 0.5 rad each way every 2 s about a joint 40% up
+            float height = rest.extent().y;
+            glm::vec3 joint(center.x, rest.lo.y + 0.4f * height, center.z);
+            float angle = 0.5f * std::sin(glm::pi<float>() * time);
+            glm::mat4 m = glm::translate(glm::mat4(1.0f), joint);
+            m = glm::rotate(m, angle, glm::vec3(0.0f, 0.0f, 1.0f));
+            rigid = glm::translate(m, -joint);
+            blend_lo = joint.y - 0.15f * height;
+            blend_hi = joint.y + 0.15f * height;
+        }
+    }
+
+    glm::vec3 apply(const glm::vec3 &p) const
+    {
+        glm::vec3 moved(rigid * glm::vec4(p, 1.0f));
+        if (mode != ANIM_SWAY) { return moved; }
+        float w = glm::clamp((p.y - blend_lo) / (blend_hi - blend_lo), 0.0f, 1.0f);
+        return glm::mix(p, moved, w * w * (3.0f - 2.0f * w));
+    }
+};
+
+// Background rebuild of the animated mesh BVH, built from a snapshot of the
+// triangle bounds. animateScene swaps the new tree in and refits it to the
+// pose of the moment.
+struct BVHRebuilder {
+    std::mutex mutex;
+    std::thread thread;
+    std::weak_ptr<Scene> scene;  // Whose mesh the snapshot is of
+    BVH bvh;
+    std::vector<std::uint32_t> order;
+    bool running = false;
+    bool done = false;
+    float build_ms = 0.0f;
+
+    ~BVHRebuilder()
+    {
+        if (thread.joinable()) { thread.join(); }
+    }
+} g_rebuilder;
+
+struct AnimationState {
+    AnimationStats stats;
+    std::vector<AABB> bounds;  // Of the posed triangles, in mesh order
+    int frame = 0;             // Frame the last playback step was taken at
+} g_animation;
+
+void rebuildMain(std::vector<AABB> bounds)
+{
+    trace::setThreadName("bvh rebuild");
+    RT_TRACE_SCOPE("rebuildBVH");
+    auto start = std::chrono::steady_clock::now();
+    // Only the render thread reads these, and only once `done` is set
+    g_rebuilder.bvh.build(bounds, kSoALeafSize, g_rebuilder.order);
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::lock_guard<std::mutex> lock(g_rebuilder.mutex);
+    g_rebuilder.build_ms = elapsed.count();
+    g_rebuilder.running = false;
+    g_rebuilder.done = true;
+}
+
+void startRebuild(const std::shared_ptr<Scene> &scene, const std::vector<AABB> &bounds)
+{
+    std::lock_guard<std::mutex> lock(g_rebuilder.mutex);
+    if (g_rebuilder.running || g_rebuilder.done) { return; }
+    if (g_rebuilder.thread.joinable()) { g_rebuilder.thread.join(); }  // Already finished
+    g_rebuilder.scene = scene;
+    g_rebuilder.running = true;
+    g_rebuilder.thread = std::thread(rebuildMain, bounds);
+}
+
+// Swaps in a finished rebuild of `scene`'s mesh BVH. The rest pose is put in
+// the new leaf order; the caller poses and refits the mesh afterwards.
+bool commitRebuild(Scene &scene)
+{
+    {
+        std::lock_guard<std::mutex> lock(g_rebuilder.mutex);
+        if (!g_rebuilder.done) { return false; }
+        g_rebuilder.done = false;
+        g_animation.stats.rebuild_ms = g_rebuilder.build_ms;
+    }
+    g_rebuilder.thread.join();
+    if (g_rebuilder.scene.lock().get() != &scene ||
+        g_rebuilder.order.size() != scene.rest_mesh.size()) {
+        return false;  // The scene was replaced while the rebuild ran
+    }
+
+    RT_TRACE_SCOPE("commitRebuild");
+    std::vector<Triangle> rest(scene.rest_mesh.begin(), scene.rest_mesh.end());
+    for (size_t i = 0; i < rest.size(); ++i) { scene.rest_mesh[i] = rest[g_rebuilder.order[i]]; }
+    scene.mesh_bvh.assignNodes(g_rebuilder.bvh);
+    ++g_animation.stats.rebuilds;
+    return true;
+}
+
+void animateScene(RTContext &rtx, float time)
+{
+    rtx.animation_time = time;
+    // Compressed and streamed meshes are static
+    if (!g_scene || g_scene->mesh.empty() || !g_scene->mesh_streamed.empty() ||
+        (rtx.animation == ANIM_NONE && g_scene->rest_mesh.empty())) {
+        return;
+    }
+    RT_TRACE_SCOPE("animateScene");
+    auto start = std::chrono::steady_clock::now();
+    Scene &scene = *g_scene;
+    if (scene.rest_mesh.empty()) {
+        scene.rest_mesh.assign(scene.mesh.begin(), scene.mesh.end());
+        for (const Triangle &tri : scene.rest_mesh) {
+            if (tri.mat_ptr == scene.mesh_material) { scene.rest_bounds.grow(tri.bounds()); }
+        }
+        scene.built_cost = scene.mesh_bvh.sahCost();
+    }
+    bool rebuilt = commitRebuild(scene);
+
+    // Only the loaded mesh moves; emitters stay where they are
+    MeshPose pose(rtx.animation, time, scene.rest_bounds);
+    int count = int(scene.mesh.size());
+    std::vector<AABB> &bounds = g_animation.bounds;
+    bounds.resize(count);
+    int animated = 0;
+#pragma omp parallel for schedule(static) reduction(+ : animated)
+    for (int i = 0; i < count; ++i) {
+        Triangle tri = scene.rest_mesh[i];
+        if (tri.mat_ptr == scene.mesh_material) {
+            tri.v0 = pose.apply(tri.v0);
+            tri.v1 = pose.apply(tri.v1);
+            tri.v2 = pose.apply(tri.v2);
+            ++animated;
+        }
+        scene.mesh[i] = tri;
+        bounds[i] = tri.bounds();
+    }
+    scene.mesh_bvh.refit(bounds.data());
+    scene.mesh_soa.update(scene.mesh.data());
+    dropLearnedLight();
+
+    AnimationStats &stats = g_animation.stats;
+    stats.triangles = animated;
+    stats.sah_cost = scene.mesh_bvh.sahCost();
+    if (rebuilt) { scene.built_cost = stats.sah_cost; }
+    stats.sah_ratio = scene.built_cost > 0.0f ? stats.sah_cost / scene.built_cost : 1.0f;
+    ++stats.refits;
+    if (stats.sah_ratio > rtx.rebuild_threshold) { startRebuild(g_scene, bounds); }
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    stats.pose_ms = elapsed.count();
+}
+
+AnimationStats animationStats()
+{
+    AnimationStats stats = g_animation.stats;
+    std::lock_guard<std::mutex> lock(g_rebuilder.mutex);
+    stats.rebuilding = g_rebuilder.running;
+    return stats;
+}
+
+// Current value of the counter the heatmap measures, for the calling thread
+std::uint64_t traversalCost(int heatmap_mode)
+{
+    const stats::ThreadCounters &counters = stats::local();
+    switch (heatmap_mode) {
+    case HEATMAP_NODES:
+        return counters.values[stats::BVH_NODES].load(std::memory_order_relaxed);
+    case HEATMAP_PRIMITIVES:
+        return counters.values[stats::SPHERE_TESTS].load(std::memory_order_relaxed) +
+               counters.values[stats::BOX_TESTS].load(std::memory_order_relaxed) +
+               counters.values[stats::TRIANGLE_TESTS].load(std::memory_order_relaxed);
+    case HEATMAP_TIME:
+        return stats::cycleCount();
+    default:
+        return 0;
+    }
+}
+
+// Pixels whose paths reached streamed clusters that were not resident. They
+// are left out of their frame and traced again, with the same samples, once
+// the loader has brought more clusters in.
+struct DeferredPixel {
+    int x;
+    int y;
+    std::uint32_t sample_base;
+};
+
+struct DeferredPixels {
+    std::mutex mutex;
+    std::vector<DeferredPixel> pixels;
+    std::uint64_t batches = 0;  // Loader batches finished at the last retry
+} g_deferred;
+
+// Camera samples and rays of the tile being rendered, shared by all kernels
+struct TileScratch {
+    CameraSamples camera_samples;
+    RayBatch rays;
+};
+
+TileScratch &tileScratch()
+{
+    static thread_local TileScratch scratch;
+    return scratch;
+}
+
+// Camera rays for samples [sample_base, sample_base + spp) of every pixel in
+// [x0, x1) x [y0, y1), generated as one batch; sample s of pixel p in row
+// order is ray p * spp + s
+const RayBatch &cameraRays(RTContext &rtx, Sampler &sampler, int x0, int y0, int x1, int y1,
+                           std::uint32_t sample_base)
+{
+    int spp = rtx.samples_per_pixel;
+    int tile_width = x1 - x0;
+    CameraSamples &camera_samples = tileScratch().camera_samples;
+    RayBatch &rays = tileScratch().rays;
+    camera_samples.resize(tile_width * (y1 - y0) * spp);
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            int base = ((y - y0) * tile_width + (x - x0)) * spp;
+            for (int s = 0; s < spp; ++s) {
+                sampler.startSample(x, y, sample_base + std::uint32_t(s));
+                glm::vec2 jitter = sampler.pixel();
+                glm::vec2 lens = sampler.lens();
+                camera_samples.film_x[base + s] = float(x) + jitter.x;
+                camera_samples.film_y[base + s] = float(y) + jitter.y;
+                camera_samples.lens_u[base + s] = lens.x;
+                camera_samples.lens_v[base + s] = lens.y;
+            }
+        }
+    }
+    rtx.camera.generate(camera_samples, rays);
+    return rays;
+}
+
+// Before a pixel's first samples of the accumulation
+void startPixel(RTContext &rtx, int x, int y, bool retry)
+{
+    // 处理第一帧
+    if (rtx.current_frame <= 0 && !retry) {
+        int nx = rtx.width;
+        glm::vec4 old = rtx.image[y * nx + x];
+        rtx.image[y * nx + x] = glm::clamp(old / glm::max(1.0f, old.a), 0.0f, 1.0f);
+        rtx.heatmap[y * nx + x] = glm::vec2(0.0f);
+    }
+}
+
+// Adds the sum `col` of a pixel's samples to the image, or defers the pixel
+// if a path missed streamed clusters
+template <bool kGamma>
+void finishPixel(RTContext &rtx, int x, int y, glm::vec3 col, std::uint32_t sample_base,
+                 bool incomplete)
+{
+    if (incomplete) {
+        DeferredPixel pixel = {x, y, sample_base};
+        std::lock_guard<std::mutex> lock(g_deferred.mutex);
+        g_deferred.pixels.push_back(pixel);
+        return;
+    }
+
+    // 应用gamma校正
+    col = col / float(rtx.samples_per_pixel);
+
+    // 根據設置決定是否進行Gamma校正
+    if (kGamma) {
+        col = glm::vec3(sqrt(col.x), sqrt(col.y), sqrt(col.z)); // gamma校正
+    }
+
+    rtx.image[y * rtx.width + x] += glm::vec4(col, 1.0f);
+}
+
+// Renders pixels [x0, x1) x [y0, y1) with samples [sample_base, sample_base +
+// spp). Camera rays for the whole tile are generated up front as one batch,
+// then traced pixel by pixel. `retry` is set for deferred pixels. Every
+// instantiation is one render kernel, see selectRenderKernel.
+template <typename Shader, bool kGamma>
+void renderPixels(RTContext &rtx, int x0, int y0, int x1, int y1, std::uint32_t sample_base,
+                  bool retry)
 {
     int nx = rtx.width;
-    int ny = rtx.height;
-    float aspect = float(nx) / float(ny);
-    glm::vec3 lower_left_corner(-1.0f * aspect, -1.0f, -1.0f);
-    glm::vec3 horizontal(2.0f * aspect, 0.0f, 0.0f);
-    glm::vec3 vertical(0.0f, 2.0f, 0.0f);
-    glm::vec3 origin(0.0f, 0.0f, 0.0f);
-    glm::mat4 world_from_view = glm::inverse(rtx.view);
-
-    for (int x = 0; x < nx; ++x) {
+    int spp = rtx.samples_per_pixel;
+    int tile_width = x1 - x0;
+    Sampler sampler(rtx.sampler);
+    const RayBatch &rays = cameraRays(rtx, sampler, x0, y0, x1, y1, sample_base);
+
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            int base = ((y - y0) * tile_width + (x - x0)) * spp;
+            glm::vec3 col(0.0f);
+            startPixel(rtx, x, y, retry);
+            bool heatmap = Shader::optional && rtx.heatmap_mode != HEATMAP_OFF;
+            std::uint64_t cost_start = heatmap ? traversalCost(rtx.heatmap_mode) : 0;
+
+            // 多重采样
+            for (int s = 0; s < spp; s++) {
+                sampler.startSample(x, y, sample_base + std::uint32_t(s));
+                Ray r = rays.ray(base + s);
+                RayCone cone = {0.0f, rtx.camera.spreadAngle(r.direction())};
+                col += Shader::radiance(rtx, sampler, r, cone);
+            }
+            bool incomplete = StreamedMesh::takeMiss();
+
+            // Heatmap pixels are coloured later by resolveHeatmap
+            if (heatmap) {
+                float cost = float(traversalCost(rtx.heatmap_mode) - cost_start);
+                if (rtx.heatmap_mode == HEATMAP_TIME) { cost *= stats::nanosecondsPerCycle(); }
+                rtx.heatmap[y * nx + x] += glm::vec2(cost / float(spp), 1.0f);
+                continue;
+            }
+            finishPixel<kGamma>(rtx, x, y, col, sample_base, incomplete);
+        }
+    }
+}
+
+// Paths of a tile traced breadth-first, see renderReordered
+struct WavefrontScratch {
+    struct Path {
+        Ray ray;  // Next ray to trace
+        RayCone cone;
+        float bsdf_pdf;
+    };
+    std::vector<Path> paths;
+    std::vector<glm::vec3> radiance;     // Per path and bounce, see shadeHit
+    std::vector<glm::vec3> attenuation;  // Per path and bounce; zero where the path ended
+    std::vector<GuidingVertex> guiding;  // Per path and bounce, with rtx.path_guiding
+    std::vector<int> lengths;            // Vertices per path
+    std::vector<std::uint64_t> queue;    // Paths to extend, (sort key << 32) | path
+    std::vector<std::uint64_t> sort_scratch;
+    std::vector<char> incomplete;        // Per pixel
+};
+
+WavefrontScratch &wavefrontScratch()
+{
+    static thread_local WavefrontScratch scratch;
+    return scratch;
+}
+
+// renderPixels with the paths of the whole tile extended one bounce at a
+// time. Before each secondary bounce, the rays still alive are sorted by
+// direction octant and origin (rayOrderKey), so that consecutive rays tend
+// to traverse the same BVH nodes. Vertices are kept per path and summed
+// back to front at the end, in the order PathTracer does it, so the image is
+// the same to the bit.
+template <typename Config, bool kGamma>
+void renderReordered(RTContext &rtx, int x0, int y0, int x1, int y1, std::uint32_t sample_base,
+                     bool retry)
+{
+    if ((Config::optional && rtx.heatmap_mode != HEATMAP_OFF) || rtx.max_bounces < 0) {
+        // Costs are per pixel, and paths of no bounces need no ordering
+        renderPixels<PathTracer<Config, kRuntimeDepth>, kGamma>(rtx, x0, y0, x1, y1, sample_base, retry);
+        return;
+    }
+    RT_TRACE_SCOPE("renderReordered");
+    int spp = rtx.samples_per_pixel;
+    int tile_width = x1 - x0;
+    int pixels = tile_width * (y1 - y0);
+    int count = pixels * spp;
+    int vertices = rtx.max_bounces + 1;
+    Sampler sampler(rtx.sampler);
+    const RayBatch &rays = cameraRays(rtx, sampler, x0, y0, x1, y1, sample_base);
+
+    WavefrontScratch &w = wavefrontScratch();
+    w.paths.resize(count);
+    w.radiance.resize(std::size_t(count) * vertices);
+    w.attenuation.resize(std::size_t(count) * vertices);
+    bool guiding = Config::optional && rtx.path_guiding;
+    if (guiding) { w.guiding.resize(std::size_t(count) * vertices); }
+    w.lengths.assign(count, 0);
+    w.incomplete.assign(pixels, 0);
+    w.queue.resize(count);
+    for (int i = 0; i < count; ++i) {
+        WavefrontScratch::Path &path = w.paths[i];
+        path.ray = rays.ray(i);
+        path.cone.width = 0.0f;
+        path.cone.spread = rtx.camera.spreadAngle(path.ray.direction());
+        path.bsdf_pdf = 0.0f;
+        w.queue[i] = std::uint64_t(i);
+    }
+
+    for (int bounce = 0; bounce < vertices && !w.queue.empty(); ++bounce) {
+        if (bounce > 0) {
+            AABB origins;
+            for (std::size_t k = 0; k < w.queue.size(); ++k) {
+                origins.grow(w.paths[std::uint32_t(w.queue[k])].ray.origin());
+            }
+            for (std::size_t k = 0; k < w.queue.size(); ++k) {
+                std::uint32_t i = std::uint32_t(w.queue[k]);
+                w.queue[k] = (std::uint64_t(rayOrderKey(w.paths[i].ray, origins)) << 32) | i;
+            }
+            sortRayKeys(w.queue, w.sort_scratch);
+        }
+
+        int depth = rtx.max_bounces - bounce;
+        std::size_t alive = 0;
+        for (std::size_t k = 0; k < w.queue.size(); ++k) {
+            std::uint32_t i = std::uint32_t(w.queue[k]);
+            WavefrontScratch::Path &path = w.paths[i];
+            int pixel = int(i) / spp;
+            sampler.startSample(x0 + pixel % tile_width, y0 + pixel / tile_width,
+                                sample_base + std::uint32_t(int(i) % spp));
+            RT_STAT_INC(stats::depthCounter(bounce));
+
+            glm::vec3 &radiance = w.radiance[std::size_t(i) * vertices + bounce];
+            glm::vec3 &attenuation = w.attenuation[std::size_t(i) * vertices + bounce];
+            Ray scattered;
+            float pdf;
+            RayCone next;
+            GuidingVertex guide;
+            guide.cell = nullptr;
+            HitRecord rec;
+            bool extend = false;
+            const Ray &r = path.ray;
+            if (hit_world(r, glm::max(r.t_min(), rtx.epsilon), glm::min(r.t_max(), 9999.0f), rec)) {
+                extend = shadeHit<Config>(rtx, sampler, r, rec, depth, path.bsdf_pdf, path.cone,
+                                          radiance, scattered, attenuation, pdf, next, guide);
+            } else {
+                radiance = missRadiance<Config::optional>(rtx, r, path.bsdf_pdf);
+            }
+            if (!extend) {
+                attenuation = glm::vec3(0.0f);
+                guide.cell = nullptr;
+            }
+            if (guiding) { w.guiding[std::size_t(i) * vertices + bounce] = guide; }
+            w.lengths[i] = bounce + 1;
+            if (StreamedMesh::takeMiss()) { w.incomplete[pixel] = 1; }
+
+            if (extend && depth > 0) {
+                path.ray = scattered;
+                path.cone = next;
+                path.bsdf_pdf = pdf;
+                w.queue[alive++] = i;
+            }
+        }
+        w.queue.resize(alive);
+    }
+
+    for (int pixel = 0; pixel < pixels; ++pixel) {
+        int x = x0 + pixel % tile_width;
+        int y = y0 + pixel / tile_width;
+        startPixel(rtx, x, y, retry);
         glm::vec3 col(0.0f);
-        
-        // 处理第一帧
-        if (rtx.current_frame <= 0) {
-            glm::vec4 old = rtx.image[y * nx + x];
-            rtx.image[y * nx + x] = glm::clamp(old / glm::max(1.0f, old.a), 0.0f, 1.0f);
+        for (int s = 0; s < spp; ++s) {
+            std::size_t i = std::size_t(pixel) * spp + s;
+            const glm::vec3 *radiance = &w.radiance[i * vertices];
+            const glm::vec3 *attenuation = &w.attenuation[i * vertices];
+            glm::vec3 value(0.0f);
+            for (int v = w.lengths[i] - 1; v >= 0; --v) {
+                // `value` is the light that came back along the vertex's scattered ray
+                if (guiding && w.guiding[i * vertices + v].cell) {
+                    trainGuiding(w.guiding[i * vertices + v], value);
+                }
+                value = radiance[v] + attenuation[v] * value;
+            }
+            col += value;
         }
-        
-        // 多重采样
-        for (int s = 0; s < rtx.samples_per_pixel; s++) {
-            float u = float(x + drand48()) / float(nx);
-            float v = float(y + drand48()) / float(ny);
-            
-            Ray r(origin, lower_left_corner + u * horizontal + v * vertical);
-            r.A = glm::vec3(world_from_view * glm::vec4(r.A, 1.0f));
-            r.B = glm::vec3(world_from_view * glm::vec4(r.B, 0.0f));
-            
-            col += color(rtx, r, rtx.max_bounces);
+        finishPixel<kGamma>(rtx, x, y, col, sample_base, w.incomplete[pixel] != 0);
+    }
+}
+
+// Every render kernel, by the settings they are compiled for
+struct KernelTable {
+    // [gamma][next-event estimation][Russian roulette][standard materials][bounces],
+    // where bounces past kMaxKernelBounces use the kRuntimeDepth kernel
+    RenderKernel paths[2][2][2][2][kMaxKernelBounces + 2];
+    // The same with optional features on; any bounce count, as they are rare
+    // enough not to be worth a kernel per count
+    RenderKernel optional_paths[2][2][2][2];
+    // [gamma][next-event estimation][Russian roulette][standard materials][optional features]
+    RenderKernel reordered[2][2][2][2][2];
+    RenderKernel normals[2][2];  // [gamma][optional features]
+
+    template <typename Config, bool kGamma, int kDepth>
+    struct Depths {
+        static void fill(RenderKernel *out)
+        {
+            out[kDepth] = &renderPixels<PathTracer<Config, kDepth>, kGamma>;
+            Depths<Config, kGamma, kDepth - 1>::fill(out);
         }
-        
-        // 应用gamma校正
-        col = col / float(rtx.samples_per_pixel);
-            
-        // 根據設置決定是否進行Gamma校正
-        if (rtx.enable_gamma_correction) {
-            col = glm::vec3(sqrt(col.x), sqrt(col.y), sqrt(col.z)); // gamma校正
+    };
+    template <typename Config, bool kGamma>
+    struct Depths<Config, kGamma, -1> {
+        static void fill(RenderKernel *) {}
+    };
+
+    template <bool kGamma, bool kNee, bool kRoulette, typename Materials>
+    void fill(RenderKernel *out, RenderKernel &optional_out, RenderKernel *reordered_out)
+    {
+        typedef KernelConfig<kNee, kRoulette, Materials, false> Config;
+        typedef KernelConfig<kNee, kRoulette, Materials, true> OptionalConfig;
+        Depths<Config, kGamma, kMaxKernelBounces>::fill(out);
+        out[kMaxKernelBounces + 1] = &renderPixels<PathTracer<Config, kRuntimeDepth>, kGamma>;
+        optional_out = &renderPixels<PathTracer<OptionalConfig, kRuntimeDepth>, kGamma>;
+        reordered_out[0] = &renderReordered<Config, kGamma>;
+        reordered_out[1] = &renderReordered<OptionalConfig, kGamma>;
+    }
+    template <bool kGamma, bool kNee, bool kRoulette>
+    void fill()
+    {
+        fill<kGamma, kNee, kRoulette, AnyMaterials>(paths[kGamma][kNee][kRoulette][0],
+                                                    optional_paths[kGamma][kNee][kRoulette][0],
+                                                    reordered[kGamma][kNee][kRoulette][0]);
+        fill<kGamma, kNee, kRoulette, StandardMaterials>(paths[kGamma][kNee][kRoulette][1],
+                                                         optional_paths[kGamma][kNee][kRoulette][1],
+                                                         reordered[kGamma][kNee][kRoulette][1]);
+    }
+    template <bool kGamma>
+    void fill()
+    {
+        fill<kGamma, false, false>();
+        fill<kGamma, false, true>();
+        fill<kGamma, true, false>();
+        fill<kGamma, true, true>();
+        normals[kGamma][0] = &renderPixels<NormalShader<false>, kGamma>;
+        normals[kGamma][1] = &renderPixels<NormalShader<true>, kGamma>;
+    }
+
+    KernelTable()
+    {
+        fill<false>();
+        fill<true>();
+    }
+};
+
+// Whether any setting is on that only kernels compiled with
+// KernelConfig::optional test
+bool optionalFeatures(const RTContext &rtx)
+{
+    return rtx.irradiance_cache || rtx.path_guiding || rtx.heatmap_mode != HEATMAP_OFF ||
+           environmentActive(rtx);
+}
+
+RenderKernel findRenderKernel(const RTContext &rtx)
+{
+    static const KernelTable table;
+    bool gamma = rtx.enable_gamma_correction;
+    bool optional = optionalFeatures(rtx);
+    if (rtx.show_normals && rtx.max_bounces >= 0) { return table.normals[gamma][optional]; }
+    bool standard = !g_scene || g_scene->standard_materials;
+    bool nee = rtx.next_event_estimation;
+    bool roulette = rtx.russian_roulette;
+    if (rtx.reorder_rays) { return table.reordered[gamma][nee][roulette][standard][optional]; }
+    if (optional) { return table.optional_paths[gamma][nee][roulette][standard]; }
+    int depth = rtx.max_bounces >= 0 && rtx.max_bounces <= kMaxKernelBounces ? rtx.max_bounces
+                                                                            : kMaxKernelBounces + 1;
+    return table.paths[gamma][nee][roulette][standard][depth];
+}
+
+void selectRenderKernel(RTContext &rtx)
+{
+    rtx.kernel = findRenderKernel(rtx);
+}
+
+std::string renderKernelName(const RTContext &rtx)
+{
+    std::string name;
+    if (rtx.show_normals && rtx.max_bounces >= 0) {
+        name = "normals";
+    } else {
+        bool standard = !g_scene || g_scene->standard_materials;
+        if (rtx.reorder_rays) {
+            name = "reordered paths";
+        } else if (rtx.max_bounces >= 0 && rtx.max_bounces <= kMaxKernelBounces &&
+                   !optionalFeatures(rtx)) {
+            name = "path, " + std::to_string(rtx.max_bounces) + " bounces";
+        } else {
+            name = "path, any bounces";
         }
-            
-        rtx.image[y * nx + x] += glm::vec4(col, 1.0f);
+        if (rtx.next_event_estimation) { name += ", NEE"; }
+        if (rtx.russian_roulette) { name += ", roulette"; }
+        name += standard ? ", built-in materials" : ", virtual materials";
     }
+    if (optionalFeatures(rtx)) { name += ", optional features"; }
+    if (rtx.enable_gamma_correction) { name += ", gamma"; }
+    return name;
+}
+
+void renderTile(RTContext &rtx, int x0, int y0, int x1, int y1)
+{
+    // Frame f of the accumulation uses sample indices [(f + 1) * spp, (f + 2) * spp);
+    // resetAccumulation() starts at frame -1, which also contributes a sample
+    std::uint32_t sample_base = std::uint32_t(glm::max(rtx.current_frame + 1, 0)) * rtx.samples_per_pixel;
+    RenderKernel kernel = rtx.kernel ? rtx.kernel : findRenderKernel(rtx);
+    kernel(rtx, x0, y0, x1, y1, sample_base, false);
+}
+
+void resolveDeferredPixels(RTContext &rtx, bool wait)
+{
+    if (!g_scene || g_scene->mesh_streamed.empty()) { return; }
+    StreamedMesh &mesh = g_scene->mesh_streamed;
+    RenderKernel kernel = rtx.kernel ? rtx.kernel : findRenderKernel(rtx);
+    while (true) {
+        if (wait) { mesh.waitForLoads(); }
+        mesh.collect();  // No query is running here
+
+        std::vector<DeferredPixel> pixels;
+        {
+            std::lock_guard<std::mutex> lock(g_deferred.mutex);
+            if (g_deferred.pixels.empty()) { return; }
+            if (!wait && g_deferred.batches == mesh.batchesLoaded()) { return; }  // Nothing new
+            g_deferred.batches = mesh.batchesLoaded();
+            pixels.swap(g_deferred.pixels);
+        }
+
+        // Pixels that miss again are deferred again. Each round loads the
+        // next clusters their paths need and keeps the ones they used, so
+        // waiting terminates.
+        RT_TRACE_SCOPE_ARG("retraceDeferred", int(pixels.size()));
+#pragma omp parallel for schedule(dynamic, 16) if (wait)
+        for (int i = 0; i < int(pixels.size()); ++i) {
+            const DeferredPixel &p = pixels[i];
+            kernel(rtx, p.x, p.y, p.x + 1, p.y + 1, p.sample_base, true);
+        }
+        if (!wait) { return; }
+    }
+}
+
+// MODIFY THIS FUNCTION!
+void updateLine(RTContext &rtx, int y)
+{
+    RT_TRACE_SCOPE_ARG("updateLine", y);
+    renderTile(rtx, 0, y, rtx.width, y + 1);
 }
 
 void updateImage(RTContext &rtx)
 {
-    if (rtx.freeze) return;                    // Skip update
+    if (rtx.freeze || !g_scene) return;        // Skip update
     rtx.image.resize(rtx.width * rtx.height);  // Just in case...
+    rtx.camera.update(rtx.view, rtx.fov, rtx.width, rtx.height, rtx.aperture, rtx.focus_distance);
+    rtx.heatmap.resize(rtx.width * rtx.height);
+
+    // Playback advances the animation after every finished frame
+    if (rtx.animation_playing && rtx.current_line == 0 && rtx.current_frame != g_animation.frame) {
+        animateScene(rtx, rtx.animation_time + 1.0f / glm::max(rtx.animation_fps, 1.0f));
+        resetAccumulation(rtx);
+        g_animation.frame = rtx.current_frame;
+    }
 
+    resolveDeferredPixels(rtx, false);
+    textureCache().collect();  // No lookup is running here
+    if (updateDistributed(rtx)) { return; }
     updateLine(rtx, rtx.current_line % rtx.height);
 
     if (rtx.current_frame < rtx.max_frames) {
         rtx.current_line += 1;
         if (rtx.current_line >= rtx.height) {
+            finishFrame(rtx);
             rtx.current_frame += 1;
             rtx.current_line = rtx.current_line % rtx.height;
         }
     }
 }
 
+void finishFrame(RTContext &rtx)
+{
+    textureCache().collect();
+    GuidingState &state = g_guiding;
+    if (!rtx.path_guiding || state.pass >= kGuidingPasses) { return; }
+    state.field.step(kGuidingLearningRate);
+    if (++state.frames < (1 << state.pass)) { return; }
+    // Pass k has 2^k frames' samples; cells split as their square root grows
+    RT_TRACE_SCOPE("refineGuiding");
+    float split_samples = kGuidingSplitSamples * std::sqrt(float(1 << state.pass));
+    state.field.refine(std::uint32_t(split_samples), kGuidingQuadrantShare, kGuidingMaxDepth);
+    ++state.pass;
+    state.frames = 0;
+}
+
+void renderFrame(RTContext &rtx)
+{
+    RT_TRACE_SCOPE("renderFrame");
+    const int tile_size = 32;
+    int tiles_x = (rtx.width + tile_size - 1) / tile_size;
+    int tiles = tiles_x * ((rtx.height + tile_size - 1) / tile_size);
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < tiles; ++t) {
+        int x0 = (t % tiles_x) * tile_size;
+        int y0 = (t / tiles_x) * tile_size;
+        renderTile(rtx, x0, y0, std::min(x0 + tile_size, rtx.width),
+                   std::min(y0 + tile_size, rtx.height));
+    }
+    resolveDeferredPixels(rtx, true);
+    finishFrame(rtx);
+    rtx.current_frame += 1;
+}
+
+void packImage(const RTContext &rtx, std::vector<unsigned char> &rgba)
+{
+    rgba.resize(std::size_t(rtx.width) * rtx.height * 4);
+    for (int y = 0; y < rtx.height; ++y) {
+        const glm::vec4 *row = &rtx.image[std::size_t(rtx.height - 1 - y) * rtx.width];
+        unsigned char *out = &rgba[std::size_t(y) * rtx.width * 4];
+        for (int x = 0; x < rtx.width; ++x) {
+            glm::vec3 c = glm::clamp(glm::vec3(row[x]) / glm::max(1.0f, row[x].a), 0.0f, 1.0f);
+            out[x * 4 + 0] = (unsigned char)(c.r * 255.0f + 0.5f);
+            out[x * 4 + 1] = (unsigned char)(c.g * 255.0f + 0.5f);
+            out[x * 4 + 2] = (unsigned char)(c.b * 255.0f + 0.5f);
+            out[x * 4 + 3] = 255;
+        }
+    }
+}
+
 void resetImage(RTContext &rtx)
 {
     rtx.image.clear();
     rtx.image.resize(rtx.width * rtx.height);
+    rtx.heatmap.clear();
+    rtx.heatmap.resize(rtx.width * rtx.height);
     rtx.current_frame = 0;
     rtx.current_line = 0;
     rtx.freeze = false;
+    selectRenderKernel(rtx);
+    syncLearnedLight(rtx);
+    std::lock_guard<std::mutex> lock(g_deferred.mutex);
+    g_deferred.pixels.clear();
 }
 
 void resetAccumulation(RTContext &rtx)
 {
     rtx.current_frame = -1;
+    selectRenderKernel(rtx);
+    syncLearnedLight(rtx);
+    std::lock_guard<std::mutex> lock(g_deferred.mutex);
+    g_deferred.pixels.clear();
+}
+
+void captureReference(RTContext &rtx)
+{
+    rtx.reference.resize(rtx.image.size());
+    for (size_t i = 0; i < rtx.image.size(); ++i) {
+        const glm::vec4 &p = rtx.image[i];
+        rtx.reference[i] = glm::vec3(p) / glm::max(1.0f, p.a);
+    }
+}
+
+float referenceError(const RTContext &rtx)
+{
+    if (rtx.reference.empty() || rtx.reference.size() != rtx.image.size()) { return -1.0f; }
+    double sum = 0.0;
+    for (size_t i = 0; i < rtx.image.size(); ++i) {
+        const glm::vec4 &p = rtx.image[i];
+        glm::vec3 d = glm::vec3(p) / glm::max(1.0f, p.a) - rtx.reference[i];
+        sum += glm::dot(d, d) / 3.0f;
+    }
+    return float(std::sqrt(sum / rtx.image.size()));
+}
+
+int accumulatedSamples(const RTContext &rtx)
+{
+    // The last pixel is written last, so its weight counts completed frames
+    if (rtx.image.empty()) { return 0; }
+    return int(rtx.image.back().a) * rtx.samples_per_pixel;
+}
+
+// Piecewise-linear false-colour scales sampled at nine evenly spaced points
+glm::vec3 falseColor(int palette, float t)
+{
+    static const float viridis[9][3] = {
+        {0.267004f, 0.004874f, 0.329415f}, {0.282623f, 0.140926f, 0.457517f},
+        {0.253935f, 0.265254f, 0.529983f}, {0.206756f, 0.371758f, 0.553117f},
+        {0.163625f, 0.471133f, 0.558148f}, {0.127568f, 0.566949f, 0.550556f},
+        {0.134692f, 0.658636f, 0.517649f}, {0.477504f, 0.821444f, 0.318195f},
+        {0.993248f, 0.906157f, 0.143936f}};
+    static const float inferno[9][3] = {
+        {0.001462f, 0.000466f, 0.013866f}, {0.087411f, 0.044556f, 0.224813f},
+        {0.258234f, 0.038571f, 0.406485f}, {0.416331f, 0.090203f, 0.432943f},
+        {0.578304f, 0.148039f, 0.404411f}, {0.735683f, 0.215906f, 0.330245f},
+        {0.865006f, 0.316822f, 0.226055f}, {0.954506f, 0.468744f, 0.099874f},
+        {0.988362f, 0.998364f, 0.644924f}};
+
+    t = glm::clamp(t, 0.0f, 1.0f);
+    if (palette == PALETTE_TURBO) {
+        // Polynomial approximation of Google's Turbo colormap
+        glm::vec4 v4(1.0f, t, t * t, t * t * t);
+        glm::vec2 v2(v4.z * v4.z, v4.w * v4.z);
+        return glm::vec3(
+            glm::dot(v4, glm::vec4(0.13572138f, 4.61539260f, -42.66032258f, 132.13108234f)) +
+                glm::dot(v2, glm::vec2(-152.94239396f, 59.28637943f)),
+            glm::dot(v4, glm::vec4(0.09140261f, 2.19418839f, 4.84296658f, -14.18503333f)) +
+                glm::dot(v2, glm::vec2(4.27729857f, 2.82956604f)),
+            glm::dot(v4, glm::vec4(0.10667330f, 12.64194608f, -60.58204836f, 110.36276771f)) +
+                glm::dot(v2, glm::vec2(-89.90310912f, 27.34824973f)));
+    }
+    if (palette == PALETTE_GRAYSCALE) { return glm::vec3(t); }
+
+    const float(*table)[3] = (palette == PALETTE_INFERNO) ? inferno : viridis;
+    float f = t * 8.0f;
+    int i = glm::min(int(f), 7);
+    glm::vec3 a(table[i][0], table[i][1], table[i][2]);
+    glm::vec3 b(table[i + 1][0], table[i + 1][1], table[i + 1][2]);
+    return glm::mix(a, b, f - float(i));
+}
+
+// Map the accumulated per-pixel costs to colours in rtx.image, normalised by
+// the current min/max cost (which is also kept for the GUI legend)
+void resolveHeatmap(RTContext &rtx)
+{
+    if (rtx.heatmap_mode == HEATMAP_OFF) { return; }
+    rtx.heatmap.resize(rtx.width * rtx.height);
+    rtx.image.resize(rtx.width * rtx.height);
+
+    float lo = FLT_MAX;
+    float hi = 0.0f;
+    for (size_t i = 0; i < rtx.heatmap.size(); ++i) {
+        if (rtx.heatmap[i].y > 0.0f) {
+            float cost = rtx.heatmap[i].x / rtx.heatmap[i].y;
+            lo = glm::min(lo, cost);
+            hi = glm::max(hi, cost);
+        }
+    }
+    if (lo > hi) { lo = hi = 0.0f; }
+    rtx.heatmap_min = lo;
+    rtx.heatmap_max = hi;
+
+    float scale_lo = rtx.heatmap_log_scale ? std::log1p(lo) : lo;
+    float scale_hi = rtx.heatmap_log_scale ? std::log1p(hi) : hi;
+    float range = glm::max(scale_hi - scale_lo, 1e-6f);
+    for (size_t i = 0; i < rtx.heatmap.size(); ++i) {
+        if (rtx.heatmap[i].y <= 0.0f) {
+            rtx.image[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            continue;
+        }
+        float cost = rtx.heatmap[i].x / rtx.heatmap[i].y;
+        if (rtx.heatmap_log_scale) { cost = std::log1p(cost); }
+        // Palettes are sRGB; undo the display shader's gamma
+        glm::vec3 rgb = falseColor(rtx.heatmap_palette, (cost - scale_lo) / range);
+        rtx.image[i] = glm::vec4(glm::pow(glm::max(rgb, glm::vec3(0.0f)), glm::vec3(2.2f)), 1.0f);
+    }
 }
 
 }  // namespace rt
@@ -4,10 +4,34 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "rt_camera.h"
+#include "rt_material.h"
+#include "rt_sampler.h"
+#include "rt_stream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <vector>
 
 namespace rt {
 
+// Debug render mode that colours pixels by traversal cost per sample
+enum HeatmapMode { HEATMAP_OFF = 0, HEATMAP_NODES, HEATMAP_PRIMITIVES, HEATMAP_TIME };
+
+enum HeatmapPalette { PALETTE_TURBO = 0, PALETTE_VIRIDIS, PALETTE_INFERNO, PALETTE_GRAYSCALE };
+
+// Mesh animation, see animateScene. Turntable spins the mesh about the
+// vertical axis; sway bends its upper half with two-bone linear blend skinning.
+enum AnimationMode { ANIM_NONE = 0, ANIM_TURNTABLE, ANIM_SWAY, NUM_ANIMATION_MODES };
+
+struct RTContext;
+
+// Renders pixels [x0, x1) x [y0, y1) with samples from sample_base on, in an
+// integrator compiled for one combination of settings; see selectRenderKernel
+typedef void (*RenderKernel)(RTContext &rtx, int x0, int y0, int x1, int y1,
+                             std::uint32_t sample_base, bool retry);
+
 struct RTContext {
     int width = 500;
     int height = 500;
@@ -19,6 +43,10 @@ struct RTContext {
     int max_bounces = 3;
     float epsilon = 2e-4f;
     glm::mat4 view = glm::mat4(1.0f);
+    float fov = 90.0f;             // Vertical, in degrees
+    float aperture = 0.0f;         // Lens diameter; 0 is a pinhole
+    float focus_distance = 2.0f;
+    Camera camera;                 // Rebuilt from the settings above when they change
     glm::vec3 ground_color = glm::vec3(0.5f, 0.5f, 0.5f);  // 几乎黑色的地面
     glm::vec3 sky_color = glm::vec3(0.1f, 0.1f, 0.3f);        // 深蓝色的天空
     bool show_normals = true;
@@ -27,11 +55,200 @@ struct RTContext {
     bool enable_gamma_correction = true;  // 控制是否開啟Gamma校正
     float metallic_roughness = 0.0f;      // 金屬材質的粗糙度
     float material_intensity = 1.0f;      // 材質強度
+    int sampler = SAMPLER_SOBOL;
+    bool next_event_estimation = true;  // Light sampling with MIS at every diffuse hit
+    bool use_environment = false;       // Environment map instead of the sky gradient
+    float environment_intensity = 1.0f;
+    bool russian_roulette = false;
+    int roulette_start_bounce = 2;
+    std::vector<glm::vec3> reference;  // See captureReference()
+    int heatmap_mode = HEATMAP_OFF;
+    int heatmap_palette = PALETTE_TURBO;
+    bool heatmap_log_scale = false;
+    std::vector<glm::vec2> heatmap;  // Per-pixel (cost sum, frame count)
+    float heatmap_min = 0.0f;
+    float heatmap_max = 0.0f;
+    int animation = ANIM_NONE;
+    float animation_time = 0.0f;     // Seconds; the pose animateScene was last given
+    bool animation_playing = false;  // Advance by 1 / animation_fps after every frame
+    float animation_fps = 24.0f;
+    float rebuild_threshold = 1.3f;  // SAH cost growth that starts a background BVH rebuild
+    bool reorder_rays = false;       // Sort secondary rays before tracing them, see selectRenderKernel
+    bool irradiance_cache = false;   // Cached diffuse light past the first hit, see irradianceCacheStats
+    float irradiance_error = 0.3f;   // Error bound of a cached record, relative to its radius
+    bool path_guiding = false;       // Learned scattering distributions, see pathGuidingStats
+    RenderKernel kernel = nullptr;   // See selectRenderKernel
+};
+
+// Memory held by the active scene's arena
+struct SceneMemory {
+    std::size_t bytes_used = 0;
+    std::size_t bytes_reserved = 0;
+    std::size_t spheres = 0;       // Besides the ground
+    std::size_t boxes = 0;
+    std::size_t triangles = 0;
+    bool compressed_mesh = false;  // See setMeshMemoryBudget
+    std::size_t mesh_bytes = 0;    // Mesh triangles and their BVH, in either form
+};
+
+// Scenes kept by activateCachedScene
+struct SceneCacheStats {
+    int entries = 0;
+    std::size_t bytes = 0;   // Arena memory of the cached scenes
+    std::size_t budget = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+};
+
+// Refit and rebuild state of the animated mesh BVH
+struct AnimationStats {
+    int triangles = 0;        // Animated, i.e. those of the loaded mesh
+    float sah_cost = 0.0f;    // Of the refit mesh BVH, see BVH::sahCost
+    float sah_ratio = 1.0f;   // Relative to the cost right after the last (re)build
+    float pose_ms = 0.0f;     // Posing, refit and SoA update of the last frame
+    float rebuild_ms = 0.0f;  // Duration of the last background rebuild
+    int refits = 0;
+    int rebuilds = 0;
+    bool rebuilding = false;
+};
+
+// Irradiance cache of the active scene
+struct IrradianceCacheStats {
+    std::size_t records = 0;
+    std::size_t bytes = 0;
 };
 
+// Path guiding distributions of the active scene
+struct PathGuidingStats {
+    int passes = 0;  // Training passes finished
+    std::size_t cells = 0;
+    std::size_t bytes = 0;
+    float bsdf_fraction = 1.0f;  // Mean over the cells that have learned anything
+};
+
+// Loaded environment map; all zero when there is none
+struct EnvironmentInfo {
+    int width = 0;
+    int height = 0;
+    std::size_t bytes = 0;  // Texels and sampling tables
+};
+
+// Builds the scene and makes it active immediately. `mesh_filename` may also
+// name a procedural scene (see rt_procedural.h); so may the scene arguments
+// of the functions below.
 void setupScene(RTContext &rtx, const char *mesh_filename);
+// Builds a scene on a background thread. commitScene() swaps the latest
+// finished build in and must be called between frames on the render thread.
+void loadSceneAsync(const std::string &mesh_filename);
+bool commitScene(RTContext &rtx);
+bool sceneLoading();
+SceneMemory sceneMemory();
+// Makes the scene for `mesh_filename` active, reusing an earlier build of a
+// file with the same content if it is still cached; otherwise builds it on
+// the calling thread. Returns false if the file cannot be read.
+bool activateCachedScene(RTContext &rtx, const std::string &mesh_filename, bool *cache_hit);
+// Meshes that would take more than this (default 1 GB) as Triangle copies,
+// SoA arrays and float BVH nodes are stored compressed instead: welded
+// vertices, 16-bit leaf indices and 8-bit quantized nodes. Slower to trace,
+// several times smaller, and static. Applies to scenes built afterwards.
+void setMeshMemoryBudget(std::size_t bytes);
+std::size_t meshMemoryBudget();
+// Cluster files (.rtc, see StreamedMesh::preprocess) are streamed from disk
+// through a cluster cache of this size (default 256 MB)
+void setStreamingBudget(std::size_t bytes);
+StreamStats streamingStats();
+// Least recently used scenes are dropped beyond this (default 512 MB)
+void setSceneCacheBudget(std::size_t bytes);
+SceneCacheStats sceneCacheStats();
+// With rtx.irradiance_cache, diffuse hits after the first take their light
+// from irradiance records instead of tracing the path on: records close
+// enough in position and normal are interpolated using their rotation and
+// translation gradients, and a new record is traced where there are none.
+// A record holds all the light arriving at its point, traced from 128
+// stratified directions with the bounces left there. The first hit is
+// always path traced. Records are dropped when the scene, its materials, the
+// pose, the background or rtx.irradiance_error change. Camera moves keep them.
+IrradianceCacheStats irradianceCacheStats();
+// With rtx.path_guiding, non-specular hits scatter either by their BSDF or
+// towards where light was seen to come from, picked with a probability
+// learned per region. Regions split where many paths pass and each holds a
+// quadtree over directions filled with the radiance its paths brought back.
+// Training runs in passes of 1, 2, 4, ... frames; each pass samples from what
+// the previous ones learned, and guiding starts with the second frame. The
+// image stays unbiased throughout. Dropped like the irradiance cache, and
+// also when rtx.max_bounces or next-event estimation change.
+PathGuidingStats pathGuidingStats();
+// Mesh file of the active scene and path of the loaded environment map, or
+// empty strings
+std::string sceneFilename();
+std::string environmentPath();
+
+// Poses the loaded mesh for rtx.animation at `time` seconds and refits the
+// mesh BVH. A finished background rebuild is swapped in first; when the refit
+// tree's SAH cost has grown by rtx.rebuild_threshold, a new one is started on
+// a snapshot of the current pose. Must be called between frames on the render
+// thread; ANIM_NONE restores the rest pose.
+void animateScene(RTContext &rtx, float time);
+AnimationStats animationStats();
+
+// Loads a Radiance .hdr or PNG lat-long image, or a directory of PNG cube
+// faces, as the background and light source (importance sampled at every
+// diffuse hit). Returns false and keeps the current map on failure.
+bool loadEnvironment(RTContext &rtx, const std::string &path);
+EnvironmentInfo environmentInfo();
+
+// In-place material edits on the active scene. Geometry and acceleration
+// structures are left alone; only the accumulated image is reset.
+int materialCount();
+const char *materialName(int index);
+MaterialParams materialParams(int index);
+void editMaterial(RTContext &rtx, int index, const MaterialParams &params);
+// Applies rtx.metallic_roughness and rtx.material_intensity to the mesh material
+void applyMaterialSettings(RTContext &rtx);
 void updateImage(RTContext &rtx);
+// Renders pixels [x0, x1) x [y0, y1) of frame rtx.current_frame and adds them
+// to rtx.image; the camera must be up to date. updateImage does this a line
+// at a time, distributed workers a tile at a time.
+void renderTile(RTContext &rtx, int x0, int y0, int x1, int y1);
+// Pixels whose paths reached streamed clusters that were not resident are
+// left out by renderTile and queued. Traces the queued pixels again, with
+// their original samples, if the loader has finished a batch since the last
+// try; with `wait`, waits for loads until none are left. Call between tiles.
+void resolveDeferredPixels(RTContext &rtx, bool wait);
+// Ends a frame rendered with renderTile, which advances path guiding
+// training and evicts texture tiles over the budget. renderFrame and
+// updateImage call it themselves.
+void finishFrame(RTContext &rtx);
+// Renders all of frame rtx.current_frame in tiles on all cores and advances
+// to the next frame. For headless rendering.
+void renderFrame(RTContext &rtx);
+// Accumulated image as 8-bit RGBA, as displayed, top row first
+void packImage(const RTContext &rtx, std::vector<unsigned char> &rgba);
 void resetImage(RTContext &rtx);
 void resetAccumulation(RTContext &rtx);
+// Picks the render kernel compiled for rtx.show_normals,
+// enable_gamma_correction, next_event_estimation, russian_roulette and
+// max_bounces (up to 10) and for the kinds of the active scene's materials,
+// so that no sample tests these settings. The irradiance cache, path
+// guiding, the heatmap and the environment map are only tested by kernels
+// picked while one of them is on. resetImage, resetAccumulation and scene
+// activation call it; settings changed without either need it called.
+// With rtx.reorder_rays, the paths of a tile are instead extended a bounce at
+// a time, and the secondary rays of each bounce are sorted by direction
+// octant and Morton-coded origin before they are traced. The image is the
+// same either way.
+void selectRenderKernel(RTContext &rtx);
+// The kernel selectRenderKernel picks for the current settings, for display
+std::string renderKernelName(const RTContext &rtx);
+void resolveHeatmap(RTContext &rtx);
+
+// Stores the current image as the reference for referenceError(), e.g. a
+// long uniform-sampled render to measure other samplers against
+void captureReference(RTContext &rtx);
+// RMSE of the current image against the reference, or -1 without one
+float referenceError(const RTContext &rtx);
+// Samples per pixel accumulated so far
+int accumulatedSamples(const RTContext &rtx);
+glm::vec3 falseColor(int palette, float t);
 
 }  // namespace rt
@@ -0,0 +1,35 @@
+#include "rt_reorder.h"
+
+#include <cstring>
+#include <utility>
+
+namespace rt {
+
+void sortRayKeys(std::vector<std::uint64_t> &entries, std::vector<std::uint64_t> &scratch)
+{
+    // Three passes of 10 bits cover the 30-bit keys
+    const int kRadixBits = 10;
+    const std::uint32_t kBuckets = 1u << kRadixBits;
+    std::size_t n = entries.size();
+    scratch.resize(n);
+    std::uint64_t *from = entries.data();
+    std::uint64_t *to = scratch.data();
+    std::uint32_t counts[kBuckets];
+    for (int pass = 0; pass < 3; ++pass) {
+        int shift = 32 + pass * kRadixBits;
+        std::memset(counts, 0, sizeof(counts));
+        for (std::size_t i = 0; i < n; ++i) { ++counts[(from[i] >> shift) & (kBuckets - 1)]; }
+        std::uint32_t sum = 0;
+        for (std::uint32_t b = 0; b < kBuckets; ++b) {
+            std::uint32_t c = counts[b];
+            counts[b] = sum;
+            sum += c;
+        }
+        for (std::size_t i = 0; i < n; ++i) { to[counts[(from[i] >> shift) & (kBuckets - 1)]++] = from[i]; }
+        std::swap(from, to);
+    }
+    // An odd number of passes leaves the result in the scratch buffer
+    entries.swap(scratch);
+}
+
+}  // namespace rt
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "rt_aabb.h"
+#include "rt_ray.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace rt {
+
+// Bits of the Morton code per axis in a ray sort key
+const int kRayKeyMortonBits = 9;
+
+// Spreads the low 9 bits of v so that they occupy every third bit
+inline std::uint32_t spreadBits3(std::uint32_t v)
+{
+    v &= 0x1ffu;
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+    return v;
+}
+
+// 30-bit sort key of a ray: the octant of its direction, then the Morton
+// code of its origin within `bounds`. Rays with nearby keys start close
+// together and head the same way, so they tend to visit the same BVH nodes.
+inline std::uint32_t rayOrderKey(const Ray &r, const AABB &bounds)
+{
+    const float cells = float(1 << kRayKeyMortonBits);
+    glm::vec3 scale = cells / glm::max(bounds.extent(), glm::vec3(1e-20f));
+    glm::vec3 q = glm::clamp((r.origin() - bounds.lo) * scale, glm::vec3(0.0f), glm::vec3(cells - 1.0f));
+    std::uint32_t morton = spreadBits3(std::uint32_t(q.x)) | (spreadBits3(std::uint32_t(q.y)) << 1) |
+                           (spreadBits3(std::uint32_t(q.z)) << 2);
+    std::uint32_t octant = r.sign(0) | (r.sign(1) << 1) | (r.sign(2) << 2);
+    return (octant << (3 * kRayKeyMortonBits)) | morton;
+}
+
+// Sorts entries of the form (key << 32) | payload by key, stably, with a
+// radix sort over the 30 key bits. `scratch` is resized as needed.
+void sortRayKeys(std::vector<std::uint64_t> &entries, std::vector<std::uint64_t> &scratch);
+
+}  // namespace rt
@@ -0,0 +1,264 @@
+#include "rt_sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace rt {
+
+namespace {
+
+// 0x1p-32f: maps a 32-bit integer to [0, 1)
+const float kToUnitFloat = 2.3283064365386963e-10f;
+const float kOneMinusEpsilon = 0.99999994f;
+
+inline float toUnitFloat(std::uint32_t x)
+{
+    return std::fmin(float(x) * kToUnitFloat, kOneMinusEpsilon);
+}
+
+inline std::uint32_t hash(std::uint32_t x)
+{
+    // Finalizer from "Hash Functions for GPU Rendering" (Jarzynski and Olano)
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+inline std::uint32_t hashCombine(std::uint32_t seed, std::uint32_t v)
+{
+    return seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+inline std::uint32_t reverseBits(std::uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Hash-based Owen scrambling from "Practical Hash-based Owen Scrambling"
+// (Burley 2020)
+inline std::uint32_t laineKarrasPermutation(std::uint32_t x, std::uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline std::uint32_t nestedUniformScramble(std::uint32_t x, std::uint32_t seed)
+{
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// Generator matrices of the first four Sobol dimensions (Joe-Kuo direction
+// numbers), one column per index bit
+struct SobolMatrices {
+    std::uint32_t v[4][32];
+
+    SobolMatrices()
+    {
+        static const unsigned s[4] = {0, 1, 2, 3};
+        static const unsigned a[4] = {0, 0, 1, 1};
+        static const unsigned m[4][3] = {{0, 0, 0}, {1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+        for (int i = 0; i < 32; ++i) { v[0][i] = 1u << (31 - i); }
+        for (int d = 1; d < 4; ++d) {
+            for (unsigned i = 0; i < 32; ++i) {
+                if (i < s[d]) {
+                    v[d][i] = m[d][i] << (31 - i);
+                    continue;
+                }
+                std::uint32_t x = v[d][i - s[d]] ^ (v[d][i - s[d]] >> s[d]);
+                for (unsigned k = 1; k < s[d]; ++k) {
+                    if ((a[d] >> (s[d] - 1 - k)) & 1u) { x ^= v[d][i - k]; }
+                }
+                v[d][i] = x;
+            }
+        }
+    }
+};
+
+const SobolMatrices g_sobol;
+
+inline std::uint32_t sobol(std::uint32_t index, int dim)
+{
+    std::uint32_t x = 0;
+    for (int bit = 0; index; index >>= 1, ++bit) {
+        if (index & 1u) { x ^= g_sobol.v[dim][bit]; }
+    }
+    return x;
+}
+
+// Shuffled, Owen-scrambled 4D Sobol point
+void sobol4D(std::uint32_t index, std::uint32_t seed, float out[4])
+{
+    index = nestedUniformScramble(index, seed);
+    for (int d = 0; d < 4; ++d) {
+        out[d] = toUnitFloat(nestedUniformScramble(sobol(index, d), hashCombine(seed, d)));
+    }
+}
+
+// 64x64 tileable blue-noise ranks from the void-and-cluster method (Ulichney
+// 1993), generated once on first use
+const int kBlueNoiseSize = 64;
+const int kBlueNoisePixels = kBlueNoiseSize * kBlueNoiseSize;
+
+struct BlueNoise {
+    std::vector<float> values;
+
+    BlueNoise() : values(kBlueNoisePixels)
+    {
+        const float sigma = 1.5f;
+        std::vector<float> kernel(kBlueNoisePixels);
+        for (int y = 0; y < kBlueNoiseSize; ++y) {
+            for (int x = 0; x < kBlueNoiseSize; ++x) {
+                int dx = std::min(x, kBlueNoiseSize - x);
+                int dy = std::min(y, kBlueNoiseSize - y);
+                kernel[y * kBlueNoiseSize + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        }
+
+        std::vector<char> on(kBlueNoisePixels, 0);
+        std::vector<float> energy(kBlueNoisePixels, 0.0f);
+        auto splat = [&](int p, float sign) {
+            int px = p % kBlueNoiseSize, py = p / kBlueNoiseSize;
+            for (int y = 0; y < kBlueNoiseSize; ++y) {
+                const float *row = &kernel[((y - py) & (kBlueNoiseSize - 1)) * kBlueNoiseSize];
+                float *e = &energy[y * kBlueNoiseSize];
+                for (int x = 0; x < kBlueNoiseSize; ++x) {
+                    e[x] += sign * row[(x - px) & (kBlueNoiseSize - 1)];
+                }
+            }
+        };
+        auto extreme = [&](bool want_on, bool largest) {
+            int best = -1;
+            for (int p = 0; p < kBlueNoisePixels; ++p) {
+                if (bool(on[p]) != want_on) { continue; }
+                if (best < 0 || (largest ? energy[p] > energy[best] : energy[p] < energy[best])) {
+                    best = p;
+                }
+            }
+            return best;
+        };
+
+        // Initial pattern: a tenth of the pixels at hashed positions, relaxed
+        // by moving the tightest cluster into the largest void
+        const int initial = kBlueNoisePixels / 10;
+        for (std::uint32_t i = 0, n = 0; n < initial; ++i) {
+            int p = int(hash(i) % kBlueNoisePixels);
+            if (!on[p]) {
+                on[p] = 1;
+                splat(p, 1.0f);
+                ++n;
+            }
+        }
+        while (true) {
+            int cluster = extreme(true, true);
+            on[cluster] = 0;
+            splat(cluster, -1.0f);
+            int gap = extreme(false, false);
+            on[gap] = 1;
+            splat(gap, 1.0f);
+            if (gap == cluster) { break; }
+        }
+
+        // Ranks below the initial count come from removing clusters, the rest
+        // from filling voids
+        std::vector<char> saved = on;
+        std::vector<float> saved_energy = energy;
+        std::vector<int> rank(kBlueNoisePixels);
+        for (int r = initial - 1; r >= 0; --r) {
+            int cluster = extreme(true, true);
+            on[cluster] = 0;
+            splat(cluster, -1.0f);
+            rank[cluster] = r;
+        }
+        on.swap(saved);
+        energy.swap(saved_energy);
+        for (int r = initial; r < kBlueNoisePixels; ++r) {
+            int gap = extreme(false, false);
+            on[gap] = 1;
+            splat(gap, 1.0f);
+            rank[gap] = r;
+        }
+        for (int p = 0; p < kBlueNoisePixels; ++p) {
+            values[p] = (rank[p] + 0.5f) / kBlueNoisePixels;
+        }
+    }
+
+    float at(int x, int y) const
+    {
+        return values[(y & (kBlueNoiseSize - 1)) * kBlueNoiseSize + (x & (kBlueNoiseSize - 1))];
+    }
+};
+
+const BlueNoise &blueNoise()
+{
+    static const BlueNoise noise;
+    return noise;
+}
+
+}  // namespace
+
+const char *samplerName(int type)
+{
+    static const char *const names[NUM_SAMPLER_TYPES] = {"Uniform", "Sobol (Owen)", "Blue noise"};
+    return (type >= 0 && type < NUM_SAMPLER_TYPES) ? names[type] : "unknown";
+}
+
+void Sampler::startSample(int x, int y, std::uint32_t sample_index)
+{
+    px = x;
+    py = y;
+    pixel_seed = hash(hashCombine(hash(std::uint32_t(x)), std::uint32_t(y)));
+    index = sample_index;
+    cached_group = -1;
+}
+
+void Sampler::fillGroup(int group)
+{
+    cached_group = group;
+    std::uint32_t group_seed = hash(std::uint32_t(group) + 0x68bc21ebu);
+    switch (type) {
+    case SAMPLER_SOBOL:
+        sobol4D(index, hashCombine(pixel_seed, group_seed), cache);
+        break;
+    case SAMPLER_BLUE_NOISE: {
+        // Every pixel walks the same sequence, toroidally shifted by blue
+        // noise so that the error is pushed to high frequencies on screen.
+        // Each dimension reads the tile at its own offset.
+        sobol4D(index, group_seed, cache);
+        const BlueNoise &noise = blueNoise();
+        for (int d = 0; d < 4; ++d) {
+            std::uint32_t offset = hash(group_seed + std::uint32_t(d));
+            float shift = noise.at(px + int(offset & 63u), py + int((offset >> 6) & 63u));
+            float v = cache[d] + shift;
+            cache[d] = std::fmin(v < 1.0f ? v : v - 1.0f, kOneMinusEpsilon);
+        }
+        break;
+    }
+    default:
+        for (int d = 0; d < 4; ++d) {
+            std::uint32_t h = hashCombine(hashCombine(pixel_seed, index), group_seed + std::uint32_t(d));
+            cache[d] = toUnitFloat(hash(h));
+        }
+        break;
+    }
+}
+
+float Sampler::get(int dim)
+{
+    int group = dim >> 2;
+    if (group != cached_group) { fillGroup(group); }
+    return cache[dim & 3];
+}
+
+}  // namespace rt
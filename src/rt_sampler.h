@@ -0,0 +1,92 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+namespace rt {
+
+enum SamplerType {
+    SAMPLER_UNIFORM = 0,  // Independent hashed random numbers (reference)
+    SAMPLER_SOBOL,        // Owen-scrambled Sobol, scrambled per pixel
+    SAMPLER_BLUE_NOISE,   // Owen-scrambled Sobol shifted per pixel by blue noise
+    NUM_SAMPLER_TYPES
+};
+
+const char *samplerName(int type);
+
+// Sample dimensions are grouped in fours, and each group is an independently
+// scrambled 4D Sobol sequence. Group 0 is the camera (pixel position and
+// lens); bounce b owns groups 1 + 2b (BSDF and roulette) and 2 + 2b (light).
+enum SampleDimension {
+    DIM_PIXEL_X = 0,
+    DIM_PIXEL_Y,
+    DIM_LENS_U,
+    DIM_LENS_V,
+    DIM_BOUNCE_START
+};
+enum BounceDimension {
+    DIM_BSDF_U = 0,
+    DIM_BSDF_V,
+    DIM_BSDF_W,
+    DIM_ROULETTE,
+    DIM_LIGHT_SELECT,
+    DIM_LIGHT_U,
+    DIM_LIGHT_V,
+    DIM_UNUSED,  // Pads the light numbers to a whole group
+    DIMS_PER_BOUNCE
+};
+
+// Per-thread sampler. Values depend only on (pixel, sample index,
+// dimension), so results are reproducible regardless of scheduling.
+class Sampler {
+  public:
+    explicit Sampler(int type = SAMPLER_SOBOL) : type(type) {}
+
+    // Starts sample `index` of pixel (x, y)
+    void startSample(int x, int y, std::uint32_t index);
+
+    // Sub-pixel position in [0, 1)^2
+    glm::vec2 pixel()
+    {
+        return glm::vec2(get(DIM_PIXEL_X), get(DIM_PIXEL_Y));
+    }
+    glm::vec2 lens()
+    {
+        return glm::vec2(get(DIM_LENS_U), get(DIM_LENS_V));
+    }
+    // Three numbers for sampling the BSDF at bounce `bounce`
+    glm::vec3 bsdf(int bounce)
+    {
+        int base = DIM_BOUNCE_START + bounce * DIMS_PER_BOUNCE;
+        return glm::vec3(get(base + DIM_BSDF_U), get(base + DIM_BSDF_V), get(base + DIM_BSDF_W));
+    }
+    float roulette(int bounce)
+    {
+        return get(DIM_BOUNCE_START + bounce * DIMS_PER_BOUNCE + DIM_ROULETTE);
+    }
+    // Light selection and a point on the light for next-event estimation
+    glm::vec3 light(int bounce)
+    {
+        int base = DIM_BOUNCE_START + bounce * DIMS_PER_BOUNCE;
+        return glm::vec3(get(base + DIM_LIGHT_SELECT), get(base + DIM_LIGHT_U),
+                         get(base + DIM_LIGHT_V));
+    }
+
+    // Value of dimension `dim` of the current sample, in [0, 1)
+    float get(int dim);
+
+  private:
+    void fillGroup(int group);
+
+    int type;
+    int px = 0;
+    int py = 0;
+    std::uint32_t pixel_seed = 0;
+    std::uint32_t index = 0;
+    int cached_group = -1;
+    float cache[4];
+};
+
+}  // namespace rt
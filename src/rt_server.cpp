@@ -0,0 +1,254 @@
+#include "rt_server.h"
+#include "rt_message.h"
+#include "rt_raytracing.h"
+#include "rt_trace.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace rt {
+
+#ifndef _WIN32
+
+namespace {
+
+enum MessageType : std::uint32_t {
+    MSG_JOB = 1,  // Client -> server: serialized RenderJob
+    MSG_FRAME,    // Server -> client: FrameInfo, then RGBA8 pixels
+    MSG_ERROR,    // Server -> client: message text
+};
+
+struct FrameInfo {
+    std::int32_t frame;
+    std::int32_t frames;
+    std::int32_t width;
+    std::int32_t height;
+    std::int32_t cache_hit;
+    float scene_ms;
+    float frame_ms;
+};
+
+// The integrator recurses once per bounce, so a job's limit is bounded
+const int kMaxJobBounces = 64;
+
+double milliseconds(std::chrono::steady_clock::time_point start)
+{
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+bool socketAddress(const std::string &path, sockaddr_un &addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+std::vector<char> serializeJob(const RenderJob &job)
+{
+    MessageWriter w;
+    w.putString(job.mesh_filename);
+    w.put(job.eye);
+    w.put(job.target);
+    w.put(job.up);
+    w.put(job.fov);
+    w.put(job.width);
+    w.put(job.height);
+    w.put(job.samples_per_pixel);
+    w.put(job.frames);
+    w.put(job.max_bounces);
+    return w.data;
+}
+
+bool deserializeJob(const std::vector<char> &payload, RenderJob &job)
+{
+    MessageReader r(payload);
+    job.mesh_filename = r.getString();
+    job.eye = r.get<glm::vec3>();
+    job.target = r.get<glm::vec3>();
+    job.up = r.get<glm::vec3>();
+    job.fov = r.get<float>();
+    job.width = r.get<int>();
+    job.height = r.get<int>();
+    job.samples_per_pixel = r.get<int>();
+    job.frames = r.get<int>();
+    job.max_bounces = r.get<int>();
+    // The pixel count is taken in 64 bits so that large sizes cannot wrap around
+    return r.ok && job.width > 0 && job.height > 0 &&
+           std::int64_t(job.width) * job.height <= (1 << 26) && job.samples_per_pixel > 0 &&
+           job.frames > 0 && job.max_bounces >= 0 && job.max_bounces <= kMaxJobBounces;
+}
+
+bool sendError(int fd, const std::string &message)
+{
+    return sendMessage(fd, MSG_ERROR, message.data(), message.size());
+}
+
+// Renders one job, sending an image after every frame. Returns false if the
+// client went away.
+bool serveJob(int fd, RTContext &rtx, const RenderJob &job)
+{
+    RT_TRACE_SCOPE("serveJob");
+    auto start = std::chrono::steady_clock::now();
+    bool cache_hit = false;
+    if (!activateCachedScene(rtx, job.mesh_filename, &cache_hit)) {
+        return sendError(fd, "Could not read " + job.mesh_filename);
+    }
+    float scene_ms = float(milliseconds(start));
+
+    rtx.width = job.width;
+    rtx.height = job.height;
+    rtx.view = glm::lookAt(job.eye, job.target, job.up);
+    rtx.fov = job.fov;
+    rtx.samples_per_pixel = job.samples_per_pixel;
+    rtx.max_bounces = job.max_bounces;
+    rtx.max_frames = job.frames;
+    rtx.show_normals = false;
+    rtx.heatmap_mode = HEATMAP_OFF;
+    resetImage(rtx);
+    rtx.camera.update(rtx.view, rtx.fov, rtx.width, rtx.height, rtx.aperture, rtx.focus_distance);
+
+    FrameInfo info = {0, job.frames, job.width, job.height, cache_hit ? 1 : 0, scene_ms, 0.0f};
+    std::vector<unsigned char> rgba;
+    for (int frame = 0; frame < job.frames; ++frame) {
+        auto frame_start = std::chrono::steady_clock::now();
+        renderFrame(rtx);
+
+        info.frame = frame + 1;
+        info.frame_ms = float(milliseconds(frame_start));
+        packImage(rtx, rgba);
+        if (!sendMessage(fd, MSG_FRAME, &info, sizeof(info), rgba.data(), rgba.size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int runServer(const std::string &socket_path)
+{
+    sockaddr_un addr;
+    if (!socketAddress(socket_path, addr)) { return 1; }
+    int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(socket_path.c_str());  // Left over from an earlier server
+    if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listen_fd, 16) != 0) {
+        std::cerr << "Could not listen on " << socket_path << ": " << std::strerror(errno)
+                  << std::endl;
+        return 1;
+    }
+    std::cout << "Serving render jobs on " << socket_path << std::endl;
+    trace::setThreadName("server");
+
+    // Clients are served one at a time; a client may send any number of jobs
+    RTContext rtx;
+    while (true) {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        MessageHeader header;
+        std::vector<char> payload;
+        while (receiveMessage(fd, header, payload)) {
+            RenderJob job;
+            if (header.type != MSG_JOB || !deserializeJob(payload, job)) {
+                sendError(fd, "Malformed job");
+                break;
+            }
+            if (!serveJob(fd, rtx, job)) { break; }
+            SceneCacheStats stats = sceneCacheStats();
+            std::cout << "Job " << job.mesh_filename << ": cache " << stats.entries << " scenes, "
+                      << stats.bytes / 1048576.0 << " MB, " << stats.hits << " hits, " << stats.misses
+                      << " misses" << std::endl;
+        }
+        ::close(fd);
+    }
+    ::close(listen_fd);
+    return 1;
+}
+
+bool submitRenderJob(const std::string &socket_path, const RenderJob &job,
+                     const std::function<void(const RenderFrame &)> &on_frame, std::string &error)
+{
+    sockaddr_un addr;
+    if (!socketAddress(socket_path, addr)) {
+        error = "Socket path too long";
+        return false;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        error = "Could not connect to " + socket_path + ": " + std::strerror(errno);
+        if (fd >= 0) { ::close(fd); }
+        return false;
+    }
+
+    std::vector<char> request = serializeJob(job);
+    bool ok = sendMessage(fd, MSG_JOB, request.data(), request.size());
+    MessageHeader header;
+    std::vector<char> payload;
+    RenderFrame result;
+    while (ok) {
+        if (!receiveMessage(fd, header, payload)) {
+            error = "Server closed the connection";
+            ok = false;
+        } else if (header.type == MSG_ERROR) {
+            error.assign(payload.begin(), payload.end());
+            ok = false;
+        } else if (header.type == MSG_FRAME && payload.size() >= sizeof(FrameInfo)) {
+            FrameInfo info;
+            std::memcpy(&info, payload.data(), sizeof(info));
+            result.frame = info.frame;
+            result.frames = info.frames;
+            result.width = info.width;
+            result.height = info.height;
+            result.cache_hit = info.cache_hit != 0;
+            result.scene_ms = info.scene_ms;
+            result.frame_ms = info.frame_ms;
+            result.rgba.assign(payload.begin() + sizeof(info), payload.end());
+            on_frame(result);
+            if (info.frame >= info.frames) { break; }
+        } else {
+            error = "Unexpected message from server";
+            ok = false;
+        }
+    }
+    ::close(fd);
+    return ok;
+}
+
+#else  // _WIN32
+
+int runServer(const std::string &)
+{
+    std::cerr << "The render server is not supported on this platform" << std::endl;
+    return 1;
+}
+
+bool submitRenderJob(const std::string &, const RenderJob &,
+                     const std::function<void(const RenderFrame &)> &, std::string &error)
+{
+    error = "The render server is not supported on this platform";
+    return false;
+}
+
+#endif  // _WIN32
+
+}  // namespace rt
@@ -0,0 +1,52 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace rt {
+
+// Render server: a headless process (rt_viewer --serve SOCKET) that takes
+// render jobs over a Unix domain socket and streams an image back after
+// every accumulated frame. Built scenes stay in the scene cache between jobs,
+// so repeated jobs on the same mesh skip loading and BVH construction.
+// POSIX only.
+
+struct RenderJob {
+    std::string mesh_filename;
+    glm::vec3 eye = glm::vec3(0.0f, 0.0f, 2.0f);
+    glm::vec3 target = glm::vec3(0.0f);
+    glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+    float fov = 90.0f;
+    int width = 500;
+    int height = 500;
+    int samples_per_pixel = 16;  // Per frame
+    int frames = 1;              // Frames to accumulate
+    int max_bounces = 3;         // 0 to 64
+};
+
+// One progressive result
+struct RenderFrame {
+    int frame = 0;   // 1-based; the job is done when frame == frames
+    int frames = 0;
+    int width = 0;
+    int height = 0;
+    bool cache_hit = false;  // Whether the scene came from the cache
+    float scene_ms = 0.0f;   // Time to hash, load and build (or find) the scene
+    float frame_ms = 0.0f;   // Time to render this frame
+    std::vector<unsigned char> rgba;  // 8-bit, gamma as displayed, top row first
+};
+
+// Serves jobs on `socket_path` until the process is killed. Returns the exit
+// status on failure to listen.
+int runServer(const std::string &socket_path);
+
+// Sends `job` to a server and calls `on_frame` for every result. Returns
+// false with a message in `error` if the job failed.
+bool submitRenderJob(const std::string &socket_path, const RenderJob &job,
+                     const std::function<void(const RenderFrame &)> &on_frame, std::string &error);
+
+}  // namespace rt
@@ -0,0 +1,151 @@
+#include "rt_soa.h"
+
+#include "rt_soa_kernels.h"
+
+namespace rt {
+
+namespace {
+
+const SoAKernels *kernelsFor(IsaLevel level)
+{
+    switch (level) {
+    case ISA_SSE2:
+        return soaKernelsSSE2();
+    case ISA_SSE41:
+        return soaKernelsSSE41();
+    case ISA_AVX2:
+        return soaKernelsAVX2();
+    case ISA_AVX512:
+        return soaKernelsAVX512();
+    default:
+        return soaKernelsScalar();
+    }
+}
+
+const SoAKernels *g_kernels = nullptr;
+
+inline const SoAKernels &kernels()
+{
+    if (!g_kernels) { setSoAIsa(NUM_ISA_LEVELS); }
+    return *g_kernels;
+}
+
+inline KernelRay kernelRay(const Ray &r)
+{
+    KernelRay kr;
+    const glm::vec3 o = r.origin();
+    const glm::vec3 d = r.direction();
+    const glm::vec3 inv_d = r.inv_direction();
+    for (int k = 0; k < 3; ++k) {
+        kr.origin[k] = o[k];
+        kr.direction[k] = d[k];
+        kr.inv_direction[k] = inv_d[k];
+        kr.negative[k] = r.sign(k) != 0;
+    }
+    return kr;
+}
+
+// Zero-filled array with padding for full batches past the last primitive
+void allocateLanes(FloatArray &array, int size, Arena *arena)
+{
+    array = FloatArray(size + kSoAWidth, 0.0f, ArenaAllocator<float>(arena));
+}
+
+}  // namespace
+
+void SphereSoA::assign(const Sphere *spheres, int count, Arena *arena)
+{
+    size = count;
+    FloatArray *arrays[4] = {&center_x, &center_y, &center_z, &radius};
+    for (int k = 0; k < 4; ++k) { allocateLanes(*arrays[k], size, arena); }
+    for (int i = 0; i < size; ++i) {
+        center_x[i] = spheres[i].center.x;
+        center_y[i] = spheres[i].center.y;
+        center_z[i] = spheres[i].center.z;
+        radius[i] = spheres[i].radius;
+    }
+}
+
+void BoxSoA::assign(const Box *boxes, int count, Arena *arena)
+{
+    size = count;
+    FloatArray *arrays[6] = {&center_x, &center_y, &center_z, &radius_x, &radius_y, &radius_z};
+    for (int k = 0; k < 6; ++k) { allocateLanes(*arrays[k], size, arena); }
+    for (int i = 0; i < size; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            (*arrays[k])[i] = boxes[i].center[k];
+            (*arrays[k + 3])[i] = boxes[i].radius[k];
+        }
+    }
+}
+
+void TriangleSoA::assign(const Triangle *triangles, int count, Arena *arena)
+{
+    allocate(count, arena);
+    update(triangles);
+}
+
+void TriangleSoA::update(const Triangle *triangles)
+{
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < size; ++i) { set(i, triangles[i].v0, triangles[i].v1, triangles[i].v2); }
+}
+
+void TriangleSoA::allocate(int count, Arena *arena)
+{
+    size = count;
+    FloatArray *arrays[12] = {&v0_x,    &v0_y,    &v0_z,    &edge1_x,  &edge1_y,  &edge1_z,
+                              &edge2_x, &edge2_y, &edge2_z, &normal_x, &normal_y, &normal_z};
+    for (int k = 0; k < 12; ++k) { allocateLanes(*arrays[k], size, arena); }
+}
+
+int closestSphere(const SphereSoA &spheres, int begin, int end, const Ray &r, float t_min,
+                  float &t_max)
+{
+    SphereArrays arrays = {{&spheres.center_x[0], &spheres.center_y[0], &spheres.center_z[0]},
+                           &spheres.radius[0]};
+    return kernels().closest_sphere(arrays, begin, end, kernelRay(r), t_min, &t_max);
+}
+
+int closestBox(const BoxSoA &boxes, int begin, int end, const Ray &r, float t_min, float &t_max)
+{
+    BoxArrays arrays = {{&boxes.center_x[0], &boxes.center_y[0], &boxes.center_z[0]},
+                        {&boxes.radius_x[0], &boxes.radius_y[0], &boxes.radius_z[0]}};
+    return kernels().closest_box(arrays, begin, end, kernelRay(r), t_min, &t_max);
+}
+
+int closestTriangle(const TriangleSoA &triangles, int begin, int end, const Ray &r, float t_min,
+                    float &t_max)
+{
+    TriangleArrays arrays = {
+        {&triangles.v0_x[0], &triangles.v0_y[0], &triangles.v0_z[0]},
+        {&triangles.edge1_x[0], &triangles.edge1_y[0], &triangles.edge1_z[0]},
+        {&triangles.edge2_x[0], &triangles.edge2_y[0], &triangles.edge2_z[0]},
+        {&triangles.normal_x[0], &triangles.normal_y[0], &triangles.normal_z[0]}};
+    return kernels().closest_triangle(arrays, begin, end, kernelRay(r), t_min, &t_max);
+}
+
+IsaLevel setSoAIsa(IsaLevel level)
+{
+    int l = level < NUM_ISA_LEVELS ? int(level) : int(NUM_ISA_LEVELS) - 1;
+    while (l > ISA_SCALAR && !soaIsaAvailable(IsaLevel(l))) { --l; }
+    g_kernels = kernelsFor(IsaLevel(l));
+    return g_kernels->level;
+}
+
+IsaLevel soaIsa()
+{
+    return kernels().level;
+}
+
+bool soaIsaAvailable(IsaLevel level)
+{
+    return level <= detectIsa() && kernelsFor(level) != nullptr;
+}
+
+const char *soaKernelName()
+{
+    return isaName(soaIsa());
+}
+
+}  // namespace rt
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "rt_arena.h"
+#include "rt_box.h"
+#include "rt_cpu.h"
+#include "rt_ray.h"
+#include "rt_sphere.h"
+#include "rt_triangle.h"
+
+#include <vector>
+
+namespace rt {
+
+// Widest SIMD batch (AVX-512); arrays are padded by this many lanes so the
+// kernels can load full batches past the end of any range
+const int kSoAWidth = 16;
+
+// Cache-line aligned array, allocated in the scene arena when there is one
+typedef ArenaVector<float> FloatArray;
+
+// Structure-of-arrays copy of a sphere list for batched intersection
+struct SphereSoA {
+    FloatArray center_x, center_y, center_z, radius;
+    int size = 0;
+
+    void assign(const Sphere *spheres, int count, Arena *arena = nullptr);
+};
+
+// Structure-of-arrays copy of a box list (center and half extents)
+struct BoxSoA {
+    FloatArray center_x, center_y, center_z, radius_x, radius_y, radius_z;
+    int size = 0;
+
+    void assign(const Box *boxes, int count, Arena *arena = nullptr);
+};
+
+// Structure-of-arrays copy of a triangle list (first vertex, edges and the
+// unnormalized face normal)
+struct TriangleSoA {
+    FloatArray v0_x, v0_y, v0_z, edge1_x, edge1_y, edge1_z, edge2_x, edge2_y, edge2_z;
+    FloatArray normal_x, normal_y, normal_z;
+    int size = 0;
+
+    void assign(const Triangle *triangles, int count, Arena *arena = nullptr);
+    // Rewrites the arrays in place for moved triangles; `triangles` holds
+    // `size` of them, in the same order as given to assign()
+    void update(const Triangle *triangles);
+    // Sizes the arrays without filling them, e.g. for scratch batches
+    void allocate(int count, Arena *arena = nullptr);
+    void set(int i, const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2)
+    {
+        glm::vec3 e1 = v1 - v0;
+        glm::vec3 e2 = v2 - v0;
+        glm::vec3 n = glm::cross(e1, e2);
+        v0_x[i] = v0.x;
+        v0_y[i] = v0.y;
+        v0_z[i] = v0.z;
+        edge1_x[i] = e1.x;
+        edge1_y[i] = e1.y;
+        edge1_z[i] = e1.z;
+        edge2_x[i] = e2.x;
+        edge2_y[i] = e2.y;
+        edge2_z[i] = e2.z;
+        normal_x[i] = n.x;
+        normal_y[i] = n.y;
+        normal_z[i] = n.z;
+    }
+};
+
+// Closest hit among primitives [begin, end) within (t_min, t_max), with the
+// same hit rules as Sphere::hit, Box::hit and Triangle::hit. Returns the
+// primitive index and updates t_max, or returns -1 if nothing was hit.
+int closestSphere(const SphereSoA &spheres, int begin, int end, const Ray &r, float t_min,
+                  float &t_max);
+int closestBox(const BoxSoA &boxes, int begin, int end, const Ray &r, float t_min, float &t_max);
+int closestTriangle(const TriangleSoA &triangles, int begin, int end, const Ray &r, float t_min,
+                    float &t_max);
+
+// The kernels are built once per instruction set and dispatched at run time.
+// By default the best level this CPU supports is used; setSoAIsa() caps it
+// (e.g. to compare levels) and returns the level actually selected.
+IsaLevel setSoAIsa(IsaLevel level);
+IsaLevel soaIsa();
+bool soaIsaAvailable(IsaLevel level);
+
+// Name of the instruction set the active kernels use
+const char *soaKernelName();
+
+}  // namespace rt
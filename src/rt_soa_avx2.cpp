@@ -0,0 +1,60 @@
+// 8-wide AVX2 build of the SoA kernels (compiled with -mavx2)
+
+#include "rt_soa_impl.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace rt {
+
+#if defined(__AVX2__)
+
+namespace {
+
+struct AVX2Lanes {
+    enum { width = 8 };
+    typedef __m256 F;
+    typedef __m256 M;
+    static F load(const float *p) { return _mm256_loadu_ps(p); }
+    static F set1(float v) { return _mm256_set1_ps(v); }
+    static F iota() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F min(F a, F b) { return _mm256_min_ps(a, b); }
+    static F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static M lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static M le(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static M eq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static M both(M a, M b) { return _mm256_and_ps(a, b); }
+    static F select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+    static unsigned bits(M m) { return unsigned(_mm256_movemask_ps(m)); }
+    static float hmin(F a)
+    {
+        __m128 v = _mm_min_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(v);
+    }
+};
+
+}  // namespace
+
+const SoAKernels *soaKernelsAVX2()
+{
+    return kernelTable<AVX2Lanes>(ISA_AVX2);
+}
+
+#else
+
+const SoAKernels *soaKernelsAVX2()
+{
+    return nullptr;
+}
+
+#endif
+
+}  // namespace rt
@@ -0,0 +1,54 @@
+// 16-wide AVX-512 build of the SoA kernels (compiled with -mavx512f)
+
+#include "rt_soa_impl.h"
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace rt {
+
+#if defined(__AVX512F__)
+
+namespace {
+
+struct AVX512Lanes {
+    enum { width = 16 };
+    typedef __m512 F;
+    typedef __mmask16 M;
+    static F load(const float *p) { return _mm512_loadu_ps(p); }
+    static F set1(float v) { return _mm512_set1_ps(v); }
+    static F iota() { return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+    static F add(F a, F b) { return _mm512_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm512_div_ps(a, b); }
+    static F min(F a, F b) { return _mm512_min_ps(a, b); }
+    static F max(F a, F b) { return _mm512_max_ps(a, b); }
+    static F sqrt(F a) { return _mm512_sqrt_ps(a); }
+    static M lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static M le(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static M eq(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    static M both(M a, M b) { return M(a & b); }
+    static F select(M m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+    static unsigned bits(M m) { return unsigned(m); }
+    static float hmin(F a) { return _mm512_reduce_min_ps(a); }
+};
+
+}  // namespace
+
+const SoAKernels *soaKernelsAVX512()
+{
+    return kernelTable<AVX512Lanes>(ISA_AVX512);
+}
+
+#else
+
+const SoAKernels *soaKernelsAVX512()
+{
+    return nullptr;
+}
+
+#endif
+
+}  // namespace rt
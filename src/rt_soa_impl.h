@@ -0,0 +1,183 @@
+#pragma once
+
+// Kernel bodies shared by the rt_soa_<isa>.cpp files. Each of them defines a
+// `Lanes` wrapper for its instruction set and instantiates the templates
+// below with it. Everything here has internal linkage so that the
+// differently compiled copies never get merged.
+
+#include "rt_soa_kernels.h"
+
+#include <cfloat>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace rt {
+
+namespace {
+
+inline int lowestBit(unsigned bits)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return int(index);
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// Horizontal minimum over the hit lanes of a batch. Returns the lane of the
+// closest hit and lowers t_max to it, or -1 if no lane hit.
+template <typename L>
+inline int closestLane(typename L::M hit, typename L::F t, float *t_max)
+{
+    if (L::bits(hit) == 0) { return -1; }
+    typename L::F t_hit = L::select(hit, t, L::set1(FLT_MAX));
+    float t_min = L::hmin(t_hit);
+    *t_max = t_min;
+    return lowestBit(L::bits(L::both(hit, L::eq(t_hit, L::set1(t_min)))));
+}
+
+template <typename L>
+int closestSphere(const SphereArrays &spheres, int begin, int end, const KernelRay &r,
+                  float t_min, float *t_max)
+{
+    typedef typename L::F F;
+    typedef typename L::M M;
+    const float *d = r.direction;
+    const float dd = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    const F ox = L::set1(r.origin[0]), oy = L::set1(r.origin[1]), oz = L::set1(r.origin[2]);
+    const F dx = L::set1(d[0]), dy = L::set1(d[1]), dz = L::set1(d[2]);
+    const F a = L::set1(dd);
+    const F inv_a = L::set1(1.0f / dd);
+    const F tmin = L::set1(t_min);
+    const F zero = L::set1(0.0f);
+
+    int best = -1;
+    for (int i = begin; i < end; i += L::width) {
+        const F tmax = L::set1(*t_max);
+        F ocx = L::sub(ox, L::load(spheres.center[0] + i));
+        F ocy = L::sub(oy, L::load(spheres.center[1] + i));
+        F ocz = L::sub(oz, L::load(spheres.center[2] + i));
+        F rad = L::load(spheres.radius + i);
+
+        // Half-b form of the quadratic in Sphere::hit
+        F h = L::add(L::add(L::mul(ocx, dx), L::mul(ocy, dy)), L::mul(ocz, dz));
+        F c = L::sub(L::add(L::add(L::mul(ocx, ocx), L::mul(ocy, ocy)), L::mul(ocz, ocz)),
+                     L::mul(rad, rad));
+        F disc = L::sub(L::mul(h, h), L::mul(a, c));
+        F sq = L::sqrt(L::max(disc, zero));
+        F t1 = L::mul(L::sub(L::sub(zero, h), sq), inv_a);
+        F t2 = L::mul(L::add(L::sub(zero, h), sq), inv_a);
+        F t = L::select(L::both(L::lt(t1, tmax), L::lt(tmin, t1)), t1, t2);
+
+        M hit = L::both(L::lt(zero, disc), L::both(L::lt(t, tmax), L::lt(tmin, t)));
+        hit = L::both(hit, L::lt(L::iota(), L::set1(float(end - i))));
+        int lane = closestLane<L>(hit, t, t_max);
+        if (lane >= 0) { best = i + lane; }
+    }
+    return best;
+}
+
+template <typename L>
+int closestBox(const BoxArrays &boxes, int begin, int end, const KernelRay &r, float t_min,
+               float *t_max)
+{
+    typedef typename L::F F;
+    typedef typename L::M M;
+    const F ox = L::set1(r.origin[0]), oy = L::set1(r.origin[1]), oz = L::set1(r.origin[2]);
+    const F ix = L::set1(r.inv_direction[0]);
+    const F iy = L::set1(r.inv_direction[1]);
+    const F iz = L::set1(r.inv_direction[2]);
+    const F tmin = L::set1(t_min);
+    const F zero = L::set1(0.0f);
+
+    int best = -1;
+    for (int i = begin; i < end; i += L::width) {
+        const F tmax = L::set1(*t_max);
+        F ocx = L::sub(ox, L::load(boxes.center[0] + i));
+        F ocy = L::sub(oy, L::load(boxes.center[1] + i));
+        F ocz = L::sub(oz, L::load(boxes.center[2] + i));
+        F rx = L::load(boxes.radius[0] + i);
+        F ry = L::load(boxes.radius[1] + i);
+        F rz = L::load(boxes.radius[2] + i);
+
+        // Slab test from Box::hit; the ray's signs pick the entry face per axis
+        F ex = r.negative[0] ? rx : L::sub(zero, rx);
+        F ey = r.negative[1] ? ry : L::sub(zero, ry);
+        F ez = r.negative[2] ? rz : L::sub(zero, rz);
+        F t_near = L::max(L::max(L::mul(L::sub(ex, ocx), ix), L::mul(L::sub(ey, ocy), iy)),
+                          L::mul(L::sub(ez, ocz), iz));
+        F t_far = L::min(L::min(L::mul(L::sub(L::sub(zero, ex), ocx), ix),
+                                L::mul(L::sub(L::sub(zero, ey), ocy), iy)),
+                         L::mul(L::sub(L::sub(zero, ez), ocz), iz));
+        F t = L::select(L::both(L::lt(t_near, tmax), L::lt(tmin, t_near)), t_near, t_far);
+
+        M hit = L::both(L::le(t_near, t_far), L::both(L::lt(t_near, tmax), L::lt(tmin, t)));
+        hit = L::both(hit, L::lt(L::iota(), L::set1(float(end - i))));
+        int lane = closestLane<L>(hit, t, t_max);
+        if (lane >= 0) { best = i + lane; }
+    }
+    return best;
+}
+
+template <typename L>
+int closestTriangle(const TriangleArrays &triangles, int begin, int end, const KernelRay &r,
+                    float t_min, float *t_max)
+{
+    typedef typename L::F F;
+    typedef typename L::M M;
+    const F ox = L::set1(r.origin[0]), oy = L::set1(r.origin[1]), oz = L::set1(r.origin[2]);
+    const F dx = L::set1(r.direction[0]), dy = L::set1(r.direction[1]);
+    const F dz = L::set1(r.direction[2]);
+    const F tmin = L::set1(t_min);
+    const F zero = L::set1(0.0f);
+
+    int best = -1;
+    for (int i = begin; i < end; i += L::width) {
+        const F tmax = L::set1(*t_max);
+        F nx = L::load(triangles.normal[0] + i);
+        F ny = L::load(triangles.normal[1] + i);
+        F nz = L::load(triangles.normal[2] + i);
+        F aox = L::sub(ox, L::load(triangles.v0[0] + i));
+        F aoy = L::sub(oy, L::load(triangles.v0[1] + i));
+        F aoz = L::sub(oz, L::load(triangles.v0[2] + i));
+
+        // Same determinant and barycentric tests as Triangle::hit
+        F d = L::sub(zero, L::add(L::add(L::mul(dx, nx), L::mul(dy, ny)), L::mul(dz, nz)));
+        F temp = L::add(L::add(L::mul(aox, nx), L::mul(aoy, ny)), L::mul(aoz, nz));
+        F ex = L::sub(L::mul(aoy, dz), L::mul(aoz, dy));
+        F ey = L::sub(L::mul(aoz, dx), L::mul(aox, dz));
+        F ez = L::sub(L::mul(aox, dy), L::mul(aoy, dx));
+        F v = L::add(L::add(L::mul(L::load(triangles.edge2[0] + i), ex),
+                            L::mul(L::load(triangles.edge2[1] + i), ey)),
+                     L::mul(L::load(triangles.edge2[2] + i), ez));
+        F w = L::sub(zero, L::add(L::add(L::mul(L::load(triangles.edge1[0] + i), ex),
+                                         L::mul(L::load(triangles.edge1[1] + i), ey)),
+                                  L::mul(L::load(triangles.edge1[2] + i), ez)));
+        F t = L::div(temp, d);
+
+        M inside = L::both(L::both(L::le(zero, v), L::le(v, d)),
+                           L::both(L::le(zero, w), L::le(L::add(v, w), d)));
+        M hit = L::both(L::both(L::lt(zero, d), L::le(zero, temp)), inside);
+        hit = L::both(hit, L::both(L::lt(t, tmax), L::lt(tmin, t)));
+        hit = L::both(hit, L::lt(L::iota(), L::set1(float(end - i))));
+        int lane = closestLane<L>(hit, t, t_max);
+        if (lane >= 0) { best = i + lane; }
+    }
+    return best;
+}
+
+template <typename L>
+const SoAKernels *kernelTable(IsaLevel level)
+{
+    static const SoAKernels table = {level, &closestSphere<L>, &closestBox<L>,
+                                     &closestTriangle<L>};
+    return &table;
+}
+
+}  // namespace
+
+}  // namespace rt
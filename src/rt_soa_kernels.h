@@ -0,0 +1,54 @@
+#pragma once
+
+#include "rt_cpu.h"
+
+namespace rt {
+
+// Plain-data views handed to the per-ISA kernels. The kernel translation
+// units are compiled with ISA-specific flags, so they must not include glm or
+// any other header with inline functions: the linker may keep their AVX copy
+// of such a function for the whole program.
+struct KernelRay {
+    float origin[3];
+    float direction[3];
+    float inv_direction[3];
+    bool negative[3];  // Direction sign per axis
+};
+
+struct SphereArrays {
+    const float *center[3];
+    const float *radius;
+};
+
+struct BoxArrays {
+    const float *center[3];
+    const float *radius[3];
+};
+
+struct TriangleArrays {
+    const float *v0[3];
+    const float *edge1[3];
+    const float *edge2[3];
+    const float *normal[3];  // Unnormalized cross(edge1, edge2)
+};
+
+// Closest-hit kernels over primitives [begin, end); see rt_soa.h
+struct SoAKernels {
+    IsaLevel level;
+    int (*closest_sphere)(const SphereArrays &spheres, int begin, int end, const KernelRay &r,
+                          float t_min, float *t_max);
+    int (*closest_box)(const BoxArrays &boxes, int begin, int end, const KernelRay &r,
+                       float t_min, float *t_max);
+    int (*closest_triangle)(const TriangleArrays &triangles, int begin, int end,
+                            const KernelRay &r, float t_min, float *t_max);
+};
+
+// One kernel table per translation unit; null when the compiler was not
+// given the flags for that instruction set
+const SoAKernels *soaKernelsScalar();
+const SoAKernels *soaKernelsSSE2();
+const SoAKernels *soaKernelsSSE41();
+const SoAKernels *soaKernelsAVX2();
+const SoAKernels *soaKernelsAVX512();
+
+}  // namespace rt
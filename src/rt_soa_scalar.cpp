@@ -0,0 +1,42 @@
+// Portable one-lane build of the SoA kernels, used when no SIMD variant is
+// available
+
+#include "rt_soa_impl.h"
+
+#include <cmath>
+
+namespace rt {
+
+namespace {
+
+struct ScalarLanes {
+    enum { width = 1 };
+    typedef float F;
+    typedef bool M;
+    static F load(const float *p) { return *p; }
+    static F set1(float v) { return v; }
+    static F iota() { return 0.0f; }
+    static F add(F a, F b) { return a + b; }
+    static F sub(F a, F b) { return a - b; }
+    static F mul(F a, F b) { return a * b; }
+    static F div(F a, F b) { return a / b; }
+    static F min(F a, F b) { return b < a ? b : a; }
+    static F max(F a, F b) { return a < b ? b : a; }
+    static F sqrt(F a) { return std::sqrt(a); }
+    static M lt(F a, F b) { return a < b; }
+    static M le(F a, F b) { return a <= b; }
+    static M eq(F a, F b) { return a == b; }
+    static M both(M a, M b) { return a && b; }
+    static F select(M m, F a, F b) { return m ? a : b; }
+    static unsigned bits(M m) { return m ? 1u : 0u; }
+    static float hmin(F a) { return a; }
+};
+
+}  // namespace
+
+const SoAKernels *soaKernelsScalar()
+{
+    return kernelTable<ScalarLanes>(ISA_SCALAR);
+}
+
+}  // namespace rt
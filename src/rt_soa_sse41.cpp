@@ -0,0 +1,59 @@
+// 4-wide SSE4.1 build of the SoA kernels (compiled with -msse4.1)
+
+#include "rt_soa_impl.h"
+
+#if defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+namespace rt {
+
+#if defined(__SSE4_1__)
+
+namespace {
+
+struct SSE41Lanes {
+    enum { width = 4 };
+    typedef __m128 F;
+    typedef __m128 M;
+    static F load(const float *p) { return _mm_loadu_ps(p); }
+    static F set1(float v) { return _mm_set1_ps(v); }
+    static F iota() { return _mm_setr_ps(0, 1, 2, 3); }
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm_div_ps(a, b); }
+    static F min(F a, F b) { return _mm_min_ps(a, b); }
+    static F max(F a, F b) { return _mm_max_ps(a, b); }
+    static F sqrt(F a) { return _mm_sqrt_ps(a); }
+    static M lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static M le(F a, F b) { return _mm_cmple_ps(a, b); }
+    static M eq(F a, F b) { return _mm_cmpeq_ps(a, b); }
+    static M both(M a, M b) { return _mm_and_ps(a, b); }
+    static F select(M m, F a, F b) { return _mm_blendv_ps(b, a, m); }
+    static unsigned bits(M m) { return unsigned(_mm_movemask_ps(m)); }
+    static float hmin(F v)
+    {
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(v);
+    }
+};
+
+}  // namespace
+
+const SoAKernels *soaKernelsSSE41()
+{
+    return kernelTable<SSE41Lanes>(ISA_SSE41);
+}
+
+#else
+
+const SoAKernels *soaKernelsSSE41()
+{
+    return nullptr;
+}
+
+#endif
+
+}  // namespace rt
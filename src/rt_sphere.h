@@ -3,6 +3,10 @@
 #include "rt_hitable.h"
 #include "rt_material.h"
 
+#include <glm/gtc/constants.hpp>
+
+#include <cmath>
+
 namespace rt {
 
 class Sphere : public Hitable {
@@ -11,6 +15,11 @@ class Sphere : public Hitable {
     Sphere(const glm::vec3 &cen, float r, Material* m)
         : center(cen), radius(r), mat_ptr(m) {};
     virtual bool hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const;
+    void record(const Ray &r, float t, HitRecord &rec) const;
+    AABB bounds() const
+    {
+        return AABB(center - glm::vec3(radius), center + glm::vec3(radius));
+    }
 
     glm::vec3 center;
     float radius;
@@ -18,7 +27,7 @@ class Sphere : public Hitable {
 };
 
 // Ray-sphere test from "Ray Tracing in a Weekend" book
-bool Sphere::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
+inline bool Sphere::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
 {
     glm::vec3 oc = r.origin() - center;
     float a = glm::dot(r.direction(), r.direction());
@@ -30,14 +39,26 @@ bool Sphere::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
         float temp2 = (-b + glm::sqrt(discriminant)) / (2.0f * a);
         float temp = (temp1 < t_max && temp1 > t_min) ? temp1 : temp2;
         if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;  // 设置材质指针
+            record(r, temp, rec);
             return true;
         }
     }
     return false;
 }
 
+// Fill in the hit record for a hit at distance t (also used by batched tests)
+inline void Sphere::record(const Ray &r, float t, HitRecord &rec) const
+{
+    rec.t = t;
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center) / radius;
+    rec.mat_ptr = mat_ptr;  // 设置材质指针
+    // Lat-long coordinates around +y; u wraps once around the equator
+    float phi = std::atan2(rec.normal.z, rec.normal.x);
+    float theta = std::acos(glm::clamp(rec.normal.y, -1.0f, 1.0f));
+    rec.uv = glm::vec2(0.5f + 0.5f * phi * glm::one_over_pi<float>(),
+                       1.0f - theta * glm::one_over_pi<float>());
+    rec.uv_density = glm::one_over_pi<float>() / radius;
+}
+
 }  // namespace rt
@@ -0,0 +1,203 @@
+#include "rt_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace rt {
+namespace stats {
+
+namespace {
+
+const size_t kHistorySize = 1024;
+
+// Registry of live per-thread counters. Counts from threads that have exited
+// are folded into `retired` so totals stay monotonic.
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadCounters *> threads;
+    std::uint64_t retired[NUM_COUNTERS] = {};
+    std::uint64_t previous[NUM_COUNTERS] = {};
+    double stage_times[NUM_STAGES] = {};
+    std::deque<FrameStats> history;
+};
+
+Registry &registry()
+{
+    static Registry *instance = new Registry();  // Leaked so it outlives thread_locals
+    return *instance;
+}
+
+}  // namespace
+
+ThreadCounters::ThreadCounters()
+{
+    for (int i = 0; i < NUM_COUNTERS; ++i) { values[i].store(0, std::memory_order_relaxed); }
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.threads.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters()
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        reg.retired[i] += values[i].load(std::memory_order_relaxed);
+    }
+    reg.threads.erase(std::remove(reg.threads.begin(), reg.threads.end(), this),
+                      reg.threads.end());
+}
+
+std::uint64_t FrameStats::rays() const
+{
+    std::uint64_t total = counters[SHADOW_RAYS];
+    for (int i = 0; i < kMaxDepthBins; ++i) { total += counters[RAYS_DEPTH_0 + i]; }
+    return total;
+}
+
+double FrameStats::raysPerSecond() const
+{
+    return frame_time > 0.0 ? double(rays()) / frame_time : 0.0;
+}
+
+double FrameStats::raysPerTraceSecond() const
+{
+    double t = stage_times[STAGE_RAY_TRACING];
+    return t > 0.0 ? double(rays()) / t : 0.0;
+}
+
+const char *counterName(Counter counter)
+{
+    static const char *names[RAYS_DEPTH_0] = {
+        "sphere_tests", "box_tests", "triangle_tests", "bvh_nodes",
+        "background_hits", "scatter_lambertian", "scatter_metal", "shadow_rays",
+        "irradiance_hits", "irradiance_records",
+    };
+    static char depth_names[kMaxDepthBins][24];
+    if (counter < RAYS_DEPTH_0) { return names[counter]; }
+    int depth = counter - RAYS_DEPTH_0;
+    if (depth_names[depth][0] == '\0') {
+        std::snprintf(depth_names[depth], sizeof(depth_names[depth]), "rays_depth_%d", depth);
+    }
+    return depth_names[depth];
+}
+
+const char *stageName(Stage stage)
+{
+    static const char *names[NUM_STAGES] = {"ray_tracing", "texture_upload", "gui"};
+    return names[stage];
+}
+
+double nanosecondsPerCycle()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    // Calibrate the TSC against the steady clock once, over a few milliseconds
+    static const double ns_per_cycle = []() {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point t0 = Clock::now();
+        std::uint64_t c0 = cycleCount();
+        while (Clock::now() - t0 < std::chrono::milliseconds(5)) {}
+        std::uint64_t c1 = cycleCount();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+        return ns / double(c1 - c0);
+    }();
+    return ns_per_cycle;
+#else
+    return 1.0;
+#endif
+}
+
+bool enabled()
+{
+#ifdef RT_ENABLE_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void recordStage(Stage stage, double seconds)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.stage_times[stage] += seconds;
+}
+
+void endFrame(double frame_time)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    std::uint64_t totals[NUM_COUNTERS];
+    std::copy(reg.retired, reg.retired + NUM_COUNTERS, totals);
+    for (size_t t = 0; t < reg.threads.size(); ++t) {
+        for (int i = 0; i < NUM_COUNTERS; ++i) {
+            totals[i] += reg.threads[t]->values[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    FrameStats frame;
+    frame.frame_time = frame_time;
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        frame.counters[i] = totals[i] - reg.previous[i];
+        reg.previous[i] = totals[i];
+    }
+    for (int i = 0; i < NUM_STAGES; ++i) {
+        frame.stage_times[i] = reg.stage_times[i];
+        reg.stage_times[i] = 0.0;
+    }
+
+    reg.history.push_back(frame);
+    if (reg.history.size() > kHistorySize) { reg.history.pop_front(); }
+}
+
+const std::deque<FrameStats> &history()
+{
+    return registry().history;
+}
+
+void clearHistory()
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.history.clear();
+}
+
+bool exportCSV(const std::string &filename)
+{
+    std::ofstream f(filename.c_str());
+    if (!f.is_open()) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return false;
+    }
+
+    f << "frame,frame_ms";
+    for (int i = 0; i < NUM_STAGES; ++i) { f << "," << stageName(Stage(i)) << "_ms"; }
+    f << ",rays,rays_per_sec,rays_per_trace_sec";
+    for (int i = 0; i < NUM_COUNTERS; ++i) { f << "," << counterName(Counter(i)); }
+    f << "\n";
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (size_t n = 0; n < reg.history.size(); ++n) {
+        const FrameStats &frame = reg.history[n];
+        f << n << "," << frame.frame_time * 1e3;
+        for (int i = 0; i < NUM_STAGES; ++i) { f << "," << frame.stage_times[i] * 1e3; }
+        f << "," << frame.rays() << "," << frame.raysPerSecond() << ","
+          << frame.raysPerTraceSecond();
+        for (int i = 0; i < NUM_COUNTERS; ++i) { f << "," << frame.counters[i]; }
+        f << "\n";
+    }
+
+    std::cout << "Exported " << reg.history.size() << " frames of stats to " << filename
+              << std::endl;
+    return true;
+}
+
+}  // namespace stats
+}  // namespace rt
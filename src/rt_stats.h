@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Hot-path counters are compiled out unless RT_ENABLE_STATS is defined (see
+// CMakeLists.txt). Stage timings and the frame history are always available.
+#ifdef RT_ENABLE_STATS
+#define RT_STAT_ADD(counter, n) ::rt::stats::add((counter), (n))
+#else
+#define RT_STAT_ADD(counter, n) ((void)0)
+#endif
+#define RT_STAT_INC(counter) RT_STAT_ADD(counter, 1)
+
+namespace rt {
+namespace stats {
+
+// Rays are binned by bounce depth; deeper bounces land in the last bin
+const int kMaxDepthBins = 16;
+
+enum Counter {
+    SPHERE_TESTS = 0,
+    BOX_TESTS,
+    TRIANGLE_TESTS,
+    BVH_NODES,
+    BACKGROUND_HITS,
+    SCATTER_LAMBERTIAN,
+    SCATTER_METAL,
+    SHADOW_RAYS,
+    IRRADIANCE_HITS,     // Diffuse hits shaded from cached records
+    IRRADIANCE_RECORDS,  // Records computed
+    RAYS_DEPTH_0,
+    NUM_COUNTERS = RAYS_DEPTH_0 + kMaxDepthBins
+};
+
+enum Stage {
+    STAGE_RAY_TRACING = 0,
+    STAGE_TEXTURE_UPLOAD,
+    STAGE_GUI,
+    NUM_STAGES
+};
+
+// Counters owned by a single thread. Only the owning thread writes them, so
+// increments are plain relaxed load/store pairs; the aggregator may read them
+// concurrently from another thread.
+struct ThreadCounters {
+    std::atomic<std::uint64_t> values[NUM_COUNTERS];
+
+    ThreadCounters();
+    ~ThreadCounters();
+};
+
+inline ThreadCounters &local()
+{
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+inline void add(Counter counter, std::uint64_t n)
+{
+    std::atomic<std::uint64_t> &value = local().values[counter];
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline Counter depthCounter(int depth)
+{
+    return Counter(RAYS_DEPTH_0 + (depth < kMaxDepthBins ? depth : kMaxDepthBins - 1));
+}
+
+// Cheap timestamp for per-pixel timing; convert with nanosecondsPerCycle()
+inline std::uint64_t cycleCount()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+double nanosecondsPerCycle();
+
+// Counter deltas and stage timings for one displayed frame
+struct FrameStats {
+    double frame_time = 0.0;
+    double stage_times[NUM_STAGES] = {};
+    std::uint64_t counters[NUM_COUNTERS] = {};
+
+    std::uint64_t rays() const;  // Camera, bounce and shadow rays
+    double raysPerSecond() const;
+    double raysPerTraceSecond() const;
+};
+
+const char *counterName(Counter counter);
+const char *stageName(Stage stage);
+
+bool enabled();
+void recordStage(Stage stage, double seconds);
+void endFrame(double frame_time);
+const std::deque<FrameStats> &history();
+void clearHistory();
+bool exportCSV(const std::string &filename);
+
+}  // namespace stats
+}  // namespace rt
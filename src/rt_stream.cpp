@@ -0,0 +1,671 @@
+#include "rt_stream.h"
+#include "rt_soa.h"
+#include "rt_stats.h"
+#include "rt_trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rt {
+
+// Decoded cluster: its BVH, the SoA batch the kernels test and the exact
+// corners for building hit records
+struct StreamedMesh::Cluster {
+    BVH bvh;
+    TriangleSoA soa;
+    std::vector<glm::vec3> vertices;  // Three per triangle, in leaf order
+    std::size_t bytes;
+};
+
+namespace {
+
+// Cluster file layout: FileHeader, page-aligned cluster data, then the
+// table of FileClusters at header.table_offset. Cluster data is the BVH
+// nodes followed by three float vertices per triangle in leaf order.
+const char kMagic[8] = {'R', 'T', 'C', 'L', 'U', 'S', 'T', 'R'};
+const std::uint32_t kVersion = 1;
+const std::uint64_t kFileAlignment = 4096;
+const int kChunkTriangles = 128;  // Written to the scratch file at a time
+
+struct FileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t node_size;  // sizeof(BVHNode) of the writer
+    std::uint64_t clusters;
+    std::uint64_t triangles;
+    std::uint64_t table_offset;
+    std::uint64_t content_hash;  // FNV-1a of the source triangles
+};
+
+struct FileCluster {
+    float lo[3];
+    float hi[3];
+    std::uint64_t offset;
+    std::uint32_t triangles;
+    std::uint32_t nodes;
+};
+
+// Set by queries that skipped a cluster, cleared by takeMiss()
+thread_local bool t_missed = false;
+
+std::size_t fileBytes(std::uint32_t triangles, std::uint32_t nodes)
+{
+    return std::size_t(nodes) * sizeof(BVHNode) + std::size_t(triangles) * 9 * sizeof(float);
+}
+
+// Decoded size: nodes, corners and 12 SoA lanes
+std::size_t residentBytes(std::uint32_t triangles, std::uint32_t nodes)
+{
+    return std::size_t(nodes) * sizeof(BVHNode) +
+           std::size_t(triangles) * (3 * sizeof(glm::vec3) + 12 * sizeof(float));
+}
+
+struct StreamTriangle {
+    glm::vec3 v[3];
+
+    glm::vec3 centroid() const
+    {
+        return (v[0] + v[1] + v[2]) * (1.0f / 3.0f);
+    }
+};
+
+// Uniform grid over the vertex bounds with about `cells` cells, used to
+// gather nearby faces before clustering
+struct Grid {
+    AABB bounds;
+    int dims[3];
+    glm::vec3 scale;
+
+    Grid(const AABB &b, std::uint64_t cells) : bounds(b)
+    {
+        glm::vec3 e = b.extent();
+        float largest = std::max(e.x, std::max(e.y, e.z));
+        e = glm::max(e, glm::vec3(std::max(largest * 1e-3f, 1e-20f)));  // Flat meshes
+        float side = std::cbrt(e.x * e.y * e.z / float(std::max<std::uint64_t>(cells, 1)));
+        for (int k = 0; k < 3; ++k) {
+            dims[k] = std::min(std::max(int(std::ceil(e[k] / side)), 1), 1024);
+            scale[k] = float(dims[k]) / e[k];
+        }
+    }
+    std::uint32_t cell(const glm::vec3 &p) const
+    {
+        int c[3];
+        for (int k = 0; k < 3; ++k) {
+            c[k] = std::min(std::max(int((p[k] - bounds.lo[k]) * scale[k]), 0), dims[k] - 1);
+        }
+        return std::uint32_t((c[2] * dims[1] + c[1]) * dims[0] + c[0]);
+    }
+};
+
+// Faces of one grid cell: full chunks in the scratch file plus a tail
+struct Bucket {
+    std::vector<float> buffer;
+    std::vector<long> chunks;
+    std::uint64_t triangles = 0;
+};
+
+// Vertex indices of an OBJ face line's corners ("v", "v/t", "v//n" or
+// "v/t/n"). Indices start at one; negative ones count back from the last
+// vertex read so far.
+bool parseFace(const std::string &line, std::size_t vertex_count, std::vector<std::uint32_t> &corners)
+{
+    corners.clear();
+    const char *p = line.c_str() + 1;
+    while (true) {
+        while (*p && std::isspace((unsigned char)*p)) { ++p; }
+        if (!*p) { break; }
+        char *end;
+        long long i = std::strtoll(p, &end, 10);
+        if (end == p) { return false; }
+        long long index = i < 0 ? (long long)vertex_count + i : i - 1;
+        if (index < 0 || index >= (long long)vertex_count) { return false; }
+        corners.push_back(std::uint32_t(index));
+        p = end;
+        while (*p && !std::isspace((unsigned char)*p)) { ++p; }  // Texture and normal indices
+    }
+    return corners.size() >= 3;
+}
+
+std::size_t countCorners(const std::string &line)
+{
+    std::size_t count = 0;
+    bool in_token = false;
+    for (std::size_t i = 1; i < line.size(); ++i) {
+        bool space = std::isspace((unsigned char)line[i]) != 0;
+        if (!space && !in_token) { ++count; }
+        in_token = !space;
+    }
+    return count;
+}
+
+// Writes the triangles of one cluster with their BVH at the next aligned
+// offset of `out`
+bool writeCluster(std::ofstream &out, const StreamTriangle *triangles, std::uint32_t count,
+                  std::vector<FileCluster> &table)
+{
+    std::vector<AABB> bounds(count);
+    AABB cluster_bounds;
+    for (std::uint32_t i = 0; i < count; ++i) {
+        for (int k = 0; k < 3; ++k) { bounds[i].grow(triangles[i].v[k]); }
+        cluster_bounds.grow(bounds[i]);
+    }
+    BVH bvh;
+    std::vector<std::uint32_t> order;
+    bvh.build(bounds, kSoAWidth, order);
+
+    std::uint64_t end = std::uint64_t(out.tellp());
+    std::uint64_t offset = (end + kFileAlignment - 1) & ~(kFileAlignment - 1);
+    static const char zeros[kFileAlignment] = {};
+    out.write(zeros, std::streamsize(offset - end));
+    out.write(reinterpret_cast<const char *>(bvh.nodes.data()),
+              std::streamsize(bvh.nodes.size() * sizeof(BVHNode)));
+    for (std::uint32_t i = 0; i < count; ++i) {
+        out.write(reinterpret_cast<const char *>(&triangles[order[i]].v[0]), 9 * sizeof(float));
+    }
+
+    FileCluster entry;
+    for (int k = 0; k < 3; ++k) {
+        entry.lo[k] = cluster_bounds.lo[k];
+        entry.hi[k] = cluster_bounds.hi[k];
+    }
+    entry.offset = offset;
+    entry.triangles = count;
+    entry.nodes = std::uint32_t(bvh.nodes.size());
+    table.push_back(entry);
+    return bool(out);
+}
+
+// Splits [begin, end) at the centroid median of its longest axis until the
+// pieces fit in a cluster
+bool writeClusters(std::ofstream &out, std::vector<StreamTriangle> &triangles, std::size_t begin,
+                   std::size_t end, std::size_t cluster_size, std::vector<FileCluster> &table)
+{
+    if (end - begin <= cluster_size) {
+        return writeCluster(out, &triangles[begin], std::uint32_t(end - begin), table);
+    }
+    AABB centroids;
+    for (std::size_t i = begin; i < end; ++i) { centroids.grow(triangles[i].centroid()); }
+    glm::vec3 e = centroids.extent();
+    int axis = e.x > e.y ? (e.x > e.z ? 0 : 2) : (e.y > e.z ? 1 : 2);
+    std::size_t mid = begin + (end - begin) / 2;
+    std::nth_element(triangles.begin() + begin, triangles.begin() + mid, triangles.begin() + end,
+                     [axis](const StreamTriangle &a, const StreamTriangle &b) {
+                         return a.centroid()[axis] < b.centroid()[axis];
+                     });
+    return writeClusters(out, triangles, begin, mid, cluster_size, table) &&
+           writeClusters(out, triangles, mid, end, cluster_size, table);
+}
+
+}  // namespace
+
+StreamedMesh::StreamedMesh() : epoch(1), budget(0), bytes(0), batches(0), misses(0) {}
+
+StreamedMesh::~StreamedMesh()
+{
+    close();
+}
+
+bool StreamedMesh::preprocess(const std::string &obj_filename, const std::string &filename,
+                              int cluster_size, std::string &error)
+{
+    RT_TRACE_SCOPE("preprocessMesh");
+    std::ifstream in(obj_filename.c_str());
+    if (!in) {
+        error = "Could not open " + obj_filename;
+        return false;
+    }
+
+    // First pass: vertex positions and the number of triangles
+    std::vector<glm::vec3> vertices;
+    AABB bounds;
+    std::uint64_t triangle_count = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 2, "v ") == 0) {
+            glm::vec3 v;
+            if (std::sscanf(line.c_str() + 2, "%f %f %f", &v.x, &v.y, &v.z) != 3) {
+                error = "Malformed vertex in " + obj_filename;
+                return false;
+            }
+            vertices.push_back(v);
+            bounds.grow(v);
+        } else if (line.compare(0, 2, "f ") == 0) {
+            triangle_count += std::max<std::size_t>(countCorners(line), 2) - 2;
+        }
+    }
+    if (triangle_count == 0) {
+        error = "No faces in " + obj_filename;
+        return false;
+    }
+
+    // Second pass: faces into grid cells, spilling full chunks to a scratch
+    // file. Polygons are split into fans.
+    std::size_t max_cluster = std::size_t(std::max(cluster_size, 1));
+    Grid grid(bounds, 8 * triangle_count / max_cluster);
+    std::map<std::uint32_t, Bucket> buckets;  // By cell, so clusters are written in cell order
+    std::FILE *scratch = std::tmpfile();
+    if (!scratch) {
+        error = "Could not create a scratch file";
+        return false;
+    }
+    std::uint64_t hash = 14695981039346656037ull;
+    std::size_t seen = 0;  // Vertices so far, for relative indices
+    std::vector<std::uint32_t> corners;
+    bool ok = true;
+    in.clear();
+    in.seekg(0);
+    while (ok && std::getline(in, line)) {
+        if (line.compare(0, 2, "v ") == 0) {
+            ++seen;
+            continue;
+        }
+        if (line.compare(0, 2, "f ") != 0) { continue; }
+        if (!parseFace(line, seen, corners)) {
+            error = "Malformed face in " + obj_filename;
+            ok = false;
+            break;
+        }
+        for (std::size_t k = 1; k + 1 < corners.size(); ++k) {
+            StreamTriangle tri = {{vertices[corners[0]], vertices[corners[k]], vertices[corners[k + 1]]}};
+            const unsigned char *b = reinterpret_cast<const unsigned char *>(&tri.v[0]);
+            for (std::size_t i = 0; i < 9 * sizeof(float); ++i) { hash = (hash ^ b[i]) * 1099511628211ull; }
+
+            Bucket &bucket = buckets[grid.cell(tri.centroid())];
+            for (int c = 0; c < 3; ++c) {
+                bucket.buffer.push_back(tri.v[c].x);
+                bucket.buffer.push_back(tri.v[c].y);
+                bucket.buffer.push_back(tri.v[c].z);
+            }
+            ++bucket.triangles;
+            if (bucket.buffer.size() == 9 * kChunkTriangles) {
+                bucket.chunks.push_back(std::ftell(scratch));
+                ok = std::fwrite(bucket.buffer.data(), sizeof(float), bucket.buffer.size(), scratch) ==
+                     bucket.buffer.size();
+                bucket.buffer.clear();
+            }
+        }
+    }
+    std::vector<glm::vec3>().swap(vertices);
+
+    // Third pass: one cell at a time, split into clusters and written out
+    std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    std::vector<FileCluster> table;
+    std::vector<StreamTriangle> triangles;
+    for (std::map<std::uint32_t, Bucket>::iterator it = buckets.begin(); ok && it != buckets.end(); ++it) {
+        Bucket &bucket = it->second;
+        triangles.resize(bucket.triangles);
+        float *dst = &triangles[0].v[0].x;
+        for (std::size_t c = 0; ok && c < bucket.chunks.size(); ++c) {
+            std::size_t floats = 9 * kChunkTriangles;
+            ok = std::fseek(scratch, bucket.chunks[c], SEEK_SET) == 0 &&
+                 std::fread(dst, sizeof(float), floats, scratch) == floats;
+            dst += floats;
+        }
+        std::memcpy(dst, bucket.buffer.data(), bucket.buffer.size() * sizeof(float));
+        std::vector<float>().swap(bucket.buffer);
+        ok = ok && writeClusters(out, triangles, 0, triangles.size(), max_cluster, table);
+    }
+    std::fclose(scratch);
+
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.node_size = sizeof(BVHNode);
+    header.clusters = table.size();
+    header.triangles = triangle_count;
+    header.table_offset = std::uint64_t(out.tellp());
+    header.content_hash = hash;
+    out.write(reinterpret_cast<const char *>(table.data()),
+              std::streamsize(table.size() * sizeof(FileCluster)));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (ok && !out) { error = "Could not write " + filename; }
+    return ok && bool(out);
+}
+
+bool StreamedMesh::isClusterFile(const std::string &filename)
+{
+    return filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".rtc") == 0;
+}
+
+bool StreamedMesh::contentHash(const std::string &filename, std::uint64_t &hash)
+{
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    FileHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        return false;
+    }
+    hash = header.content_hash;
+    return true;
+}
+
+#ifndef _WIN32
+
+bool StreamedMesh::open(const std::string &filename, Material *mat, const glm::vec3 &translation,
+                        std::size_t budget_bytes)
+{
+    RT_TRACE_SCOPE("openStreamedMesh");
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat info;
+    void *map = MAP_FAILED;
+    if (::fstat(fd, &info) == 0 && std::size_t(info.st_size) >= sizeof(FileHeader)) {
+        map = ::mmap(nullptr, std::size_t(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);  // The mapping keeps the file open
+    if (map == MAP_FAILED) { return false; }
+    mapping = static_cast<const char *>(map);
+    mapping_size = std::size_t(info.st_size);
+
+    FileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    bool valid = std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+                 header.version == kVersion && header.node_size == sizeof(BVHNode) &&
+                 header.table_offset <= mapping_size &&
+                 header.clusters <= (mapping_size - header.table_offset) / sizeof(FileCluster);
+    std::vector<FileCluster> table(valid ? header.clusters : 0);
+    if (valid && !table.empty()) {
+        std::memcpy(table.data(), mapping + header.table_offset, table.size() * sizeof(FileCluster));
+    }
+    for (std::size_t i = 0; valid && i < table.size(); ++i) {
+        valid = table[i].offset % kFileAlignment == 0 && table[i].offset <= mapping_size &&
+                fileBytes(table[i].triangles, table[i].nodes) <= mapping_size - table[i].offset;
+    }
+    if (!valid || table.empty()) {
+        close();
+        return false;
+    }
+
+    // Top level: a BVH with one cluster per leaf, clusters stored in its order
+    std::vector<AABB> bounds(table.size());
+    for (std::size_t i = 0; i < table.size(); ++i) {
+        bounds[i] = AABB(glm::vec3(table[i].lo[0], table[i].lo[1], table[i].lo[2]),
+                         glm::vec3(table[i].hi[0], table[i].hi[1], table[i].hi[2]));
+    }
+    std::vector<std::uint32_t> order;
+    top.build(bounds, 1, order);
+    clusters = std::vector<Slot>(table.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        const FileCluster &entry = table[order[i]];
+        clusters[i].bounds = bounds[order[i]];
+        clusters[i].offset = entry.offset;
+        clusters[i].triangles = entry.triangles;
+        clusters[i].nodes = entry.nodes;
+    }
+    triangle_count = std::size_t(header.triangles);
+    material = mat;
+    offset = translation;
+    budget = budget_bytes;
+
+    // Access is by cluster, so the kernel's readahead would only waste memory
+    ::madvise(const_cast<char *>(mapping), mapping_size, MADV_RANDOM);
+    stopping = false;
+    thread = std::thread(&StreamedMesh::loaderMain, this);
+    return true;
+}
+
+void StreamedMesh::close()
+{
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+    for (std::size_t i = 0; i < clusters.size(); ++i) { delete clusters[i].data.load(); }
+    clusters.clear();
+    top.clear();
+    pending.clear();
+    bytes = 0;
+    if (mapping) { ::munmap(const_cast<char *>(mapping), mapping_size); }
+    mapping = nullptr;
+    mapping_size = 0;
+}
+
+void StreamedMesh::loaderMain()
+{
+    trace::setThreadName("cluster loader");
+    const std::size_t page = std::size_t(::sysconf(_SC_PAGESIZE));
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (stopping) { break; }
+        std::vector<std::uint32_t> batch;
+        batch.swap(pending);
+        loading = true;
+        lock.unlock();
+        {
+            RT_TRACE_SCOPE_ARG("loadClusters", int(batch.size()));
+            // Reading in file order and announcing every range up front lets
+            // the kernel merge and overlap the reads of the whole batch
+            std::sort(batch.begin(), batch.end(), [this](std::uint32_t a, std::uint32_t b) {
+                return clusters[a].offset < clusters[b].offset;
+            });
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                const Slot &slot = clusters[batch[i]];
+                ::madvise(const_cast<char *>(mapping) + slot.offset,
+                          fileBytes(slot.triangles, slot.nodes), MADV_WILLNEED);
+            }
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                Slot &slot = clusters[batch[i]];
+                const Cluster *cluster = load(slot);
+                bytes += cluster->bytes;
+                slot.data.store(cluster, std::memory_order_release);
+                slot.state.store(RESIDENT, std::memory_order_release);
+
+                // Only the decoded copy counts against the budget; drop the
+                // mapped pages (the range may end mid-page, so round down)
+                std::size_t length = fileBytes(slot.triangles, slot.nodes) / page * page;
+                if (length > 0) {
+                    ::madvise(const_cast<char *>(mapping) + slot.offset, length, MADV_DONTNEED);
+                }
+            }
+        }
+        lock.lock();
+        loads += batch.size();
+        loading = false;
+        batches.fetch_add(1, std::memory_order_release);
+        idle.notify_all();
+    }
+}
+
+#else  // _WIN32
+
+bool StreamedMesh::open(const std::string &, Material *, const glm::vec3 &, std::size_t)
+{
+    return false;
+}
+
+void StreamedMesh::close()
+{
+    clusters.clear();
+}
+
+void StreamedMesh::loaderMain() {}
+
+#endif  // _WIN32
+
+const StreamedMesh::Cluster *StreamedMesh::load(const Slot &slot) const
+{
+    const char *data = mapping + slot.offset;
+    Cluster *cluster = new Cluster();
+    cluster->bvh.nodes.resize(slot.nodes);
+    std::memcpy(static_cast<void *>(cluster->bvh.nodes.data()), data, slot.nodes * sizeof(BVHNode));
+    cluster->vertices.resize(3 * std::size_t(slot.triangles));
+    std::memcpy(static_cast<void *>(cluster->vertices.data()), data + slot.nodes * sizeof(BVHNode),
+                std::size_t(slot.triangles) * 9 * sizeof(float));
+    cluster->soa.allocate(int(slot.triangles));
+    for (std::uint32_t i = 0; i < slot.triangles; ++i) {
+        const glm::vec3 *v = &cluster->vertices[3 * i];
+        cluster->soa.set(int(i), v[0], v[1], v[2]);
+    }
+    cluster->bytes = residentBytes(slot.triangles, slot.nodes);
+    return cluster;
+}
+
+void StreamedMesh::request(std::uint32_t index) const
+{
+    const Slot &slot = clusters[index];
+    int expected = ABSENT;
+    if (!slot.state.compare_exchange_strong(expected, QUEUED)) { return; }
+    // Stamped now, so that collect() spares it once loaded
+    slot.stamp.store(epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(index);
+    }
+    wake.notify_one();
+}
+
+inline const StreamedMesh::Cluster *StreamedMesh::acquire(std::uint32_t index) const
+{
+    const Slot &slot = clusters[index];
+    const Cluster *cluster = slot.data.load(std::memory_order_acquire);
+    if (!cluster) {
+        request(index);
+        t_missed = true;
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    // Skip the store when already current, to keep the line shared
+    std::uint32_t current = epoch.load(std::memory_order_relaxed);
+    if (slot.stamp.load(std::memory_order_relaxed) != current) {
+        slot.stamp.store(current, std::memory_order_relaxed);
+    }
+    return cluster;
+}
+
+bool StreamedMesh::closest(const Ray &r, float t_min, float &t_max, Triangle &hit) const
+{
+    if (clusters.empty()) { return false; }
+    Ray local(r.origin() - offset, r.direction());
+    const Cluster *hit_cluster = nullptr;
+    int hit_index = -1;
+    top.traverse(local, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+        bool hit_leaf = false;
+        for (std::uint32_t c = first; c < first + count; ++c) {
+            const Cluster *cluster = acquire(c);
+            if (!cluster) { continue; }
+            hit_leaf = cluster->bvh.traverse(
+                local, t_min, t_far, [&](std::uint32_t begin, std::uint32_t n, float &t_leaf) {
+                    RT_STAT_ADD(stats::TRIANGLE_TESTS, n);
+                    int i = closestTriangle(cluster->soa, begin, begin + n, local, t_min, t_leaf);
+                    if (i < 0) { return false; }
+                    hit_cluster = cluster;
+                    hit_index = i;
+                    return true;
+                }) || hit_leaf;
+        }
+        return hit_leaf;
+    });
+    if (!hit_cluster) { return false; }
+    const glm::vec3 *v = &hit_cluster->vertices[3 * hit_index];
+    hit = Triangle(v[0] + offset, v[1] + offset, v[2] + offset, material);
+    return true;
+}
+
+bool StreamedMesh::occluded(const Ray &r, float t_min, float t_max) const
+{
+    if (clusters.empty()) { return false; }
+    Ray local(r.origin() - offset, r.direction());
+    return top.occluded(local, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, float &t_far) {
+        for (std::uint32_t c = first; c < first + count; ++c) {
+            const Cluster *cluster = acquire(c);
+            if (cluster && cluster->bvh.occluded(local, t_min, t_far, [&](std::uint32_t begin, std::uint32_t n,
+                                                                         float &t_leaf) {
+                    RT_STAT_ADD(stats::TRIANGLE_TESTS, n);
+                    return closestTriangle(cluster->soa, begin, begin + n, local, t_min, t_leaf) >= 0;
+                })) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+bool StreamedMesh::takeMiss()
+{
+    bool missed = t_missed;
+    t_missed = false;
+    return missed;
+}
+
+void StreamedMesh::collect()
+{
+    std::uint32_t current = epoch.load(std::memory_order_relaxed);
+    if (bytes.load() > budget.load()) {
+        RT_TRACE_SCOPE("evictClusters");
+        std::vector<std::uint32_t> candidates;
+        for (std::uint32_t i = 0; i < clusters.size(); ++i) {
+            if (clusters[i].state.load(std::memory_order_acquire) == RESIDENT &&
+                clusters[i].stamp.load(std::memory_order_relaxed) != current) {
+                candidates.push_back(i);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [this](std::uint32_t a, std::uint32_t b) {
+            return clusters[a].stamp.load(std::memory_order_relaxed) <
+                   clusters[b].stamp.load(std::memory_order_relaxed);
+        });
+        for (std::size_t i = 0; i < candidates.size() && bytes.load() > budget.load(); ++i) {
+            Slot &slot = clusters[candidates[i]];
+            const Cluster *cluster = slot.data.exchange(nullptr);
+            bytes -= cluster->bytes;
+            delete cluster;
+            slot.state.store(ABSENT, std::memory_order_release);
+            ++evictions;
+        }
+    }
+    epoch.store(current + 1, std::memory_order_relaxed);
+}
+
+void StreamedMesh::waitForLoads()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return stopping || !thread.joinable() || (pending.empty() && !loading); });
+}
+
+void StreamedMesh::setBudget(std::size_t limit)
+{
+    budget = limit;
+}
+
+StreamStats StreamedMesh::stats() const
+{
+    StreamStats s;
+    s.clusters = int(clusters.size());
+    for (std::size_t i = 0; i < clusters.size(); ++i) {
+        s.resident += clusters[i].state.load(std::memory_order_relaxed) == RESIDENT ? 1 : 0;
+    }
+    s.triangles = triangle_count;
+    s.budget = budget.load();
+    s.bytes = bytes.load();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        s.loads = loads;
+    }
+    s.evictions = evictions;
+    s.batches = batches.load();
+    s.misses = misses.load();
+    return s;
+}
+
+}  // namespace rt
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "rt_aabb.h"
+#include "rt_bvh.h"
+#include "rt_ray.h"
+#include "rt_triangle.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rt {
+
+// Triangles per cluster written by StreamedMesh::preprocess by default
+const int kDefaultClusterSize = 16384;
+
+struct StreamStats {
+    int clusters = 0;
+    int resident = 0;           // Clusters in the cache
+    std::size_t triangles = 0;
+    std::size_t budget = 0;     // Bytes of decoded cluster data
+    std::size_t bytes = 0;      // Bytes of decoded cluster data in the cache
+    std::uint64_t loads = 0;
+    std::uint64_t evictions = 0;
+    std::uint64_t batches = 0;  // Loader wake-ups; each reads its requests in file order
+    std::uint64_t misses = 0;   // Queries that reached a cluster that was not resident
+};
+
+// Mesh kept out of core in a cluster file (.rtc). The file holds spatially
+// coherent clusters of triangles, each with its own BVH, at page-aligned
+// offsets. Only the cluster table and a BVH over the cluster bounds stay in
+// memory; the file is memory-mapped and clusters are decoded into a cache
+// bounded by a byte budget.
+//
+// Queries never wait for the disk. A query that reaches a cluster that is
+// not resident skips it and requests it from a loader thread, which reads
+// the requests it has gathered as one batch in file order. takeMiss() tells
+// the caller that its result is incomplete and must be retried once the
+// cluster is in. POSIX only.
+class StreamedMesh {
+  public:
+    StreamedMesh();
+    ~StreamedMesh();
+
+    // Splits the triangles of an OBJ file into clusters of at most
+    // `cluster_size` triangles and writes them to a cluster file. Faces are
+    // streamed through a uniform grid into a temporary file, so only the
+    // vertex positions and one grid cell at a time are held in memory.
+    static bool preprocess(const std::string &obj_filename, const std::string &filename,
+                           int cluster_size, std::string &error);
+    static bool isClusterFile(const std::string &filename);
+    // Hash of the source triangles, stored by preprocess(), so that the
+    // scene cache need not read the whole file
+    static bool contentHash(const std::string &filename, std::uint64_t &hash);
+
+    // Maps a cluster file. Triangles are moved by `offset` and use `material`.
+    bool open(const std::string &filename, Material *material, const glm::vec3 &offset,
+              std::size_t budget);
+    bool empty() const
+    {
+        return clusters.empty();
+    }
+
+    // Of all clusters, resident or not
+    AABB bounds() const
+    {
+        if (top.empty()) { return AABB(); }
+        return AABB(top.nodes[0].lo + offset, top.nodes[0].hi + offset);
+    }
+
+    // Same contracts as CompressedMesh, over the resident clusters
+    bool closest(const Ray &r, float t_min, float &t_max, Triangle &hit) const;
+    bool occluded(const Ray &r, float t_min, float t_max) const;
+
+    // Whether a query on the calling thread skipped a cluster that was not
+    // resident since the last call
+    static bool takeMiss();
+
+    // Evicts least recently used clusters down to the budget, sparing those
+    // used since the previous call. Only call while no query is running.
+    void collect();
+    // Blocks until every requested cluster has been loaded
+    void waitForLoads();
+    // Number of finished load batches, to tell whether retrying can help
+    std::uint64_t batchesLoaded() const
+    {
+        return batches.load(std::memory_order_acquire);
+    }
+    void setBudget(std::size_t bytes);
+    StreamStats stats() const;
+
+  private:
+    enum State { ABSENT = 0, QUEUED, RESIDENT };
+
+    struct Cluster;
+    struct Slot {
+        AABB bounds;
+        std::uint64_t offset = 0;  // In the file
+        std::uint32_t triangles = 0;
+        std::uint32_t nodes = 0;
+        std::atomic<const Cluster *> data;
+        mutable std::atomic<int> state;
+        mutable std::atomic<std::uint32_t> stamp;  // Epoch of the last use
+
+        Slot() : data(nullptr), state(ABSENT), stamp(0) {}
+    };
+
+    // Resident cluster for a query, or nullptr after requesting it
+    const Cluster *acquire(std::uint32_t index) const;
+    void request(std::uint32_t index) const;
+    void loaderMain();
+    const Cluster *load(const Slot &slot) const;
+    void close();
+
+    std::vector<Slot> clusters;
+    BVH top;  // Leaves are single clusters
+    std::size_t triangle_count = 0;
+    Material *material = nullptr;
+    glm::vec3 offset = glm::vec3(0.0f);
+
+    const char *mapping = nullptr;
+    std::size_t mapping_size = 0;
+
+    std::atomic<std::uint32_t> epoch;
+    std::atomic<std::size_t> budget;
+    std::atomic<std::size_t> bytes;
+    std::atomic<std::uint64_t> batches;
+    mutable std::atomic<std::uint64_t> misses;
+    std::uint64_t loads = 0;      // Written by the loader thread under `mutex`
+    std::uint64_t evictions = 0;  // Written by collect()
+
+    mutable std::mutex mutex;
+    mutable std::condition_variable wake;  // Loader: requests are pending or it must stop
+    std::condition_variable idle;          // Waiters: the loader has no work left
+    mutable std::vector<std::uint32_t> pending;
+    bool loading = false;
+    bool stopping = false;
+    std::thread thread;
+};
+
+}  // namespace rt
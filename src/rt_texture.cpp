@@ -0,0 +1,352 @@
+#include "rt_texture.h"
+#include "rt_trace.h"
+
+#include <lodepng.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+namespace rt {
+
+namespace {
+
+const int kTileSize = 32;
+const std::size_t kTileBytes = kTileSize * kTileSize * 4;
+
+// 8-bit sRGB to linear, with the same 2.2 gamma as the environment loader
+struct SRGBTable {
+    float linear[256];
+    SRGBTable()
+    {
+        for (int i = 0; i < 256; ++i) { linear[i] = std::pow(i / 255.0f, 2.2f); }
+    }
+};
+const SRGBTable g_srgb;
+
+unsigned char encodeSRGB(float linear)
+{
+    float v = std::pow(glm::clamp(linear, 0.0f, 1.0f), 1.0f / 2.2f);
+    return (unsigned char)(v * 255.0f + 0.5f);
+}
+
+// Texture ids fit the 16 bits tile keys have for them
+const int kMaxTextures = 1 << 16;
+
+// level:8 | tile y:20 | tile x:20, within one texture
+std::uint64_t tileKey(int level, int tx, int ty)
+{
+    return (std::uint64_t(level) << 40) | (std::uint64_t(ty) << 20) | std::uint64_t(tx);
+}
+
+int wrap(int x, int n)
+{
+    x %= n;
+    return x < 0 ? x + n : x;
+}
+
+// Hits are counted per thread and added to the shared counter in batches,
+// so that lookups do not all write one cache line
+const std::uint64_t kHitBatch = 1024;
+thread_local std::uint64_t t_hits = 0;
+
+}  // namespace
+
+struct TextureCache::Texture {
+    struct Level {
+        int width, height;
+        int tiles_x, tiles_y;
+        long offset;             // Of the first tile in the backing file
+        std::size_t first_tile;  // Index into `tiles`
+    };
+
+    std::string name;
+    bool srgb;
+    std::vector<Level> levels;
+    std::FILE *file = nullptr;
+    mutable std::mutex file_mutex;  // Held while reading tiles from `file`
+    std::unique_ptr<Tile[]> tiles;
+    std::size_t tile_count = 0;
+};
+
+TextureCache::TextureCache(std::size_t budget_bytes)
+    : textures(kMaxTextures, nullptr), count(0), epoch(0), budget(budget_bytes), bytes(0), hits(0),
+      misses(0)
+{
+}
+
+TextureCache::~TextureCache()
+{
+    for (int i = 0; i < count.load(); ++i) {
+        Texture *texture = textures[i];
+        for (std::size_t n = 0; n < texture->tile_count; ++n) { delete[] texture->tiles[n].data.load(); }
+        if (texture->file) { std::fclose(texture->file); }
+        delete texture;
+    }
+}
+
+int TextureCache::load(const std::string &filename, bool srgb)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < count.load(std::memory_order_relaxed); ++i) {
+            if (textures[i]->name == filename && textures[i]->srgb == srgb) { return i; }
+        }
+    }
+
+    std::vector<unsigned char> data;
+    unsigned width, height;
+    if (lodepng::decode(data, width, height, filename) != 0 || width == 0 || height == 0) {
+        std::cerr << "Could not load texture " << filename << std::endl;
+        return -1;
+    }
+
+    std::unique_ptr<Texture> texture(new Texture);
+    texture->name = filename;
+    texture->srgb = srgb;
+    texture->file = std::tmpfile();
+    if (!texture->file) {
+        std::cerr << "Could not create texture backing file" << std::endl;
+        return -1;
+    }
+
+    // Write each mip level as tiles, halving with a 2x2 box filter (in linear
+    // space for sRGB data) until the level is a single texel
+    std::vector<unsigned char> tile_data(kTileBytes);
+    int w = int(width), h = int(height);
+    long offset = 0;
+    std::size_t tile_count = 0;
+    while (true) {
+        Texture::Level level;
+        level.width = w;
+        level.height = h;
+        level.tiles_x = (w + kTileSize - 1) / kTileSize;
+        level.tiles_y = (h + kTileSize - 1) / kTileSize;
+        level.offset = offset;
+        level.first_tile = tile_count;
+        texture->levels.push_back(level);
+        tile_count += std::size_t(level.tiles_x) * level.tiles_y;
+
+        for (int ty = 0; ty < level.tiles_y; ++ty) {
+            for (int tx = 0; tx < level.tiles_x; ++tx) {
+                for (int y = 0; y < kTileSize; ++y) {
+                    int sy = std::min(ty * kTileSize + y, h - 1);
+                    for (int x = 0; x < kTileSize; ++x) {
+                        int sx = std::min(tx * kTileSize + x, w - 1);
+                        std::copy_n(&data[(std::size_t(sy) * w + sx) * 4], 4,
+                                    &tile_data[(y * kTileSize + x) * 4]);
+                    }
+                }
+                std::fwrite(tile_data.data(), 1, kTileBytes, texture->file);
+                offset += long(kTileBytes);
+            }
+        }
+        if (w == 1 && h == 1) { break; }
+
+        int nw = std::max(w / 2, 1), nh = std::max(h / 2, 1);
+        std::vector<unsigned char> next(std::size_t(nw) * nh * 4);
+        for (int y = 0; y < nh; ++y) {
+            for (int x = 0; x < nw; ++x) {
+                for (int c = 0; c < 4; ++c) {
+                    float sum = 0.0f;
+                    for (int k = 0; k < 4; ++k) {
+                        int sx = std::min(2 * x + (k & 1), w - 1);
+                        int sy = std::min(2 * y + (k >> 1), h - 1);
+                        unsigned char v = data[(std::size_t(sy) * w + sx) * 4 + c];
+                        sum += (srgb && c < 3) ? g_srgb.linear[v] : v / 255.0f;
+                    }
+                    sum *= 0.25f;
+                    next[(std::size_t(y) * nw + x) * 4 + c] =
+                        (srgb && c < 3) ? encodeSRGB(sum) : (unsigned char)(sum * 255.0f + 0.5f);
+                }
+            }
+        }
+        data.swap(next);
+        w = nw;
+        h = nh;
+    }
+    std::fflush(texture->file);
+    texture->tiles.reset(new Tile[tile_count]);
+    texture->tile_count = tile_count;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    int n = count.load(std::memory_order_relaxed);
+    // Another thread may have loaded the same file meanwhile
+    for (int i = 0; i < n; ++i) {
+        if (textures[i]->name == filename && textures[i]->srgb == srgb) {
+            std::fclose(texture->file);
+            return i;
+        }
+    }
+    if (n >= kMaxTextures) {
+        std::cerr << "Too many textures, could not load " << filename << std::endl;
+        std::fclose(texture->file);
+        return -1;
+    }
+    textures[n] = texture.release();
+    count.store(n + 1, std::memory_order_release);
+    return n;
+}
+
+const TextureCache::Texture *TextureCache::texture(int index) const
+{
+    if (index < 0 || index >= count.load(std::memory_order_acquire)) { return nullptr; }
+    return textures[index];
+}
+
+const char *TextureCache::name(int index) const
+{
+    const Texture *t = texture(index);
+    return t ? t->name.c_str() : "";
+}
+
+void TextureCache::collect()
+{
+    std::uint32_t current = epoch.load(std::memory_order_relaxed);
+    if (bytes.load() > budget.load()) {
+        RT_TRACE_SCOPE("evictTiles");
+        struct Candidate {
+            std::uint32_t stamp;
+            Tile *tile;
+        };
+        std::vector<Candidate> candidates;
+        for (int i = 0; i < count.load(); ++i) {
+            Texture &t = *textures[i];
+            for (std::size_t n = 0; n < t.tile_count; ++n) {
+                Tile &tile = t.tiles[n];
+                std::uint32_t stamp = tile.stamp.load(std::memory_order_relaxed);
+                if (tile.data.load(std::memory_order_relaxed) && stamp != current) {
+                    Candidate candidate = {stamp, &tile};
+                    candidates.push_back(candidate);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Candidate &a, const Candidate &b) { return a.stamp < b.stamp; });
+        for (std::size_t i = 0; i < candidates.size() && bytes.load() > budget.load(); ++i) {
+            delete[] candidates[i].tile->data.exchange(nullptr);
+            bytes -= kTileBytes;
+            ++evictions;
+        }
+    }
+    epoch.store(current + 1, std::memory_order_relaxed);
+}
+
+void TextureCache::setBudget(std::size_t limit)
+{
+    budget = limit;
+}
+
+TextureCacheStats TextureCache::stats() const
+{
+    TextureCacheStats s;
+    s.budget = budget.load();
+    s.resident = bytes.load();
+    s.hits = hits.load();
+    s.misses = misses.load();
+    s.evictions = evictions;
+    s.textures = count.load();
+    return s;
+}
+
+// Returns the tile's texels, reading it from the backing file if needed
+const unsigned char *TextureCache::tile(const Texture &t, int level, int tx, int ty,
+                                        TileMemo &memo)
+{
+    std::uint64_t key = tileKey(level, tx, ty);
+    if (key == memo.key) { return memo.data; }
+    memo.key = key;
+    const Texture::Level &l = t.levels[level];
+    Tile &tile = t.tiles[l.first_tile + std::size_t(ty) * l.tiles_x + tx];
+    std::uint32_t current = epoch.load(std::memory_order_relaxed);
+    if (tile.stamp.load(std::memory_order_relaxed) != current) {
+        tile.stamp.store(current, std::memory_order_relaxed);
+    }
+    unsigned char *data = tile.data.load(std::memory_order_acquire);
+    if (data) {
+        if (++t_hits == kHitBatch) {
+            hits.fetch_add(kHitBatch, std::memory_order_relaxed);
+            t_hits = 0;
+        }
+        memo.data = data;
+        return data;
+    }
+
+    misses.fetch_add(1, std::memory_order_relaxed);
+    unsigned char *loaded = new unsigned char[kTileBytes];
+    {
+        std::lock_guard<std::mutex> lock(t.file_mutex);
+        long offset = l.offset + long(ty * l.tiles_x + tx) * long(kTileBytes);
+        if (std::fseek(t.file, offset, SEEK_SET) != 0 ||
+            std::fread(loaded, 1, kTileBytes, t.file) != kTileBytes) {
+            std::fill_n(loaded, kTileBytes, 0);
+        }
+    }
+    // Another thread may have read the same tile meanwhile; its copy wins
+    if (tile.data.compare_exchange_strong(data, loaded, std::memory_order_acq_rel)) {
+        bytes += kTileBytes;
+        data = loaded;
+    } else {
+        delete[] loaded;
+    }
+    memo.data = data;
+    return data;
+}
+
+glm::vec4 TextureCache::texel(const Texture &t, int level, int x, int y, TileMemo &memo)
+{
+    const Texture::Level &l = t.levels[level];
+    x = wrap(x, l.width);
+    y = wrap(y, l.height);
+    const unsigned char *p =
+        tile(t, level, x / kTileSize, y / kTileSize, memo) +
+        ((y % kTileSize) * kTileSize + x % kTileSize) * 4;
+    if (t.srgb) {
+        return glm::vec4(g_srgb.linear[p[0]], g_srgb.linear[p[1]], g_srgb.linear[p[2]],
+                         p[3] / 255.0f);
+    }
+    return glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+}
+
+// Images are stored top row first, so v = 0 is the bottom of the image
+glm::vec4 TextureCache::bilinear(const Texture &t, int level, const glm::vec2 &uv, TileMemo &memo)
+{
+    const Texture::Level &l = t.levels[level];
+    float x = uv.x * l.width - 0.5f;
+    float y = (1.0f - uv.y) * l.height - 0.5f;
+    float fx = std::floor(x), fy = std::floor(y);
+    int x0 = int(fx), y0 = int(fy);
+    float sx = x - fx, sy = y - fy;
+    glm::vec4 top = glm::mix(texel(t, level, x0, y0, memo), texel(t, level, x0 + 1, y0, memo), sx);
+    glm::vec4 bottom =
+        glm::mix(texel(t, level, x0, y0 + 1, memo), texel(t, level, x0 + 1, y0 + 1, memo), sx);
+    return glm::mix(top, bottom, sy);
+}
+
+glm::vec4 TextureCache::sample(int index, const glm::vec2 &uv, float footprint)
+{
+    const Texture *texture = this->texture(index);
+    if (!texture) { return glm::vec4(1.0f); }
+    const Texture &t = *texture;
+    // Keep the fractional coordinates small so float precision holds up
+    glm::vec2 st = uv - glm::floor(uv);
+
+    float size = float(std::max(t.levels[0].width, t.levels[0].height));
+    float lod = std::log2(std::max(footprint * size, 1e-8f));
+    int last = int(t.levels.size()) - 1;
+    TileMemo memo;
+    if (lod <= 0.0f) { return bilinear(t, 0, st, memo); }
+    if (lod >= float(last)) { return bilinear(t, last, st, memo); }
+    int level = int(lod);
+    float f = lod - float(level);
+    return glm::mix(bilinear(t, level, st, memo), bilinear(t, level + 1, st, memo), f);
+}
+
+TextureCache &textureCache()
+{
+    static TextureCache cache(std::size_t(64) << 20);
+    return cache;
+}
+
+}  // namespace rt
@@ -0,0 +1,127 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "rt_hitable.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rt {
+
+// How a material maps a hit to texture coordinates
+enum TextureMapping {
+    TEXMAP_UV = 0,  // The primitive's own coordinates (mesh vt, sphere lat-long, box faces)
+    TEXMAP_PLANAR,  // World x and z, e.g. for the ground
+    NUM_TEXTURE_MAPPINGS
+};
+
+// Pixel footprint carried along a path (ray cone): width at the ray origin
+// and spread angle in radians. Camera rays start with the spread of one
+// pixel; rough bounces widen it.
+struct RayCone {
+    float width;
+    float spread;
+
+    float widthAt(float distance) const
+    {
+        return width + spread * distance;
+    }
+};
+
+struct TextureCacheStats {
+    std::size_t budget = 0;    // Bytes of tile memory
+    std::size_t resident = 0;  // Bytes of tiles currently cached
+    std::uint64_t hits = 0;  // Added per thread in batches, so the latest may be missing
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    int textures = 0;
+};
+
+// Shared, memory-bounded cache of texture tiles. Textures are decoded once
+// with lodepng, mip-mapped, and written as 32x32 RGBA8 tiles to a temporary
+// backing file, so scenes can reference more texture data than the budget.
+//
+// Lookups take no lock. A tile that is not resident is read by the looking
+// thread, under a lock of its texture's backing file only, and published
+// atomically. Tiles are only freed by collect(), least recently used first,
+// so the cache may exceed its budget by what one frame touches.
+class TextureCache {
+  public:
+    explicit TextureCache(std::size_t budget_bytes);
+    ~TextureCache();
+
+    // Returns the texture id, or -1 if the file could not be loaded. Loading
+    // the same file twice returns the same id. sRGB textures are decoded to
+    // linear on lookup; others (e.g. roughness) are used as stored. Safe to
+    // call while lookups run.
+    int load(const std::string &filename, bool srgb);
+    const char *name(int texture) const;
+
+    // Trilinear lookup with repeat addressing. `footprint` is the width of
+    // the filter in texture coordinates and selects the mip level.
+    glm::vec4 sample(int texture, const glm::vec2 &uv, float footprint);
+
+    // Evicts least recently used tiles down to the budget, sparing those
+    // used since the previous call. Only call while no lookup is running.
+    void collect();
+    // Takes effect at the next collect()
+    void setBudget(std::size_t bytes);
+    TextureCacheStats stats() const;
+
+  private:
+    struct Texture;
+    struct Tile {
+        std::atomic<unsigned char *> data;
+        std::atomic<std::uint32_t> stamp;  // Epoch of the last use
+
+        Tile() : data(nullptr), stamp(0) {}
+    };
+
+    // Last tile used within one sample() call, which collect() cannot free
+    struct TileMemo {
+        std::uint64_t key = ~std::uint64_t(0);
+        const unsigned char *data = nullptr;
+    };
+
+    const Texture *texture(int index) const;
+    const unsigned char *tile(const Texture &t, int level, int tx, int ty, TileMemo &memo);
+    glm::vec4 texel(const Texture &t, int level, int x, int y, TileMemo &memo);
+    glm::vec4 bilinear(const Texture &t, int level, const glm::vec2 &uv, TileMemo &memo);
+
+    std::mutex mutex;  // Serialises load()
+    // Fixed capacity, so that lookups can index it while load() appends;
+    // entries below `count` never change
+    std::vector<Texture *> textures;
+    std::atomic<int> count;
+
+    std::atomic<std::uint32_t> epoch;
+    std::atomic<std::size_t> budget;
+    std::atomic<std::size_t> bytes;
+    std::atomic<std::uint64_t> hits;
+    std::atomic<std::uint64_t> misses;
+    std::uint64_t evictions = 0;  // Written by collect()
+};
+
+// The process-wide cache, 64 MB by default
+TextureCache &textureCache();
+
+// Texture value at a hit, using the hit's filter footprint
+inline glm::vec4 lookupTexture(int texture, int mapping, float scale, const HitRecord &rec)
+{
+    glm::vec2 uv = scale * rec.uv;
+    float density = scale * rec.uv_density;
+    if (mapping == TEXMAP_PLANAR) {
+        uv = scale * glm::vec2(rec.p.x, rec.p.z);
+        density = scale;
+    }
+    return textureCache().sample(texture, uv, rec.footprint * density);
+}
+
+}  // namespace rt
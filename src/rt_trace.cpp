@@ -0,0 +1,156 @@
+#include "rt_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace rt {
+namespace trace {
+
+std::atomic<bool> g_enabled(false);
+
+namespace {
+
+const std::uint64_t kBufferSize = 1 << 16;  // Events kept per thread
+
+// Single-producer ring buffer. The owning thread writes the slot and then
+// publishes it by bumping `head`; readers never block the writer.
+struct ThreadBuffer {
+    std::vector<Event> events;
+    std::atomic<std::uint64_t> head;
+    int tid;
+    std::string name;
+
+    ThreadBuffer(int id) : events(kBufferSize), head(0), tid(id) {}
+};
+
+// Buffers are never freed, so events from exited threads can still be written
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadBuffer *> buffers;
+};
+
+Registry &registry()
+{
+    static Registry *instance = new Registry();
+    return *instance;
+}
+
+ThreadBuffer &localBuffer()
+{
+    static thread_local ThreadBuffer *buffer = nullptr;
+    if (!buffer) {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        buffer = new ThreadBuffer(int(reg.buffers.size()));
+        reg.buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+void writeString(std::ostream &out, const char *s)
+{
+    out << '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') { out << '\\'; }
+        out << *s;
+    }
+    out << '"';
+}
+
+}  // namespace
+
+void setEnabled(bool enabled)
+{
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+std::uint64_t now()
+{
+    typedef std::chrono::steady_clock Clock;
+    static const Clock::time_point epoch = Clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+}
+
+void record(const char *name, std::uint64_t start_ns, std::uint64_t end_ns, std::int64_t arg)
+{
+    ThreadBuffer &buffer = localBuffer();
+    std::uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    Event &event = buffer.events[head % kBufferSize];
+    event.name = name;
+    event.start_ns = start_ns;
+    event.duration_ns = end_ns - start_ns;
+    event.arg = arg;
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void setThreadName(const char *name)
+{
+    ThreadBuffer &buffer = localBuffer();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    buffer.name = name;
+}
+
+bool flush(const std::string &filename)
+{
+    std::ofstream f(filename.c_str());
+    if (!f.is_open()) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return false;
+    }
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    size_t num_events = 0;
+    std::vector<Event> events;
+    for (size_t i = 0; i < reg.buffers.size(); ++i) {
+        ThreadBuffer &buffer = *reg.buffers[i];
+        if (!buffer.name.empty()) {
+            f << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+              << buffer.tid << ",\"args\":{\"name\":";
+            writeString(f, buffer.name.c_str());
+            f << "}}";
+            first = false;
+        }
+
+        // Copy the live window, then drop slots the writer may have reused.
+        // Slot `head` is the one being written, which in a full buffer holds
+        // the oldest event, so a window holds kBufferSize - 1 events at most.
+        std::uint64_t end = buffer.head.load(std::memory_order_acquire);
+        std::uint64_t begin = end >= kBufferSize ? end + 1 - kBufferSize : 0;
+        events.clear();
+        for (std::uint64_t n = begin; n < end; ++n) {
+            events.push_back(buffer.events[n % kBufferSize]);
+        }
+        std::uint64_t head_after = buffer.head.load(std::memory_order_acquire);
+        std::uint64_t valid_begin = head_after >= kBufferSize ? head_after + 1 - kBufferSize : 0;
+        size_t skip = valid_begin > begin ? size_t(valid_begin - begin) : 0;
+
+        f.precision(3);
+        f << std::fixed;
+        for (size_t n = skip; n < events.size(); ++n) {
+            const Event &event = events[n];
+            f << (first ? "" : ",\n") << "{\"ph\":\"X\",\"cat\":\"rt\",\"name\":";
+            writeString(f, event.name);
+            f << ",\"pid\":1,\"tid\":" << buffer.tid << ",\"ts\":" << event.start_ns * 1e-3
+              << ",\"dur\":" << event.duration_ns * 1e-3;
+            if (event.arg != kNoArg) { f << ",\"args\":{\"arg\":" << event.arg << "}"; }
+            f << "}";
+            first = false;
+        }
+        num_events += events.size() - std::min(skip, events.size());
+    }
+    f << "\n]}\n";
+
+    std::cout << "Wrote " << num_events << " trace events to " << filename << std::endl;
+    return true;
+}
+
+}  // namespace trace
+}  // namespace rt
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped timers that record into per-thread ring buffers and can be written
+// out in the Chrome trace_event JSON format (open in Perfetto or
+// chrome://tracing). Names must be string literals or otherwise outlive the
+// trace, since only the pointer is stored.
+#define RT_TRACE_CONCAT_IMPL(a, b) a##b
+#define RT_TRACE_CONCAT(a, b) RT_TRACE_CONCAT_IMPL(a, b)
+#define RT_TRACE_SCOPE(name) ::rt::trace::Scope RT_TRACE_CONCAT(rt_trace_scope_, __LINE__)(name)
+#define RT_TRACE_SCOPE_ARG(name, arg) \
+    ::rt::trace::Scope RT_TRACE_CONCAT(rt_trace_scope_, __LINE__)(name, arg)
+
+namespace rt {
+namespace trace {
+
+const std::int64_t kNoArg = INT64_MIN;
+
+struct Event {
+    const char *name;
+    std::uint64_t start_ns;
+    std::uint64_t duration_ns;
+    std::int64_t arg;
+};
+
+extern std::atomic<bool> g_enabled;
+
+inline bool enabled()
+{
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+void setEnabled(bool enabled);
+std::uint64_t now();
+void record(const char *name, std::uint64_t start_ns, std::uint64_t end_ns, std::int64_t arg);
+void setThreadName(const char *name);
+
+// Write all buffered events to a trace JSON file. Safe to call while other
+// threads keep recording; events overwritten during the copy are dropped.
+bool flush(const std::string &filename);
+
+class Scope {
+  public:
+    explicit Scope(const char *name, std::int64_t arg = kNoArg)
+        : scope_name(enabled() ? name : nullptr), scope_arg(arg),
+          start_ns(scope_name ? now() : 0)
+    {
+    }
+    ~Scope()
+    {
+        if (scope_name) { record(scope_name, start_ns, now(), scope_arg); }
+    }
+
+  private:
+    Scope(const Scope &);
+    Scope &operator=(const Scope &);
+
+    const char *scope_name;
+    std::int64_t scope_arg;
+    std::uint64_t start_ns;
+};
+
+}  // namespace trace
+}  // namespace rt
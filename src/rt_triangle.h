@@ -3,23 +3,33 @@
 #include "rt_hitable.h"
 #include "rt_material.h"
 
+#include <cmath>
+
 namespace rt {
 
 class Triangle : public Hitable {
   public:
     Triangle() {}
     Triangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c, Material* m = nullptr)
-        : v0(a), v1(b), v2(c), mat_ptr(m) {};
+        : v0(a), v1(b), v2(c), t0(0.0f), t1(1.0f, 0.0f), t2(0.0f, 1.0f), mat_ptr(m) {};
     virtual bool hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const;
+    void record(const Ray &r, float t, HitRecord &rec) const;
+    AABB bounds() const
+    {
+        return AABB(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+    }
 
     glm::vec3 v0;
     glm::vec3 v1;
     glm::vec3 v2;
+    glm::vec2 t0;  // Texture coordinates per vertex
+    glm::vec2 t1;
+    glm::vec2 t2;
     Material* mat_ptr;
 };
 
 // Ray-triangle test
-bool Triangle::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
+inline bool Triangle::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
 {
     glm::vec3 n = glm::cross(v1 - v0, v2 - v0);
     float d = glm::dot(-r.direction(), n);
@@ -32,10 +42,7 @@ bool Triangle::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
             if (v >= 0.0f && v <= d && w >= 0.0f && v + w <= d) {
                 temp /= d;
                 if (temp < t_max && temp > t_min) {
-                    rec.t = temp;
-                    rec.p = r.point_at_parameter(rec.t);
-                    rec.normal = glm::normalize(n);  // 确保法线被正规化
-                    rec.mat_ptr = mat_ptr;  // 确保材质被正确设置
+                    record(r, temp, rec);
                     return true;
                 }
             }
@@ -44,4 +51,22 @@ bool Triangle::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
     return false;
 }
 
+// Fill in the hit record for a hit at distance t (also used by batched tests)
+inline void Triangle::record(const Ray &r, float t, HitRecord &rec) const
+{
+    rec.t = t;
+    rec.p = r.point_at_parameter(rec.t);
+    glm::vec3 n = glm::cross(v1 - v0, v2 - v0);
+    float area = glm::length(n);
+    rec.normal = n / area;  // 确保法线被正规化
+    rec.mat_ptr = mat_ptr;  // 确保材质被正确设置
+    // Barycentrics from the sub-triangle areas opposite v1 and v2
+    float b1 = glm::dot(glm::cross(rec.p - v0, v2 - v0), rec.normal) / area;
+    float b2 = glm::dot(glm::cross(v1 - v0, rec.p - v0), rec.normal) / area;
+    rec.uv = (1.0f - b1 - b2) * t0 + b1 * t1 + b2 * t2;
+    glm::vec2 e1 = t1 - t0, e2 = t2 - t0;
+    float uv_area = std::abs(e1.x * e2.y - e1.y * e2.x);
+    rec.uv_density = std::sqrt(uv_area / glm::max(area, 1e-12f));
+}
+
 }  // namespace rt
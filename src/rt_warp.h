@@ -0,0 +1,113 @@
+#pragma once
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+namespace rt {
+
+// Closed-form warps from [0, 1)^2 to directions. Each one uses exactly the
+// numbers it is given, so the sampler's stratification carries through.
+
+// Orthonormal basis around a unit normal (Duff et al. 2017, branchless)
+struct Frame {
+    glm::vec3 t, b, n;
+
+    explicit Frame(const glm::vec3 &normal) : n(normal)
+    {
+        float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + n.z);
+        float c = n.x * n.y * a;
+        t = glm::vec3(1.0f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+        b = glm::vec3(c, sign + n.y * n.y * a, -n.y);
+    }
+
+    glm::vec3 toLocal(const glm::vec3 &v) const
+    {
+        return glm::vec3(glm::dot(v, t), glm::dot(v, b), glm::dot(v, n));
+    }
+    glm::vec3 toWorld(const glm::vec3 &v) const
+    {
+        return v.x * t + v.y * b + v.z * n;
+    }
+};
+
+// Shirley-Chiu concentric map to the unit disk
+inline glm::vec2 sampleConcentricDisk(const glm::vec2 &u)
+{
+    glm::vec2 p = 2.0f * u - 1.0f;
+    if (p.x == 0.0f && p.y == 0.0f) { return glm::vec2(0.0f); }
+    const float quarter_pi = 0.25f * glm::pi<float>();
+    float r, phi;
+    if (glm::abs(p.x) > glm::abs(p.y)) {
+        r = p.x;
+        phi = quarter_pi * (p.y / p.x);
+    } else {
+        r = p.y;
+        phi = 2.0f * quarter_pi - quarter_pi * (p.x / p.y);
+    }
+    return r * glm::vec2(glm::cos(phi), glm::sin(phi));
+}
+
+// Cosine-weighted direction around +z; pdf is cos(theta) / pi
+inline glm::vec3 sampleCosineHemisphere(const glm::vec2 &u)
+{
+    glm::vec2 d = sampleConcentricDisk(u);
+    return glm::vec3(d, glm::sqrt(glm::max(0.0f, 1.0f - glm::dot(d, d))));
+}
+
+inline float cosineHemispherePdf(float cos_theta)
+{
+    return glm::max(cos_theta, 0.0f) * glm::one_over_pi<float>();
+}
+
+// Isotropic GGX microfacet distribution with roughness `alpha`, in the local
+// frame where +z is the macro normal
+inline float ggxD(const glm::vec3 &h, float alpha)
+{
+    float a2 = alpha * alpha;
+    float d = h.z * h.z * (a2 - 1.0f) + 1.0f;
+    return a2 / (glm::pi<float>() * d * d);
+}
+
+// Smith masking for a single direction
+inline float ggxG1(const glm::vec3 &w, float alpha)
+{
+    if (w.z <= 0.0f) { return 0.0f; }
+    float a2 = alpha * alpha;
+    return 2.0f * w.z / (w.z + glm::sqrt(a2 + (1.0f - a2) * w.z * w.z));
+}
+
+// Samples a normal visible from `wo` (Heitz 2018). Unlike sampling D alone,
+// every sample faces the viewer, so far fewer reflections end up below the
+// surface and the weight stays bounded.
+inline glm::vec3 sampleGGXVisibleNormal(const glm::vec3 &wo, float alpha, const glm::vec2 &u)
+{
+    // Stretch to the hemisphere configuration
+    glm::vec3 v = glm::normalize(glm::vec3(alpha * wo.x, alpha * wo.y, wo.z));
+    float len2 = v.x * v.x + v.y * v.y;
+    glm::vec3 t1 = len2 > 0.0f ? glm::vec3(-v.y, v.x, 0.0f) / glm::sqrt(len2)
+                               : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 t2 = glm::cross(v, t1);
+
+    // Uniform disk sample, warped towards the projected visible half
+    float r = glm::sqrt(u.x);
+    float phi = 2.0f * glm::pi<float>() * u.y;
+    float p1 = r * glm::cos(phi);
+    float p2 = r * glm::sin(phi);
+    float s = 0.5f * (1.0f + v.z);
+    p2 = (1.0f - s) * glm::sqrt(glm::max(0.0f, 1.0f - p1 * p1)) + s * p2;
+
+    glm::vec3 h = p1 * t1 + p2 * t2 + glm::sqrt(glm::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * v;
+    return glm::normalize(glm::vec3(alpha * h.x, alpha * h.y, glm::max(0.0f, h.z)));
+}
+
+// Solid-angle pdf of reflecting `wo` into `wi` through a visible normal
+inline float ggxReflectionPdf(const glm::vec3 &wo, const glm::vec3 &wi, float alpha)
+{
+    if (wo.z <= 0.0f || wi.z <= 0.0f) { return 0.0f; }
+    glm::vec3 h = glm::normalize(wo + wi);
+    return ggxG1(wo, alpha) * ggxD(h, alpha) / (4.0f * wo.z);
+}
+
+}  // namespace rt